@@ -0,0 +1,874 @@
+/* 
+ * 
+ * Copyright (C) 2009-2011 Colomban Wendling <ban@herbesfolles.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ */
+
+#include "ctpl-analysis.h"
+#include <string.h>
+#include <glib.h>
+#include "ctpl-token.h"
+#include "ctpl-token-private.h"
+#include "ctpl-value.h"
+
+
+/**
+ * SECTION: analysis
+ * @short_description: Static template analysis
+ * @include: ctpl/ctpl.h
+ * 
+ * A #CtplAnalysis describes what rendering a template needs and roughly how
+ * much it costs, without an environment: the symbols it reads and the
+ * functions it calls, its <code>for</code> loops and how many times they
+ * repeat their body, and estimates of the work and of the output size of a
+ * rendering.  This can be used to only fetch the data a template needs, and to
+ * choose how to render it, before building its environment.
+ * 
+ * The symbols are those ctpl_token_get_dependencies() finds, with how many
+ * times they appear in the template: the iterators of the loops are not
+ * counted inside their loops.
+ * 
+ * The number of iterations of a loop is known when it iterates over range()
+ * with constant arguments, otherwise it is the default number of iterations
+ * given to ctpl_analysis_new().  The multiplier
+ * of a loop is how many times its body is rendered, which is, the product of
+ * its number of iterations with these of the loops containing it.
+ * The cost of a rendering is estimated in evaluation steps, each data block,
+ * operator, value, symbol, function call and index counting for one step,
+ * and each iteration of a loop for one more.  Of the two branches of an
+ * <code>if</code> statement, only the most expensive one is counted, both in
+ * the cost and in the output size.  The output of an expression is estimated
+ * to be of 8 bytes, unless it is an inline value.
+ * 
+ * ctpl_analysis_to_json() gives the whole report as JSON, which is also what
+ * the command-line tool outputs with its <code>--analyze</code> option.  For
+ * the template:
+ * |[
+ * <h1>{title}</h1>
+ * {for i in items}<li>{i}</li>{end}
+ * {if len(items) > n}more than {n}{end}
+ * ]|
+ * the report, assuming loops repeat 10 times, is:
+ * |[
+ * {
+ *   "symbols": {"title": 1, "items": 2, "n": 2},
+ *   "functions": {"len": 1},
+ *   "literal_size": 31,
+ *   "max_loop_depth": 1,
+ *   "loops": [
+ *     {"iterator": "i", "depth": 1, "iterations": 10, "exact": false, "multiplier": 10}
+ *   ],
+ *   "cost": 52,
+ *   "output_size": 208
+ * }
+ * ]|
+ * 
+ * A #CtplAnalysis is created with ctpl_analysis_new() and uses a refcounting
+ * through ctpl_analysis_ref() and ctpl_analysis_unref().
+ */
+
+
+/* the estimated output size of a non-constant expression */
+#define EXPR_OUTPUT_SIZE 8
+
+typedef struct _CtplAnalysisName CtplAnalysisName;
+struct _CtplAnalysisName
+{
+  gchar  *name;
+  guint   count;
+};
+
+typedef struct _CtplAnalysisLoop CtplAnalysisLoop;
+struct _CtplAnalysisLoop
+{
+  gchar    *iterator;
+  guint     depth;
+  gulong    iterations;
+  gboolean  exact;
+  guint64   multiplier;
+};
+
+/**
+ * CtplAnalysis:
+ * 
+ * An opaque object describing a template.
+ * 
+ * Since: 0.4
+ */
+struct _CtplAnalysis
+{
+  gint        ref_count;
+  gulong      default_iterations;
+  GPtrArray  *symbols;        /* CtplAnalysisName, in order of first use */
+  GHashTable *symbols_table;  /* name -> CtplAnalysisName */
+  GPtrArray  *functions;      /* CtplAnalysisName, in order of first use */
+  GHashTable *functions_table;/* name -> CtplAnalysisName */
+  GArray     *loops;          /* CtplAnalysisLoop, in document order */
+  gsize       literal_size;
+  guint       max_loop_depth;
+  guint64     cost;
+  guint64     output_size;
+};
+
+
+/* adds @a and @b, saturating to G_MAXUINT64 */
+static guint64
+add_sat (guint64 a,
+         guint64 b)
+{
+  return (a > G_MAXUINT64 - b) ? G_MAXUINT64 : a + b;
+}
+
+/* multiplies @a and @b, saturating to G_MAXUINT64 */
+static guint64
+mul_sat (guint64 a,
+         guint64 b)
+{
+  return (b != 0 && a > G_MAXUINT64 / b) ? G_MAXUINT64 : a * b;
+}
+
+/* counts a use of @name in @array and @table */
+static void
+count_name (GPtrArray   *array,
+            GHashTable  *table,
+            const gchar *name)
+{
+  CtplAnalysisName *entry;
+  
+  entry = g_hash_table_lookup (table, name);
+  if (! entry) {
+    entry = g_slice_alloc (sizeof *entry);
+    entry->name = g_strdup (name);
+    entry->count = 0;
+    g_ptr_array_add (array, entry);
+    g_hash_table_insert (table, entry->name, entry);
+  }
+  entry->count++;
+}
+
+/* checks whether @name is the iterator of an enclosing for loop */
+static gboolean
+is_bound (const GSList *bound,
+          const gchar  *name)
+{
+  for (; bound; bound = bound->next) {
+    if (strcmp (bound->data, name) == 0) {
+      return TRUE;
+    }
+  }
+  
+  return FALSE;
+}
+
+/* counts the symbols and functions used by @expr, and returns the number of
+ * steps evaluating it takes */
+static guint64
+analyze_expr (CtplAnalysis        *analysis,
+              const CtplTokenExpr *expr,
+              const GSList        *bound)
+{
+  guint64       cost = 1;
+  const GSList  *item;
+  
+  switch (expr->type) {
+    case CTPL_TOKEN_EXPR_TYPE_OPERATOR:
+      cost = add_sat (cost, analyze_expr (analysis,
+                                          expr->token.t_operator->loperand,
+                                          bound));
+      cost = add_sat (cost, analyze_expr (analysis,
+                                          expr->token.t_operator->roperand,
+                                          bound));
+      break;
+    
+    case CTPL_TOKEN_EXPR_TYPE_VALUE:
+      break;
+    
+    case CTPL_TOKEN_EXPR_TYPE_SYMBOL:
+      if (! is_bound (bound, expr->token.t_symbol)) {
+        count_name (analysis->symbols, analysis->symbols_table,
+                    expr->token.t_symbol);
+      }
+      break;
+    
+    case CTPL_TOKEN_EXPR_TYPE_FUNCTION:
+      count_name (analysis->functions, analysis->functions_table,
+                  expr->token.t_function->name);
+      for (item = expr->token.t_function->args; item; item = item->next) {
+        cost = add_sat (cost, analyze_expr (analysis, item->data, bound));
+      }
+      break;
+  }
+  for (item = expr->indexes; item; item = item->next) {
+    cost = add_sat (cost, analyze_expr (analysis, item->data, bound));
+  }
+  
+  return cost;
+}
+
+/* gets the integer value of @expr if it is an inline integer */
+static gboolean
+get_constant_int (const CtplTokenExpr *expr,
+                  glong               *value)
+{
+  if (expr->type == CTPL_TOKEN_EXPR_TYPE_VALUE && ! expr->indexes &&
+      ctpl_value_get_held_type (&expr->token.t_value) == CTPL_VTYPE_INT) {
+    *value = ctpl_value_get_int (&expr->token.t_value);
+    return TRUE;
+  }
+  
+  return FALSE;
+}
+
+/* gets the number of items of @expr if it is a call to range() with inline
+ * integer arguments */
+static gboolean
+get_constant_length (const CtplTokenExpr *expr,
+                     gulong              *length)
+{
+  if (! expr->indexes && expr->type == CTPL_TOKEN_EXPR_TYPE_FUNCTION &&
+      strcmp (expr->token.t_function->name, "range") == 0) {
+    glong         bounds[3] = {0, 0, 1};
+    guint         n_args = g_slist_length (expr->token.t_function->args);
+    const GSList *item;
+    guint         i = 0;
+    
+    if (n_args < 1 || n_args > 3) {
+      return FALSE;
+    }
+    for (item = expr->token.t_function->args; item; item = item->next) {
+      /* with only one argument, it is the stop */
+      if (! get_constant_int (item->data, &bounds[n_args == 1 ? 1 : i++])) {
+        return FALSE;
+      }
+    }
+    /* the differences are computed unsigned so they cannot overflow */
+    if (bounds[2] > 0 && bounds[1] > bounds[0]) {
+      *length = ((gulong) bounds[1] - (gulong) bounds[0] - 1) /
+                (gulong) bounds[2] + 1;
+    } else if (bounds[2] < 0 && bounds[1] < bounds[0]) {
+      *length = ((gulong) bounds[0] - (gulong) bounds[1] - 1) /
+                (0ul - (gulong) bounds[2]) + 1;
+    } else {
+      *length = 0;
+    }
+    return TRUE;
+  }
+  
+  return FALSE;
+}
+
+/* analyzes @token and its siblings, in loops of depth @depth repeating
+ * @multiplier times.  Returns the cost of one rendering in @cost and its
+ * output size in @size */
+static void
+analyze_tokens (CtplAnalysis    *analysis,
+                const CtplToken *token,
+                const GSList    *bound,
+                guint            depth,
+                guint64          multiplier,
+                guint64         *cost,
+                guint64         *size)
+{
+  *cost = 0;
+  *size = 0;
+  for (; token; token = token->next) {
+    switch (token->type) {
+      case CTPL_TOKEN_TYPE_DATA: {
+        gsize length = strlen (token->token.t_data);
+        
+        analysis->literal_size += length;
+        *cost = add_sat (*cost, 1);
+        *size = add_sat (*size, length);
+        break;
+      }
+      
+      case CTPL_TOKEN_TYPE_EXPR: {
+        const CtplTokenExpr *expr = token->token.t_expr;
+        
+        *cost = add_sat (*cost, analyze_expr (analysis, expr, bound));
+        if (expr->type == CTPL_TOKEN_EXPR_TYPE_VALUE && ! expr->indexes) {
+          gchar *str = ctpl_value_to_string (&expr->token.t_value);
+          
+          *size = add_sat (*size, str ? strlen (str) : EXPR_OUTPUT_SIZE);
+          g_free (str);
+        } else {
+          *size = add_sat (*size, EXPR_OUTPUT_SIZE);
+        }
+        break;
+      }
+      
+      case CTPL_TOKEN_TYPE_FOR: {
+        const CtplTokenFor *t_for = token->token.t_for;
+        CtplAnalysisLoop   *loop;
+        guint               index = analysis->loops->len;
+        GSList              iter;
+        guint64             body_cost;
+        guint64             body_size;
+        gulong              iterations;
+        gboolean            exact;
+        
+        /* the array is evaluated before the iterator is bound */
+        *cost = add_sat (*cost, analyze_expr (analysis, t_for->array, bound));
+        exact = get_constant_length (t_for->array, &iterations);
+        if (! exact) {
+          iterations = analysis->default_iterations;
+        }
+        g_array_set_size (analysis->loops, index + 1);
+        loop = &g_array_index (analysis->loops, CtplAnalysisLoop, index);
+        loop->iterator = g_strdup (t_for->iter);
+        loop->depth = depth + 1;
+        loop->iterations = iterations;
+        loop->exact = exact;
+        loop->multiplier = mul_sat (multiplier, iterations);
+        analysis->max_loop_depth = MAX (analysis->max_loop_depth, depth + 1);
+        
+        iter.data = t_for->iter;
+        iter.next = (GSList *) bound;
+        analyze_tokens (analysis, t_for->children, &iter, depth + 1,
+                        mul_sat (multiplier, iterations),
+                        &body_cost, &body_size);
+        /* binding the iterator is a step */
+        *cost = add_sat (*cost, mul_sat (iterations, add_sat (body_cost, 1)));
+        *size = add_sat (*size, mul_sat (iterations, body_size));
+        break;
+      }
+      
+      case CTPL_TOKEN_TYPE_IF: {
+        const CtplTokenIf *t_if = token->token.t_if;
+        guint64            if_cost;
+        guint64            if_size;
+        guint64            else_cost;
+        guint64            else_size;
+        
+        *cost = add_sat (*cost, analyze_expr (analysis, t_if->condition,
+                                              bound));
+        analyze_tokens (analysis, t_if->if_children, bound, depth, multiplier,
+                        &if_cost, &if_size);
+        analyze_tokens (analysis, t_if->else_children, bound, depth,
+                        multiplier, &else_cost, &else_size);
+        *cost = add_sat (*cost, MAX (if_cost, else_cost));
+        *size = add_sat (*size, MAX (if_size, else_size));
+        break;
+      }
+    }
+  }
+}
+
+static void
+name_free (CtplAnalysisName *entry)
+{
+  g_free (entry->name);
+  g_slice_free1 (sizeof *entry, entry);
+}
+
+/**
+ * ctpl_analysis_new:
+ * @tree: A #CtplToken
+ * @default_iterations: The number of iterations to assume for loops iterating
+ *                      over values that are not known without an environment
+ * 
+ * Analyzes a template.
+ * 
+ * Returns: A new #CtplAnalysis describing @tree
+ * 
+ * Since: 0.4
+ */
+CtplAnalysis *
+ctpl_analysis_new (const CtplToken *tree,
+                   gulong           default_iterations)
+{
+  CtplAnalysis *analysis;
+  
+  analysis = g_slice_alloc (sizeof *analysis);
+  analysis->ref_count = 1;
+  analysis->default_iterations = default_iterations;
+  analysis->symbols = g_ptr_array_new ();
+  analysis->symbols_table = g_hash_table_new (g_str_hash, g_str_equal);
+  analysis->functions = g_ptr_array_new ();
+  analysis->functions_table = g_hash_table_new (g_str_hash, g_str_equal);
+  analysis->loops = g_array_new (FALSE, FALSE, sizeof (CtplAnalysisLoop));
+  analysis->literal_size = 0;
+  analysis->max_loop_depth = 0;
+  analyze_tokens (analysis, tree, NULL, 0, 1,
+                  &analysis->cost, &analysis->output_size);
+  
+  return analysis;
+}
+
+/**
+ * ctpl_analysis_ref:
+ * @analysis: A #CtplAnalysis
+ * 
+ * Adds a reference to a #CtplAnalysis.
+ * 
+ * Returns: The analysis
+ * 
+ * Since: 0.4
+ */
+CtplAnalysis *
+ctpl_analysis_ref (CtplAnalysis *analysis)
+{
+  g_atomic_int_inc (&analysis->ref_count);
+  
+  return analysis;
+}
+
+/**
+ * ctpl_analysis_unref:
+ * @analysis: A #CtplAnalysis
+ * 
+ * Removes a reference from a #CtplAnalysis. When its reference count reaches
+ * 0, the analysis is freed.
+ * 
+ * Since: 0.4
+ */
+void
+ctpl_analysis_unref (CtplAnalysis *analysis)
+{
+  if (g_atomic_int_dec_and_test (&analysis->ref_count)) {
+    guint i;
+    
+    g_hash_table_destroy (analysis->symbols_table);
+    g_ptr_array_foreach (analysis->symbols, (GFunc) name_free, NULL);
+    g_ptr_array_free (analysis->symbols, TRUE);
+    g_hash_table_destroy (analysis->functions_table);
+    g_ptr_array_foreach (analysis->functions, (GFunc) name_free, NULL);
+    g_ptr_array_free (analysis->functions, TRUE);
+    for (i = 0; i < analysis->loops->len; i++) {
+      g_free (g_array_index (analysis->loops, CtplAnalysisLoop, i).iterator);
+    }
+    g_array_free (analysis->loops, TRUE);
+    g_slice_free1 (sizeof *analysis, analysis);
+  }
+}
+
+/* copies the names in @names to a new string vector */
+static gchar **
+names_to_strv (const GPtrArray *names)
+{
+  gchar **strv = g_new (gchar *, names->len + 1);
+  guint   i;
+  
+  for (i = 0; i < names->len; i++) {
+    strv[i] = g_strdup (((CtplAnalysisName *) names->pdata[i])->name);
+  }
+  strv[i] = NULL;
+  
+  return strv;
+}
+
+/* gets the count of @name in @table */
+static guint
+get_count (GHashTable  *table,
+           const gchar *name)
+{
+  CtplAnalysisName *entry = g_hash_table_lookup (table, name);
+  
+  return entry ? entry->count : 0;
+}
+
+/**
+ * ctpl_analysis_get_symbols:
+ * @analysis: A #CtplAnalysis
+ * 
+ * Gets the symbols the analyzed template reads from its environment.
+ * 
+ * Returns: A %NULL-terminated array of symbol names, in the order of their
+ *          first use.  Free with g_strfreev().
+ * 
+ * Since: 0.4
+ */
+gchar **
+ctpl_analysis_get_symbols (const CtplAnalysis *analysis)
+{
+  return names_to_strv (analysis->symbols);
+}
+
+/**
+ * ctpl_analysis_get_symbol_reads:
+ * @analysis: A #CtplAnalysis
+ * @symbol: A symbol name
+ * 
+ * Gets how many times the analyzed template reads a symbol from its
+ * environment.  Each use in the template counts once, even in a loop.
+ * 
+ * Returns: The number of uses of @symbol, or 0 if the template doesn't read it
+ * 
+ * Since: 0.4
+ */
+guint
+ctpl_analysis_get_symbol_reads (const CtplAnalysis *analysis,
+                                const gchar        *symbol)
+{
+  return get_count (analysis->symbols_table, symbol);
+}
+
+/**
+ * ctpl_analysis_get_functions:
+ * @analysis: A #CtplAnalysis
+ * 
+ * Gets the functions the analyzed template calls.
+ * 
+ * Returns: A %NULL-terminated array of function names, in the order of their
+ *          first call.  Free with g_strfreev().
+ * 
+ * Since: 0.4
+ */
+gchar **
+ctpl_analysis_get_functions (const CtplAnalysis *analysis)
+{
+  return names_to_strv (analysis->functions);
+}
+
+/**
+ * ctpl_analysis_get_function_calls:
+ * @analysis: A #CtplAnalysis
+ * @function: A function name
+ * 
+ * Gets how many times the analyzed template calls a function, each call in the
+ * template counting once.
+ * 
+ * Returns: The number of calls to @function, or 0 if the template doesn't call
+ *          it
+ * 
+ * Since: 0.4
+ */
+guint
+ctpl_analysis_get_function_calls (const CtplAnalysis *analysis,
+                                  const gchar        *function)
+{
+  return get_count (analysis->functions_table, function);
+}
+
+/**
+ * ctpl_analysis_get_literal_size:
+ * @analysis: A #CtplAnalysis
+ * 
+ * Gets the size of the data of the analyzed template, which is, of everything
+ * but its statements.
+ * 
+ * Returns: The size of the data, in bytes
+ * 
+ * Since: 0.4
+ */
+gsize
+ctpl_analysis_get_literal_size (const CtplAnalysis *analysis)
+{
+  return analysis->literal_size;
+}
+
+/**
+ * ctpl_analysis_get_max_loop_depth:
+ * @analysis: A #CtplAnalysis
+ * 
+ * Gets the maximum nesting of the <code>for</code> loops of the analyzed
+ * template.
+ * 
+ * Returns: The depth of the most nested loop, or 0 if there are no loops
+ * 
+ * Since: 0.4
+ */
+guint
+ctpl_analysis_get_max_loop_depth (const CtplAnalysis *analysis)
+{
+  return analysis->max_loop_depth;
+}
+
+/**
+ * ctpl_analysis_get_n_loops:
+ * @analysis: A #CtplAnalysis
+ * 
+ * Gets the number of <code>for</code> loops in the analyzed template.  They
+ * are numbered from 0, in the order they appear in the template.
+ * 
+ * Returns: The number of loops
+ * 
+ * Since: 0.4
+ */
+guint
+ctpl_analysis_get_n_loops (const CtplAnalysis *analysis)
+{
+  return analysis->loops->len;
+}
+
+/* gets the loop number @loop of @analysis */
+static const CtplAnalysisLoop *
+get_loop (const CtplAnalysis *analysis,
+          guint               loop)
+{
+  g_return_val_if_fail (loop < analysis->loops->len, NULL);
+  
+  return &g_array_index (analysis->loops, CtplAnalysisLoop, loop);
+}
+
+/**
+ * ctpl_analysis_get_loop_iterator:
+ * @analysis: A #CtplAnalysis
+ * @loop: The number of a loop
+ * 
+ * Gets the name of the iterator of a loop.
+ * 
+ * Returns: The iterator of the loop.  This string is owned by @analysis.
+ * 
+ * Since: 0.4
+ */
+const gchar *
+ctpl_analysis_get_loop_iterator (const CtplAnalysis *analysis,
+                                 guint               loop)
+{
+  const CtplAnalysisLoop *l = get_loop (analysis, loop);
+  
+  return l ? l->iterator : NULL;
+}
+
+/**
+ * ctpl_analysis_get_loop_depth:
+ * @analysis: A #CtplAnalysis
+ * @loop: The number of a loop
+ * 
+ * Gets the depth of a loop: 1 for a loop that is in no other loop, 2 for a loop
+ * in one other loop, and so on.
+ * 
+ * Returns: The depth of the loop
+ * 
+ * Since: 0.4
+ */
+guint
+ctpl_analysis_get_loop_depth (const CtplAnalysis *analysis,
+                              guint               loop)
+{
+  const CtplAnalysisLoop *l = get_loop (analysis, loop);
+  
+  return l ? l->depth : 0;
+}
+
+/**
+ * ctpl_analysis_get_loop_iterations:
+ * @analysis: A #CtplAnalysis
+ * @loop: The number of a loop
+ * @exact: (out) (allow-none): Return location for whether the number of
+ *         iterations is known rather than assumed, or %NULL
+ * 
+ * Gets how many times a loop repeats its body each time it is rendered.
+ * 
+ * Returns: The number of iterations of the loop
+ * 
+ * Since: 0.4
+ */
+gulong
+ctpl_analysis_get_loop_iterations (const CtplAnalysis *analysis,
+                                   guint               loop,
+                                   gboolean           *exact)
+{
+  const CtplAnalysisLoop *l = get_loop (analysis, loop);
+  
+  if (exact) {
+    *exact = l ? l->exact : FALSE;
+  }
+  
+  return l ? l->iterations : 0;
+}
+
+/**
+ * ctpl_analysis_get_loop_multiplier:
+ * @analysis: A #CtplAnalysis
+ * @loop: The number of a loop
+ * 
+ * Gets how many times the body of a loop is rendered in a rendering of the
+ * template, that is, the product of its number of iterations and of these of
+ * the loops containing it.
+ * 
+ * Returns: The multiplier of the loop, or %G_MAXUINT64 if it is too large to
+ *          be represented
+ * 
+ * Since: 0.4
+ */
+guint64
+ctpl_analysis_get_loop_multiplier (const CtplAnalysis *analysis,
+                                   guint               loop)
+{
+  const CtplAnalysisLoop *l = get_loop (analysis, loop);
+  
+  return l ? l->multiplier : 0;
+}
+
+/**
+ * ctpl_analysis_get_cost:
+ * @analysis: A #CtplAnalysis
+ * 
+ * Gets an estimate of the number of evaluation steps a rendering of the
+ * analyzed template takes.  This is only meaningful to compare templates, or
+ * renderings of the same template with different numbers of iterations.
+ * 
+ * Returns: The estimated cost, or %G_MAXUINT64 if it is too large to be
+ *          represented
+ * 
+ * Since: 0.4
+ */
+guint64
+ctpl_analysis_get_cost (const CtplAnalysis *analysis)
+{
+  return analysis->cost;
+}
+
+/**
+ * ctpl_analysis_get_output_size:
+ * @analysis: A #CtplAnalysis
+ * 
+ * Gets an estimate of the size of the output of the analyzed template.
+ * 
+ * Returns: The estimated size of the output, in bytes, or %G_MAXUINT64 if it
+ *          is too large to be represented
+ * 
+ * Since: 0.4
+ */
+guint64
+ctpl_analysis_get_output_size (const CtplAnalysis *analysis)
+{
+  return analysis->output_size;
+}
+
+/* appends @str to @json as a JSON string */
+static void
+json_append_string (GString     *json,
+                    const gchar *str)
+{
+  g_string_append_c (json, '"');
+  for (; *str; str++) {
+    switch (*str) {
+      case '"':   g_string_append (json, "\\\""); break;
+      case '\\':  g_string_append (json, "\\\\"); break;
+      case '\n':  g_string_append (json, "\\n");  break;
+      case '\r':  g_string_append (json, "\\r");  break;
+      case '\t':  g_string_append (json, "\\t");  break;
+      default:
+        if ((guchar) *str < 0x20) {
+          g_string_append_printf (json, "\\u%04x", (guint) (guchar) *str);
+        } else {
+          g_string_append_c (json, *str);
+        }
+    }
+  }
+  g_string_append_c (json, '"');
+}
+
+/* appends @names to @json as a JSON object mapping names to counts */
+static void
+json_append_names (GString         *json,
+                   const GPtrArray *names)
+{
+  guint i;
+  
+  g_string_append_c (json, '{');
+  for (i = 0; i < names->len; i++) {
+    const CtplAnalysisName *entry = names->pdata[i];
+    
+    if (i > 0) {
+      g_string_append (json, ", ");
+    }
+    json_append_string (json, entry->name);
+    g_string_append_printf (json, ": %u", entry->count);
+  }
+  g_string_append_c (json, '}');
+}
+
+/**
+ * ctpl_analysis_to_json:
+ * @analysis: A #CtplAnalysis
+ * 
+ * Writes the whole report of a #CtplAnalysis as a JSON object, with the
+ * members:
+ * <variablelist>
+ *   <varlistentry>
+ *     <term><code>symbols</code></term>
+ *     <listitem><para>
+ *       An object mapping each symbol to its number of reads
+ *     </para></listitem>
+ *   </varlistentry>
+ *   <varlistentry>
+ *     <term><code>functions</code></term>
+ *     <listitem><para>
+ *       An object mapping each function to its number of calls
+ *     </para></listitem>
+ *   </varlistentry>
+ *   <varlistentry>
+ *     <term><code>literal_size</code></term>
+ *     <listitem><para>The size of the data of the template</para></listitem>
+ *   </varlistentry>
+ *   <varlistentry>
+ *     <term><code>max_loop_depth</code></term>
+ *     <listitem><para>The maximum nesting of the loops</para></listitem>
+ *   </varlistentry>
+ *   <varlistentry>
+ *     <term><code>loops</code></term>
+ *     <listitem><para>
+ *       An array of the loops in document order, each an object with the
+ *       members <code>iterator</code>, <code>depth</code>,
+ *       <code>iterations</code>, <code>exact</code> and
+ *       <code>multiplier</code>
+ *     </para></listitem>
+ *   </varlistentry>
+ *   <varlistentry>
+ *     <term><code>cost</code></term>
+ *     <listitem><para>The estimated cost of a rendering</para></listitem>
+ *   </varlistentry>
+ *   <varlistentry>
+ *     <term><code>output_size</code></term>
+ *     <listitem><para>The estimated size of the output</para></listitem>
+ *   </varlistentry>
+ * </variablelist>
+ * 
+ * Returns: A newly allocated string holding the JSON report, ending with a
+ *          newline.  Free with g_free().
+ * 
+ * Since: 0.4
+ */
+gchar *
+ctpl_analysis_to_json (const CtplAnalysis *analysis)
+{
+  GString  *json = g_string_new ("{\n");
+  guint     i;
+  
+  g_string_append (json, "  \"symbols\": ");
+  json_append_names (json, analysis->symbols);
+  g_string_append (json, ",\n  \"functions\": ");
+  json_append_names (json, analysis->functions);
+  g_string_append_printf (json, ",\n  \"literal_size\": %" G_GSIZE_FORMAT,
+                          analysis->literal_size);
+  g_string_append_printf (json, ",\n  \"max_loop_depth\": %u",
+                          analysis->max_loop_depth);
+  g_string_append (json, ",\n  \"loops\": [");
+  for (i = 0; i < analysis->loops->len; i++) {
+    const CtplAnalysisLoop *loop = get_loop (analysis, i);
+    
+    g_string_append (json, i > 0 ? ",\n    " : "\n    ");
+    g_string_append (json, "{\"iterator\": ");
+    json_append_string (json, loop->iterator);
+    g_string_append_printf (json, ", \"depth\": %u, \"iterations\": %lu, "
+                                  "\"exact\": %s, "
+                                  "\"multiplier\": %" G_GUINT64_FORMAT "}",
+                            loop->depth, loop->iterations,
+                            loop->exact ? "true" : "false", loop->multiplier);
+  }
+  g_string_append (json, i > 0 ? "\n  ]" : "]");
+  g_string_append_printf (json, ",\n  \"cost\": %" G_GUINT64_FORMAT,
+                          analysis->cost);
+  g_string_append_printf (json, ",\n  \"output_size\": %" G_GUINT64_FORMAT,
+                          analysis->output_size);
+  g_string_append (json, "\n}\n");
+  
+  return g_string_free (json, FALSE);
+}
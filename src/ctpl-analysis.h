@@ -0,0 +1,64 @@
+/* 
+ * 
+ * Copyright (C) 2009-2011 Colomban Wendling <ban@herbesfolles.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ */
+
+#if ! defined (H_CTPL_H_INSIDE) && ! defined (CTPL_COMPILATION)
+# error "Only <ctpl/ctpl.h> can be included directly."
+#endif
+
+#ifndef H_CTPL_ANALYSIS_H
+#define H_CTPL_ANALYSIS_H
+
+#include <glib.h>
+#include "ctpl-token.h"
+
+G_BEGIN_DECLS
+
+
+typedef struct _CtplAnalysis CtplAnalysis;
+
+CtplAnalysis   *ctpl_analysis_new                 (const CtplToken *tree,
+                                                   gulong           default_iterations);
+CtplAnalysis   *ctpl_analysis_ref                 (CtplAnalysis *analysis);
+void            ctpl_analysis_unref               (CtplAnalysis *analysis);
+gchar         **ctpl_analysis_get_symbols         (const CtplAnalysis *analysis);
+guint           ctpl_analysis_get_symbol_reads    (const CtplAnalysis *analysis,
+                                                   const gchar        *symbol);
+gchar         **ctpl_analysis_get_functions       (const CtplAnalysis *analysis);
+guint           ctpl_analysis_get_function_calls  (const CtplAnalysis *analysis,
+                                                   const gchar        *function);
+gsize           ctpl_analysis_get_literal_size    (const CtplAnalysis *analysis);
+guint           ctpl_analysis_get_max_loop_depth  (const CtplAnalysis *analysis);
+guint           ctpl_analysis_get_n_loops         (const CtplAnalysis *analysis);
+const gchar    *ctpl_analysis_get_loop_iterator   (const CtplAnalysis *analysis,
+                                                   guint               loop);
+guint           ctpl_analysis_get_loop_depth      (const CtplAnalysis *analysis,
+                                                   guint               loop);
+gulong          ctpl_analysis_get_loop_iterations (const CtplAnalysis *analysis,
+                                                   guint               loop,
+                                                   gboolean           *exact);
+guint64         ctpl_analysis_get_loop_multiplier (const CtplAnalysis *analysis,
+                                                   guint               loop);
+guint64         ctpl_analysis_get_cost            (const CtplAnalysis *analysis);
+guint64         ctpl_analysis_get_output_size     (const CtplAnalysis *analysis);
+gchar          *ctpl_analysis_to_json             (const CtplAnalysis *analysis);
+
+
+G_END_DECLS
+
+#endif /* guard */
@@ -0,0 +1,75 @@
+/* 
+ * 
+ * Copyright (C) 2009-2011 Colomban Wendling <ban@herbesfolles.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ */
+
+#ifndef H_CTPL_ARENA_PRIVATE_H
+#define H_CTPL_ARENA_PRIVATE_H
+
+#include <glib.h>
+#include "ctpl-arena.h"
+
+G_BEGIN_DECLS
+
+
+/*
+ * SECTION: arena-private
+ * @short_description: Private arena API
+ * @include: ctpl/arena-private.h
+ * 
+ * Allocation in a #CtplArena.  Memory allocated in an arena is never freed
+ * individually, but released in bulk back to a mark, in a stack-like manner.
+ */
+
+/*
+ * CtplArenaMark:
+ * 
+ * A position in a #CtplArena, see ctpl_arena_mark().
+ */
+typedef struct _CtplArenaMark CtplArenaMark;
+struct _CtplArenaMark
+{
+  /*<private>*/
+  guint block;
+  gsize used;
+};
+
+
+G_GNUC_INTERNAL
+gpointer      ctpl_arena_alloc    (CtplArena *arena,
+                                   gsize      size);
+G_GNUC_INTERNAL
+void          ctpl_arena_mark     (CtplArena     *arena,
+                                   CtplArenaMark *mark);
+G_GNUC_INTERNAL
+void          ctpl_arena_release  (CtplArena           *arena,
+                                   const CtplArenaMark *mark);
+G_GNUC_INTERNAL
+gsize         ctpl_arena_get_size   (const CtplArena *arena);
+G_GNUC_INTERNAL
+void          ctpl_arena_set_limit  (CtplArena *arena,
+                                     gsize      limit);
+G_GNUC_INTERNAL
+gsize         ctpl_arena_get_limit  (const CtplArena *arena);
+G_GNUC_INTERNAL
+gboolean      ctpl_arena_can_hold   (const CtplArena *arena,
+                                     gsize            size);
+
+
+G_END_DECLS
+
+#endif /* guard */
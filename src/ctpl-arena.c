@@ -0,0 +1,299 @@
+/* 
+ * 
+ * Copyright (C) 2009-2011 Colomban Wendling <ban@herbesfolles.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ */
+
+#include "ctpl-arena.h"
+#include "ctpl-arena-private.h"
+#include <glib.h>
+
+
+/**
+ * SECTION: arena
+ * @short_description: Scratch memory for rendering
+ * @include: ctpl/ctpl.h
+ * 
+ * A #CtplArena holds the temporary values computed while evaluating the
+ * expressions of a template, such as the intermediate results of string
+ * operations.  Rather than being freed one by one, they are released all at
+ * once when the evaluation of the token that created them is done, and the
+ * memory is reused for the next ones.
+ * 
+ * ctpl_parser_parse() uses an arena of its own, but you can give one to
+ * ctpl_parser_parse_with_arena() to keep the memory between renderings, for
+ * example when rendering many templates in a row.
+ * 
+ * An arena cannot be used by more than one rendering at a time.
+ * 
+ * A #CtplArena is created with ctpl_arena_new() and uses a refcounting
+ * through ctpl_arena_ref() and ctpl_arena_unref().
+ */
+
+
+/* size of the blocks in which small allocations are made, larger ones get a
+ * block of their own */
+#define ARENA_BLOCK_SIZE  8192
+/* alignment of the allocations */
+#define ARENA_ALIGNMENT   (2 * sizeof (gpointer))
+
+typedef struct _CtplArenaBlock CtplArenaBlock;
+struct _CtplArenaBlock
+{
+  gsize   size;
+  gchar  *data;
+};
+
+/**
+ * CtplArena:
+ * 
+ * An opaque object holding scratch memory.
+ * 
+ * Since: 0.4
+ */
+struct _CtplArena
+{
+  gint    ref_count;
+  GArray *blocks;   /* CtplArenaBlock */
+  guint   current;  /* index of the block being filled */
+  gsize   used;     /* bytes used in the current block */
+  gsize   size;     /* total size of the blocks */
+  gsize   limit;    /* size the arena shouldn't exceed, or 0 */
+};
+
+
+/**
+ * ctpl_arena_new:
+ * 
+ * Creates a new empty #CtplArena.
+ * 
+ * Returns: A new #CtplArena
+ * 
+ * Since: 0.4
+ */
+CtplArena *
+ctpl_arena_new (void)
+{
+  CtplArena *arena;
+  
+  arena = g_slice_alloc (sizeof *arena);
+  arena->ref_count = 1;
+  arena->blocks = g_array_new (FALSE, FALSE, sizeof (CtplArenaBlock));
+  arena->current = 0;
+  arena->used = 0;
+  arena->size = 0;
+  arena->limit = 0;
+  
+  return arena;
+}
+
+/**
+ * ctpl_arena_ref:
+ * @arena: A #CtplArena
+ * 
+ * Adds a reference to a #CtplArena.
+ * 
+ * Returns: The arena
+ * 
+ * Since: 0.4
+ */
+CtplArena *
+ctpl_arena_ref (CtplArena *arena)
+{
+  g_atomic_int_inc (&arena->ref_count);
+  
+  return arena;
+}
+
+/**
+ * ctpl_arena_unref:
+ * @arena: A #CtplArena
+ * 
+ * Removes a reference from a #CtplArena. When its reference count reaches 0,
+ * the arena and all its memory are freed.
+ * 
+ * Since: 0.4
+ */
+void
+ctpl_arena_unref (CtplArena *arena)
+{
+  if (g_atomic_int_dec_and_test (&arena->ref_count)) {
+    guint i;
+    
+    for (i = 0; i < arena->blocks->len; i++) {
+      g_free (g_array_index (arena->blocks, CtplArenaBlock, i).data);
+    }
+    g_array_free (arena->blocks, TRUE);
+    g_slice_free1 (sizeof *arena, arena);
+  }
+}
+
+/*
+ * ctpl_arena_alloc:
+ * @arena: A #CtplArena
+ * @size: The number of bytes to allocate
+ * 
+ * Allocates memory in an arena.  It stays valid until the arena is released
+ * to a mark taken before the allocation.
+ * 
+ * Returns: The allocated memory, suitably aligned for any type.
+ */
+gpointer
+ctpl_arena_alloc (CtplArena *arena,
+                  gsize      size)
+{
+  CtplArenaBlock *block = NULL;
+  gpointer        mem;
+  
+  size = (size + ARENA_ALIGNMENT - 1) & ~(ARENA_ALIGNMENT - 1);
+  /* find the first block with enough room left, from the current one */
+  while (arena->current < arena->blocks->len) {
+    block = &g_array_index (arena->blocks, CtplArenaBlock, arena->current);
+    if (arena->used + size <= block->size) {
+      break;
+    }
+    block = NULL;
+    arena->current++;
+    arena->used = 0;
+  }
+  if (! block) {
+    CtplArenaBlock new_block;
+    
+    new_block.size = MAX (size, ARENA_BLOCK_SIZE);
+    new_block.data = g_malloc (new_block.size);
+    g_array_append_val (arena->blocks, new_block);
+    arena->size += new_block.size;
+    arena->current = arena->blocks->len - 1;
+    arena->used = 0;
+    block = &g_array_index (arena->blocks, CtplArenaBlock, arena->current);
+  }
+  mem = &block->data[arena->used];
+  arena->used += size;
+  
+  return mem;
+}
+
+/*
+ * ctpl_arena_mark:
+ * @arena: A #CtplArena
+ * @mark: (out): A #CtplArenaMark to fill
+ * 
+ * Gets the current position of an arena, to release it there later with
+ * ctpl_arena_release().
+ */
+void
+ctpl_arena_mark (CtplArena     *arena,
+                 CtplArenaMark *mark)
+{
+  mark->block = arena->current;
+  mark->used = arena->used;
+}
+
+/*
+ * ctpl_arena_release:
+ * @arena: A #CtplArena
+ * @mark: A #CtplArenaMark got from @arena
+ * 
+ * Releases all the memory allocated in an arena since @mark was taken, which
+ * should not be used anymore.  Marks taken after @mark are invalidated.
+ * The blocks of larger than usual allocations are freed, the others are
+ * kept to be reused.
+ */
+void
+ctpl_arena_release (CtplArena           *arena,
+                    const CtplArenaMark *mark)
+{
+  guint first;
+  guint i;
+  
+  /* the mark's block is only free if nothing was allocated in it before */
+  first = (mark->used > 0) ? mark->block + 1 : mark->block;
+  for (i = arena->blocks->len; i > first; i--) {
+    CtplArenaBlock *block;
+    
+    block = &g_array_index (arena->blocks, CtplArenaBlock, i - 1);
+    if (block->size > ARENA_BLOCK_SIZE) {
+      arena->size -= block->size;
+      g_free (block->data);
+      g_array_remove_index (arena->blocks, i - 1);
+    }
+  }
+  arena->current = mark->block;
+  arena->used = mark->used;
+}
+
+/*
+ * ctpl_arena_get_size:
+ * @arena: A #CtplArena
+ * 
+ * Gets the size of the memory an arena holds, which is, of the blocks it
+ * allocated and didn't free yet, whether they are used or kept for reuse.
+ * 
+ * Returns: The size of the memory held by @arena, in bytes
+ */
+gsize
+ctpl_arena_get_size (const CtplArena *arena)
+{
+  return arena->size;
+}
+
+/*
+ * ctpl_arena_set_limit:
+ * @arena: A #CtplArena
+ * @limit: The size @arena shouldn't exceed, in bytes, or 0 for no limit
+ * 
+ * Sets the size an arena shouldn't exceed.  The limit isn't enforced by the
+ * arena itself, but large allocations can be checked against it beforehand
+ * with ctpl_arena_can_hold().
+ */
+void
+ctpl_arena_set_limit (CtplArena *arena,
+                      gsize      limit)
+{
+  arena->limit = limit;
+}
+
+/*
+ * ctpl_arena_get_limit:
+ * @arena: A #CtplArena
+ * 
+ * Gets the limit set with ctpl_arena_set_limit().
+ * 
+ * Returns: The size @arena shouldn't exceed, or 0 if there is no limit
+ */
+gsize
+ctpl_arena_get_limit (const CtplArena *arena)
+{
+  return arena->limit;
+}
+
+/*
+ * ctpl_arena_can_hold:
+ * @arena: A #CtplArena
+ * @size: A number of bytes
+ * 
+ * Checks whether @size more bytes would fit in the limit of an arena.
+ * 
+ * Returns: %TRUE if @arena has no limit or if @size more bytes fit in it,
+ *          %FALSE otherwise.
+ */
+gboolean
+ctpl_arena_can_hold (const CtplArena *arena,
+                     gsize            size)
+{
+  return arena->limit == 0 ||
+         (arena->size <= arena->limit && size <= arena->limit - arena->size);
+}
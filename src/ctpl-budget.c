@@ -0,0 +1,213 @@
+/* 
+ * 
+ * Copyright (C) 2009-2011 Colomban Wendling <ban@herbesfolles.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ */
+
+#include "ctpl-budget.h"
+#include <glib.h>
+#include "ctpl-i18n.h"
+#include "ctpl-arena.h"
+#include "ctpl-arena-private.h"
+#include "ctpl-output-stream.h"
+#include "ctpl-parser.h"
+
+
+/*
+ * SECTION: budget
+ * @short_description: Rendering limits
+ * @include: ctpl/budget.h
+ * 
+ * A #CtplBudget enforces the limits of a #CtplParserOptions during a
+ * rendering.  The renderer calls ctpl_budget_iterate() at each loop iteration
+ * and writes through ctpl_budget_write(), which both check the limits, so a
+ * rendering stops at the first of these points after a limit was exceeded.
+ * The output limit is exact: the write exceeding it is truncated to what fits.
+ * The memory limit is also set on the arena, so that large allocations can be
+ * checked beforehand with ctpl_arena_can_hold().
+ */
+
+
+/* number of checks between two reads of the clock, as reading it is much
+ * slower than the other checks */
+#define CLOCK_CHECK_INTERVAL 64
+
+
+/* gets the current time in microseconds since the epoch, like
+ * g_get_real_time() which needs a newer GLib */
+static gint64
+get_real_time (void)
+{
+  GTimeVal now;
+  
+  g_get_current_time (&now);
+  
+  return (gint64) now.tv_sec * G_USEC_PER_SEC + now.tv_usec;
+}
+
+/*
+ * ctpl_budget_init:
+ * @budget: A #CtplBudget to initialize
+ * @options: The #CtplParserOptions to enforce
+ * @arena: The #CtplArena in which the temporaries are allocated
+ * 
+ * Initializes a #CtplBudget, setting the memory limit of @options on @arena
+ * until ctpl_budget_clear() is called.
+ */
+void
+ctpl_budget_init (CtplBudget              *budget,
+                  const CtplParserOptions *options,
+                  CtplArena               *arena)
+{
+  budget->options = *options;
+  budget->arena = ctpl_arena_ref (arena);
+  budget->old_limit = ctpl_arena_get_limit (arena);
+  budget->n_output = 0;
+  budget->n_iterations = 0;
+  /* read the clock on the first check */
+  budget->clock_countdown = 0;
+  if (options->max_memory > 0) {
+    ctpl_arena_set_limit (arena, options->max_memory);
+  }
+}
+
+/*
+ * ctpl_budget_clear:
+ * @budget: A #CtplBudget
+ * 
+ * Releases a #CtplBudget, restoring the limit of its arena.
+ */
+void
+ctpl_budget_clear (CtplBudget *budget)
+{
+  ctpl_arena_set_limit (budget->arena, budget->old_limit);
+  ctpl_arena_unref (budget->arena);
+}
+
+/*
+ * ctpl_budget_check:
+ * @budget: A #CtplBudget
+ * @error: Return location for errors, or %NULL to ignore them
+ * 
+ * Checks the deadline and the memory limit.
+ * 
+ * Returns: %TRUE if they are not exceeded, %FALSE otherwise.
+ */
+gboolean
+ctpl_budget_check (CtplBudget  *budget,
+                   GError     **error)
+{
+  const CtplParserOptions *options = &budget->options;
+  
+  if (options->max_memory > 0 &&
+      ctpl_arena_get_size (budget->arena) > options->max_memory) {
+    g_set_error (error, CTPL_PARSER_ERROR, CTPL_PARSER_ERROR_MEMORY_LIMIT,
+                 _("Temporary values exceeded the memory budget of "
+                   "%"G_GSIZE_FORMAT" bytes"),
+                 options->max_memory);
+    return FALSE;
+  }
+  if (options->deadline > 0) {
+    if (budget->clock_countdown > 0) {
+      budget->clock_countdown--;
+    } else if (get_real_time () >= options->deadline) {
+      g_set_error (error, CTPL_PARSER_ERROR, CTPL_PARSER_ERROR_TIMED_OUT,
+                   _("Rendering deadline exceeded"));
+      return FALSE;
+    } else {
+      budget->clock_countdown = CLOCK_CHECK_INTERVAL - 1;
+    }
+  }
+  
+  return TRUE;
+}
+
+/*
+ * ctpl_budget_iterate:
+ * @budget: A #CtplBudget
+ * @error: Return location for errors, or %NULL to ignore them
+ * 
+ * Counts a loop iteration, and checks the limits.
+ * 
+ * Returns: %TRUE if no limit is exceeded, %FALSE otherwise.
+ */
+gboolean
+ctpl_budget_iterate (CtplBudget  *budget,
+                     GError     **error)
+{
+  const CtplParserOptions *options = &budget->options;
+  
+  budget->n_iterations++;
+  if (options->max_iterations > 0 &&
+      budget->n_iterations > options->max_iterations) {
+    g_set_error (error, CTPL_PARSER_ERROR, CTPL_PARSER_ERROR_ITERATION_LIMIT,
+                 _("Loops exceeded the limit of %"G_GUINT64_FORMAT" "
+                   "iterations"),
+                 options->max_iterations);
+    return FALSE;
+  }
+  
+  return ctpl_budget_check (budget, error);
+}
+
+/*
+ * ctpl_budget_write:
+ * @budget: A #CtplBudget
+ * @output: A #CtplOutputStream
+ * @data: The data to write
+ * @length: The length of @data
+ * @written: (out): Return location for the number of bytes written
+ * @error: Return location for errors, or %NULL to ignore them
+ * 
+ * Writes @data to @output if it fits in the output limit, or only the part of
+ * it that fits otherwise, and checks the limits.
+ * 
+ * Returns: %TRUE if the data was written and no limit is exceeded, %FALSE
+ *          otherwise.
+ */
+gboolean
+ctpl_budget_write (CtplBudget        *budget,
+                   CtplOutputStream  *output,
+                   const gchar       *data,
+                   gsize              length,
+                   gsize             *written,
+                   GError           **error)
+{
+  const CtplParserOptions  *options = &budget->options;
+  gboolean                  fits = TRUE;
+  
+  if (options->max_output > 0 &&
+      length > options->max_output - budget->n_output) {
+    length = options->max_output - budget->n_output;
+    fits = FALSE;
+  }
+  *written = 0;
+  if (length > 0) {
+    if (! ctpl_output_stream_write (output, data, (gssize) length, error)) {
+      return FALSE;
+    }
+    *written = length;
+    budget->n_output += length;
+  }
+  if (! fits) {
+    g_set_error (error, CTPL_PARSER_ERROR, CTPL_PARSER_ERROR_OUTPUT_LIMIT,
+                 _("Output exceeded the limit of %"G_GSIZE_FORMAT" bytes"),
+                 options->max_output);
+    return FALSE;
+  }
+  
+  return ctpl_budget_check (budget, error);
+}
@@ -0,0 +1,66 @@
+/* 
+ * 
+ * Copyright (C) 2009-2011 Colomban Wendling <ban@herbesfolles.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ */
+
+#ifndef H_CTPL_BUDGET_H
+#define H_CTPL_BUDGET_H
+
+#include <glib.h>
+#include "ctpl-parser.h"
+#include "ctpl-arena.h"
+#include "ctpl-output-stream.h"
+
+G_BEGIN_DECLS
+
+
+typedef struct _CtplBudget CtplBudget;
+struct _CtplBudget
+{
+  CtplParserOptions options;
+  CtplArena        *arena;          /* arena holding the temporaries */
+  gsize             old_limit;      /* limit @arena had before */
+  gsize             n_output;
+  guint64           n_iterations;
+  guint             clock_countdown; /* checks before reading the clock */
+};
+
+
+G_GNUC_INTERNAL
+void          ctpl_budget_init      (CtplBudget              *budget,
+                                     const CtplParserOptions *options,
+                                     CtplArena               *arena);
+G_GNUC_INTERNAL
+void          ctpl_budget_clear     (CtplBudget *budget);
+G_GNUC_INTERNAL
+gboolean      ctpl_budget_check     (CtplBudget  *budget,
+                                     GError     **error);
+G_GNUC_INTERNAL
+gboolean      ctpl_budget_iterate   (CtplBudget  *budget,
+                                     GError     **error);
+G_GNUC_INTERNAL
+gboolean      ctpl_budget_write     (CtplBudget        *budget,
+                                     CtplOutputStream  *output,
+                                     const gchar       *data,
+                                     gsize              length,
+                                     gsize             *written,
+                                     GError           **error);
+
+
+G_END_DECLS
+
+#endif /* guard */
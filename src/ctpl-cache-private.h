@@ -0,0 +1,57 @@
+/* 
+ * 
+ * Copyright (C) 2009-2011 Colomban Wendling <ban@herbesfolles.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ */
+
+#ifndef H_CTPL_CACHE_PRIVATE_H
+#define H_CTPL_CACHE_PRIVATE_H
+
+#include <glib.h>
+#include "ctpl-cache.h"
+#include "ctpl-environ.h"
+#include "ctpl-token.h"
+
+G_BEGIN_DECLS
+
+
+/*
+ * SECTION: cache-private
+ * @short_description: Private fragment cache API
+ * @include: ctpl/cache-private.h
+ * 
+ * Keys and entries of a #CtplCache, used by the parser.
+ */
+
+
+G_GNUC_INTERNAL
+gchar        *ctpl_cache_build_key  (const CtplToken *token,
+                                     CtplEnviron     *env);
+G_GNUC_INTERNAL
+gboolean      ctpl_cache_lookup     (CtplCache    *cache,
+                                     const gchar  *key,
+                                     const gchar **data,
+                                     gsize        *length);
+G_GNUC_INTERNAL
+void          ctpl_cache_store      (CtplCache *cache,
+                                     gchar     *key,
+                                     gchar     *data,
+                                     gsize      length);
+
+
+G_END_DECLS
+
+#endif /* guard */
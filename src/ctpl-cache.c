@@ -0,0 +1,551 @@
+/* 
+ * 
+ * Copyright (C) 2009-2011 Colomban Wendling <ban@herbesfolles.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ */
+
+#include "ctpl-cache.h"
+#include "ctpl-cache-private.h"
+#include <string.h>
+#include <glib.h>
+#include "ctpl-environ.h"
+#include "ctpl-environ-private.h"
+#include "ctpl-token.h"
+#include "ctpl-token-private.h"
+#include "ctpl-value.h"
+
+
+/**
+ * SECTION: cache
+ * @short_description: Fragment output cache
+ * @include: ctpl/ctpl.h
+ * 
+ * A #CtplCache keeps the output of the <code>for</code> and <code>if</code>
+ * statements of a template, so that rendering them again with the same
+ * values replays the stored output rather than computing it.  It is used with
+ * ctpl_parser_parse_cached().
+ * 
+ * The output of a statement is stored under the values of the symbols it
+ * reads, as ctpl_token_get_dependencies() finds them, so a change to one of
+ * these symbols simply leads to another entry: you don't need to invalidate
+ * the cache when the environment changes.
+ * Statements calling functions added with ctpl_environ_add_function() are
+ * not cached since their output may depend on anything, nor are those reading
+ * iterator values or values from a resolver that doesn't memoize them, see
+ * ctpl_environ_set_resolver().
+ * 
+ * When the size of the stored outputs exceeds the maximum size of the cache,
+ * the least recently used ones are dropped.  ctpl_cache_invalidate() drops
+ * them all, which is useful if a rendering depends on something else than the
+ * environment, like host functions do.
+ * 
+ * A cache cannot be used by more than one rendering at a time.
+ * 
+ * A #CtplCache is created with ctpl_cache_new() and uses a refcounting
+ * through ctpl_cache_ref() and ctpl_cache_unref().
+ */
+
+
+typedef struct _CtplCacheEntry CtplCacheEntry;
+struct _CtplCacheEntry
+{
+  gchar  *key;
+  gchar  *data;
+  gsize   length;
+};
+
+/* what an entry counts for in the cache's size */
+#define ENTRY_SIZE(entry) \
+  (sizeof *(entry) + strlen ((entry)->key) + (entry)->length)
+
+/**
+ * CtplCache:
+ * 
+ * An opaque object holding rendered template fragments.
+ * 
+ * Since: 0.4
+ */
+struct _CtplCache
+{
+  gint        ref_count;
+  gsize       max_size;
+  gsize       size;
+  GHashTable *entries;  /* key -> link in @lru */
+  GQueue      lru;      /* CtplCacheEntry, most recently used first */
+  gulong      hits;
+  gulong      misses;
+};
+
+
+/**
+ * ctpl_cache_new:
+ * @max_size: Maximum size of the cache, in bytes
+ * 
+ * Creates a new empty #CtplCache.
+ * 
+ * Returns: A new #CtplCache
+ * 
+ * Since: 0.4
+ */
+CtplCache *
+ctpl_cache_new (gsize max_size)
+{
+  CtplCache *cache;
+  
+  cache = g_slice_alloc (sizeof *cache);
+  cache->ref_count = 1;
+  cache->max_size = max_size;
+  cache->size = 0;
+  cache->entries = g_hash_table_new (g_str_hash, g_str_equal);
+  g_queue_init (&cache->lru);
+  cache->hits = 0;
+  cache->misses = 0;
+  
+  return cache;
+}
+
+/**
+ * ctpl_cache_ref:
+ * @cache: A #CtplCache
+ * 
+ * Adds a reference to a #CtplCache.
+ * 
+ * Returns: The cache
+ * 
+ * Since: 0.4
+ */
+CtplCache *
+ctpl_cache_ref (CtplCache *cache)
+{
+  g_atomic_int_inc (&cache->ref_count);
+  
+  return cache;
+}
+
+/**
+ * ctpl_cache_unref:
+ * @cache: A #CtplCache
+ * 
+ * Removes a reference from a #CtplCache. When its reference count reaches 0,
+ * the cache and all its entries are freed.
+ * 
+ * Since: 0.4
+ */
+void
+ctpl_cache_unref (CtplCache *cache)
+{
+  if (g_atomic_int_dec_and_test (&cache->ref_count)) {
+    ctpl_cache_invalidate (cache);
+    g_hash_table_destroy (cache->entries);
+    g_slice_free1 (sizeof *cache, cache);
+  }
+}
+
+static void
+entry_free (CtplCacheEntry *entry)
+{
+  g_free (entry->key);
+  g_free (entry->data);
+  g_slice_free1 (sizeof *entry, entry);
+}
+
+/* drops the least recently used entry */
+static void
+drop_last_entry (CtplCache *cache)
+{
+  CtplCacheEntry *entry = g_queue_pop_tail (&cache->lru);
+  
+  g_hash_table_remove (cache->entries, entry->key);
+  cache->size -= ENTRY_SIZE (entry);
+  entry_free (entry);
+}
+
+/**
+ * ctpl_cache_invalidate:
+ * @cache: A #CtplCache
+ * 
+ * Drops all the entries of a #CtplCache.  The hit and miss counters are kept.
+ * 
+ * Since: 0.4
+ */
+void
+ctpl_cache_invalidate (CtplCache *cache)
+{
+  while (! g_queue_is_empty (&cache->lru)) {
+    drop_last_entry (cache);
+  }
+}
+
+/**
+ * ctpl_cache_get_size:
+ * @cache: A #CtplCache
+ * 
+ * Gets the size of the entries of a #CtplCache.
+ * 
+ * Returns: The size of the cache, in bytes
+ * 
+ * Since: 0.4
+ */
+gsize
+ctpl_cache_get_size (const CtplCache *cache)
+{
+  return cache->size;
+}
+
+/**
+ * ctpl_cache_get_hits:
+ * @cache: A #CtplCache
+ * 
+ * Gets how many times a #CtplCache replayed a stored output.
+ * 
+ * Returns: The number of hits
+ * 
+ * Since: 0.4
+ */
+gulong
+ctpl_cache_get_hits (const CtplCache *cache)
+{
+  return cache->hits;
+}
+
+/**
+ * ctpl_cache_get_misses:
+ * @cache: A #CtplCache
+ * 
+ * Gets how many times a cacheable output wasn't found in a #CtplCache.
+ * 
+ * Returns: The number of misses
+ * 
+ * Since: 0.4
+ */
+gulong
+ctpl_cache_get_misses (const CtplCache *cache)
+{
+  return cache->misses;
+}
+
+
+/* appends an exact representation of @value to @key.
+ * Returns: %FALSE if @value cannot be represented */
+static gboolean
+append_value_key (GString         *key,
+                  const CtplValue *value)
+{
+  gboolean rv = TRUE;
+  
+  if (! value) {
+    g_string_append_c (key, '!');
+  } else {
+    switch (ctpl_value_get_held_type (value)) {
+      case CTPL_VTYPE_INT:
+        g_string_append_printf (key, "i%ld", ctpl_value_get_int (value));
+        break;
+      
+      case CTPL_VTYPE_FLOAT: {
+        union { gdouble d; guint64 u; } bits;
+        
+        bits.d = ctpl_value_get_float (value);
+        g_string_append_printf (key, "f%" G_GINT64_MODIFIER "x", bits.u);
+        break;
+      }
+      
+      case CTPL_VTYPE_STRING: {
+        const gchar *str = ctpl_value_get_string (value);
+        
+        g_string_append_printf (key, "s%" G_GSIZE_FORMAT ":", strlen (str));
+        g_string_append (key, str);
+        break;
+      }
+      
+      case CTPL_VTYPE_ARRAY: {
+        const GSList *item;
+        
+        g_string_append_c (key, '[');
+        for (item = ctpl_value_get_array (value); rv && item; item = item->next) {
+          rv = append_value_key (key, item->data);
+          g_string_append_c (key, ',');
+        }
+        g_string_append_c (key, ']');
+        break;
+      }
+      
+      default:
+        /* iterators may give other items each time */
+        rv = FALSE;
+    }
+  }
+  
+  return rv;
+}
+
+/* feeds the structure of an expression to @checksum */
+static void
+checksum_expr (GChecksum           *checksum,
+               const CtplTokenExpr *expr)
+{
+  const GSList *item;
+  
+  switch (expr->type) {
+    case CTPL_TOKEN_EXPR_TYPE_OPERATOR: {
+      guchar op = (guchar) expr->token.t_operator->operator;
+      
+      g_checksum_update (checksum, (const guchar *) "O", 1);
+      g_checksum_update (checksum, &op, 1);
+      checksum_expr (checksum, expr->token.t_operator->loperand);
+      checksum_expr (checksum, expr->token.t_operator->roperand);
+      break;
+    }
+    
+    case CTPL_TOKEN_EXPR_TYPE_VALUE: {
+      GString *str = g_string_new ("V");
+      
+      append_value_key (str, &expr->token.t_value);
+      g_checksum_update (checksum, (const guchar *) str->str,
+                         (gssize) str->len + 1);
+      g_string_free (str, TRUE);
+      break;
+    }
+    
+    case CTPL_TOKEN_EXPR_TYPE_SYMBOL:
+      g_checksum_update (checksum, (const guchar *) "S", 1);
+      g_checksum_update (checksum, (const guchar *) expr->token.t_symbol,
+                         (gssize) strlen (expr->token.t_symbol) + 1);
+      break;
+    
+    case CTPL_TOKEN_EXPR_TYPE_FUNCTION:
+      g_checksum_update (checksum, (const guchar *) "C", 1);
+      g_checksum_update (checksum,
+                         (const guchar *) expr->token.t_function->name,
+                         (gssize) strlen (expr->token.t_function->name) + 1);
+      for (item = expr->token.t_function->args; item; item = item->next) {
+        checksum_expr (checksum, item->data);
+      }
+      g_checksum_update (checksum, (const guchar *) ")", 1);
+      break;
+  }
+  for (item = expr->indexes; item; item = item->next) {
+    g_checksum_update (checksum, (const guchar *) "[", 1);
+    checksum_expr (checksum, item->data);
+  }
+  g_checksum_update (checksum, (const guchar *) ";", 1);
+}
+
+/* tokens whose structure is being fed to a checksum */
+typedef struct _ChecksumFrame ChecksumFrame;
+struct _ChecksumFrame
+{
+  const CtplToken  *token;    /* next token to feed, or %NULL */
+  gboolean          siblings; /* whether to feed the siblings of @token */
+  const gchar      *end;      /* what to feed after the tokens, or %NULL */
+};
+
+static void
+push_checksum_frame (GArray          *stack,
+                     const CtplToken *token,
+                     gboolean         siblings,
+                     const gchar     *end)
+{
+  ChecksumFrame frame;
+  
+  frame.token = token;
+  frame.siblings = siblings;
+  frame.end = end;
+  g_array_append_val (stack, frame);
+}
+
+/* feeds the structure of a token to @checksum, walking the blocks with an
+ * explicit stack so deeply nested trees don't overflow the stack */
+static void
+checksum_token (GChecksum       *checksum,
+                const CtplToken *token,
+                gboolean         siblings)
+{
+  GArray *stack = g_array_new (FALSE, FALSE, sizeof (ChecksumFrame));
+  
+  push_checksum_frame (stack, token, siblings, NULL);
+  while (stack->len > 0) {
+    ChecksumFrame *frame;
+    
+    frame = &g_array_index (stack, ChecksumFrame, stack->len - 1);
+    token = frame->token;
+    if (! token) {
+      if (frame->end) {
+        g_checksum_update (checksum, (const guchar *) frame->end, 1);
+      }
+      g_array_set_size (stack, stack->len - 1);
+    } else {
+      frame->token = frame->siblings ? token->next : NULL;
+      /* pushing frames invalidates @frame */
+      switch (token->type) {
+        case CTPL_TOKEN_TYPE_DATA:
+          g_checksum_update (checksum, (const guchar *) "D", 1);
+          g_checksum_update (checksum, (const guchar *) token->token.t_data,
+                             (gssize) strlen (token->token.t_data) + 1);
+          g_checksum_update (checksum, (const guchar *) "}", 1);
+          break;
+        
+        case CTPL_TOKEN_TYPE_EXPR:
+          g_checksum_update (checksum, (const guchar *) "E", 1);
+          checksum_expr (checksum, token->token.t_expr);
+          g_checksum_update (checksum, (const guchar *) "}", 1);
+          break;
+        
+        case CTPL_TOKEN_TYPE_FOR:
+          g_checksum_update (checksum, (const guchar *) "F", 1);
+          g_checksum_update (checksum,
+                             (const guchar *) token->token.t_for->iter,
+                             (gssize) strlen (token->token.t_for->iter) + 1);
+          checksum_expr (checksum, token->token.t_for->array);
+          push_checksum_frame (stack, token->token.t_for->children, TRUE,
+                               "}");
+          break;
+        
+        case CTPL_TOKEN_TYPE_IF:
+          g_checksum_update (checksum, (const guchar *) "I", 1);
+          checksum_expr (checksum, token->token.t_if->condition);
+          /* the last pushed is fed first */
+          push_checksum_frame (stack, token->token.t_if->else_children, TRUE,
+                               "}");
+          push_checksum_frame (stack, token->token.t_if->if_children, TRUE,
+                               "|");
+          break;
+      }
+    }
+  }
+  g_array_free (stack, TRUE);
+}
+
+/*
+ * ctpl_cache_build_key:
+ * @token: A #CtplToken
+ * @env: The #CtplEnviron in which @token will be rendered
+ * 
+ * Builds the key under which the output of @token rendered in @env is
+ * stored: a checksum of @token's structure followed by the values of the
+ * symbols it reads.
+ * 
+ * Returns: A new key, or %NULL if the output of @token cannot be cached.
+ */
+gchar *
+ctpl_cache_build_key (const CtplToken *token,
+                      CtplEnviron     *env)
+{
+  GPtrArray  *symbols = g_ptr_array_new ();
+  GPtrArray  *functions = g_ptr_array_new ();
+  GString    *key = NULL;
+  gboolean    cacheable = TRUE;
+  guint       i;
+  
+  ctpl_token_collect_dependencies (token, FALSE, symbols, functions);
+  for (i = 0; cacheable && i < functions->len; i++) {
+    CtplEnvironFunction func;
+    gpointer            user_data;
+    
+    /* only the built-in functions are known to be pure */
+    cacheable = ! ctpl_environ_lookup_function (env, functions->pdata[i],
+                                                &func, &user_data);
+  }
+  if (cacheable) {
+    GChecksum *checksum = g_checksum_new (G_CHECKSUM_MD5);
+    
+    checksum_token (checksum, token, FALSE);
+    key = g_string_new (g_checksum_get_string (checksum));
+    g_checksum_free (checksum);
+    for (i = 0; cacheable && i < symbols->len; i++) {
+      const gchar *symbol = symbols->pdata[i];
+      
+      g_string_append_c (key, ';');
+      /* a value the rendering may read differently than the key can't be
+       * trusted */
+      cacheable = ctpl_environ_symbol_is_stable (env, symbol) &&
+                  append_value_key (key, ctpl_environ_lookup (env, symbol));
+    }
+  }
+  g_ptr_array_free (functions, TRUE);
+  g_ptr_array_free (symbols, TRUE);
+  
+  return key ? g_string_free (key, ! cacheable) : NULL;
+}
+
+/*
+ * ctpl_cache_lookup:
+ * @cache: A #CtplCache
+ * @key: A key from ctpl_cache_build_key()
+ * @data: (out): Return location for the stored output
+ * @length: (out): Return location for the length of @data
+ * 
+ * Looks up for the output stored under @key, counting a hit or a miss.
+ * 
+ * Returns: %TRUE if an output was found, %FALSE otherwise.
+ */
+gboolean
+ctpl_cache_lookup (CtplCache    *cache,
+                   const gchar  *key,
+                   const gchar **data,
+                   gsize        *length)
+{
+  GList *link = g_hash_table_lookup (cache->entries, key);
+  
+  if (! link) {
+    cache->misses++;
+  } else {
+    CtplCacheEntry *entry = link->data;
+    
+    cache->hits++;
+    g_queue_unlink (&cache->lru, link);
+    g_queue_push_head_link (&cache->lru, link);
+    *data = entry->data;
+    *length = entry->length;
+  }
+  
+  return link != NULL;
+}
+
+/*
+ * ctpl_cache_store:
+ * @cache: A #CtplCache
+ * @key: (transfer full): A key from ctpl_cache_build_key()
+ * @data: (transfer full): The output to store
+ * @length: The length of @data
+ * 
+ * Stores an output under @key, dropping the least recently used entries if
+ * needed to keep @cache within its maximum size.  If the output alone is
+ * larger than this size, it isn't stored.
+ */
+void
+ctpl_cache_store (CtplCache *cache,
+                  gchar     *key,
+                  gchar     *data,
+                  gsize      length)
+{
+  CtplCacheEntry *entry;
+  
+  entry = g_slice_alloc (sizeof *entry);
+  entry->key = key;
+  entry->data = data;
+  entry->length = length;
+  if (ENTRY_SIZE (entry) > cache->max_size ||
+      g_hash_table_lookup (cache->entries, key)) {
+    entry_free (entry);
+  } else {
+    cache->size += ENTRY_SIZE (entry);
+    while (cache->size > cache->max_size) {
+      drop_last_entry (cache);
+    }
+    g_queue_push_head (&cache->lru, entry);
+    g_hash_table_insert (cache->entries, entry->key, cache->lru.head);
+  }
+}
@@ -0,0 +1,45 @@
+/* 
+ * 
+ * Copyright (C) 2009-2011 Colomban Wendling <ban@herbesfolles.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ */
+
+#if ! defined (H_CTPL_H_INSIDE) && ! defined (CTPL_COMPILATION)
+# error "Only <ctpl/ctpl.h> can be included directly."
+#endif
+
+#ifndef H_CTPL_CACHE_H
+#define H_CTPL_CACHE_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+
+typedef struct _CtplCache CtplCache;
+
+CtplCache  *ctpl_cache_new          (gsize max_size);
+CtplCache  *ctpl_cache_ref          (CtplCache *cache);
+void        ctpl_cache_unref        (CtplCache *cache);
+void        ctpl_cache_invalidate   (CtplCache *cache);
+gsize       ctpl_cache_get_size     (const CtplCache *cache);
+gulong      ctpl_cache_get_hits     (const CtplCache *cache);
+gulong      ctpl_cache_get_misses   (const CtplCache *cache);
+
+
+G_END_DECLS
+
+#endif /* guard */
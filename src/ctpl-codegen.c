@@ -0,0 +1,1817 @@
+/* 
+ * 
+ * Copyright (C) 2009-2011 Colomban Wendling <ban@herbesfolles.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ */
+
+#include "ctpl-codegen.h"
+#include <stdarg.h>
+#include <string.h>
+#include <glib.h>
+#include <gio/gio.h>
+#include "ctpl-i18n.h"
+#include "ctpl-environ.h"
+#include "ctpl-eval.h"
+#include "ctpl-eval-private.h"
+#include "ctpl-lexer-expr.h"
+#include "ctpl-lexer-private.h"
+#include "ctpl-output-stream.h"
+#include "ctpl-token.h"
+#include "ctpl-token-private.h"
+#include "ctpl-value.h"
+
+
+/**
+ * SECTION: codegen
+ * @short_description: Template to C translation
+ * @include: ctpl/ctpl.h
+ * 
+ * Translates a template tree to the C source of a function rendering it, for
+ * templates rendered often enough to be worth a build step.
+ * 
+ * The generated function has the signature of ctpl_parser_parse() without its
+ * tree argument, and renders through the public API as the parser would do,
+ * with the same output and errors:
+ * |[
+ * gboolean name (CtplEnviron       *env,
+ *                CtplOutputStream  *output,
+ *                GError           **error);
+ * ]|
+ * Data is written from static arrays, <code>for</code> and <code>if</code>
+ * statements become C loops and branches, and expressions that only hold
+ * constants are computed while generating the code.  Operations get a function
+ * of their own reading literals and symbols directly and computing integers,
+ * floating-point numbers and strings natively.  Function calls, indexes, the
+ * loop arrays and the operands of other types are left to the library: their
+ * expressions are lexed once, the first time the function is called, and
+ * evaluated with ctpl_eval_value() or ctpl_eval_bool().
+ * 
+ * The command-line tool can generate this code with its
+ * <code>--compile</code> option.
+ */
+
+
+/* constant expressions with a longer output are kept for run time, not to
+ * bloat the generated code */
+#define FOLD_MAX_LENGTH 4096
+
+/* support code of the compiled expressions */
+typedef enum {
+  HELPER_SCALAR,
+  HELPER_UPDATE,
+  HELPER_GET_VALUE,
+  HELPER_LOOKUP,
+  HELPER_EVAL,
+  HELPER_OPERATOR,
+  HELPER_TEST,
+  HELPER_COMPARE,
+  HELPER_WRITE_VALUE,
+  HELPER_WRITE,
+  HELPER_WRITE_EVAL,
+  HELPER_WRITE_SYMBOL,
+  HELPER_TEST_SYMBOL,
+  HELPER_PLUS,
+  HELPER_MINUS,
+  HELPER_MUL,
+  HELPER_DIV,
+  HELPER_MODULO,
+  HELPER_RELATION,
+  HELPER_AND,
+  HELPER_OR,
+  N_HELPERS
+} Helper;
+
+#define HELPER_BIT(helper) (1u << (helper))
+
+/* the helpers each helper uses, that come before it */
+static const guint helper_deps[N_HELPERS] = {
+  0,                                                    /* SCALAR */
+  HELPER_BIT (HELPER_SCALAR),                           /* UPDATE */
+  HELPER_BIT (HELPER_SCALAR),                           /* GET_VALUE */
+  HELPER_BIT (HELPER_UPDATE),                           /* LOOKUP */
+  HELPER_BIT (HELPER_UPDATE),                           /* EVAL */
+  HELPER_BIT (HELPER_UPDATE) | HELPER_BIT (HELPER_GET_VALUE), /* OPERATOR */
+  HELPER_BIT (HELPER_GET_VALUE),                        /* TEST */
+  HELPER_BIT (HELPER_SCALAR),                           /* COMPARE */
+  0,                                                    /* WRITE_VALUE */
+  HELPER_BIT (HELPER_SCALAR) | HELPER_BIT (HELPER_WRITE_VALUE), /* WRITE */
+  HELPER_BIT (HELPER_WRITE_VALUE),                      /* WRITE_EVAL */
+  HELPER_BIT (HELPER_WRITE_EVAL),                       /* WRITE_SYMBOL */
+  0,                                                    /* TEST_SYMBOL */
+  HELPER_BIT (HELPER_OPERATOR),                         /* PLUS */
+  HELPER_BIT (HELPER_OPERATOR),                         /* MINUS */
+  HELPER_BIT (HELPER_OPERATOR),                         /* MUL */
+  HELPER_BIT (HELPER_OPERATOR),                         /* DIV */
+  HELPER_BIT (HELPER_OPERATOR),                         /* MODULO */
+  HELPER_BIT (HELPER_OPERATOR) | HELPER_BIT (HELPER_COMPARE), /* RELATION */
+  HELPER_BIT (HELPER_TEST),                             /* AND */
+  HELPER_BIT (HELPER_TEST)                              /* OR */
+};
+
+/* the sources of the helpers, "$" standing for the name of the generated
+ * function and "~" for as many spaces */
+static const gchar *const helper_sources[N_HELPERS] = {
+  /* HELPER_SCALAR */
+  "\n"
+  "/* a value computed by the compiled expressions: numbers and strings are held\n"
+  " * natively, values of other types in @value */\n"
+  "typedef struct _$_Scalar $_Scalar;\n"
+  "struct _$_Scalar\n"
+  "{\n"
+  "  CtplValueType  type;\n"
+  "  glong          v_int;\n"
+  "  gdouble        v_float;\n"
+  "  const gchar   *v_string;\n"
+  "  gchar         *owned;     /* v_string if built by the compiled code */\n"
+  "  CtplValue      value;     /* holds v_string, or values of other types */\n"
+  "};\n"
+  "\n"
+  "#define $_IS_NUMBER(s) \\\n"
+  "  ((s)->type == CTPL_VTYPE_INT || (s)->type == CTPL_VTYPE_FLOAT)\n"
+  "#define $_NUMBER(s) \\\n"
+  "  ((s)->type == CTPL_VTYPE_INT ? (gdouble) (s)->v_int : (s)->v_float)\n"
+  "\n"
+  "static void\n"
+  "$_scalars_init ($_Scalar *scalars,\n"
+  "~               guint~    n)\n"
+  "{\n"
+  "  guint i;\n"
+  "  \n"
+  "  for (i = 0; i < n; i++) {\n"
+  "    scalars[i].owned = NULL;\n"
+  "    ctpl_value_init (&scalars[i].value);\n"
+  "  }\n"
+  "}\n"
+  "\n"
+  "static void\n"
+  "$_scalars_clear ($_Scalar *scalars,\n"
+  "~                guint~    n)\n"
+  "{\n"
+  "  guint i;\n"
+  "  \n"
+  "  for (i = 0; i < n; i++) {\n"
+  "    g_free (scalars[i].owned);\n"
+  "    ctpl_value_free_value (&scalars[i].value);\n"
+  "  }\n"
+  "}\n",
+  /* HELPER_UPDATE */
+  "\n"
+  "/* sets the native form of @s from its value */\n"
+  "static void\n"
+  "$_scalar_update ($_Scalar *s)\n"
+  "{\n"
+  "  s->type = ctpl_value_get_held_type (&s->value);\n"
+  "  switch (s->type) {\n"
+  "    case CTPL_VTYPE_INT:\n"
+  "      s->v_int = ctpl_value_get_int (&s->value);\n"
+  "      break;\n"
+  "    \n"
+  "    case CTPL_VTYPE_FLOAT:\n"
+  "      s->v_float = ctpl_value_get_float (&s->value);\n"
+  "      break;\n"
+  "    \n"
+  "    case CTPL_VTYPE_STRING:\n"
+  "      s->v_string = ctpl_value_get_string (&s->value);\n"
+  "      break;\n"
+  "    \n"
+  "    default:\n"
+  "      break;\n"
+  "  }\n"
+  "}\n",
+  /* HELPER_GET_VALUE */
+  "\n"
+  "/* sets @value to the value of @s */\n"
+  "static void\n"
+  "$_scalar_get_value (const $_Scalar *s,\n"
+  "~                   CtplValue~      *value)\n"
+  "{\n"
+  "  switch (s->type) {\n"
+  "    case CTPL_VTYPE_INT:\n"
+  "      ctpl_value_set_int (value, s->v_int);\n"
+  "      break;\n"
+  "    \n"
+  "    case CTPL_VTYPE_FLOAT:\n"
+  "      ctpl_value_set_float (value, s->v_float);\n"
+  "      break;\n"
+  "    \n"
+  "    case CTPL_VTYPE_STRING:\n"
+  "      if (s->owned || ! CTPL_VALUE_HOLDS_STRING (&s->value)) {\n"
+  "        ctpl_value_set_string (value, s->v_string);\n"
+  "        break;\n"
+  "      }\n"
+  "      /* fallthrough */\n"
+  "    \n"
+  "    default:\n"
+  "      ctpl_value_copy (&s->value, value);\n"
+  "  }\n"
+  "}\n",
+  /* HELPER_LOOKUP */
+  "\n"
+  "/* sets @s to the value of @symbol, or evaluates @expr to fail as the library\n"
+  " * does if it cannot be found */\n"
+  "static gboolean\n"
+  "$_lookup (CtplEnviron~          *env,\n"
+  "~         const gchar~          *symbol,\n"
+  "~         const CtplTokenExpr~  *expr,\n"
+  "~         $_Scalar              *s,\n"
+  "~         GError~              **error)\n"
+  "{\n"
+  "  const CtplValue  *value = ctpl_environ_lookup (env, symbol);\n"
+  "  gboolean          rv = TRUE;\n"
+  "  \n"
+  "  if (value && CTPL_VALUE_HOLDS_INT (value)) {\n"
+  "    s->type = CTPL_VTYPE_INT;\n"
+  "    s->v_int = ctpl_value_get_int (value);\n"
+  "  } else if (value && CTPL_VALUE_HOLDS_FLOAT (value)) {\n"
+  "    s->type = CTPL_VTYPE_FLOAT;\n"
+  "    s->v_float = ctpl_value_get_float (value);\n"
+  "  } else {\n"
+  "    if (value) {\n"
+  "      /* the value may only be valid until the next lookup */\n"
+  "      ctpl_value_copy (value, &s->value);\n"
+  "    } else {\n"
+  "      rv = ctpl_eval_value (expr, env, &s->value, error);\n"
+  "    }\n"
+  "    if (rv) {\n"
+  "      $_scalar_update (s);\n"
+  "    }\n"
+  "  }\n"
+  "  \n"
+  "  return rv;\n"
+  "}\n",
+  /* HELPER_EVAL */
+  "\n"
+  "/* sets @s to the value of @expr, computed by the library */\n"
+  "static gboolean\n"
+  "$_eval (CtplEnviron~          *env,\n"
+  "~       const CtplTokenExpr~  *expr,\n"
+  "~       $_Scalar              *s,\n"
+  "~       GError~              **error)\n"
+  "{\n"
+  "  if (! ctpl_eval_value (expr, env, &s->value, error)) {\n"
+  "    return FALSE;\n"
+  "  }\n"
+  "  $_scalar_update (s);\n"
+  "  \n"
+  "  return TRUE;\n"
+  "}\n",
+  /* HELPER_OPERATOR */
+  "\n"
+  "/* computes the operation @expr of @l and @r with the library, for the\n"
+  " * operands the compiled code doesn't handle */\n"
+  "static gboolean\n"
+  "$_operator (const CtplTokenExpr~  *expr,\n"
+  "~           const $_Scalar        *l,\n"
+  "~           const $_Scalar        *r,\n"
+  "~           $_Scalar              *result,\n"
+  "~           GError~              **error)\n"
+  "{\n"
+  "  CtplValue lvalue;\n"
+  "  CtplValue rvalue;\n"
+  "  gboolean  rv;\n"
+  "  \n"
+  "  ctpl_value_init (&lvalue);\n"
+  "  ctpl_value_init (&rvalue);\n"
+  "  $_scalar_get_value (l, &lvalue);\n"
+  "  $_scalar_get_value (r, &rvalue);\n"
+  "  G_LOCK ($_scratch);\n"
+  "  ctpl_environ_push ($_scratch, \"__ctpl_l\", &lvalue);\n"
+  "  ctpl_environ_push ($_scratch, \"__ctpl_r\", &rvalue);\n"
+  "  rv = ctpl_eval_value (expr, $_scratch, &result->value, error);\n"
+  "  ctpl_environ_pop ($_scratch, \"__ctpl_r\", NULL);\n"
+  "  ctpl_environ_pop ($_scratch, \"__ctpl_l\", NULL);\n"
+  "  G_UNLOCK ($_scratch);\n"
+  "  ctpl_value_free_value (&rvalue);\n"
+  "  ctpl_value_free_value (&lvalue);\n"
+  "  if (rv) {\n"
+  "    $_scalar_update (result);\n"
+  "  }\n"
+  "  \n"
+  "  return rv;\n"
+  "}\n",
+  /* HELPER_TEST */
+  "\n"
+  "/* gets the truth value of @s, with the library for the types the compiled\n"
+  " * code doesn't handle.  @expr is \"__ctpl_l\" */\n"
+  "static gboolean\n"
+  "$_test (const CtplTokenExpr~  *expr,\n"
+  "~       const $_Scalar        *s,\n"
+  "~       gboolean~             *result,\n"
+  "~       GError~              **error)\n"
+  "{\n"
+  "  gboolean rv = TRUE;\n"
+  "  \n"
+  "  switch (s->type) {\n"
+  "    case CTPL_VTYPE_INT:\n"
+  "      *result = s->v_int != 0;\n"
+  "      break;\n"
+  "    \n"
+  "    case CTPL_VTYPE_STRING:\n"
+  "      *result = *s->v_string != 0;\n"
+  "      break;\n"
+  "    \n"
+  "    case CTPL_VTYPE_ARRAY:\n"
+  "      *result = ctpl_value_array_length (&s->value) != 0;\n"
+  "      break;\n"
+  "    \n"
+  "    default: {\n"
+  "      CtplValue value;\n"
+  "      \n"
+  "      ctpl_value_init (&value);\n"
+  "      $_scalar_get_value (s, &value);\n"
+  "      G_LOCK ($_scratch);\n"
+  "      ctpl_environ_push ($_scratch, \"__ctpl_l\", &value);\n"
+  "      rv = ctpl_eval_bool (expr, $_scratch, result, error);\n"
+  "      ctpl_environ_pop ($_scratch, \"__ctpl_l\", NULL);\n"
+  "      G_UNLOCK ($_scratch);\n"
+  "      ctpl_value_free_value (&value);\n"
+  "    }\n"
+  "  }\n"
+  "  \n"
+  "  return rv;\n"
+  "}\n",
+  /* HELPER_COMPARE */
+  "\n"
+  "/* compares @l and @r like strcmp() if the compiled code can */\n"
+  "static gboolean\n"
+  "$_compare (const $_Scalar *l,\n"
+  "~          const $_Scalar *r,\n"
+  "~          gint~           *cmp)\n"
+  "{\n"
+  "  if (l->type == CTPL_VTYPE_INT && r->type == CTPL_VTYPE_INT) {\n"
+  "    *cmp = (l->v_int < r->v_int) ? -1 : (l->v_int > r->v_int);\n"
+  "  } else if ($_IS_NUMBER (l) && $_IS_NUMBER (r)) {\n"
+  "    gdouble lval = $_NUMBER (l);\n"
+  "    gdouble rval = $_NUMBER (r);\n"
+  "    \n"
+  "    /* whether close numbers are equal depends on how the library was built */\n"
+  "    if (! (lval - rval >= 0.000001 || rval - lval >= 0.000001)) {\n"
+  "      return FALSE;\n"
+  "    }\n"
+  "    *cmp = (lval < rval) ? -1 : 1;\n"
+  "  } else if (l->type == CTPL_VTYPE_STRING && r->type == CTPL_VTYPE_STRING) {\n"
+  "    *cmp = strcmp (l->v_string, r->v_string);\n"
+  "  } else {\n"
+  "    return FALSE;\n"
+  "  }\n"
+  "  \n"
+  "  return TRUE;\n"
+  "}\n",
+  /* HELPER_WRITE_VALUE */
+  "\n"
+  "/* writes the string form of @value */\n"
+  "static gboolean\n"
+  "$_write_value (CtplOutputStream  *output,\n"
+  "~              const CtplValue   *value,\n"
+  "~              GError           **error)\n"
+  "{\n"
+  "  gboolean  rv = FALSE;\n"
+  "  gchar     buf[G_ASCII_DTOSTR_BUF_SIZE];\n"
+  "  gchar    *str;\n"
+  "  \n"
+  "  switch (ctpl_value_get_held_type (value)) {\n"
+  "    case CTPL_VTYPE_STRING:\n"
+  "      rv = ctpl_output_stream_write (output, ctpl_value_get_string (value), -1,\n"
+  "                                     error);\n"
+  "      break;\n"
+  "    \n"
+  "    case CTPL_VTYPE_INT:\n"
+  "      g_snprintf (buf, sizeof buf, \"%ld\", ctpl_value_get_int (value));\n"
+  "      rv = ctpl_output_stream_write (output, buf, -1, error);\n"
+  "      break;\n"
+  "    \n"
+  "    case CTPL_VTYPE_FLOAT:\n"
+  "      g_ascii_formatd (buf, sizeof buf, \"%.15g\", ctpl_value_get_float (value));\n"
+  "      rv = ctpl_output_stream_write (output, buf, -1, error);\n"
+  "      break;\n"
+  "    \n"
+  "    default:\n"
+  "      str = ctpl_value_to_string (value);\n"
+  "      if (! str) {\n"
+  "        g_set_error (error, CTPL_EVAL_ERROR, CTPL_EVAL_ERROR_FAILED,\n"
+  "                     \"Cannot convert expression to a printable format\");\n"
+  "      } else {\n"
+  "        rv = ctpl_output_stream_write (output, str, -1, error);\n"
+  "        g_free (str);\n"
+  "      }\n"
+  "  }\n"
+  "  \n"
+  "  return rv;\n"
+  "}\n",
+  /* HELPER_WRITE */
+  "\n"
+  "/* writes the string form of @s */\n"
+  "static gboolean\n"
+  "$_write (CtplOutputStream~  *output,\n"
+  "~        const $_Scalar     *s,\n"
+  "~        GError~           **error)\n"
+  "{\n"
+  "  gchar buf[G_ASCII_DTOSTR_BUF_SIZE];\n"
+  "  \n"
+  "  switch (s->type) {\n"
+  "    case CTPL_VTYPE_INT:\n"
+  "      g_snprintf (buf, sizeof buf, \"%ld\", s->v_int);\n"
+  "      return ctpl_output_stream_write (output, buf, -1, error);\n"
+  "    \n"
+  "    case CTPL_VTYPE_FLOAT:\n"
+  "      g_ascii_formatd (buf, sizeof buf, \"%.15g\", s->v_float);\n"
+  "      return ctpl_output_stream_write (output, buf, -1, error);\n"
+  "    \n"
+  "    case CTPL_VTYPE_STRING:\n"
+  "      return ctpl_output_stream_write (output, s->v_string, -1, error);\n"
+  "    \n"
+  "    default:\n"
+  "      return $_write_value (output, &s->value, error);\n"
+  "  }\n"
+  "}\n",
+  /* HELPER_WRITE_EVAL */
+  "\n"
+  "/* writes the value of @expr, computed by the library */\n"
+  "static gboolean\n"
+  "$_write_eval (CtplEnviron          *env,\n"
+  "~             const CtplTokenExpr  *expr,\n"
+  "~             CtplOutputStream     *output,\n"
+  "~             GError              **error)\n"
+  "{\n"
+  "  CtplValue value;\n"
+  "  gboolean  rv;\n"
+  "  \n"
+  "  ctpl_value_init (&value);\n"
+  "  rv = (ctpl_eval_value (expr, env, &value, error) &&\n"
+  "        $_write_value (output, &value, error));\n"
+  "  ctpl_value_free_value (&value);\n"
+  "  \n"
+  "  return rv;\n"
+  "}\n",
+  /* HELPER_WRITE_SYMBOL */
+  "\n"
+  "/* writes the value of @symbol, or evaluates @expr to fail as the library does\n"
+  " * if it cannot be found */\n"
+  "static gboolean\n"
+  "$_write_symbol (CtplEnviron          *env,\n"
+  "~               const gchar          *symbol,\n"
+  "~               const CtplTokenExpr  *expr,\n"
+  "~               CtplOutputStream     *output,\n"
+  "~               GError              **error)\n"
+  "{\n"
+  "  const CtplValue *value = ctpl_environ_lookup (env, symbol);\n"
+  "  \n"
+  "  if (! value) {\n"
+  "    return $_write_eval (env, expr, output, error);\n"
+  "  }\n"
+  "  \n"
+  "  return $_write_value (output, value, error);\n"
+  "}\n",
+  /* HELPER_TEST_SYMBOL */
+  "\n"
+  "/* gets the truth value of @symbol, with the library for the types the\n"
+  " * compiled code doesn't handle */\n"
+  "static gboolean\n"
+  "$_test_symbol (CtplEnviron          *env,\n"
+  "~              const gchar          *symbol,\n"
+  "~              const CtplTokenExpr  *expr,\n"
+  "~              gboolean             *result,\n"
+  "~              GError              **error)\n"
+  "{\n"
+  "  const CtplValue *value = ctpl_environ_lookup (env, symbol);\n"
+  "  \n"
+  "  if (value && CTPL_VALUE_HOLDS_INT (value)) {\n"
+  "    *result = ctpl_value_get_int (value) != 0;\n"
+  "  } else if (value && CTPL_VALUE_HOLDS_STRING (value)) {\n"
+  "    *result = *ctpl_value_get_string (value) != 0;\n"
+  "  } else if (value && CTPL_VALUE_HOLDS_ARRAY (value)) {\n"
+  "    *result = ctpl_value_array_length (value) != 0;\n"
+  "  } else {\n"
+  "    return ctpl_eval_bool (expr, env, result, error);\n"
+  "  }\n"
+  "  \n"
+  "  return TRUE;\n"
+  "}\n",
+  /* HELPER_PLUS */
+  "\n"
+  "/* computes l + r, @expr being \"(__ctpl_l + __ctpl_r)\" */\n"
+  "static gboolean\n"
+  "$_plus (const CtplTokenExpr~  *expr,\n"
+  "~       const $_Scalar        *l,\n"
+  "~       const $_Scalar        *r,\n"
+  "~       $_Scalar              *result,\n"
+  "~       GError~              **error)\n"
+  "{\n"
+  "  if (l->type == CTPL_VTYPE_INT && r->type == CTPL_VTYPE_INT) {\n"
+  "    result->type = CTPL_VTYPE_INT;\n"
+  "    result->v_int = l->v_int + r->v_int;\n"
+  "  } else if ($_IS_NUMBER (l) && $_IS_NUMBER (r)) {\n"
+  "    result->type = CTPL_VTYPE_FLOAT;\n"
+  "    result->v_float = $_NUMBER (l) + $_NUMBER (r);\n"
+  "  } else if (l->type == CTPL_VTYPE_STRING && $_IS_NUMBER (r)) {\n"
+  "    gchar buf[G_ASCII_DTOSTR_BUF_SIZE];\n"
+  "    \n"
+  "    if (r->type == CTPL_VTYPE_INT) {\n"
+  "      g_snprintf (buf, sizeof buf, \"%ld\", r->v_int);\n"
+  "    } else {\n"
+  "      g_ascii_formatd (buf, sizeof buf, \"%.15g\", r->v_float);\n"
+  "    }\n"
+  "    result->type = CTPL_VTYPE_STRING;\n"
+  "    result->owned = g_strconcat (l->v_string, buf, NULL);\n"
+  "    result->v_string = result->owned;\n"
+  "  } else if (l->type == CTPL_VTYPE_STRING && r->type == CTPL_VTYPE_STRING) {\n"
+  "    result->type = CTPL_VTYPE_STRING;\n"
+  "    result->owned = g_strconcat (l->v_string, r->v_string, NULL);\n"
+  "    result->v_string = result->owned;\n"
+  "  } else {\n"
+  "    return $_operator (expr, l, r, result, error);\n"
+  "  }\n"
+  "  \n"
+  "  return TRUE;\n"
+  "}\n",
+  /* HELPER_MINUS */
+  "\n"
+  "/* computes l - r, @expr being \"(__ctpl_l - __ctpl_r)\" */\n"
+  "static gboolean\n"
+  "$_minus (const CtplTokenExpr~  *expr,\n"
+  "~        const $_Scalar        *l,\n"
+  "~        const $_Scalar        *r,\n"
+  "~        $_Scalar              *result,\n"
+  "~        GError~              **error)\n"
+  "{\n"
+  "  if ($_IS_NUMBER (l) && $_IS_NUMBER (r)) {\n"
+  "    result->type = CTPL_VTYPE_FLOAT;\n"
+  "    result->v_float = $_NUMBER (l) - $_NUMBER (r);\n"
+  "  } else {\n"
+  "    return $_operator (expr, l, r, result, error);\n"
+  "  }\n"
+  "  \n"
+  "  return TRUE;\n"
+  "}\n",
+  /* HELPER_MUL */
+  "\n"
+  "/* computes l * r, @expr being \"(__ctpl_l * __ctpl_r)\" */\n"
+  "static gboolean\n"
+  "$_mul (const CtplTokenExpr~  *expr,\n"
+  "~      const $_Scalar        *l,\n"
+  "~      const $_Scalar        *r,\n"
+  "~      $_Scalar              *result,\n"
+  "~      GError~              **error)\n"
+  "{\n"
+  "  if (l->type == CTPL_VTYPE_INT && r->type == CTPL_VTYPE_INT) {\n"
+  "    result->type = CTPL_VTYPE_INT;\n"
+  "    result->v_int = l->v_int * r->v_int;\n"
+  "  } else if ($_IS_NUMBER (l) && $_IS_NUMBER (r)) {\n"
+  "    result->type = CTPL_VTYPE_FLOAT;\n"
+  "    result->v_float = $_NUMBER (l) * $_NUMBER (r);\n"
+  "  } else {\n"
+  "    return $_operator (expr, l, r, result, error);\n"
+  "  }\n"
+  "  \n"
+  "  return TRUE;\n"
+  "}\n",
+  /* HELPER_DIV */
+  "\n"
+  "/* computes l / r, @expr being \"(__ctpl_l / __ctpl_r)\" */\n"
+  "static gboolean\n"
+  "$_div (const CtplTokenExpr~  *expr,\n"
+  "~      const $_Scalar        *l,\n"
+  "~      const $_Scalar        *r,\n"
+  "~      $_Scalar              *result,\n"
+  "~      GError~              **error)\n"
+  "{\n"
+  "  if ($_IS_NUMBER (l) && $_IS_NUMBER (r) &&\n"
+  "      ($_NUMBER (r) >= 0.000001 || $_NUMBER (r) <= -0.000001)) {\n"
+  "    result->type = CTPL_VTYPE_FLOAT;\n"
+  "    result->v_float = $_NUMBER (l) / $_NUMBER (r);\n"
+  "  } else {\n"
+  "    /* including the divisions by zero, that fail */\n"
+  "    return $_operator (expr, l, r, result, error);\n"
+  "  }\n"
+  "  \n"
+  "  return TRUE;\n"
+  "}\n",
+  /* HELPER_MODULO */
+  "\n"
+  "/* computes l % r, @expr being \"(__ctpl_l % __ctpl_r)\" */\n"
+  "static gboolean\n"
+  "$_modulo (const CtplTokenExpr~  *expr,\n"
+  "~         const $_Scalar        *l,\n"
+  "~         const $_Scalar        *r,\n"
+  "~         $_Scalar              *result,\n"
+  "~         GError~              **error)\n"
+  "{\n"
+  "  if (l->type == CTPL_VTYPE_INT && r->type == CTPL_VTYPE_INT &&\n"
+  "      r->v_int != 0) {\n"
+  "    result->type = CTPL_VTYPE_INT;\n"
+  "    result->v_int = l->v_int % r->v_int;\n"
+  "  } else {\n"
+  "    return $_operator (expr, l, r, result, error);\n"
+  "  }\n"
+  "  \n"
+  "  return TRUE;\n"
+  "}\n",
+  /* HELPER_RELATION */
+  "\n"
+  "/* compares l and r, @mask telling which of 1 (lower), 2 (equal) and 4\n"
+  " * (greater) are true, @expr being the comparison of \"__ctpl_l\" and \"__ctpl_r\" */\n"
+  "static gboolean\n"
+  "$_relation (const CtplTokenExpr~  *expr,\n"
+  "~           const $_Scalar        *l,\n"
+  "~           const $_Scalar        *r,\n"
+  "~           guint~                 mask,\n"
+  "~           $_Scalar              *result,\n"
+  "~           GError~              **error)\n"
+  "{\n"
+  "  gint cmp;\n"
+  "  \n"
+  "  if (! $_compare (l, r, &cmp)) {\n"
+  "    return $_operator (expr, l, r, result, error);\n"
+  "  }\n"
+  "  result->type = CTPL_VTYPE_INT;\n"
+  "  result->v_int = (mask & (cmp < 0 ? 1 : cmp == 0 ? 2 : 4)) != 0;\n"
+  "  \n"
+  "  return TRUE;\n"
+  "}\n",
+  /* HELPER_AND */
+  "\n"
+  "/* computes l AND r, @expr being \"__ctpl_l\" */\n"
+  "static gboolean\n"
+  "$_and (const CtplTokenExpr~  *expr,\n"
+  "~      const $_Scalar        *l,\n"
+  "~      const $_Scalar        *r,\n"
+  "~      $_Scalar              *result,\n"
+  "~      GError~              **error)\n"
+  "{\n"
+  "  gboolean lres;\n"
+  "  gboolean rres;\n"
+  "  \n"
+  "  if (! $_test (expr, l, &lres, error) ||\n"
+  "      ! $_test (expr, r, &rres, error)) {\n"
+  "    return FALSE;\n"
+  "  }\n"
+  "  result->type = CTPL_VTYPE_INT;\n"
+  "  result->v_int = lres && rres;\n"
+  "  \n"
+  "  return TRUE;\n"
+  "}\n",
+  /* HELPER_OR */
+  "\n"
+  "/* computes l OR r, @expr being \"__ctpl_l\" */\n"
+  "static gboolean\n"
+  "$_or (const CtplTokenExpr~  *expr,\n"
+  "~     const $_Scalar        *l,\n"
+  "~     const $_Scalar        *r,\n"
+  "~     $_Scalar              *result,\n"
+  "~     GError~              **error)\n"
+  "{\n"
+  "  gboolean lres;\n"
+  "  gboolean rres;\n"
+  "  \n"
+  "  if (! $_test (expr, l, &lres, error) ||\n"
+  "      ! $_test (expr, r, &rres, error)) {\n"
+  "    return FALSE;\n"
+  "  }\n"
+  "  result->type = CTPL_VTYPE_INT;\n"
+  "  result->v_int = lres || rres;\n"
+  "  \n"
+  "  return TRUE;\n"
+  "}\n",
+};
+
+/* the helper computing each operator and the suffix of its name, in the order
+ * of #CtplOperator, with for comparisons the results (1: lower, 2: equal,
+ * 4: greater) that are true */
+static const struct {
+  Helper        helper;
+  const gchar  *suffix;
+  guint         mask;
+} operator_kernels[CTPL_OPERATOR_NONE] = {
+  { HELPER_AND,       "and",      0 }, /* AND */
+  { HELPER_DIV,       "div",      0 }, /* DIV */
+  { HELPER_RELATION,  "relation", 2 }, /* EQUAL */
+  { HELPER_RELATION,  "relation", 3 }, /* INFEQ */
+  { HELPER_RELATION,  "relation", 1 }, /* INF */
+  { HELPER_MINUS,     "minus",    0 }, /* MINUS */
+  { HELPER_MODULO,    "modulo",   0 }, /* MODULO */
+  { HELPER_MUL,       "mul",      0 }, /* MUL */
+  { HELPER_RELATION,  "relation", 5 }, /* NEQ */
+  { HELPER_OR,        "or",       0 }, /* OR */
+  { HELPER_PLUS,      "plus",     0 }, /* PLUS */
+  { HELPER_RELATION,  "relation", 6 }, /* SUPEQ */
+  { HELPER_RELATION,  "relation", 4 }  /* SUP */
+};
+
+typedef struct _Codegen Codegen;
+struct _Codegen
+{
+  const gchar  *name;
+  GString      *decls;    /* static data */
+  GString      *funcs;    /* functions computing expressions */
+  GString      *body;     /* the function's body */
+  GString      *pending;  /* constant output not written yet */
+  GPtrArray    *exprs;    /* sources of the expressions lexed at run time */
+  GHashTable   *expr_ids; /* source -> index in @exprs + 1 */
+  GHashTable   *func_ids; /* source -> index of its function + 1 */
+  GHashTable   *data_ids; /* data -> index of its array + 1 */
+  CtplEnviron  *env;      /* empty environment for folding constants */
+  guint         helpers;  /* helpers used, as HELPER_BIT()s */
+  guint         n_data;
+  guint         n_funcs;
+  guint         n_vars;
+  guint         n_loops;
+  guint         depth;
+};
+
+
+/*<standard>*/
+GQuark
+ctpl_codegen_error_quark (void)
+{
+  static GQuark error_quark = 0;
+  
+  if (G_UNLIKELY (error_quark == 0)) {
+    error_quark = g_quark_from_static_string ("CtplCodegen");
+  }
+  
+  return error_quark;
+}
+
+
+/* checks whether @name is a valid C identifier */
+static gboolean
+is_identifier (const gchar *name)
+{
+  if (! (g_ascii_isalpha (*name) || *name == '_')) {
+    return FALSE;
+  }
+  for (name++; *name; name++) {
+    if (! (g_ascii_isalnum (*name) || *name == '_')) {
+      return FALSE;
+    }
+  }
+  
+  return TRUE;
+}
+
+/* appends a line of code to the function's body, at the current depth */
+static void G_GNUC_PRINTF (2, 3)
+emit (Codegen     *cg,
+      const gchar *fmt,
+      ...)
+{
+  va_list ap;
+  guint   i;
+  
+  for (i = 0; i < cg->depth + 1; i++) {
+    g_string_append (cg->body, "  ");
+  }
+  va_start (ap, fmt);
+  g_string_append_vprintf (cg->body, fmt, ap);
+  va_end (ap);
+  g_string_append_c (cg->body, '\n');
+}
+
+/* appends @data as a C string literal, split on lines after newlines */
+static void
+append_c_string (GString      *str,
+                 const gchar  *data,
+                 gsize         length,
+                 const gchar  *line_prefix)
+{
+  gsize line_start = str->len;
+  gsize i;
+  
+  g_string_append_c (str, '"');
+  for (i = 0; i < length; i++) {
+    guchar c = (guchar)data[i];
+    
+    switch (c) {
+      case '"':   g_string_append (str, "\\\""); break;
+      case '\\':  g_string_append (str, "\\\\"); break;
+      case '?':   g_string_append (str, "\\?");  break; /* trigraphs */
+      case '\n':  g_string_append (str, "\\n");  break;
+      case '\t':  g_string_append (str, "\\t");  break;
+      default:
+        if (c < 0x20 || c >= 0x7f) {
+          g_string_append_printf (str, "\\%03o", c);
+        } else {
+          g_string_append_c (str, (gchar)c);
+        }
+    }
+    if (i + 1 < length && (c == '\n' || str->len - line_start > 72)) {
+      g_string_append_c (str, '"');
+      g_string_append_c (str, '\n');
+      line_start = str->len;
+      g_string_append (str, line_prefix);
+      g_string_append_c (str, '"');
+    }
+  }
+  g_string_append_c (str, '"');
+}
+
+/* writes the constant output gathered so far */
+static void
+flush_pending (Codegen *cg)
+{
+  if (cg->pending->len > 0) {
+    guint id;
+    
+    id = GPOINTER_TO_UINT (g_hash_table_lookup (cg->data_ids,
+                                                cg->pending->str));
+    if (id == 0) {
+      /* the same data is only stored once */
+      id = ++cg->n_data;
+      g_string_append_printf (cg->decls,
+                              "static const gchar %s_data_%u[] =\n  ",
+                              cg->name, id - 1);
+      append_c_string (cg->decls, cg->pending->str, cg->pending->len, "  ");
+      g_string_append (cg->decls, ";\n");
+      g_hash_table_insert (cg->data_ids, g_strdup (cg->pending->str),
+                           GUINT_TO_POINTER (id));
+    }
+    emit (cg, "rv = rv && ctpl_output_stream_write (output, %s_data_%u,",
+          cg->name, id - 1);
+    emit (cg, "                                     sizeof %s_data_%u - 1, "
+              "error);", cg->name, id - 1);
+    g_string_truncate (cg->pending, 0);
+  }
+}
+
+static gboolean   append_expr_source  (GString              *source,
+                                       const CtplTokenExpr  *expr,
+                                       GError              **error);
+
+/* appends the source of a literal value */
+static gboolean
+append_value_source (GString         *source,
+                     const CtplValue *value,
+                     GError         **error)
+{
+  gboolean rv = TRUE;
+  
+  switch (ctpl_value_get_held_type (value)) {
+    case CTPL_VTYPE_INT:
+      g_string_append_printf (source, "%ld", ctpl_value_get_int (value));
+      break;
+    
+    case CTPL_VTYPE_FLOAT: {
+      gchar buf[G_ASCII_DTOSTR_BUF_SIZE];
+      
+      g_ascii_dtostr (buf, sizeof buf, ctpl_value_get_float (value));
+      if (strspn (buf, "0123456789+-.e") != strlen (buf)) {
+        /* infinite or not a number */
+        g_set_error (error, CTPL_CODEGEN_ERROR, CTPL_CODEGEN_ERROR_UNSUPPORTED,
+                     _("Cannot translate number '%s'"), buf);
+        rv = FALSE;
+      } else {
+        g_string_append (source, buf);
+        if (! strpbrk (buf, ".e")) {
+          /* don't let it be read as an integer */
+          g_string_append (source, ".0");
+        }
+      }
+      break;
+    }
+    
+    case CTPL_VTYPE_STRING: {
+      const gchar *p;
+      
+      g_string_append_c (source, CTPL_STRING_DELIMITER_CHAR);
+      for (p = ctpl_value_get_string (value); *p; p++) {
+        if (*p == CTPL_STRING_DELIMITER_CHAR || *p == CTPL_ESCAPE_CHAR) {
+          g_string_append_c (source, CTPL_ESCAPE_CHAR);
+        }
+        g_string_append_c (source, *p);
+      }
+      g_string_append_c (source, CTPL_STRING_DELIMITER_CHAR);
+      break;
+    }
+    
+    default:
+      g_set_error (error, CTPL_CODEGEN_ERROR, CTPL_CODEGEN_ERROR_UNSUPPORTED,
+                   _("Cannot translate literal value of type '%s'"),
+                   ctpl_value_type_get_name (ctpl_value_get_held_type (value)));
+      rv = FALSE;
+  }
+  
+  return rv;
+}
+
+/* appends a source of @expr that the lexer reads back as @expr.  Operations
+ * are fully parenthesized so priorities don't matter */
+static gboolean
+append_expr_source (GString              *source,
+                    const CtplTokenExpr  *expr,
+                    GError              **error)
+{
+  gboolean      rv = TRUE;
+  const GSList *item;
+  
+  switch (expr->type) {
+    case CTPL_TOKEN_EXPR_TYPE_OPERATOR: {
+      const CtplTokenExprOperator *op = expr->token.t_operator;
+      
+      if (expr->indexes) {
+        g_set_error (error, CTPL_CODEGEN_ERROR, CTPL_CODEGEN_ERROR_UNSUPPORTED,
+                     _("Cannot translate indexed operation"));
+        rv = FALSE;
+      } else {
+        g_string_append_c (source, '(');
+        rv = append_expr_source (source, op->loperand, error);
+        g_string_append_printf (source, " %s ",
+                                ctpl_operator_to_string (op->operator));
+        rv = rv && append_expr_source (source, op->roperand, error);
+        g_string_append_c (source, ')');
+      }
+      break;
+    }
+    
+    case CTPL_TOKEN_EXPR_TYPE_VALUE:
+      rv = append_value_source (source, &expr->token.t_value, error);
+      break;
+    
+    case CTPL_TOKEN_EXPR_TYPE_SYMBOL:
+      g_string_append (source, expr->token.t_symbol);
+      break;
+    
+    case CTPL_TOKEN_EXPR_TYPE_FUNCTION:
+      g_string_append (source, expr->token.t_function->name);
+      g_string_append_c (source, '(');
+      for (item = expr->token.t_function->args; rv && item; item = item->next) {
+        rv = append_expr_source (source, item->data, error);
+        if (item->next) {
+          g_string_append (source, ", ");
+        }
+      }
+      g_string_append_c (source, ')');
+      break;
+  }
+  for (item = expr->indexes; rv && item; item = item->next) {
+    g_string_append_c (source, '[');
+    rv = append_expr_source (source, item->data, error);
+    g_string_append_c (source, ']');
+  }
+  
+  return rv;
+}
+
+/* checks whether @expr only depends on constants */
+static gboolean
+expr_is_constant (const CtplTokenExpr *expr)
+{
+  gboolean      constant;
+  const GSList  *item;
+  
+  switch (expr->type) {
+    case CTPL_TOKEN_EXPR_TYPE_OPERATOR:
+      constant = expr_is_constant (expr->token.t_operator->loperand) &&
+                 expr_is_constant (expr->token.t_operator->roperand);
+      break;
+    
+    case CTPL_TOKEN_EXPR_TYPE_VALUE:
+      constant = TRUE;
+      break;
+    
+    default:
+      /* symbols and functions depend on the environment */
+      constant = FALSE;
+  }
+  for (item = expr->indexes; constant && item; item = item->next) {
+    constant = expr_is_constant (item->data);
+  }
+  
+  return constant;
+}
+
+/* tries to compute the output of a constant expression and add it to the
+ * pending output.  If it fails, the expression is left for run time so it
+ * fails there */
+static gboolean
+fold_constant_write (Codegen             *cg,
+                     const CtplTokenExpr *expr)
+{
+  gboolean          rv = FALSE;
+  GOutputStream    *ostream;
+  CtplOutputStream *stream;
+  
+  if (! expr_is_constant (expr)) {
+    return FALSE;
+  }
+  ostream = g_memory_output_stream_new (NULL, 0, g_realloc, g_free);
+  stream = ctpl_output_stream_new (ostream);
+  if (ctpl_eval_write (expr, cg->env, stream, NULL) &&
+      g_output_stream_flush (ostream, NULL, NULL)) {
+    GMemoryOutputStream  *mstream = G_MEMORY_OUTPUT_STREAM (ostream);
+    gsize                 size = g_memory_output_stream_get_data_size (mstream);
+    
+    if (size <= FOLD_MAX_LENGTH) {
+      g_string_append_len (cg->pending,
+                           g_memory_output_stream_get_data (mstream),
+                           (gssize)size);
+      rv = TRUE;
+    }
+  }
+  ctpl_output_stream_unref (stream);
+  g_object_unref (ostream);
+  
+  return rv;
+}
+
+/* adds @source to the expressions lexed at run time, if it isn't yet.
+ * Returns: the index of @source in them */
+static gint
+add_source (Codegen     *cg,
+            const gchar *source)
+{
+  gint id;
+  
+  id = GPOINTER_TO_INT (g_hash_table_lookup (cg->expr_ids, source)) - 1;
+  if (id < 0) {
+    id = (gint)cg->exprs->len;
+    g_ptr_array_add (cg->exprs, g_strdup (source));
+    g_hash_table_insert (cg->expr_ids, cg->exprs->pdata[id],
+                         GINT_TO_POINTER (id + 1));
+  }
+  
+  return id;
+}
+
+/* adds @expr to the expressions lexed at run time.
+ * Returns: the index of @expr in them, or -1 on error */
+static gint
+add_expr (Codegen              *cg,
+          const CtplTokenExpr  *expr,
+          GError              **error)
+{
+  gint      id = -1;
+  GString  *source = g_string_new (NULL);
+  
+  if (append_expr_source (source, expr, error)) {
+    id = GPOINTER_TO_INT (g_hash_table_lookup (cg->expr_ids, source->str)) - 1;
+    if (id < 0) {
+      CtplTokenExpr  *relexed;
+      GString        *check = g_string_new (NULL);
+      
+      /* make sure the generated code will get the same expression */
+      relexed = ctpl_lexer_expr_lex_string (source->str, (gssize)source->len,
+                                            NULL);
+      if (! relexed || ! append_expr_source (check, relexed, NULL) ||
+          strcmp (check->str, source->str) != 0) {
+        g_set_error (error, CTPL_CODEGEN_ERROR, CTPL_CODEGEN_ERROR_UNSUPPORTED,
+                     _("Cannot translate expression '%s'"), source->str);
+      } else {
+        id = add_source (cg, source->str);
+      }
+      if (relexed) {
+        ctpl_token_expr_free (relexed);
+      }
+      g_string_free (check, TRUE);
+    }
+  }
+  g_string_free (source, TRUE);
+  
+  return id;
+}
+
+/* marks @helper and the helpers it uses as used */
+static void
+use_helper (Codegen  *cg,
+            Helper    helper)
+{
+  if (! (cg->helpers & HELPER_BIT (helper))) {
+    guint i;
+    
+    cg->helpers |= HELPER_BIT (helper);
+    for (i = 0; i < N_HELPERS; i++) {
+      if (helper_deps[helper] & HELPER_BIT (i)) {
+        use_helper (cg, i);
+      }
+    }
+  }
+}
+
+/* appends the source of a helper, see helper_sources */
+static void
+append_helper (GString     *str,
+               const gchar *name,
+               const gchar *source)
+{
+  gsize len = strlen (name);
+  
+  for (; *source; source++) {
+    switch (*source) {
+      case '$':
+        g_string_append (str, name);
+        break;
+      
+      case '~':
+        g_string_append_printf (str, "%*s", (int)len, "");
+        break;
+      
+      default:
+        g_string_append_c (str, *source);
+    }
+  }
+}
+
+/* appends the code setting the scalar of the fields @field to a literal
+ * @value, if it is a number or a string.
+ * Returns: whether @value could be written */
+static gboolean
+append_scalar_literal (GString         *code,
+                       const gchar     *field,
+                       const CtplValue *value)
+{
+  gboolean rv = TRUE;
+  
+  switch (ctpl_value_get_held_type (value)) {
+    case CTPL_VTYPE_INT: {
+      glong v = ctpl_value_get_int (value);
+      
+      g_string_append_printf (code, "  %stype = CTPL_VTYPE_INT;\n", field);
+      if (v == G_MINLONG) {
+        /* its opposite doesn't fit a long literal */
+        g_string_append_printf (code, "  %sv_int = G_MINLONG;\n", field);
+      } else {
+        g_string_append_printf (code, "  %sv_int = %ldL;\n", field, v);
+      }
+      break;
+    }
+    
+    case CTPL_VTYPE_FLOAT: {
+      gchar buf[G_ASCII_DTOSTR_BUF_SIZE];
+      
+      g_ascii_formatd (buf, sizeof buf, "%.17g", ctpl_value_get_float (value));
+      if (strspn (buf, "0123456789+-.e") != strlen (buf)) {
+        /* infinite or not a number */
+        rv = FALSE;
+      } else {
+        g_string_append_printf (code, "  %stype = CTPL_VTYPE_FLOAT;\n"
+                                      "  %sv_float = %s%s;\n",
+                                field, field, buf,
+                                strpbrk (buf, ".e") ? "" : ".0");
+      }
+      break;
+    }
+    
+    case CTPL_VTYPE_STRING: {
+      const gchar *str = ctpl_value_get_string (value);
+      gsize        len = strlen (str);
+      
+      if (len > FOLD_MAX_LENGTH) {
+        rv = FALSE;
+      } else {
+        g_string_append_printf (code, "  %stype = CTPL_VTYPE_STRING;\n"
+                                      "  %sv_string = ", field, field);
+        append_c_string (code, str, len, "    ");
+        g_string_append (code, ";\n");
+      }
+      break;
+    }
+    
+    default:
+      rv = FALSE;
+  }
+  
+  return rv;
+}
+
+/* appends to @code the code computing @expr in the slot @slot of the
+ * function of a compiled expression, or in its result if @slot is -1.
+ * Literals, symbols and operators are computed natively, the other
+ * expressions by the library */
+static gboolean
+gen_scalar (Codegen              *cg,
+            GString              *code,
+            const CtplTokenExpr  *expr,
+            gint                  slot,
+            guint                *n_slots,
+            GError              **error)
+{
+  gboolean          rv = TRUE;
+  const gchar      *name = cg->name;
+  gchar            *target;
+  gchar            *field;
+  CtplValue         folded;
+  const CtplValue  *literal = NULL;
+  
+  if (slot < 0) {
+    target = g_strdup ("result");
+    field = g_strdup ("result->");
+  } else {
+    target = g_strdup_printf ("&s[%d]", slot);
+    field = g_strdup_printf ("s[%d].", slot);
+  }
+  ctpl_value_init (&folded);
+  if (expr->type == CTPL_TOKEN_EXPR_TYPE_VALUE && ! expr->indexes) {
+    literal = &expr->token.t_value;
+  } else if (expr->type == CTPL_TOKEN_EXPR_TYPE_OPERATOR && ! expr->indexes &&
+             expr_is_constant (expr) &&
+             ctpl_eval_value (expr, cg->env, &folded, NULL)) {
+    /* if it fails, it is left for run time so it fails there */
+    literal = &folded;
+  }
+  
+  if (literal && append_scalar_literal (code, field, literal)) {
+    /* done */
+  } else if (expr->type == CTPL_TOKEN_EXPR_TYPE_SYMBOL && ! expr->indexes) {
+    /* the expression is only evaluated to report a missing symbol */
+    gint id = add_expr (cg, expr, error);
+    
+    if (id < 0) {
+      rv = FALSE;
+    } else {
+      use_helper (cg, HELPER_LOOKUP);
+      g_string_append_printf (code, "  rv = rv && %s_lookup (env, ", name);
+      append_c_string (code, expr->token.t_symbol,
+                       strlen (expr->token.t_symbol), "");
+      g_string_append_printf (code, ", %s_exprs[%d], %s, error);\n",
+                              name, id, target);
+    }
+  } else if (expr->type == CTPL_TOKEN_EXPR_TYPE_OPERATOR && ! expr->indexes) {
+    const CtplTokenExprOperator  *op = expr->token.t_operator;
+    guint                         l = (*n_slots)++;
+    guint                         r = (*n_slots)++;
+    Helper                        kernel = operator_kernels[op->operator].helper;
+    gchar                        *source;
+    
+    rv = (gen_scalar (cg, code, op->loperand, (gint)l, n_slots, error) &&
+          gen_scalar (cg, code, op->roperand, (gint)r, n_slots, error));
+    if (kernel == HELPER_AND || kernel == HELPER_OR) {
+      /* the truth value of operands that aren't handled natively */
+      source = g_strdup ("__ctpl_l");
+    } else {
+      /* the operation itself, for operands that aren't handled natively */
+      source = g_strdup_printf ("(__ctpl_l %s __ctpl_r)",
+                                ctpl_operator_to_string (op->operator));
+    }
+    use_helper (cg, kernel);
+    g_string_append_printf (code, "  rv = rv && %s_%s (%s_exprs[%d], "
+                                  "&s[%u], &s[%u], ",
+                            name, operator_kernels[op->operator].suffix,
+                            name, add_source (cg, source), l, r);
+    if (kernel == HELPER_RELATION) {
+      g_string_append_printf (code, "%u, ", operator_kernels[op->operator].mask);
+    }
+    g_string_append_printf (code, "%s, error);\n", target);
+    g_free (source);
+  } else {
+    gint id = add_expr (cg, expr, error);
+    
+    if (id < 0) {
+      rv = FALSE;
+    } else {
+      use_helper (cg, HELPER_EVAL);
+      g_string_append_printf (code, "  rv = rv && %s_eval (env, %s_exprs[%d], "
+                                    "%s, error);\n", name, name, id, target);
+    }
+  }
+  ctpl_value_free_value (&folded);
+  g_free (field);
+  g_free (target);
+  
+  return rv;
+}
+
+/* generates the function computing the operation @expr natively.
+ * Returns: the index of the function, or -1 on error */
+static gint
+gen_expr_func (Codegen              *cg,
+               const CtplTokenExpr  *expr,
+               GError              **error)
+{
+  gint      id = -1;
+  GString  *source = g_string_new (NULL);
+  
+  if (append_expr_source (source, expr, error)) {
+    id = GPOINTER_TO_INT (g_hash_table_lookup (cg->func_ids, source->str)) - 1;
+    if (id < 0) {
+      GString  *code = g_string_new (NULL);
+      guint     n_slots = 0;
+      
+      if (gen_scalar (cg, code, expr, -1, &n_slots, error)) {
+        const gchar  *name = cg->name;
+        gchar        *scalar = g_strdup_printf ("%s_Scalar", name);
+        gchar        *func;
+        gint          width = (gint)MAX (strlen (scalar), strlen ("CtplEnviron"));
+        
+        id = (gint)cg->n_funcs++;
+        func = g_strdup_printf ("%s_expr_%d", name, id);
+        g_string_append_c (cg->funcs, '\n');
+        if (! strstr (source->str, "*/")) {
+          g_string_append_printf (cg->funcs, "/* %s */\n", source->str);
+        }
+        g_string_append_printf (cg->funcs,
+          "static gboolean\n"
+          "%s (%-*s  *env,\n"
+          "%*s %-*s  *result,\n"
+          "%*s %-*s **error)\n"
+          "{\n"
+          "  %s s[%u];\n"
+          "  %-*s rv = TRUE;\n"
+          "  \n"
+          "  %s_scalars_init (s, G_N_ELEMENTS (s));\n"
+          "%s"
+          "  %s_scalars_clear (s, G_N_ELEMENTS (s));\n"
+          "  \n"
+          "  return rv;\n"
+          "}\n",
+          func, width, "CtplEnviron",
+          (int)strlen (func) + 1, "", width, scalar,
+          (int)strlen (func) + 1, "", width, "GError",
+          scalar, n_slots,
+          (int)strlen (scalar), "gboolean",
+          name, code->str, name);
+        g_hash_table_insert (cg->func_ids, g_strdup (source->str),
+                             GINT_TO_POINTER (id + 1));
+        g_free (func);
+        g_free (scalar);
+      }
+      g_string_free (code, TRUE);
+    }
+  }
+  g_string_free (source, TRUE);
+  
+  return id;
+}
+
+/* checks whether @expr is computed by a function generated for it */
+static gboolean
+expr_is_native (const CtplTokenExpr *expr)
+{
+  return expr->type == CTPL_TOKEN_EXPR_TYPE_OPERATOR && ! expr->indexes;
+}
+
+/* checks whether @expr is only a symbol, read directly from the environment */
+static gboolean
+expr_is_symbol (const CtplTokenExpr *expr)
+{
+  return expr->type == CTPL_TOKEN_EXPR_TYPE_SYMBOL && ! expr->indexes;
+}
+
+/* generates the code writing @expr */
+static gboolean
+gen_write (Codegen              *cg,
+           const CtplTokenExpr  *expr,
+           GError              **error)
+{
+  gboolean  rv = TRUE;
+  gint      id;
+  
+  if (expr_is_native (expr)) {
+    id = gen_expr_func (cg, expr, error);
+    if (id < 0) {
+      rv = FALSE;
+    } else {
+      guint var = cg->n_vars++;
+      
+      use_helper (cg, HELPER_WRITE);
+      flush_pending (cg);
+      emit (cg, "if (rv) {");
+      emit (cg, "  %s_Scalar value_%u;", cg->name, var);
+      emit (cg, "  ");
+      emit (cg, "  %s_scalars_init (&value_%u, 1);", cg->name, var);
+      emit (cg, "  rv = (%s_expr_%d (env, &value_%u, error) &&",
+            cg->name, id, var);
+      emit (cg, "        %s_write (output, &value_%u, error));", cg->name, var);
+      emit (cg, "  %s_scalars_clear (&value_%u, 1);", cg->name, var);
+      emit (cg, "}");
+    }
+  } else {
+    id = add_expr (cg, expr, error);
+    if (id < 0) {
+      rv = FALSE;
+    } else if (expr_is_symbol (expr)) {
+      GString *symbol = g_string_new (NULL);
+      
+      append_c_string (symbol, expr->token.t_symbol,
+                       strlen (expr->token.t_symbol), "");
+      use_helper (cg, HELPER_WRITE_SYMBOL);
+      flush_pending (cg);
+      emit (cg, "rv = rv && %s_write_symbol (env, %s, %s_exprs[%d], output, "
+                "error);", cg->name, symbol->str, cg->name, id);
+      g_string_free (symbol, TRUE);
+    } else {
+      use_helper (cg, HELPER_WRITE_EVAL);
+      flush_pending (cg);
+      emit (cg, "rv = rv && %s_write_eval (env, %s_exprs[%d], output, error);",
+            cg->name, cg->name, id);
+    }
+  }
+  
+  return rv;
+}
+
+/* generates the code setting the variable cond_@var to the truth value of
+ * @expr, in a block starting with its declaration */
+static gboolean
+gen_test (Codegen              *cg,
+          const CtplTokenExpr  *expr,
+          guint                 var,
+          GError              **error)
+{
+  gboolean  rv = TRUE;
+  gint      id;
+  
+  if (expr_is_native (expr)) {
+    id = gen_expr_func (cg, expr, error);
+    if (id < 0) {
+      rv = FALSE;
+    } else {
+      use_helper (cg, HELPER_TEST);
+      emit (cg, "  %s_Scalar value_%u;", cg->name, var);
+      emit (cg, "  gboolean%*scond_%u;", (int)strlen (cg->name), "", var);
+      emit (cg, "  ");
+      emit (cg, "  %s_scalars_init (&value_%u, 1);", cg->name, var);
+      emit (cg, "  rv = (%s_expr_%d (env, &value_%u, error) &&",
+            cg->name, id, var);
+      emit (cg, "        %s_test (%s_exprs[%d], &value_%u, &cond_%u, "
+                "error));", cg->name, cg->name, add_source (cg, "__ctpl_l"),
+            var, var);
+      emit (cg, "  %s_scalars_clear (&value_%u, 1);", cg->name, var);
+    }
+  } else {
+    id = add_expr (cg, expr, error);
+    if (id < 0) {
+      rv = FALSE;
+    } else {
+      emit (cg, "  gboolean cond_%u;", var);
+      emit (cg, "  ");
+      if (expr_is_symbol (expr)) {
+        GString *symbol = g_string_new (NULL);
+        
+        append_c_string (symbol, expr->token.t_symbol,
+                         strlen (expr->token.t_symbol), "");
+        use_helper (cg, HELPER_TEST_SYMBOL);
+        emit (cg, "  rv = %s_test_symbol (env, %s, %s_exprs[%d], &cond_%u, "
+                  "error);", cg->name, symbol->str, cg->name, id, var);
+        g_string_free (symbol, TRUE);
+      } else {
+        emit (cg, "  rv = ctpl_eval_bool (%s_exprs[%d], env, &cond_%u, error);",
+              cg->name, id, var);
+      }
+    }
+  }
+  
+  return rv;
+}
+
+static gboolean   gen_tree  (Codegen          *cg,
+                             const CtplToken  *tree,
+                             GError          **error);
+
+/* generates a nested tree, ending with the output it holds */
+static gboolean
+gen_block (Codegen         *cg,
+           const CtplToken *tree,
+           GError         **error)
+{
+  gboolean rv;
+  
+  cg->depth++;
+  rv = gen_tree (cg, tree, error);
+  flush_pending (cg);
+  cg->depth--;
+  
+  return rv;
+}
+
+/* generates an `if` statement */
+static gboolean
+gen_if (Codegen            *cg,
+        const CtplTokenIf  *token,
+        GError            **error)
+{
+  gboolean  rv = TRUE;
+  gboolean  eval;
+  
+  if (expr_is_constant (token->condition) &&
+      ctpl_eval_bool (token->condition, cg->env, &eval, NULL)) {
+    /* only the taken branch remains */
+    rv = gen_tree (cg, eval ? token->if_children : token->else_children,
+                   error);
+  } else {
+    guint var = cg->n_vars++;
+    
+    flush_pending (cg);
+    emit (cg, "if (rv) {");
+    rv = gen_test (cg, token->condition, var, error);
+    if (rv) {
+      emit (cg, "  if (rv && cond_%u) {", var);
+      cg->depth++;
+      rv = gen_block (cg, token->if_children, error);
+      if (rv && token->else_children) {
+        emit (cg, "} else if (rv) {");
+        rv = gen_block (cg, token->else_children, error);
+      }
+      emit (cg, "}");
+      cg->depth--;
+    }
+    emit (cg, "}");
+  }
+  
+  return rv;
+}
+
+/* generates a `for` statement */
+static gboolean
+gen_for (Codegen            *cg,
+         const CtplTokenFor *token,
+         GError            **error)
+{
+  gboolean  rv = TRUE;
+  gint      id = add_expr (cg, token->array, error);
+  guint     var = cg->n_vars++;
+  GString  *iter = g_string_new (NULL);
+  
+  if (id < 0) {
+    rv = FALSE;
+  } else {
+    append_c_string (iter, token->iter, strlen (token->iter), "");
+    flush_pending (cg);
+    emit (cg, "if (rv) {");
+    emit (cg, "  CtplValue         array_%u;", var);
+    emit (cg, "  CtplValue         item_%u;", var);
+    emit (cg, "  const GSList     *items_%u = NULL;", var);
+    emit (cg, "  const CtplValue  *iter_%u;", var);
+    emit (cg, "  ");
+    emit (cg, "  ctpl_value_init (&array_%u);", var);
+    emit (cg, "  ctpl_value_init (&item_%u);", var);
+    emit (cg, "  rv = (ctpl_eval_value (%s_exprs[%d], env, &array_%u, error) &&",
+          cg->name, id, var);
+    emit (cg, "        %s_loop_start (&array_%u, &items_%u, error));",
+          cg->name, var, var);
+    emit (cg, "  while (rv &&");
+    emit (cg, "         (iter_%u = %s_loop_next (&array_%u, &items_%u, &item_%u))) {",
+          var, cg->name, var, var, var);
+    emit (cg, "    ctpl_environ_push (env, %s, iter_%u);", iter->str, var);
+    cg->depth++;
+    rv = gen_block (cg, token->children, error);
+    cg->depth--;
+    emit (cg, "    ctpl_environ_pop (env, %s, NULL);", iter->str);
+    emit (cg, "  }");
+    emit (cg, "  ctpl_value_free_value (&item_%u);", var);
+    emit (cg, "  ctpl_value_free_value (&array_%u);", var);
+    emit (cg, "}");
+    cg->n_loops++;
+  }
+  g_string_free (iter, TRUE);
+  
+  return rv;
+}
+
+/* generates the code of a token list */
+static gboolean
+gen_tree (Codegen          *cg,
+          const CtplToken  *tree,
+          GError          **error)
+{
+  gboolean rv = TRUE;
+  
+  for (; rv && tree; tree = tree->next) {
+    switch (tree->type) {
+      case CTPL_TOKEN_TYPE_DATA:
+        g_string_append (cg->pending, tree->token.t_data);
+        break;
+      
+      case CTPL_TOKEN_TYPE_FOR:
+        rv = gen_for (cg, tree->token.t_for, error);
+        break;
+      
+      case CTPL_TOKEN_TYPE_IF:
+        rv = gen_if (cg, tree->token.t_if, error);
+        break;
+      
+      case CTPL_TOKEN_TYPE_EXPR:
+        if (! fold_constant_write (cg, tree->token.t_expr)) {
+          rv = gen_write (cg, tree->token.t_expr, error);
+        }
+        break;
+    }
+  }
+  
+  return rv;
+}
+
+/* writes the whole source file of the function */
+static void
+write_source (Codegen *cg,
+              GString *source)
+{
+  const gchar  *name = cg->name;
+  gboolean      scratch = (cg->helpers & (HELPER_BIT (HELPER_OPERATOR) |
+                                          HELPER_BIT (HELPER_TEST))) != 0;
+  guint         i;
+  
+  g_string_append (source,
+    "/* Generated by ctpl_codegen_write(), do not edit. */\n"
+    "\n"
+    "#include <string.h>\n"
+    "#include <glib.h>\n"
+    "#include <ctpl/ctpl.h>\n"
+    "\n"
+    "\n");
+  g_string_append_printf (source,
+    "gboolean %s (CtplEnviron       *env,\n"
+    "%*s CtplOutputStream  *output,\n"
+    "%*s GError           **error);\n"
+    "\n",
+    name, (int)strlen (name) + 10, "", (int)strlen (name) + 10, "");
+  g_string_append (source, cg->decls->str);
+  if (cg->exprs->len > 0) {
+    g_string_append_printf (source,
+      "\n"
+      "static CtplTokenExpr *%s_exprs[%u];\n",
+      name, cg->exprs->len);
+    if (scratch) {
+      /* the fallbacks to the library bind their operands there rather than in
+       * the caller's environ, which they must not change */
+      g_string_append_printf (source,
+        "static CtplEnviron   *%s_scratch;\n"
+        "G_LOCK_DEFINE_STATIC (%s_scratch);\n",
+        name, name);
+    }
+    g_string_append_printf (source,
+      "\n"
+      "static gpointer\n"
+      "%s_init (gpointer data)\n"
+      "{\n"
+      "  static const gchar *const sources[%u] = {\n",
+      name, cg->exprs->len);
+    for (i = 0; i < cg->exprs->len; i++) {
+      const gchar *expr = cg->exprs->pdata[i];
+      
+      g_string_append (source, "    ");
+      append_c_string (source, expr, strlen (expr), "    ");
+      g_string_append (source, ",\n");
+    }
+    g_string_append_printf (source,
+      "  };\n"
+      "  guint i;\n"
+      "  \n"
+      "  for (i = 0; i < G_N_ELEMENTS (sources); i++) {\n"
+      "    %s_exprs[i] = ctpl_lexer_expr_lex_string (sources[i], -1, NULL);\n"
+      "  }\n",
+      name);
+    if (scratch) {
+      g_string_append_printf (source,
+        "  %s_scratch = ctpl_environ_new ();\n",
+        name);
+    }
+    g_string_append (source,
+      "  \n"
+      "  return NULL;\n"
+      "}\n");
+  }
+  for (i = 0; i < N_HELPERS; i++) {
+    if (cg->helpers & HELPER_BIT (i)) {
+      append_helper (source, name, helper_sources[i]);
+    }
+  }
+  g_string_append (source, cg->funcs->str);
+  if (cg->n_loops > 0) {
+    g_string_append_printf (source,
+      "\n"
+      "static gboolean\n"
+      "%s_loop_start (const CtplValue  *array,\n"
+      "%*s const GSList    **items,\n"
+      "%*s GError          **error)\n"
+      "{\n"
+      "  if (CTPL_VALUE_HOLDS_ITERATOR (array)) {\n"
+      "    ctpl_value_iterator_reset (array);\n"
+      "  } else if (CTPL_VALUE_HOLDS_ARRAY (array)) {\n"
+      "    *items = ctpl_value_get_array (array);\n"
+      "  } else {\n"
+      "    gchar *str = ctpl_value_to_string (array);\n"
+      "    \n"
+      "    g_set_error (error, CTPL_PARSER_ERROR,\n"
+      "                 CTPL_PARSER_ERROR_INCOMPATIBLE_SYMBOL,\n"
+      "                 \"Cannot iterate over value '%%s'\", str);\n"
+      "    g_free (str);\n"
+      "    return FALSE;\n"
+      "  }\n"
+      "  \n"
+      "  return TRUE;\n"
+      "}\n"
+      "\n"
+      "static const CtplValue *\n"
+      "%s_loop_next (const CtplValue  *array,\n"
+      "%*s const GSList    **items,\n"
+      "%*s CtplValue        *item)\n"
+      "{\n"
+      "  const CtplValue *next = NULL;\n"
+      "  \n"
+      "  if (CTPL_VALUE_HOLDS_ITERATOR (array)) {\n"
+      "    if (ctpl_value_iterator_next (array, item)) {\n"
+      "      next = item;\n"
+      "    }\n"
+      "  } else if (*items) {\n"
+      "    next = (*items)->data;\n"
+      "    *items = (*items)->next;\n"
+      "  }\n"
+      "  \n"
+      "  return next;\n"
+      "}\n",
+      name, (int)strlen (name) + 12, "", (int)strlen (name) + 12, "",
+      name, (int)strlen (name) + 11, "", (int)strlen (name) + 11, "");
+  }
+  g_string_append_printf (source,
+    "\n"
+    "gboolean\n"
+    "%s (CtplEnviron       *env,\n"
+    "%*s CtplOutputStream  *output,\n"
+    "%*s GError           **error)\n"
+    "{\n",
+    name, (int)strlen (name) + 1, "", (int)strlen (name) + 1, "");
+  if (cg->exprs->len > 0) {
+    g_string_append (source, "  static GOnce once = G_ONCE_INIT;\n");
+  }
+  g_string_append (source,
+    "  gboolean rv = TRUE;\n"
+    "  \n");
+  if (cg->exprs->len > 0) {
+    g_string_append_printf (source,
+      "  g_once (&once, %s_init, NULL);\n", name);
+  }
+  g_string_append (source, cg->body->str);
+  g_string_append (source,
+    "  \n"
+    "  return rv;\n"
+    "}\n");
+}
+
+/**
+ * ctpl_codegen_write:
+ * @tree: A #CtplToken holding the template
+ * @name: The name of the function to generate
+ * @output: A #CtplOutputStream where write the C source
+ * @error: Return location for errors, or %NULL to ignore them
+ * 
+ * Writes the C source of a function named @name rendering @tree.
+ * See the <link linkend="ctpl-codegen.description">description</link> of this
+ * section for details on the generated function.
+ * 
+ * Returns: %TRUE on success, %FALSE otherwise.
+ * 
+ * Since: 0.4
+ */
+gboolean
+ctpl_codegen_write (const CtplToken   *tree,
+                    const gchar       *name,
+                    CtplOutputStream  *output,
+                    GError           **error)
+{
+  gboolean  rv = FALSE;
+  Codegen   cg;
+  
+  if (! is_identifier (name)) {
+    g_set_error (error, CTPL_CODEGEN_ERROR, CTPL_CODEGEN_ERROR_INVALID_NAME,
+                 _("Invalid function name '%s'"), name);
+    return FALSE;
+  }
+  cg.name = name;
+  cg.decls = g_string_new (NULL);
+  cg.funcs = g_string_new (NULL);
+  cg.body = g_string_new (NULL);
+  cg.pending = g_string_new (NULL);
+  cg.exprs = g_ptr_array_new_with_free_func (g_free);
+  cg.expr_ids = g_hash_table_new (g_str_hash, g_str_equal);
+  cg.func_ids = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  cg.data_ids = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  cg.env = ctpl_environ_new ();
+  cg.helpers = 0;
+  cg.n_data = 0;
+  cg.n_funcs = 0;
+  cg.n_vars = 0;
+  cg.n_loops = 0;
+  cg.depth = 0;
+  if (gen_tree (&cg, tree, error)) {
+    GString *source = g_string_new (NULL);
+    
+    flush_pending (&cg);
+    write_source (&cg, source);
+    rv = ctpl_output_stream_write (output, source->str, (gssize)source->len,
+                                   error);
+    g_string_free (source, TRUE);
+  }
+  ctpl_environ_unref (cg.env);
+  g_hash_table_destroy (cg.data_ids);
+  g_hash_table_destroy (cg.func_ids);
+  g_hash_table_destroy (cg.expr_ids);
+  g_ptr_array_free (cg.exprs, TRUE);
+  g_string_free (cg.pending, TRUE);
+  g_string_free (cg.body, TRUE);
+  g_string_free (cg.funcs, TRUE);
+  g_string_free (cg.decls, TRUE);
+  
+  return rv;
+}
@@ -0,0 +1,73 @@
+/* 
+ * 
+ * Copyright (C) 2009-2011 Colomban Wendling <ban@herbesfolles.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ */
+#if ! defined (H_CTPL_H_INSIDE) && ! defined (CTPL_COMPILATION)
+# error "Only <ctpl/ctpl.h> can be included directly."
+#endif
+
+#ifndef H_CTPL_CODEGEN_H
+#define H_CTPL_CODEGEN_H
+
+#include <glib.h>
+#include "ctpl-token.h"
+#include "ctpl-output-stream.h"
+
+G_BEGIN_DECLS
+
+
+/**
+ * CTPL_CODEGEN_ERROR:
+ * 
+ * Error domain of CtplCodegen.
+ * 
+ * Since: 0.4
+ */
+#define CTPL_CODEGEN_ERROR  (ctpl_codegen_error_quark ())
+
+/**
+ * CtplCodegenError:
+ * @CTPL_CODEGEN_ERROR_INVALID_NAME: The function name is not a valid C
+ *                                   identifier.
+ * @CTPL_CODEGEN_ERROR_UNSUPPORTED: The template holds something that cannot be
+ *                                  translated to C.
+ * @CTPL_CODEGEN_ERROR_FAILED: An error occurred without any precision on what
+ *                             failed.
+ * 
+ * Error codes that code generation functions can throw, from the
+ * %CTPL_CODEGEN_ERROR domain.
+ * 
+ * Since: 0.4
+ */
+typedef enum _CtplCodegenError
+{
+  CTPL_CODEGEN_ERROR_INVALID_NAME,
+  CTPL_CODEGEN_ERROR_UNSUPPORTED,
+  CTPL_CODEGEN_ERROR_FAILED
+} CtplCodegenError;
+
+
+GQuark    ctpl_codegen_error_quark  (void) G_GNUC_CONST;
+gboolean  ctpl_codegen_write        (const CtplToken   *tree,
+                                     const gchar       *name,
+                                     CtplOutputStream  *output,
+                                     GError           **error);
+
+
+G_END_DECLS
+
+#endif /* guard */
@@ -0,0 +1,81 @@
+/* 
+ * 
+ * Copyright (C) 2009-2011 Colomban Wendling <ban@herbesfolles.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ */
+
+#ifndef H_CTPL_ENVIRON_PRIVATE_H
+#define H_CTPL_ENVIRON_PRIVATE_H
+
+#include <glib.h>
+#include "ctpl-environ.h"
+#include "ctpl-value.h"
+#include "ctpl-arena.h"
+
+G_BEGIN_DECLS
+
+
+/*
+ * SECTION: environ-private
+ * @short_description: Private environment API
+ * @include: ctpl/environ-private.h
+ * 
+ * Environment internals used by the evaluator and the renderers.
+ */
+
+
+G_GNUC_INTERNAL
+gboolean      ctpl_environ_lookup_function      (const CtplEnviron    *env,
+                                                 const gchar          *name,
+                                                 CtplEnvironFunction  *func,
+                                                 gpointer             *user_data);
+G_GNUC_INTERNAL
+gboolean      ctpl_environ_value_is_transient   (const CtplEnviron *env,
+                                                 const CtplValue   *value);
+G_GNUC_INTERNAL
+gboolean      ctpl_environ_symbol_is_stable     (const CtplEnviron *env,
+                                                 const gchar       *symbol);
+G_GNUC_INTERNAL
+void          ctpl_environ_begin_render         (CtplEnviron *env);
+G_GNUC_INTERNAL
+void          ctpl_environ_end_render           (CtplEnviron *env);
+G_GNUC_INTERNAL
+void          ctpl_environ_begin_step           (CtplEnviron *env);
+G_GNUC_INTERNAL
+void          ctpl_environ_end_step             (CtplEnviron *env);
+G_GNUC_INTERNAL
+guint         ctpl_environ_suspend_steps        (CtplEnviron *env);
+G_GNUC_INTERNAL
+void          ctpl_environ_resume_steps         (CtplEnviron *env,
+                                                 guint        n_steps);
+G_GNUC_INTERNAL
+CtplArena    *ctpl_environ_get_arena            (const CtplEnviron *env);
+G_GNUC_INTERNAL
+void          ctpl_environ_set_arena            (CtplEnviron *env,
+                                                 CtplArena   *arena);
+G_GNUC_INTERNAL
+void          ctpl_environ_log_changes          (CtplEnviron *env,
+                                                 gboolean     log);
+G_GNUC_INTERNAL
+guint         ctpl_environ_get_changes          (const CtplEnviron  *env,
+                                                 guint               serial,
+                                                 GPtrArray          *symbols,
+                                                 gboolean           *all);
+
+
+G_END_DECLS
+
+#endif /* guard */
@@ -18,10 +18,14 @@
  */
 
 #include "ctpl-environ.h"
+#include "ctpl-environ-private.h"
 #include <glib.h>
+#include <string.h>
+#include "ctpl-arena-private.h"
 #include "ctpl-i18n.h"
 #include "ctpl-stack.h"
 #include "ctpl-value.h"
+#include "ctpl-value-private.h"
 
 
 /**
@@ -60,12 +64,67 @@
  * <code>SYMBOL = VALUE;</code> and can contain comments. Comments start with a
  * <code>#</code> (number sign) and end at the next line ending.
  * 
+ * An environment can also be saved as a binary snapshot using
+ * ctpl_environ_write_snapshot(), and loaded back with
+ * ctpl_environ_add_from_snapshot().  Loading a snapshot is very fast even for
+ * huge environments, since symbols are only read when they are used.
+ * 
+ * Symbols can also be computed only when a template uses them, by setting a
+ * resolver with ctpl_environ_set_resolver().
+ * 
+ * An environment also holds the functions templates can call besides the
+ * built-in ones, see ctpl_environ_add_function().
+ * 
+ * ctpl_environ_get_fingerprint() gives a hash of the content of an environment
+ * that only hashes again the symbols changed since it was last computed, which
+ * makes it cheap to tell whether a rendering would have the same input as a
+ * previous one.
+ * 
  * For more details, see the
  * <link linkend="environment-description-syntax">environment description
  * syntax</link>.
  */
 
 
+/* initial number of slots of a symbol table, a power of 2 */
+#define SYMBOL_TABLE_MIN_SLOTS  16
+/* number of changed symbols tracked for the fingerprint past which it is
+ * simply computed again from all the symbols */
+#define FINGERPRINT_MAX_DIRTY 64
+
+
+/* a symbol of an environ, allocated along with its name */
+typedef struct _CtplSymbol CtplSymbol;
+struct _CtplSymbol
+{
+  CtplStack stack;    /* values of the symbol */
+  guint32   hash;     /* hash of @name */
+  gchar     name[1];  /* actually as long as the name */
+};
+
+/*
+ * CtplSymbolTable:
+ * 
+ * The symbols of an environ.  Unlike a #GHashTable, it can be sized ahead for
+ * the symbols about to be added, and finding a symbol to add it if missing
+ * takes a single probe, which matters when loading big descriptions.  Symbols
+ * are only removed all at once, so they are allocated in bulk.
+ */
+typedef struct _CtplSymbolTable CtplSymbolTable;
+struct _CtplSymbolTable
+{
+  GPtrArray  *symbols;  /* CtplSymbol, in the order they were added */
+  guint64    *slots;    /* open addressing index of @symbols: the hash of a
+                         * symbol in the high half and its index + 1 in the
+                         * low one, or 0 for a free slot */
+  gsize       n_slots;  /* size of @slots, a power of 2 */
+  CtplArena  *arena;    /* memory of the symbols, and of the values loaded
+                         * from descriptions */
+  GSList     *arenas;   /* arenas of other tables, holding values of symbols
+                         * stolen from them */
+};
+
+
 /**
  * CtplEnviron:
  * 
@@ -74,11 +133,73 @@
 struct _CtplEnviron
 {
   /*<private>*/
-  gint            ref_count;
-  GHashTable     *symbol_table; /* hash table containing stacks of symbols */
+  gint                    ref_count;
+  CtplSymbolTable         symbol_table;   /* stacks of symbols, by name */
+  GVariant               *snapshot;       /* symbols not yet loaded from a
+                                           * snapshot */
+  
+  /* resolver for symbols that cannot be found */
+  CtplEnvironResolveFunc  resolver;
+  gpointer                resolver_data;
+  GDestroyNotify          resolver_destroy;
+  gboolean                resolver_memoize;
+  GHashTable             *resolved;       /* memoized resolved values, kept
+                                           * until the end of the render */
+  CtplValue              *last_resolved;  /* last non-memoized resolved value */
+  
+  GHashTable             *functions;      /* host functions, by name */
+  
+  CtplArena              *arena;          /* scratch memory of the current
+                                           * rendering, if any */
+  guint                   n_renders;      /* renders in progress */
+  guint                   n_steps;        /* render steps running, not
+                                           * counting host code they call */
+  
+  guint64                 fingerprint;    /* sum of the hashes of the topmost
+                                           * values of loaded symbols, but the
+                                           * ones of @dirty */
+  GHashTable             *dirty;          /* symbol -> its hash included in
+                                           * @fingerprint, for the symbols
+                                           * changed since it was computed */
+  gboolean                stale;          /* whether too many symbols changed
+                                           * to track them in @dirty, and
+                                           * @fingerprint must be computed
+                                           * again from all the symbols */
+  
+  /* log of the changed symbols, while something uses it */
+  guint                   n_change_logs;
+  guint                   change_serial;  /* serial of the last change */
+  guint                   reset_serial;   /* serial of the last change that may
+                                           * affect any symbol */
+  GHashTable             *changes;        /* symbol -> link in @change_log */
+  GQueue                  change_log;     /* CtplEnvironChange, latest first */
+};
+
+/* the last change of a symbol */
+typedef struct _CtplEnvironChange CtplEnvironChange;
+struct _CtplEnvironChange
+{
+  gchar  *symbol;
+  guint   serial;
+};
+
+/* a function added with ctpl_environ_add_function() */
+typedef struct _CtplEnvironFunctionEntry CtplEnvironFunctionEntry;
+struct _CtplEnvironFunctionEntry
+{
+  CtplEnvironFunction func;
+  gpointer            user_data;
+  GDestroyNotify      destroy;
 };
 
 
+static CtplStack *snapshot_load_symbol    (CtplEnviron *env,
+                                           const gchar *symbol);
+static void       snapshot_load_all       (CtplEnviron *env);
+static CtplValue *resolve_symbol          (CtplEnviron *env,
+                                           const gchar *symbol);
+
+
 /*<standard>*/
 GQuark
 ctpl_environ_error_quark (void)
@@ -93,9 +214,390 @@ ctpl_environ_error_quark (void)
 }
 
 static void
-free_stack (void *stack)
+free_hash (void *hash)
+{
+  g_slice_free1 (sizeof (guint64), hash);
+}
+
+static void
+symbol_table_init (CtplSymbolTable *table)
+{
+  table->symbols = g_ptr_array_new ();
+  table->slots = g_new0 (guint64, SYMBOL_TABLE_MIN_SLOTS);
+  table->n_slots = SYMBOL_TABLE_MIN_SLOTS;
+  table->arena = ctpl_arena_new ();
+  table->arenas = NULL;
+}
+
+/* frees the symbols of @table, and the memory it uses */
+static void
+symbol_table_free (CtplSymbolTable *table)
+{
+  guint i;
+  
+  for (i = 0; i < table->symbols->len; i++) {
+    CtplSymbol *symbol = g_ptr_array_index (table->symbols, i);
+    
+    ctpl_stack_clear (&symbol->stack, (GFreeFunc) ctpl_value_free);
+  }
+  g_ptr_array_free (table->symbols, TRUE);
+  g_free (table->slots);
+  ctpl_arena_unref (table->arena);
+  g_slist_foreach (table->arenas, (GFunc) ctpl_arena_unref, NULL);
+  g_slist_free (table->arenas);
+}
+
+/* hashes the symbol name @name, and gets its length */
+static guint32
+symbol_name_hash (const gchar *name,
+                  gsize       *length)
+{
+  const gchar  *p;
+  guint32       hash = 5381;
+  
+  for (p = name; *p; p++) {
+    hash = hash * 33 + (guchar) *p;
+  }
+  *length = (gsize) (p - name);
+  
+  return hash;
+}
+
+/* first slot where to look for a symbol of hash @hash.  The hash is mixed so
+ * that similar names don't end up in neighbouring slots */
+static gsize
+symbol_table_first_slot (const CtplSymbolTable *table,
+                         guint32                hash)
+{
+  guint64 mixed = hash * G_GUINT64_CONSTANT (0x9e3779b97f4a7c15);
+  
+  return (gsize) (mixed >> 32) & (table->n_slots - 1);
+}
+
+/* finds the slot of the symbol @name in @table, or the free slot where it
+ * would go */
+static gsize
+symbol_table_find_slot (const CtplSymbolTable *table,
+                        const gchar           *name,
+                        guint32                hash)
+{
+  gsize slot = symbol_table_first_slot (table, hash);
+  
+  while (table->slots[slot]) {
+    if ((guint32) (table->slots[slot] >> 32) == hash) {
+      guint       index = (guint) (table->slots[slot] & G_MAXUINT32) - 1;
+      CtplSymbol *symbol = g_ptr_array_index (table->symbols, index);
+      
+      if (strcmp (symbol->name, name) == 0) {
+        break;
+      }
+    }
+    slot = (slot + 1) & (table->n_slots - 1);
+  }
+  
+  return slot;
+}
+
+/* makes room in @table for @n_symbols more symbols, keeping it at most 3/4
+ * full so that probes stay short */
+static void
+symbol_table_reserve (CtplSymbolTable *table,
+                      gsize            n_symbols)
+{
+  gsize n_needed  = table->symbols->len + n_symbols;
+  gsize n_slots   = table->n_slots;
+  
+  while (n_slots / 4 * 3 < n_needed) {
+    n_slots *= 2;
+  }
+  if (n_slots != table->n_slots) {
+    guint i;
+    
+    g_free (table->slots);
+    table->slots = g_new0 (guint64, n_slots);
+    table->n_slots = n_slots;
+    for (i = 0; i < table->symbols->len; i++) {
+      CtplSymbol *symbol = g_ptr_array_index (table->symbols, i);
+      gsize       slot = symbol_table_first_slot (table, symbol->hash);
+      
+      while (table->slots[slot]) {
+        slot = (slot + 1) & (n_slots - 1);
+      }
+      table->slots[slot] = ((guint64) symbol->hash << 32) | (i + 1);
+    }
+  }
+}
+
+/* starts fetching the memory where the symbol @name would be in @table, so
+ * that looking it up after some other work doesn't wait for it */
+static void
+symbol_table_prefetch (const CtplSymbolTable *table,
+                       const gchar           *name)
+{
+#if defined (__GNUC__)
+  gsize   length;
+  guint32 hash = symbol_name_hash (name, &length);
+  
+  __builtin_prefetch (&table->slots[symbol_table_first_slot (table, hash)]);
+#endif
+}
+
+/* gets the symbol @name of @table, or %NULL if there is none */
+static CtplSymbol *
+symbol_table_lookup (const CtplSymbolTable *table,
+                     const gchar           *name)
+{
+  gsize   length;
+  guint32 hash = symbol_name_hash (name, &length);
+  gsize   slot = symbol_table_find_slot (table, name, hash);
+  
+  if (! table->slots[slot]) {
+    return NULL;
+  }
+  
+  return g_ptr_array_index (table->symbols,
+                            (guint) (table->slots[slot] & G_MAXUINT32) - 1);
+}
+
+/* gets the symbol @name of @table, adding it with an empty stack if there is
+ * none */
+static CtplSymbol *
+symbol_table_add (CtplSymbolTable *table,
+                  const gchar     *name)
+{
+  gsize       length;
+  guint32     hash = symbol_name_hash (name, &length);
+  gsize       slot = symbol_table_find_slot (table, name, hash);
+  CtplSymbol *symbol;
+  
+  if (table->slots[slot]) {
+    return g_ptr_array_index (table->symbols,
+                              (guint) (table->slots[slot] & G_MAXUINT32) - 1);
+  }
+  if (table->symbols->len >= table->n_slots / 4 * 3) {
+    symbol_table_reserve (table, 1);
+    slot = symbol_table_find_slot (table, name, hash);
+  }
+  symbol = ctpl_arena_alloc (table->arena,
+                             G_STRUCT_OFFSET (CtplSymbol, name) + length + 1);
+  ctpl_stack_init (&symbol->stack);
+  symbol->hash = hash;
+  memcpy (symbol->name, name, length + 1);
+  g_ptr_array_add (table->symbols, symbol);
+  table->slots[slot] = ((guint64) hash << 32) | table->symbols->len;
+  
+  return symbol;
+}
+
+/* hash of @symbol having the value @value, 0 for no value */
+static guint64
+symbol_hash (const gchar     *symbol,
+             const CtplValue *value)
+{
+  guint64 hash = 0;
+  
+  if (value) {
+    const gchar *p;
+    
+    hash = ctpl_value_hash64 (value);
+    for (p = symbol; *p; p++) {
+      hash = (hash ^ (guchar) *p) * G_GUINT64_CONSTANT (0x100000001b3);
+    }
+    /* splitmix64 finalizer, so that summing hashes doesn't cancel bits */
+    hash ^= hash >> 30;
+    hash *= G_GUINT64_CONSTANT (0xbf58476d1ce4e5b9);
+    hash ^= hash >> 27;
+    hash *= G_GUINT64_CONSTANT (0x94d049bb133111eb);
+    hash ^= hash >> 31;
+  }
+  
+  return hash;
+}
+
+/*
+ * update_fingerprint:
+ * @env: A #CtplEnviron
+ * @symbol: The symbol that changed
+ * @old_value: The previous topmost value of @symbol, or %NULL
+ * @new_value: The new topmost value of @symbol, or %NULL
+ * 
+ * Marks @symbol as changed after its topmost value changed, so that
+ * ctpl_environ_get_fingerprint() hashes it again.  Only the first change since
+ * the fingerprint was computed hashes the old value, so pushing and popping the
+ * same symbols over and over, like loops do, costs no hashing.  Past
+ * %FINGERPRINT_MAX_DIRTY symbols, or a quarter of them, changes are no longer
+ * tracked one by one, so that loading descriptions doesn't pay for them.
+ */
+static void
+update_fingerprint (CtplEnviron     *env,
+                    const gchar     *symbol,
+                    const CtplValue *old_value,
+                    const CtplValue *new_value)
+{
+  if (old_value != new_value && ! env->stale &&
+      ! g_hash_table_lookup (env->dirty, symbol)) {
+    guint n_dirty = g_hash_table_size (env->dirty);
+    
+    if (n_dirty >= FINGERPRINT_MAX_DIRTY &&
+        n_dirty >= env->symbol_table.symbols->len / 4) {
+      env->stale = TRUE;
+      g_hash_table_remove_all (env->dirty);
+    } else {
+      guint64 *hash = g_slice_alloc (sizeof *hash);
+      
+      *hash = symbol_hash (symbol, old_value);
+      g_hash_table_insert (env->dirty, g_strdup (symbol), hash);
+    }
+  }
+}
+
+/* hashes again the symbols changed since the fingerprint of @env was last
+ * computed.  The fingerprint is a sum so it doesn't depend on the order of the
+ * changes */
+static void
+refresh_fingerprint (CtplEnviron *env)
+{
+  if (env->stale) {
+    guint i;
+    
+    env->fingerprint = 0;
+    for (i = 0; i < env->symbol_table.symbols->len; i++) {
+      CtplSymbol *symbol = g_ptr_array_index (env->symbol_table.symbols, i);
+      
+      env->fingerprint += symbol_hash (symbol->name,
+                                       ctpl_stack_peek (&symbol->stack));
+    }
+    env->stale = FALSE;
+  } else {
+    GHashTableIter  iter;
+    gpointer        key;
+    gpointer        value;
+    
+    g_hash_table_iter_init (&iter, env->dirty);
+    while (g_hash_table_iter_next (&iter, &key, &value)) {
+      CtplSymbol *symbol = symbol_table_lookup (&env->symbol_table, key);
+      
+      env->fingerprint -= *(guint64 *) value;
+      env->fingerprint += symbol_hash (key, symbol
+                                            ? ctpl_stack_peek (&symbol->stack)
+                                            : NULL);
+    }
+    g_hash_table_remove_all (env->dirty);
+  }
+}
+
+/* records a change of @symbol in the change log of @env, if any.  Changes made
+ * by render steps, like pushing the iterators of loops, are only temporary so
+ * they aren't recorded, but the ones of host code they call are */
+static void
+log_change (CtplEnviron *env,
+            const gchar *symbol)
+{
+  if (env->changes && env->n_steps == 0) {
+    GList              *link = g_hash_table_lookup (env->changes, symbol);
+    CtplEnvironChange  *change;
+    
+    if (link) {
+      g_queue_unlink (&env->change_log, link);
+      change = link->data;
+    } else {
+      change = g_slice_alloc (sizeof *change);
+      change->symbol = g_strdup (symbol);
+      link = g_list_alloc ();
+      link->data = change;
+      g_hash_table_insert (env->changes, change->symbol, link);
+    }
+    change->serial = ++env->change_serial;
+    g_queue_push_head_link (&env->change_log, link);
+  }
+}
+
+/* records in the change log of @env a change that may affect any symbol */
+static void
+log_reset (CtplEnviron *env)
+{
+  if (env->changes) {
+    env->reset_serial = ++env->change_serial;
+  }
+}
+
+/* the topmost value of @symbol changed from @old_value to @new_value */
+static void
+symbol_changed (CtplEnviron     *env,
+                const gchar     *symbol,
+                const CtplValue *old_value,
+                const CtplValue *new_value)
+{
+  if (old_value != new_value) {
+    update_fingerprint (env, symbol, old_value, new_value);
+    log_change (env, symbol);
+  }
+}
+
+/*
+ * ctpl_environ_log_changes:
+ * @env: A #CtplEnviron
+ * @log: Whether to start or stop logging changes
+ * 
+ * Starts or stops recording which symbols of @env change, see
+ * ctpl_environ_get_changes().  Calls are counted, so the log is kept until
+ * each call starting it got a matching call stopping it.
+ */
+void
+ctpl_environ_log_changes (CtplEnviron *env,
+                          gboolean     log)
+{
+  if (log) {
+    if (env->n_change_logs++ == 0) {
+      env->changes = g_hash_table_new (g_str_hash, g_str_equal);
+    }
+  } else if (--env->n_change_logs == 0) {
+    while (! g_queue_is_empty (&env->change_log)) {
+      CtplEnvironChange *change = g_queue_pop_head (&env->change_log);
+      
+      g_free (change->symbol);
+      g_slice_free1 (sizeof *change, change);
+    }
+    g_hash_table_destroy (env->changes);
+    env->changes = NULL;
+  }
+}
+
+/*
+ * ctpl_environ_get_changes:
+ * @env: A #CtplEnviron logging its changes
+ * @serial: A serial returned by a previous call, or 0
+ * @symbols: (element-type utf8): Array where add the symbols that changed
+ *           since @serial.  The names are owned by @env and only valid until
+ *           it changes.
+ * @all: (out): Return location for whether any symbol may have changed since
+ *       @serial, for example because a resolver or a function changed
+ * 
+ * Gets which symbols of @env changed since @serial, as logged since
+ * ctpl_environ_log_changes() was called.  The cost of this only depends on the
+ * number of changed symbols.
+ * 
+ * Returns: The serial of the last change, to pass to a later call.
+ */
+guint
+ctpl_environ_get_changes (const CtplEnviron  *env,
+                          guint               serial,
+                          GPtrArray          *symbols,
+                          gboolean           *all)
 {
-  ctpl_stack_free (stack, (GFreeFunc) ctpl_value_free);
+  GList *link;
+  
+  for (link = env->change_log.head; link; link = link->next) {
+    CtplEnvironChange *change = link->data;
+    
+    if (change->serial <= serial) {
+      break;
+    }
+    g_ptr_array_add (symbols, change->symbol);
+  }
+  *all = env->reset_serial > serial;
+  
+  return env->change_serial;
 }
 
 /*
@@ -108,8 +610,27 @@ static void
 ctpl_environ_init (CtplEnviron *env)
 {
   env->ref_count = 1;
-  env->symbol_table = g_hash_table_new_full (g_str_hash, g_str_equal,
-                                             g_free, free_stack);
+  symbol_table_init (&env->symbol_table);
+  env->snapshot = NULL;
+  env->resolver = NULL;
+  env->resolver_data = NULL;
+  env->resolver_destroy = NULL;
+  env->resolver_memoize = FALSE;
+  env->resolved = NULL;
+  env->last_resolved = NULL;
+  env->n_renders = 0;
+  env->n_steps = 0;
+  env->functions = NULL;
+  env->arena = NULL;
+  env->fingerprint = 0;
+  env->dirty = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                      g_free, free_hash);
+  env->stale = FALSE;
+  env->n_change_logs = 0;
+  env->change_serial = 0;
+  env->reset_serial = 0;
+  env->changes = NULL;
+  g_queue_init (&env->change_log);
 }
 
 /**
@@ -163,7 +684,18 @@ void
 ctpl_environ_unref (CtplEnviron *env)
 {
   if (g_atomic_int_dec_and_test (&env->ref_count)) {
-    g_hash_table_destroy (env->symbol_table);
+    symbol_table_free (&env->symbol_table);
+    g_hash_table_destroy (env->dirty);
+    if (env->snapshot) {
+      g_variant_unref (env->snapshot);
+    }
+    ctpl_environ_set_resolver (env, NULL, FALSE, NULL, NULL);
+    if (env->functions) {
+      g_hash_table_destroy (env->functions);
+    }
+    while (env->n_change_logs > 0) {
+      ctpl_environ_log_changes (env, FALSE);
+    }
     g_slice_free1 (sizeof *env, env);
   }
 }
@@ -173,7 +705,8 @@ ctpl_environ_unref (CtplEnviron *env)
  * @env: A #CtplEnviron
  * @symbol: A symbol name
  * 
- * Lookups for a symbol stack in the given #CtplEnviron.
+ * Lookups for a symbol stack in the given #CtplEnviron.  If the symbol isn't
+ * loaded yet but is part of the environ's snapshot, it gets loaded.
  * 
  * Returns: A #CtplStack or %NULL if the symbol can't be found.
  */
@@ -181,7 +714,37 @@ static CtplStack *
 ctpl_environ_lookup_stack (const CtplEnviron *env,
                            const gchar       *symbol)
 {
-  return g_hash_table_lookup (env->symbol_table, symbol);
+  CtplSymbol *entry;
+  CtplStack  *stack = NULL;
+  
+  entry = symbol_table_lookup (&env->symbol_table, symbol);
+  if (entry) {
+    stack = &entry->stack;
+  } else if (env->snapshot) {
+    /* loading from the snapshot only fills a cache, the environ's content
+     * doesn't change */
+    stack = snapshot_load_symbol ((CtplEnviron *) env, symbol);
+  }
+  
+  return stack;
+}
+
+/* gets the stack of @symbol in @env, adding the symbol if it doesn't exist */
+static CtplStack *
+ctpl_environ_add_stack (CtplEnviron *env,
+                        const gchar *symbol)
+{
+  CtplStack *stack = NULL;
+  
+  if (env->snapshot) {
+    /* the symbol may have values in the snapshot */
+    stack = ctpl_environ_lookup_stack (env, symbol);
+  }
+  if (! stack) {
+    stack = &symbol_table_add (&env->symbol_table, symbol)->stack;
+  }
+  
+  return stack;
 }
 
 /**
@@ -191,8 +754,13 @@ ctpl_environ_lookup_stack (const CtplEnviron *env,
  * 
  * Looks up for a symbol in the given #CtplEnviron.
  * 
+ * If the symbol isn't in the environ and a resolver was set with
+ * ctpl_environ_set_resolver(), it is asked for the symbol's value.
+ * 
  * Returns: The #CtplValue holding the symbol's value, or %NULL if the symbol
- *          can't be found. This value should not be modified or freed.
+ *          can't be found. This value should not be modified or freed, and
+ *          if it was given by a resolver that doesn't memoize its values, it
+ *          is only valid until the next lookup.
  */
 const CtplValue *
 ctpl_environ_lookup (const CtplEnviron *env,
@@ -205,91 +773,487 @@ ctpl_environ_lookup (const CtplEnviron *env,
   if (stack) {
     value = ctpl_stack_peek (stack);
   }
+  if (! value && env->resolver) {
+    /* resolving only fills a cache, the environ's content doesn't change */
+    value = resolve_symbol ((CtplEnviron *) env, symbol);
+  }
+  
+  return value;
+}
+
+/* asks @env's resolver for the value of @symbol */
+static CtplValue *
+resolve_symbol (CtplEnviron *env,
+                const gchar *symbol)
+{
+  CtplValue *value = NULL;
+  
+  if (env->resolved) {
+    value = g_hash_table_lookup (env->resolved, symbol);
+  }
+  if (! value) {
+    gboolean  resolved;
+    guint     n_steps;
+    
+    value = ctpl_value_new ();
+    n_steps = ctpl_environ_suspend_steps (env);
+    resolved = env->resolver (env, symbol, value, env->resolver_data);
+    ctpl_environ_resume_steps (env, n_steps);
+    if (! resolved) {
+      ctpl_value_free (value);
+      value = NULL;
+    } else if (env->resolver_memoize) {
+      if (! env->resolved) {
+        env->resolved = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                                               (GDestroyNotify) ctpl_value_free);
+      }
+      g_hash_table_insert (env->resolved, g_strdup (symbol), value);
+    } else {
+      if (env->last_resolved) {
+        ctpl_value_free (env->last_resolved);
+      }
+      env->last_resolved = value;
+    }
+  }
   
   return value;
 }
 
 /**
- * ctpl_environ_push:
+ * ctpl_environ_set_resolver:
  * @env: A #CtplEnviron
- * @symbol: The symbol name
- * @value: The symbol value
+ * @func: (allow-none): A #CtplEnvironResolveFunc, or %NULL to remove the
+ *        current resolver
+ * @memoize: Whether to keep the values given by @func, rather than calling it
+ *           again each time the symbol is looked up
+ * @user_data: User data to pass to @func
+ * @destroy: (allow-none): A function to call to free @user_data when the
+ *           resolver is removed, or %NULL
  * 
- * Pushes a symbol into a #CtplEnviron.
- * Pushing a symbol adds it or overwrites the value in place for it while
- * keeping any already present value for latter poping.
- * The push/pop concept is simple as a stack: when you push, you add a value on
- * the top of a stack, and when you pop, you remove the top element of this
- * stack, revealing the previous value.
+ * Sets a function to call when a symbol cannot be found in @env, see
+ * ctpl_environ_lookup().  This allows to only compute the values a template
+ * actually uses, instead of pushing everything it might need beforehand.
+ * 
+ * Resolved symbols are not part of the environ: they are not reported by
+ * ctpl_environ_foreach() nor merged by ctpl_environ_merge(), and pushing a
+ * symbol hides its resolved value until the pushed value is popped.
+ * 
+ * Memoized values are kept until the end of the render that asked for them,
+ * so a template sees the same value each time it uses a symbol but the next
+ * render asks the resolver again.  When several renders use @env at the same
+ * time, e.g. with #CtplRenderer, they are kept until the last one ends.
+ * ctpl_environ_forget_resolved() or changing the resolver drops them
+ * earlier.
+ * 
+ * Since: 0.4
  */
 void
-ctpl_environ_push (CtplEnviron     *env,
-                   const gchar     *symbol,
-                   const CtplValue *value)
+ctpl_environ_set_resolver (CtplEnviron            *env,
+                           CtplEnvironResolveFunc  func,
+                           gboolean                memoize,
+                           gpointer                user_data,
+                           GDestroyNotify          destroy)
 {
-  CtplStack *stack;
-  
-  /* FIXME: perhaps warn if overriding an identifier?
-   *        or if the overriding value is not of the same type? */
-  stack = g_hash_table_lookup (env->symbol_table, symbol);
-  if (! stack) {
-    stack = ctpl_stack_new ();
-    if (stack) {
-      g_hash_table_insert (env->symbol_table, g_strdup (symbol), stack);
-    }
-  }
-  if (stack) {
-    ctpl_stack_push (stack, ctpl_value_dup (value));
+  ctpl_environ_forget_resolved (env);
+  if (env->resolver_destroy) {
+    env->resolver_destroy (env->resolver_data);
   }
+  env->resolver = func;
+  env->resolver_memoize = memoize;
+  env->resolver_data = user_data;
+  env->resolver_destroy = destroy;
 }
 
 /**
- * ctpl_environ_push_int:
+ * ctpl_environ_forget_resolved:
  * @env: A #CtplEnviron
- * @symbol: A symbol name
- * @value: The symbol value
  * 
- * Pushes an integer symbol into a #CtplEnviron. See ctpl_environ_push().
+ * Drops all values the resolver of @env gave, so it gets asked again for them.
+ * See ctpl_environ_set_resolver().
+ * 
+ * Since: 0.4
  */
 void
-ctpl_environ_push_int (CtplEnviron *env,
-                       const gchar *symbol,
-                       glong        value)
+ctpl_environ_forget_resolved (CtplEnviron *env)
 {
-  CtplValue val;
-  
-  ctpl_value_init (&val);
-  ctpl_value_set_int (&val, value);
-  ctpl_environ_push (env, symbol, &val);
-  ctpl_value_free_value (&val);
+  log_reset (env);
+  if (env->resolved) {
+    g_hash_table_destroy (env->resolved);
+    env->resolved = NULL;
+  }
+  if (env->last_resolved) {
+    ctpl_value_free (env->last_resolved);
+    env->last_resolved = NULL;
+  }
 }
 
-/**
- * ctpl_environ_push_float:
+/*
+ * ctpl_environ_value_is_transient:
  * @env: A #CtplEnviron
- * @symbol: A symbol name
- * @value: The symbol value
+ * @value: A value returned by ctpl_environ_lookup() on @env
  * 
- * Pushes a float symbol into a #CtplEnviron. See ctpl_environ_push().
+ * Checks whether a looked up value is only valid until the next lookup, see
+ * ctpl_environ_lookup().
+ * 
+ * Returns: %TRUE if @value has to be copied to be kept, %FALSE otherwise.
  */
-void
-ctpl_environ_push_float (CtplEnviron *env,
-                         const gchar *symbol,
-                         gdouble      value)
+gboolean
+ctpl_environ_value_is_transient (const CtplEnviron *env,
+                                 const CtplValue   *value)
 {
-  CtplValue val;
-  
-  ctpl_value_init (&val);
-  ctpl_value_set_float (&val, value);
-  ctpl_environ_push (env, symbol, &val);
-  ctpl_value_free_value (&val);
+  return value == env->last_resolved;
 }
 
-/**
- * ctpl_environ_push_string:
+/*
+ * ctpl_environ_symbol_is_stable:
  * @env: A #CtplEnviron
  * @symbol: A symbol name
- * @value: The symbol value
+ * 
+ * Checks whether the value of @symbol can only change through changes
+ * recorded in the change log of @env, see ctpl_environ_log_changes().  This is
+ * not the case of iterators, nor of values from a resolver that doesn't
+ * memoize them.  The resolver is not called.
+ * 
+ * Returns: %TRUE if the value of @symbol is stable, %FALSE otherwise.
+ */
+gboolean
+ctpl_environ_symbol_is_stable (const CtplEnviron *env,
+                               const gchar       *symbol)
+{
+  CtplStack        *stack = ctpl_environ_lookup_stack (env, symbol);
+  const CtplValue  *value = stack ? ctpl_stack_peek (stack) : NULL;
+  
+  if (! value && env->resolver) {
+    if (! env->resolver_memoize) {
+      return FALSE;
+    }
+    value = env->resolved ? g_hash_table_lookup (env->resolved, symbol) : NULL;
+  }
+  
+  return ! value || ! CTPL_VALUE_HOLDS_ITERATOR (value);
+}
+
+/*
+ * ctpl_environ_begin_render:
+ * @env: A #CtplEnviron
+ * 
+ * Marks the start of a render with @env.  Each call must be balanced with a
+ * call to ctpl_environ_end_render().
+ */
+void
+ctpl_environ_begin_render (CtplEnviron *env)
+{
+  env->n_renders++;
+}
+
+/*
+ * ctpl_environ_begin_step:
+ * @env: A #CtplEnviron
+ * 
+ * Marks the start of a render step with @env, during which the changes made
+ * to @env are temporary and not recorded in its change log.  Each call must be
+ * balanced with a call to ctpl_environ_end_step().
+ */
+void
+ctpl_environ_begin_step (CtplEnviron *env)
+{
+  env->n_steps++;
+}
+
+/*
+ * ctpl_environ_end_step:
+ * @env: A #CtplEnviron
+ * 
+ * Marks the end of a render step started with ctpl_environ_begin_step().
+ */
+void
+ctpl_environ_end_step (CtplEnviron *env)
+{
+  g_return_if_fail (env->n_steps > 0);
+  
+  env->n_steps--;
+}
+
+/*
+ * ctpl_environ_suspend_steps:
+ * @env: A #CtplEnviron
+ * 
+ * Suspends the render steps running with @env while calling host code, whose
+ * changes to @env are recorded in its change log as any other.
+ * 
+ * Returns: The number of render steps to give back to
+ *          ctpl_environ_resume_steps() once the host code returned.
+ */
+guint
+ctpl_environ_suspend_steps (CtplEnviron *env)
+{
+  guint n_steps = env->n_steps;
+  
+  env->n_steps = 0;
+  
+  return n_steps;
+}
+
+/*
+ * ctpl_environ_resume_steps:
+ * @env: A #CtplEnviron
+ * @n_steps: The value returned by ctpl_environ_suspend_steps()
+ * 
+ * Resumes the render steps suspended by ctpl_environ_suspend_steps().
+ */
+void
+ctpl_environ_resume_steps (CtplEnviron *env,
+                           guint        n_steps)
+{
+  env->n_steps = n_steps;
+}
+
+/*
+ * ctpl_environ_end_render:
+ * @env: A #CtplEnviron
+ * 
+ * Marks the end of a render started with ctpl_environ_begin_render().  When
+ * no render is left, the values memoized from the resolver are dropped so the
+ * next render asks for them again, and they are recorded as changed.
+ */
+void
+ctpl_environ_end_render (CtplEnviron *env)
+{
+  g_return_if_fail (env->n_renders > 0);
+  
+  if (--env->n_renders == 0 && env->resolved) {
+    GHashTableIter  iter;
+    gpointer        symbol;
+    
+    g_hash_table_iter_init (&iter, env->resolved);
+    while (g_hash_table_iter_next (&iter, &symbol, NULL)) {
+      log_change (env, symbol);
+    }
+    g_hash_table_destroy (env->resolved);
+    env->resolved = NULL;
+  }
+}
+
+/*
+ * ctpl_environ_get_arena:
+ * @env: A #CtplEnviron
+ * 
+ * Gets the arena in which temporary values are allocated while rendering
+ * with @env, see ctpl_environ_set_arena().
+ * 
+ * Returns: (transfer none): The arena of @env, or %NULL if it has none.
+ */
+CtplArena *
+ctpl_environ_get_arena (const CtplEnviron *env)
+{
+  return env->arena;
+}
+
+/*
+ * ctpl_environ_set_arena:
+ * @env: A #CtplEnviron
+ * @arena: (allow-none): A #CtplArena, or %NULL
+ * 
+ * Sets the arena in which temporary values are allocated while rendering
+ * with @env.  The environment does not hold a reference on @arena, so it
+ * has to be unset before being freed.
+ */
+void
+ctpl_environ_set_arena (CtplEnviron *env,
+                        CtplArena   *arena)
+{
+  env->arena = arena;
+}
+
+static void
+free_function_entry (gpointer data)
+{
+  CtplEnvironFunctionEntry *entry = data;
+  
+  if (entry->destroy) {
+    entry->destroy (entry->user_data);
+  }
+  g_slice_free1 (sizeof *entry, entry);
+}
+
+/**
+ * ctpl_environ_add_function:
+ * @env: A #CtplEnviron
+ * @name: The name of the function
+ * @func: A #CtplEnvironFunction implementing the function
+ * @user_data: User data to pass to @func
+ * @destroy: (allow-none): A function to call to free @user_data when the
+ *           function is removed or the environ freed, or %NULL
+ * 
+ * Adds a function templates can call, as <code>name(arg1, arg2, ...)</code>.
+ * Its arguments are evaluated before calling @func, that computes the result.
+ * 
+ * If a function with the same name was already added, it is replaced.  A
+ * function added this way also hides any built-in function with the same name.
+ * 
+ * Since: 0.4
+ */
+void
+ctpl_environ_add_function (CtplEnviron         *env,
+                           const gchar         *name,
+                           CtplEnvironFunction  func,
+                           gpointer             user_data,
+                           GDestroyNotify       destroy)
+{
+  CtplEnvironFunctionEntry *entry;
+  
+  g_return_if_fail (name != NULL);
+  g_return_if_fail (func != NULL);
+  
+  if (! env->functions) {
+    env->functions = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                            g_free, free_function_entry);
+  }
+  entry = g_slice_alloc (sizeof *entry);
+  entry->func = func;
+  entry->user_data = user_data;
+  entry->destroy = destroy;
+  g_hash_table_insert (env->functions, g_strdup (name), entry);
+  log_reset (env);
+}
+
+/**
+ * ctpl_environ_remove_function:
+ * @env: A #CtplEnviron
+ * @name: The name of a function added with ctpl_environ_add_function()
+ * 
+ * Removes a function added with ctpl_environ_add_function().
+ * 
+ * Returns: %TRUE if the function was removed, %FALSE if there was no such
+ *          function.
+ * 
+ * Since: 0.4
+ */
+gboolean
+ctpl_environ_remove_function (CtplEnviron *env,
+                              const gchar *name)
+{
+  if (env->functions && g_hash_table_remove (env->functions, name)) {
+    log_reset (env);
+    return TRUE;
+  }
+  
+  return FALSE;
+}
+
+/*
+ * ctpl_environ_lookup_function:
+ * @env: A #CtplEnviron
+ * @name: A function name
+ * @func: (out): Return location for the function
+ * @user_data: (out): Return location for the function's user data
+ * 
+ * Looks up for a function added with ctpl_environ_add_function().
+ * 
+ * Returns: %TRUE if the function was found, %FALSE otherwise.
+ */
+gboolean
+ctpl_environ_lookup_function (const CtplEnviron    *env,
+                              const gchar          *name,
+                              CtplEnvironFunction  *func,
+                              gpointer             *user_data)
+{
+  CtplEnvironFunctionEntry *entry = NULL;
+  
+  if (env->functions) {
+    entry = g_hash_table_lookup (env->functions, name);
+  }
+  if (entry) {
+    *func = entry->func;
+    *user_data = entry->user_data;
+  }
+  
+  return entry != NULL;
+}
+
+/* pushes @value, taking ownership of it */
+static void
+push_value (CtplEnviron  *env,
+            const gchar  *symbol,
+            CtplValue    *value)
+{
+  CtplStack *stack;
+  
+  /* FIXME: perhaps warn if overriding an identifier?
+   *        or if the overriding value is not of the same type? */
+  stack = ctpl_environ_add_stack (env, symbol);
+  symbol_changed (env, symbol, ctpl_stack_peek (stack), value);
+  ctpl_stack_push (stack, value);
+}
+
+/**
+ * ctpl_environ_push:
+ * @env: A #CtplEnviron
+ * @symbol: The symbol name
+ * @value: The symbol value
+ * 
+ * Pushes a symbol into a #CtplEnviron.
+ * Pushing a symbol adds it or overwrites the value in place for it while
+ * keeping any already present value for latter poping.
+ * The push/pop concept is simple as a stack: when you push, you add a value on
+ * the top of a stack, and when you pop, you remove the top element of this
+ * stack, revealing the previous value.
+ */
+void
+ctpl_environ_push (CtplEnviron     *env,
+                   const gchar     *symbol,
+                   const CtplValue *value)
+{
+  push_value (env, symbol, ctpl_value_dup (value));
+}
+
+/**
+ * ctpl_environ_push_int:
+ * @env: A #CtplEnviron
+ * @symbol: A symbol name
+ * @value: The symbol value
+ * 
+ * Pushes an integer symbol into a #CtplEnviron. See ctpl_environ_push().
+ */
+void
+ctpl_environ_push_int (CtplEnviron *env,
+                       const gchar *symbol,
+                       glong        value)
+{
+  CtplValue val;
+  
+  ctpl_value_init (&val);
+  ctpl_value_set_int (&val, value);
+  ctpl_environ_push (env, symbol, &val);
+  ctpl_value_free_value (&val);
+}
+
+/**
+ * ctpl_environ_push_float:
+ * @env: A #CtplEnviron
+ * @symbol: A symbol name
+ * @value: The symbol value
+ * 
+ * Pushes a float symbol into a #CtplEnviron. See ctpl_environ_push().
+ */
+void
+ctpl_environ_push_float (CtplEnviron *env,
+                         const gchar *symbol,
+                         gdouble      value)
+{
+  CtplValue val;
+  
+  ctpl_value_init (&val);
+  ctpl_value_set_float (&val, value);
+  ctpl_environ_push (env, symbol, &val);
+  ctpl_value_free_value (&val);
+}
+
+/**
+ * ctpl_environ_push_string:
+ * @env: A #CtplEnviron
+ * @symbol: A symbol name
+ * @value: The symbol value
  * 
  * Pushes a string symbol into a #CtplEnviron. See ctpl_environ_push().
  */
@@ -335,6 +1299,14 @@ ctpl_environ_pop (CtplEnviron *env,
   stack = ctpl_environ_lookup_stack (env, symbol);
   if (stack) {
     value = ctpl_stack_pop (stack);
+    symbol_changed (env, symbol, value, ctpl_stack_peek (stack));
+    if (poped_value && value && ctpl_value_is_in_arena (value)) {
+      CtplValue *copy = ctpl_value_dup (value);
+      
+      /* loaded values live in the environ's memory */
+      ctpl_value_free (value);
+      value = copy;
+    }
     if (poped_value) {
       *poped_value = value;
     } else {
@@ -345,33 +1317,6 @@ ctpl_environ_pop (CtplEnviron *env,
   return value != NULL;
 }
 
-/* data for ctpl_environ_foreach() */
-struct _CtplEnvironForeachData
-{
-  CtplEnviron            *env;
-  CtplEnvironForeachFunc  func;
-  gpointer                user_data;
-  gboolean                run;
-};
-
-/* callback for ctpl_environ_foreach() */
-static void
-ctpl_environ_foreach_hfunc (gpointer  symbol,
-                            gpointer  stack,
-                            gpointer  user_data)
-{
-  struct _CtplEnvironForeachData *data = user_data;
-  
-  if (data->run) {
-    CtplValue *value;
-    
-    value = ctpl_stack_peek (stack);
-    if (value) {
-      data->run = data->func (data->env, symbol, value, data->user_data);
-    }
-  }
-}
-
 /**
  * ctpl_environ_foreach:
  * @env: A #CtplEnviron
@@ -385,39 +1330,17 @@ ctpl_environ_foreach (CtplEnviron            *env,
                       CtplEnvironForeachFunc  func,
                       gpointer                user_data)
 {
-  struct _CtplEnvironForeachData data;
-  
-  data.env = env;
-  data.func = func;
-  data.user_data = user_data;
-  data.run = TRUE;
-  g_hash_table_foreach (env->symbol_table, ctpl_environ_foreach_hfunc, &data);
-}
-
-/* data for ctpl_environ_merge() */
-struct _CtplEnvironMergeData
-{
-  CtplEnviron  *env;
-  gboolean      merge_symbols;
-};
-
-/* callback for ctpl_environ_merge() */
-static void
-ctpl_environ_merge_hfunc (gpointer  symbol,
-                          gpointer  stack,
-                          gpointer  user_data)
-{
-  struct _CtplEnvironMergeData *data = user_data;
-  CtplStack                    *local_stack;
+  gboolean  run = TRUE;
+  guint     i;
   
-  local_stack = ctpl_environ_lookup_stack (data->env, symbol);
-  if (! local_stack || data->merge_symbols) {
-    CtplValue *value;
+  snapshot_load_all (env);
+  for (i = 0; run && i < env->symbol_table.symbols->len; i++) {
+    CtplSymbol *symbol = g_ptr_array_index (env->symbol_table.symbols, i);
+    CtplValue  *value;
     
-    /* FIXME: merge the whole stack and not its top value */
-    value = ctpl_stack_peek (stack);
+    value = ctpl_stack_peek (&symbol->stack);
     if (value) {
-      ctpl_environ_push (data->env, symbol, value);
+      run = func (env, symbol->name, value, user_data);
     }
   }
 }
@@ -431,6 +1354,8 @@ ctpl_environ_merge_hfunc (gpointer  symbol,
  * Merges an environment into another. If a symbol of the source environ already
  * exists in the destination one, its value is either pushed if @merge_symbols
  * is true or ignored if %FALSE.
+ * The fingerprint of @env is updated for each pushed value, see
+ * ctpl_environ_get_fingerprint().
  * 
  * <warning>
  *   Currently, symbol merging only pushes the topmost value from the source
@@ -442,18 +1367,64 @@ ctpl_environ_merge (CtplEnviron        *env,
                     const CtplEnviron  *source,
                     gboolean            merge_symbols)
 {
-  struct _CtplEnvironMergeData data;
+  guint i;
+  
+  snapshot_load_all ((CtplEnviron *) source);
+  for (i = 0; i < source->symbol_table.symbols->len; i++) {
+    CtplSymbol *symbol = g_ptr_array_index (source->symbol_table.symbols, i);
+    
+    if (merge_symbols || ! ctpl_environ_lookup_stack (env, symbol->name)) {
+      CtplValue *value;
+      
+      /* FIXME: merge the whole stack and not its top value */
+      value = ctpl_stack_peek (&symbol->stack);
+      if (value) {
+        ctpl_environ_push (env, symbol->name, value);
+      }
+    }
+  }
+}
+
+/**
+ * ctpl_environ_get_fingerprint:
+ * @env: A #CtplEnviron
+ * 
+ * Gets a hash of the content of a #CtplEnviron, that is of the topmost value
+ * of each of its symbols.  Environments with the same symbols and values have
+ * the same fingerprint whatever the order in which they were filled, so it can
+ * be used with the template to identify a rendering's output without
+ * comparing whole environments.
+ * 
+ * Only the symbols that changed since the last call are hashed again, so
+ * getting it repeatedly is cheap, and pushing or popping symbols costs nothing
+ * until it is requested; but for an environment loaded from a snapshot, the
+ * first call loads all the symbols not loaded yet.
+ * Iterator values are taken into account by identity, not by content.
+ * The resolver and the functions of @env are not taken into account.
+ * 
+ * As any hash, different environments may have the same fingerprint, though it
+ * is very unlikely.
+ * 
+ * Returns: The fingerprint of @env.
+ * 
+ * Since: 0.4
+ */
+guint64
+ctpl_environ_get_fingerprint (CtplEnviron *env)
+{
+  snapshot_load_all (env);
+  refresh_fingerprint (env);
   
-  data.env = env;
-  data.merge_symbols = merge_symbols;
-  g_hash_table_foreach (source->symbol_table, ctpl_environ_merge_hfunc, &data);
+  return env->fingerprint;
 }
 
 
 /*============================ environment loader ============================*/
 
+#include <stdarg.h>
 #include <string.h>
 #include "ctpl-input-stream.h"
+#include "ctpl-io.h"
 #include "ctpl-mathutils.h"
 #include "ctpl-lexer-private.h"     /* for CTPL_*_CHARS */
 
@@ -466,78 +1437,148 @@ ctpl_environ_merge (CtplEnviron        *env,
 #define VALUE_END_CHAR        ';'
 #define SINGLE_COMMENT_START  '#'
 
+/* size of the chunks read when loading from a stream */
+#define STREAM_CHUNK_SIZE     (64 * 1024)
+/* minimal size of the parts of a description loaded by separate threads */
+#define LOADER_MIN_CHUNK_SIZE (256 * 1024)
+
+
+/*
+ * LoaderState:
+ * 
+ * State of the loader.  The loader works on a whole environment description
+ * in memory (either mapped or read at once) and scans it directly, rather than
+ * reading it byte after byte through a #CtplInputStream.  Line information is
+ * only computed when reporting an error.
+ */
+typedef struct _LoaderState LoaderState;
+struct _LoaderState
+{
+  const gchar  *data;   /* start of the description */
+  const gchar  *cur;    /* current position */
+  const gchar  *end;    /* end of the description */
+  const gchar  *name;   /* name of the description, for errors */
+  guint         line;   /* line at @data */
+  guint         pos;    /* position in the line at @data */
+  GString      *symbol; /* buffer for the symbol being read */
+  CtplArena    *arena;  /* memory of the values read */
+};
+
 
-static gboolean   read_value              (CtplInputStream *stream,
-                                           CtplValue       *value,
-                                           GError         **error);
+static gboolean   read_value              (LoaderState *state,
+                                           CtplValue   *value,
+                                           GError     **error);
 
 
-/* skips characters that should be skipped: blanks and comments */
-static gssize
-skip_blank (CtplInputStream *stream,
-            GError         **error)
+/* sets an error located at the current position of @state */
+static void
+loader_set_error (LoaderState  *state,
+                  GError      **error,
+                  GQuark        domain,
+                  gint          code,
+                  const gchar  *format,
+                  ...)
 {
-  gssize  skip = 0;
-  gssize  pass_skip;
-  
-  do {
-    pass_skip = ctpl_input_stream_skip_blank (stream, error);
-    if (pass_skip >= 0) {
-      GError *err = NULL;
-      
-      if (ctpl_input_stream_peek_c (stream, &err) == SINGLE_COMMENT_START) {
-        gboolean in_comment = TRUE;
+  if (error) {
+    const gchar  *p;
+    guint         line = state->line;
+    guint         pos = state->pos;
+    gchar        *message;
+    va_list       ap;
+    
+    for (p = state->data; p < state->cur; p++) {
+      switch (*p) {
+        case '\n':
+          line ++;
+          /* Fallthrough */
+        case '\r':
+          pos = 0;
+          break;
         
-        for (; in_comment; pass_skip++) {
-          gchar c;
-          
-          c = ctpl_input_stream_get_c (stream, &err);
-          if (err) {
-            break;
-          } else {
-            switch (c) {
-              case '\r':
-              case '\n':
-              case CTPL_EOF:
-                in_comment = FALSE;
-                break;
-            }
-          }
-        }
-        if (! err) {
-          pass_skip += ctpl_input_stream_skip_blank (stream, &err);
-        }
-      }
-      if (err) {
-        g_propagate_error (error, err);
-        pass_skip = -1;
+        default:
+          pos ++;
       }
     }
-    if (pass_skip > 0) {
-      skip += pass_skip;
-    } else if (pass_skip < 0) {
-      skip = -1;
-    }
-  } while (pass_skip > 0);
+    va_start (ap, format);
+    message = g_strdup_vprintf (format, ap);
+    va_end (ap);
+    g_set_error (error, domain, code, "%s:%u:%u: %s (at byte %lu)",
+                 state->name, line, pos, message,
+                 (gulong) (state->cur - state->data));
+    g_free (message);
+  }
+}
+
+/* skips characters that should be skipped: blanks and comments */
+static void
+skip_blank (LoaderState *state)
+{
+  const gchar *p = state->cur;
   
-  return skip;
+  while (p < state->end) {
+    if (ctpl_is_blank (*p)) {
+      p++;
+    } else if (*p == SINGLE_COMMENT_START) {
+      /* skip up to the end of the line, the line ending being a blank */
+      while (p < state->end && ! ctpl_char_is_class (*p, CTPL_CHAR_CLASS_EOL)) {
+        p++;
+      }
+    } else {
+      break;
+    }
+  }
+  state->cur = p;
 }
 
 /* tries to read a string literal */
 static gboolean
-read_string (CtplInputStream *stream,
-             CtplValue       *value,
-             GError         **error)
+read_string (LoaderState *state,
+             CtplValue   *value,
+             GError     **error)
 {
-  gchar    *str;
-  gboolean  rv = FALSE;
+  const gchar  *start = state->cur + 1; /* skip the opening delimiter */
+  const gchar  *p;
+  gsize         len = (gsize) (state->end - start);
+  gboolean      rv = FALSE;
   
-  str = ctpl_input_stream_read_string_literal (stream, error);
-  if (str) {
-    ctpl_value_set_string (value, str);
+  p = memchr (start, CTPL_STRING_DELIMITER_CHAR, len);
+  if (p && ! memchr (start, CTPL_ESCAPE_CHAR, (gsize) (p - start))) {
+    /* fast path, nothing to unescape */
+    memcpy (ctpl_value_alloc_shared_string (value, state->arena,
+                                            (gsize) (p - start)),
+            start, (gsize) (p - start));
+    state->cur = p + 1;
     rv = TRUE;
+  } else {
+    GString  *string;
+    
+    string = g_string_sized_new (len < 64 ? len : 64);
+    for (p = start; p < state->end; p++) {
+      const gchar *run = p;
+      
+      while (p < state->end &&
+             *p != CTPL_ESCAPE_CHAR && *p != CTPL_STRING_DELIMITER_CHAR) {
+        p++;
+      }
+      g_string_append_len (string, run, p - run);
+      if (p >= state->end || *p == CTPL_STRING_DELIMITER_CHAR) {
+        break;
+      } else if (++p < state->end) {
+        /* an escaped character is taken as-is */
+        g_string_append_c (string, *p);
+      }
+    }
+    if (p >= state->end) {
+      state->cur = state->end;
+      loader_set_error (state, error, CTPL_IO_ERROR, CTPL_IO_ERROR_EOF,
+                        _("Unexpected EOF inside string constant"));
+      g_string_free (string, TRUE);
+    } else {
+      ctpl_value_take_string (value, g_string_free (string, FALSE));
+      state->cur = p + 1;
+      rv = TRUE;
+    }
   }
-  g_free (str);
   
   return rv;
 }
@@ -545,162 +1586,234 @@ read_string (CtplInputStream *stream,
 /*
  * tries to read an array.
  * 
+ * Items are gathered in a list that is handed over to @value at once, so the
+ * array is built in a single pass without copying any item.  The items and
+ * the list live in the loader's arena like the other values.
+ * 
  * Returns: %TRUE on full success, %FALSE otherwise.
  */
 static gboolean
-read_array (CtplInputStream *stream,
-            CtplValue       *value,
-            GError         **error)
+read_array (LoaderState *state,
+            CtplValue   *value,
+            GError     **error)
 {
-  GError *err = NULL;
-  gchar   c;
+  GError   *err = NULL;
+  GSList   *items = NULL;
+  GSList  **tail = &items;
   
-  c = ctpl_input_stream_get_c (stream, &err);
-  if (err) {
-    /* I/O error */
-  } else if (c != ARRAY_START_CHAR) {
-    ctpl_input_stream_set_error (stream, &err, CTPL_ENVIRON_ERROR,
-                                 CTPL_ENVIRON_ERROR_LOADER_MISSING_VALUE,
-                                 _("Not an array"));
+  state->cur++; /* skip the opening character */
+  skip_blank (state);
+  /* don't try to extract any value from an empty array */
+  if (state->cur < state->end && *state->cur == ARRAY_END_CHAR) {
+    state->cur++;
   } else {
-    ctpl_value_set_array (value, CTPL_VTYPE_INT, 0, NULL);
-    /* don't try to extract any value from an empty array */
-    if (skip_blank (stream, &err) >= 0 &&
-        ctpl_input_stream_peek_c (stream, &err) == ARRAY_END_CHAR &&
-        ! err) {
-      ctpl_input_stream_get_c (stream, &err); /* eat character */
-    } else {
-      CtplValue item;
-      gboolean  in_array = TRUE;
+    gboolean in_array = TRUE;
+    
+    while (! err && in_array) {
+      CtplValue *item;
+      GSList    *link;
       
-      ctpl_value_init (&item);
-      while (! err && in_array) {
-        if (skip_blank (stream, &err) >= 0 &&
-            read_value (stream, &item, &err)) {
-          ctpl_value_array_append (value, &item);
-          if (skip_blank (stream, &err) >= 0) {
-            c = ctpl_input_stream_get_c (stream, &err);
-            if (err) {
-              /* I/O error */
-            } else if (c == ARRAY_END_CHAR) {
-              in_array = FALSE;
-            } else if (c == ARRAY_SEPARATOR_CHAR) {
-              /* nothing to do, just continue reading */
-            } else {
-              ctpl_input_stream_set_error (stream, &err, CTPL_ENVIRON_ERROR,
-                                           CTPL_ENVIRON_ERROR_LOADER_MISSING_SEPARATOR,
-                                           _("Missing `%c` separator between array "
-                                             "values"), ARRAY_SEPARATOR_CHAR);
-            }
-          }
+      item = ctpl_value_new_in_arena (state->arena);
+      link = ctpl_arena_alloc (state->arena, sizeof *link);
+      link->data = item;
+      link->next = NULL;
+      *tail = link;
+      tail = &link->next;
+      skip_blank (state);
+      if (read_value (state, item, &err)) {
+        skip_blank (state);
+        if (state->cur >= state->end) {
+          loader_set_error (state, &err, CTPL_IO_ERROR, CTPL_IO_ERROR_EOF,
+                            _("Unexpected EOF inside array"));
+        } else if (*state->cur == ARRAY_END_CHAR) {
+          state->cur++;
+          in_array = FALSE;
+        } else if (*state->cur == ARRAY_SEPARATOR_CHAR) {
+          /* nothing to do, just continue reading */
+          state->cur++;
+        } else {
+          loader_set_error (state, &err, CTPL_ENVIRON_ERROR,
+                            CTPL_ENVIRON_ERROR_LOADER_MISSING_SEPARATOR,
+                            _("Missing `%c` separator between array values"),
+                            ARRAY_SEPARATOR_CHAR);
         }
       }
-      ctpl_value_free_value (&item);
     }
   }
   if (err) {
+    g_slist_foreach (items, (GFunc) ctpl_value_free, NULL);
     g_propagate_error (error, err);
+  } else {
+    ctpl_value_take_arena_array (value, items);
   }
   
   return ! err;
 }
 
-/* tries to read a symbol's value */
+/* tries to read a number */
 static gboolean
-read_value (CtplInputStream *stream,
-            CtplValue       *value,
-            GError         **error)
+read_number (LoaderState *state,
+             CtplValue   *value,
+             GError     **error)
 {
-  GError *err = NULL;
-  gchar   c;
+  GError   *err = NULL;
+  gsize     n_read;
   
-  c = ctpl_input_stream_peek_c (stream, &err);
+  ctpl_math_scan_number (state->cur, (gsize) (state->end - state->cur),
+                         CTPL_MATH_NUMBER_INT | CTPL_MATH_NUMBER_FLOAT,
+                         value, &n_read, &err);
+  state->cur += n_read;
   if (err) {
-    /* I/O error */
-  } else if (c == CTPL_STRING_DELIMITER_CHAR) {
-    read_string (stream, value, &err);
+    loader_set_error (state, error, err->domain, err->code, "%s", err->message);
+    g_error_free (err);
+  }
+  
+  return ! err;
+}
+
+/* tries to read a symbol's value */
+static gboolean
+read_value (LoaderState *state,
+            CtplValue   *value,
+            GError     **error)
+{
+  gchar c = (state->cur < state->end) ? *state->cur : CTPL_EOF;
+  
+  if (c == CTPL_STRING_DELIMITER_CHAR) {
+    return read_string (state, value, error);
   } else if (c == ARRAY_START_CHAR) {
-    read_array (stream, value, &err);
+    return read_array (state, value, error);
   } else if (c == '.' ||
              (c >= '0' && c <= '9') ||
              c == '+' || c == '-') {
-    ctpl_input_stream_read_number (stream, value, &err);
+    return read_number (state, value, error);
   } else {
-    ctpl_input_stream_set_error (stream, &err, CTPL_ENVIRON_ERROR,
-                                 CTPL_ENVIRON_ERROR_LOADER_MISSING_VALUE,
-                                 _("No valid value can be read"));
+    loader_set_error (state, error, CTPL_ENVIRON_ERROR,
+                      CTPL_ENVIRON_ERROR_LOADER_MISSING_VALUE,
+                      _("No valid value can be read"));
+    return FALSE;
   }
-  if (err) {
-    g_propagate_error (error, err);
+}
+
+/* tries to load the next symbol from the environment description */
+static gboolean
+load_next (CtplEnviron *env,
+           LoaderState *state,
+           GError     **error)
+{
+  const gchar  *symbol = state->cur;
+  CtplValue    *value;
+  
+  while (state->cur < state->end && ctpl_is_symbol (*state->cur)) {
+    state->cur++;
+  }
+  if (state->cur == symbol) {
+    loader_set_error (state, error, CTPL_ENVIRON_ERROR,
+                      CTPL_ENVIRON_ERROR_LOADER_MISSING_SYMBOL,
+                      _("Missing symbol"));
+    return FALSE;
   }
+  /* the symbol is copied to a reused buffer, so existing symbols don't cost
+   * any allocation */
+  g_string_truncate (state->symbol, 0);
+  g_string_append_len (state->symbol, symbol, state->cur - symbol);
+  symbol_table_prefetch (&env->symbol_table, state->symbol->str);
   
-  return ! err;
+  skip_blank (state);
+  if (state->cur >= state->end || *state->cur != VALUE_SEPARATOR_CHAR) {
+    loader_set_error (state, error, CTPL_ENVIRON_ERROR,
+                      CTPL_ENVIRON_ERROR_LOADER_MISSING_SEPARATOR,
+                      _("Missing `%c` separator between symbol and value"),
+                      VALUE_SEPARATOR_CHAR);
+    return FALSE;
+  }
+  state->cur++;
+  skip_blank (state);
+  value = ctpl_value_new_in_arena (state->arena);
+  if (! read_value (state, value, error)) {
+    ctpl_value_free (value);
+    return FALSE;
+  }
+  skip_blank (state);
+  if (state->cur >= state->end || *state->cur != VALUE_END_CHAR) {
+    loader_set_error (state, error, CTPL_ENVIRON_ERROR,
+                      CTPL_ENVIRON_ERROR_LOADER_MISSING_SEPARATOR,
+                      _("Missing `%c` separator after end of symbol's value"),
+                      VALUE_END_CHAR);
+    ctpl_value_free (value);
+    return FALSE;
+  }
+  state->cur++;
+  push_value (env, state->symbol->str, value);
+  
+  return TRUE;
 }
 
-/* tries to load the next symbol from the environment description */
+/* gets an upper bound of the number of statements between @start and @end,
+ * to size the symbol table ahead */
+static gsize
+count_statements (const gchar *start,
+                  const gchar *end)
+{
+  gsize n = 0;
+  
+  while ((start = memchr (start, VALUE_END_CHAR, (gsize) (end - start)))) {
+    start++;
+    n++;
+  }
+  
+  return n;
+}
+
+/*
+ * load_buffer:
+ * @env: A #CtplEnviron to fill
+ * @data: The environment description
+ * @start: Offset in @data at which start loading
+ * @end: Offset in @data at which stop loading
+ * @name: The name of the description, for error messages
+ * @line: The line at which @data starts
+ * @pos: The position in the line at which @data starts
+ * @error: Return location for an error, or %NULL to ignore them
+ * 
+ * Loads an environment description from memory.  Only the part of @data
+ * between @start and @end is loaded, but error locations are relative to the
+ * start of @data.
+ * 
+ * Returns: %TRUE on success, %FALSE otherwise.
+ */
 static gboolean
-load_next (CtplEnviron     *env,
-           CtplInputStream *stream,
-           GError         **error)
+load_buffer (CtplEnviron *env,
+             const gchar *data,
+             gsize        start,
+             gsize        end,
+             const gchar *name,
+             guint        line,
+             guint        pos,
+             GError     **error)
 {
-  gboolean  rv = FALSE;
+  LoaderState state;
+  gboolean    rv = TRUE;
   
-  if (skip_blank (stream, error) >= 0) {
-    gchar *symbol;
-    
-    symbol = ctpl_input_stream_read_symbol (stream, error);
-    if (! symbol) {
-      /* I/O error */
-    } else if (! *symbol) {
-      ctpl_input_stream_set_error (stream, error, CTPL_ENVIRON_ERROR,
-                                   CTPL_ENVIRON_ERROR_LOADER_MISSING_SYMBOL,
-                                   _("Missing symbol"));
-    } else {
-      if (skip_blank (stream, error) >= 0) {
-        GError *err = NULL;
-        gchar   c;
-        
-        c = ctpl_input_stream_get_c (stream, &err);
-        if (err) {
-          /* I/O error */
-          g_propagate_error (error, err);
-        } else if (c != VALUE_SEPARATOR_CHAR) {
-          ctpl_input_stream_set_error (stream, error, CTPL_ENVIRON_ERROR,
-                                       CTPL_ENVIRON_ERROR_LOADER_MISSING_SEPARATOR,
-                                       _("Missing `%c` separator between symbol "
-                                         "and value"), VALUE_SEPARATOR_CHAR);
-        } else {
-          if (skip_blank (stream, error) >= 0) {
-            CtplValue value;
-            
-            ctpl_value_init (&value);
-            if (read_value (stream, &value, error) &&
-                skip_blank (stream, error) >= 0) {
-              c = ctpl_input_stream_get_c (stream, &err);
-              if (err) {
-                /* I/O error */
-                g_propagate_error (error, err);
-              } else if (c != VALUE_END_CHAR) {
-                ctpl_input_stream_set_error (stream, error, CTPL_ENVIRON_ERROR,
-                                             CTPL_ENVIRON_ERROR_LOADER_MISSING_SEPARATOR,
-                                             _("Missing `%c` separator after "
-                                               "end of symbol's value"),
-                                             VALUE_END_CHAR);
-              } else {
-                /* skip blanks again to try to reach end before next call */
-                if (skip_blank (stream, error) >= 0) {
-                  ctpl_environ_push (env, symbol, &value);
-                  rv = TRUE;
-                }
-              }
-            }
-            ctpl_value_free_value (&value);
-          }
-        }
-      }
-    }
-    g_free (symbol);
+  state.data = data;
+  state.cur = data + start;
+  state.end = data + end;
+  state.name = name;
+  state.line = line;
+  state.pos = pos;
+  state.symbol = g_string_sized_new (64);
+  /* values are allocated along with the symbols, as they usually live as long
+   * as each other */
+  state.arena = env->symbol_table.arena;
+  symbol_table_reserve (&env->symbol_table,
+                        count_statements (state.cur, state.end));
+  skip_blank (&state);
+  while (rv && state.cur < state.end) {
+    rv = load_next (env, &state, error);
+    /* skip blanks again to try to reach end before next call */
+    skip_blank (&state);
   }
+  g_string_free (state.symbol, TRUE);
   
   return rv;
 }
@@ -712,6 +1825,10 @@ load_next (CtplEnviron     *env,
  * @error: Return location for an error, or %NULL to ignore them
  * 
  * Loads an environment description from a #CtplInputStream.
+ * The whole remaining of the stream is read.
+ * 
+ * Loaded values are allocated in bulk, so their memory is only given back
+ * with @env, even if they are popped.
  * 
  * Returns: %TRUE on success, %FALSE otherwise.
  */
@@ -720,16 +1837,37 @@ ctpl_environ_add_from_stream (CtplEnviron      *env,
                               CtplInputStream  *stream,
                               GError          **error)
 {
-  GError   *err = NULL;
+  gboolean  rv = FALSE;
+  gchar    *data;
+  gsize     size = STREAM_CHUNK_SIZE;
+  gsize     length = 0;
+  gssize    n_read;
+  guint     line;
+  guint     pos;
   
-  while (! err && ! ctpl_input_stream_eof (stream, &err)) {
-    load_next (env, stream, &err);
-  }
-  if (err) {
-    g_propagate_error (error, err);
+  line = ctpl_input_stream_get_line (stream);
+  pos = ctpl_input_stream_get_line_position (stream);
+  data = g_malloc (size);
+  do {
+    if (size - length < STREAM_CHUNK_SIZE) {
+      size *= 2;
+      data = g_realloc (data, size);
+    }
+    n_read = ctpl_input_stream_read (stream, &data[length], size - length,
+                                     error);
+    if (n_read > 0) {
+      length += (gsize) n_read;
+    }
+  } while (n_read > 0);
+  if (n_read == 0) {
+    const gchar *name = ctpl_input_stream_get_name (stream);
+    
+    rv = load_buffer (env, data, 0, length, name ? name : _("<stream>"),
+                      line, pos, error);
   }
+  g_free (data);
   
-  return ! err;
+  return rv;
 }
 
 /**
@@ -748,13 +1886,280 @@ ctpl_environ_add_from_string (CtplEnviron  *env,
                               const gchar  *string,
                               GError      **error)
 {
-  gboolean          rv;
-  CtplInputStream  *stream;
+  return load_buffer (env, string, 0, strlen (string),
+                      _("environment description"), 1, 0, error);
+}
+
+/*
+ * find_split_point:
+ * @data: An environment description
+ * @start: Offset in @data of the start of a statement
+ * @target: Offset in @data from which a split point is wanted
+ * @length: Length of @data
+ * 
+ * Finds where to split an environment description so that each part only
+ * contains whole statements: the offset right after the first
+ * <code>;</code> found after @target that is neither part of a string, of a
+ * comment nor of an array.  Scanning starts at @start so the context of each
+ * character is known.
+ * 
+ * Returns: The offset of the split point, or @length if there is none.
+ */
+static gsize
+find_split_point (const gchar *data,
+                  gsize        start,
+                  gsize        target,
+                  gsize        length)
+{
+  const gchar  *p     = data + start;
+  const gchar  *end   = data + length;
+  guint         depth = 0;
+  
+  for (; p < end; p++) {
+    switch (*p) {
+      case CTPL_STRING_DELIMITER_CHAR:
+        for (p++; p < end && *p != CTPL_STRING_DELIMITER_CHAR; p++) {
+          if (*p == CTPL_ESCAPE_CHAR && p + 1 < end) {
+            p++;
+          }
+        }
+        break;
+      
+      case SINGLE_COMMENT_START:
+        while (p + 1 < end && ! ctpl_char_is_class (p[1], CTPL_CHAR_CLASS_EOL)) {
+          p++;
+        }
+        break;
+      
+      case ARRAY_START_CHAR:
+        depth++;
+        break;
+      
+      case ARRAY_END_CHAR:
+        if (depth > 0) {
+          depth--;
+        }
+        break;
+      
+      case VALUE_END_CHAR:
+        if (depth == 0 && p >= data + target) {
+          return (gsize) (p + 1 - data);
+        }
+        break;
+    }
+  }
+  
+  return length;
+}
+
+/* a part of an environment description loaded by a worker thread */
+typedef struct _LoaderChunk LoaderChunk;
+struct _LoaderChunk
+{
+  const gchar  *data;   /* the whole description */
+  gsize         start;  /* offset of the chunk in @data */
+  gsize         end;    /* offset of the end of the chunk in @data */
+  const gchar  *name;   /* name of the description */
+  CtplEnviron  *env;    /* environ in which load the chunk */
+  GError       *error;  /* loading error, if any */
+};
+
+/* #GFunc loading a #LoaderChunk */
+static void
+load_chunk (gpointer data,
+            gpointer user_data)
+{
+  LoaderChunk *chunk = data;
+  
+  load_buffer (chunk->env, chunk->data, chunk->start, chunk->end, chunk->name,
+               1, 0, &chunk->error);
+}
+
+/* moves the values of @symbol to the environ @env, pushing them in the order
+ * they were pushed on @symbol's stack, and leaves @symbol empty */
+static void
+steal_symbol (CtplEnviron *env,
+              CtplSymbol  *symbol)
+{
+  CtplStack *stack = &symbol->stack;
+  CtplStack *dest;
   
-  stream = ctpl_input_stream_new_for_memory (string, -1, NULL,
-                                             _("environment description"));
-  rv = ctpl_environ_add_from_stream (env, stream, error);
-  ctpl_input_stream_unref (stream);
+  dest = ctpl_environ_add_stack (env, symbol->name);
+  if (ctpl_stack_is_empty (dest)) {
+    symbol_changed (env, symbol->name, NULL, ctpl_stack_peek (stack));
+    *dest = *stack;
+    ctpl_stack_init (stack);
+  } else {
+    GSList *values = NULL;
+    GSList *item;
+    
+    if (! ctpl_stack_is_empty (stack)) {
+      symbol_changed (env, symbol->name,
+                      ctpl_stack_peek (dest), ctpl_stack_peek (stack));
+    }
+    /* popping starts at the top, so the list ends up bottom first */
+    while (! ctpl_stack_is_empty (stack)) {
+      values = g_slist_prepend (values, ctpl_stack_pop (stack));
+    }
+    for (item = values; item; item = item->next) {
+      ctpl_stack_push (dest, item->data);
+    }
+    g_slist_free (values);
+  }
+}
+
+/* moves all symbols of @source on top of the ones of @env */
+static void
+steal_environ (CtplEnviron *env,
+               CtplEnviron *source)
+{
+  if (env->symbol_table.symbols->len == 0 && ! env->snapshot) {
+    CtplSymbolTable table = env->symbol_table;
+    guint64         fingerprint = env->fingerprint;
+    GHashTable     *dirty = env->dirty;
+    gboolean        stale = env->stale;
+    
+    /* nothing to merge with, simply swap the tables */
+    env->symbol_table = source->symbol_table;
+    source->symbol_table = table;
+    env->fingerprint = source->fingerprint;
+    source->fingerprint = fingerprint;
+    env->dirty = source->dirty;
+    source->dirty = dirty;
+    env->stale = source->stale;
+    source->stale = stale;
+    log_reset (env);
+  } else {
+    guint i;
+    
+    symbol_table_reserve (&env->symbol_table,
+                          source->symbol_table.symbols->len);
+    for (i = 0; i < source->symbol_table.symbols->len; i++) {
+      steal_symbol (env, g_ptr_array_index (source->symbol_table.symbols, i));
+    }
+    /* the stolen values may live in the arenas of @source */
+    env->symbol_table.arenas = g_slist_concat (source->symbol_table.arenas,
+                                               env->symbol_table.arenas);
+    env->symbol_table.arenas = g_slist_prepend (env->symbol_table.arenas,
+                                                source->symbol_table.arena);
+    /* all the stacks are empty now, and the arenas belong to @env */
+    g_ptr_array_free (source->symbol_table.symbols, TRUE);
+    g_free (source->symbol_table.slots);
+    symbol_table_init (&source->symbol_table);
+  }
+}
+
+/*
+ * load_buffer_parallel:
+ * @env: A #CtplEnviron to fill
+ * @data: The environment description
+ * @length: Length of @data
+ * @name: The name of the description, for error messages
+ * @n_threads: The number of threads to use
+ * @error: Return location for an error, or %NULL to ignore them
+ * 
+ * Loads an environment description from memory using several threads.  The
+ * description is split at statement boundaries, each part is loaded into its
+ * own environ by a worker thread and the results are merged in order.  This
+ * gives the same result as load_buffer(), including which symbols were loaded
+ * when an error occurs.
+ * 
+ * Returns: %TRUE on success, %FALSE otherwise.
+ */
+static gboolean
+load_buffer_parallel (CtplEnviron *env,
+                      const gchar *data,
+                      gsize        length,
+                      const gchar *name,
+                      guint        n_threads,
+                      GError     **error)
+{
+  gboolean      rv = TRUE;
+  LoaderChunk  *chunks;
+  GThreadPool  *pool;
+  guint         n_chunks;
+  guint         i;
+  
+  n_chunks = (guint) MIN (n_threads, length / LOADER_MIN_CHUNK_SIZE);
+  if (n_chunks < 2) {
+    return load_buffer (env, data, 0, length, name, 1, 0, error);
+  }
+  
+  chunks = g_new (LoaderChunk, n_chunks);
+  for (i = 0; i < n_chunks; i++) {
+    chunks[i].data = data;
+    chunks[i].start = (i > 0) ? chunks[i - 1].end : 0;
+    if (i + 1 < n_chunks) {
+      chunks[i].end = find_split_point (data, chunks[i].start,
+                                        length / n_chunks * (i + 1), length);
+    } else {
+      chunks[i].end = length;
+    }
+    chunks[i].name = name;
+    chunks[i].env = ctpl_environ_new ();
+    chunks[i].error = NULL;
+  }
+  pool = g_thread_pool_new (load_chunk, NULL, (gint) n_chunks, TRUE, NULL);
+  for (i = 0; i < n_chunks; i++) {
+    if (! pool || ! g_thread_pool_push (pool, &chunks[i], NULL)) {
+      /* no thread available, load it ourselves */
+      load_chunk (&chunks[i], NULL);
+    }
+  }
+  if (pool) {
+    /* wait for all chunks to be loaded */
+    g_thread_pool_free (pool, FALSE, TRUE);
+  }
+  
+  for (i = 0; i < n_chunks; i++) {
+    /* stop merging after the first failure, as sequential loading would */
+    if (rv) {
+      steal_environ (env, chunks[i].env);
+      if (chunks[i].error) {
+        g_propagate_error (error, chunks[i].error);
+        rv = FALSE;
+      }
+    } else if (chunks[i].error) {
+      g_error_free (chunks[i].error);
+    }
+    ctpl_environ_unref (chunks[i].env);
+  }
+  g_free (chunks);
+  
+  return rv;
+}
+
+/* loads the environment description at @path using @n_threads threads */
+static gboolean
+load_path (CtplEnviron *env,
+           const gchar *path,
+           guint        n_threads,
+           GError     **error)
+{
+  gboolean      rv = FALSE;
+  GMappedFile  *file;
+  
+  file = g_mapped_file_new (path, FALSE, NULL);
+  if (file) {
+    gchar *name;
+    
+    name = g_filename_display_basename (path);
+    rv = load_buffer_parallel (env, g_mapped_file_get_contents (file),
+                               g_mapped_file_get_length (file), name,
+                               n_threads, error);
+    g_free (name);
+    g_mapped_file_unref (file);
+  } else {
+    CtplInputStream *stream;
+    
+    /* not a mappable file, go through GIO to get the appropriate error or
+     * to read from whatever it is */
+    stream = ctpl_input_stream_new_for_path (path, error);
+    if (stream) {
+      rv = ctpl_environ_add_from_stream (env, stream, error);
+      ctpl_input_stream_unref (stream);
+    }
+  }
   
   return rv;
 }
@@ -780,13 +2185,459 @@ ctpl_environ_add_from_path (CtplEnviron *env,
                             const gchar *path,
                             GError     **error)
 {
-  gboolean  rv = FALSE;
-  CtplInputStream *stream;
+  return load_path (env, path, 1, error);
+}
+
+/**
+ * ctpl_environ_add_from_path_parallel:
+ * @env: A #CtplEnviron to fill
+ * @path: The path of the file from which load the environment description, in
+ *        the GLib's filename encoding
+ * @n_threads: The maximum number of threads to use, or 0 to use as many as
+ *             there are processors
+ * @error: Return location for an error, or %NULL to ignore them
+ * 
+ * Loads an environment description from a path using several threads.  The
+ * description is split at statement boundaries and each part is loaded by a
+ * worker thread.  The result is the same as with ctpl_environ_add_from_path():
+ * the parts are added in the order they appear in the file, so later
+ * definitions of a symbol are pushed over the earlier ones.
+ * 
+ * This is only useful with large descriptions, smaller ones are loaded by the
+ * calling thread.
+ * 
+ * Returns: %TRUE on success, %FALSE otherwise.
+ * 
+ * Since: 0.4
+ */
+gboolean
+ctpl_environ_add_from_path_parallel (CtplEnviron *env,
+                                     const gchar *path,
+                                     guint        n_threads,
+                                     GError     **error)
+{
+  if (n_threads == 0) {
+#if GLIB_CHECK_VERSION (2, 36, 0)
+    n_threads = g_get_num_processors ();
+#else
+    n_threads = 1;
+#endif
+  }
+#if ! GLIB_CHECK_VERSION (2, 32, 0)
+  if (! g_thread_supported ()) {
+    /* the GLib thread system isn't initialized, we can't use threads */
+    n_threads = 1;
+  }
+#endif
+
+  return load_path (env, path, n_threads, error);
+}
+
+
+/*============================ environment snapshots =========================*/
+
+/*
+ * Snapshots are a binary serialization of an environ, as a #GVariant of type
+ * %SNAPSHOT_TYPE:
+ * 
+ *  - a magic string, %SNAPSHOT_MAGIC;
+ *  - a format version, %SNAPSHOT_VERSION;
+ *  - the symbols, sorted by name, each with its values from the bottom to the
+ *    top of its stack.
+ * 
+ * Values are stored as <code>x</code> for integers, <code>d</code> for floats,
+ * <code>ay</code> for strings (as they may not be UTF-8) and <code>av</code>
+ * for arrays.  Symbol names are stored as <code>ay</code> too.
+ * 
+ * Sorting the symbols allows to find them with a binary search right in the
+ * mapped file, so a snapshot doesn't need to be read before use and only the
+ * symbols actually looked up get decoded.
+ */
+#define SNAPSHOT_MAGIC    "CtplEnviron"
+#define SNAPSHOT_VERSION  1
+#define SNAPSHOT_TYPE     "(sua(ayav))"
+
+
+/* decodes a value stored in a snapshot */
+static CtplValue *
+snapshot_decode_value (GVariant *variant)
+{
+  CtplValue *value;
   
-  stream = ctpl_input_stream_new_for_path (path, error);
-  if (stream) {
-    rv = ctpl_environ_add_from_stream (env, stream, error);
+  value = ctpl_value_new ();
+  switch (g_variant_classify (variant)) {
+    case G_VARIANT_CLASS_INT64:
+      ctpl_value_set_int (value, (glong) g_variant_get_int64 (variant));
+      break;
+    
+    case G_VARIANT_CLASS_DOUBLE:
+      ctpl_value_set_float (value, g_variant_get_double (variant));
+      break;
+    
+    case G_VARIANT_CLASS_ARRAY:
+      if (g_variant_is_of_type (variant, G_VARIANT_TYPE_BYTESTRING)) {
+        /* served from the snapshot's data, that @variant keeps alive */
+        ctpl_value_borrow_string (value, g_variant_get_bytestring (variant),
+                                  g_variant_ref (variant),
+                                  (GDestroyNotify) g_variant_unref);
+      } else {
+        GSList *items = NULL;
+        gsize   n = g_variant_n_children (variant);
+        gsize   i;
+        
+        for (i = 0; i < n; i++) {
+          GVariant *child = g_variant_get_child_value (variant, i);
+          GVariant *item = g_variant_get_variant (child);
+          
+          items = g_slist_prepend (items, snapshot_decode_value (item));
+          g_variant_unref (item);
+          g_variant_unref (child);
+        }
+        ctpl_value_take_array (value, g_slist_reverse (items));
+      }
+      break;
+    
+    default:
+      /* cannot happen with a snapshot we wrote, and the value is already a
+       * valid one anyway */
+      break;
   }
   
+  return value;
+}
+
+/* pushes all values of a snapshot entry on @stack */
+static void
+snapshot_push_entry (GVariant  *entry,
+                     CtplStack *stack)
+{
+  GVariant *values;
+  gsize     n;
+  gsize     i;
+  
+  values = g_variant_get_child_value (entry, 1);
+  n = g_variant_n_children (values);
+  for (i = 0; i < n; i++) {
+    GVariant *child = g_variant_get_child_value (values, i);
+    GVariant *value = g_variant_get_variant (child);
+    
+    ctpl_stack_push (stack, snapshot_decode_value (value));
+    g_variant_unref (value);
+    g_variant_unref (child);
+  }
+  g_variant_unref (values);
+}
+
+/* finds the entry of @symbol in @snapshot, or returns %NULL */
+static GVariant *
+snapshot_find_entry (GVariant    *snapshot,
+                     const gchar *symbol)
+{
+  gsize low = 0;
+  gsize high = g_variant_n_children (snapshot);
+  
+  while (low < high) {
+    gsize     mid = low + (high - low) / 2;
+    GVariant *entry = g_variant_get_child_value (snapshot, mid);
+    GVariant *key = g_variant_get_child_value (entry, 0);
+    gint      cmp;
+    
+    cmp = strcmp (symbol, g_variant_get_bytestring (key));
+    g_variant_unref (key);
+    if (cmp == 0) {
+      return entry;
+    }
+    g_variant_unref (entry);
+    if (cmp < 0) {
+      high = mid;
+    } else {
+      low = mid + 1;
+    }
+  }
+  
+  return NULL;
+}
+
+/*
+ * snapshot_load_symbol:
+ * @env: A #CtplEnviron with a snapshot
+ * @symbol: A symbol that isn't loaded yet
+ * 
+ * Loads a symbol from @env's snapshot.  Symbols not part of the snapshot get
+ * an empty stack so the next lookups don't search for them again.
+ * 
+ * Returns: The stack of @symbol.
+ */
+static CtplStack *
+snapshot_load_symbol (CtplEnviron *env,
+                      const gchar *symbol)
+{
+  CtplStack  *stack;
+  GVariant   *entry;
+  
+  stack = &symbol_table_add (&env->symbol_table, symbol)->stack;
+  entry = snapshot_find_entry (env->snapshot, symbol);
+  if (entry) {
+    snapshot_push_entry (entry, stack);
+    update_fingerprint (env, symbol, NULL, ctpl_stack_peek (stack));
+    g_variant_unref (entry);
+  }
+  
+  return stack;
+}
+
+/* loads all symbols not loaded yet from @env's snapshot, and drops it */
+static void
+snapshot_load_all (CtplEnviron *env)
+{
+  if (env->snapshot) {
+    gsize n = g_variant_n_children (env->snapshot);
+    gsize i;
+    
+    for (i = 0; i < n; i++) {
+      GVariant     *entry = g_variant_get_child_value (env->snapshot, i);
+      GVariant     *key = g_variant_get_child_value (entry, 0);
+      const gchar  *symbol = g_variant_get_bytestring (key);
+      
+      if (! symbol_table_lookup (&env->symbol_table, symbol)) {
+        CtplStack *stack = &symbol_table_add (&env->symbol_table,
+                                              symbol)->stack;
+        
+        snapshot_push_entry (entry, stack);
+        update_fingerprint (env, symbol, NULL, ctpl_stack_peek (stack));
+      }
+      g_variant_unref (key);
+      g_variant_unref (entry);
+    }
+    g_variant_unref (env->snapshot);
+    env->snapshot = NULL;
+  }
+}
+
+/* encodes a value to store in a snapshot */
+static GVariant *
+snapshot_encode_value (const CtplValue *value)
+{
+  GVariant *variant = NULL;
+  
+  switch (ctpl_value_get_held_type (value)) {
+    case CTPL_VTYPE_INT:
+      variant = g_variant_new_int64 (ctpl_value_get_int (value));
+      break;
+    
+    case CTPL_VTYPE_FLOAT:
+      variant = g_variant_new_double (ctpl_value_get_float (value));
+      break;
+    
+    case CTPL_VTYPE_STRING:
+      variant = g_variant_new_bytestring (ctpl_value_get_string (value));
+      break;
+    
+    case CTPL_VTYPE_ARRAY: {
+      GVariantBuilder   builder;
+      const GSList     *item;
+      
+      g_variant_builder_init (&builder, G_VARIANT_TYPE ("av"));
+      for (item = ctpl_value_get_array (value); item; item = item->next) {
+        g_variant_builder_add (&builder, "v",
+                               snapshot_encode_value (item->data));
+      }
+      variant = g_variant_builder_end (&builder);
+      break;
+    }
+    
+    case CTPL_VTYPE_ITERATOR: {
+      CtplValue array;
+      
+      /* snapshots hold the items, not the iterator */
+      ctpl_value_init (&array);
+      ctpl_value_copy (value, &array);
+      ctpl_value_convert (&array, CTPL_VTYPE_ARRAY);
+      variant = snapshot_encode_value (&array);
+      ctpl_value_free_value (&array);
+      break;
+    }
+  }
+  
+  return variant;
+}
+
+/* GFunc prepending the snapshot encoding of a value to a list */
+static void
+snapshot_encode_value_gfunc (gpointer value,
+                             gpointer list)
+{
+  *(GSList **) list = g_slist_prepend (*(GSList **) list,
+                                       snapshot_encode_value (value));
+}
+
+/* GCompareFunc for sorting symbols the way snapshot_find_entry() expects */
+static gint
+snapshot_compare_symbols (gconstpointer a,
+                          gconstpointer b)
+{
+  const CtplSymbol *symbol_a = a;
+  const CtplSymbol *symbol_b = b;
+  
+  return strcmp (symbol_a->name, symbol_b->name);
+}
+
+/**
+ * ctpl_environ_write_snapshot:
+ * @env: A #CtplEnviron
+ * @path: The path of the file to write, in the GLib's filename encoding
+ * @error: Return location for an error, or %NULL to ignore them
+ * 
+ * Writes a binary snapshot of a #CtplEnviron, that can be loaded back with
+ * ctpl_environ_add_from_snapshot().  All values of all symbols are saved, not
+ * only the topmost ones.
+ * 
+ * Snapshots are not meant to be portable between different versions of CTPL.
+ * 
+ * Returns: %TRUE on success, %FALSE otherwise.
+ * 
+ * Since: 0.4
+ */
+gboolean
+ctpl_environ_write_snapshot (CtplEnviron *env,
+                             const gchar *path,
+                             GError     **error)
+{
+  GVariantBuilder builder;
+  GVariant       *snapshot;
+  GList          *symbols = NULL;
+  GList          *item;
+  guint           i;
+  gboolean        rv;
+  
+  snapshot_load_all (env);
+  for (i = 0; i < env->symbol_table.symbols->len; i++) {
+    symbols = g_list_prepend (symbols,
+                              g_ptr_array_index (env->symbol_table.symbols, i));
+  }
+  symbols = g_list_sort (symbols, snapshot_compare_symbols);
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(ayav)"));
+  for (item = symbols; item; item = item->next) {
+    CtplSymbol *symbol = item->data;
+    CtplStack  *stack = &symbol->stack;
+    
+    if (! ctpl_stack_is_empty (stack)) {
+      GSList *values = NULL;
+      GSList *value;
+      
+      /* the stack is walked from the top, so the list ends up bottom first */
+      ctpl_stack_foreach (stack, snapshot_encode_value_gfunc, &values);
+      g_variant_builder_open (&builder, G_VARIANT_TYPE ("(ayav)"));
+      g_variant_builder_add (&builder, "^ay", symbol->name);
+      g_variant_builder_open (&builder, G_VARIANT_TYPE ("av"));
+      for (value = values; value; value = value->next) {
+        g_variant_builder_add (&builder, "v", value->data);
+      }
+      g_variant_builder_close (&builder);
+      g_variant_builder_close (&builder);
+      g_slist_free (values);
+    }
+  }
+  g_list_free (symbols);
+  snapshot = g_variant_new ("(su@a(ayav))", SNAPSHOT_MAGIC, SNAPSHOT_VERSION,
+                            g_variant_builder_end (&builder));
+  g_variant_ref_sink (snapshot);
+  rv = g_file_set_contents (path, g_variant_get_data (snapshot),
+                            (gssize) g_variant_get_size (snapshot), error);
+  g_variant_unref (snapshot);
+  
   return rv;
 }
+
+/**
+ * ctpl_environ_add_from_snapshot:
+ * @env: A #CtplEnviron to fill
+ * @path: The path of a snapshot written by ctpl_environ_write_snapshot(), in
+ *        the GLib's filename encoding
+ * @error: Return location for an error, or %NULL to ignore them
+ * 
+ * Loads an environment snapshot written by ctpl_environ_write_snapshot().
+ * 
+ * If @env is empty, the snapshot is mapped in memory and its symbols are only
+ * loaded when they are first looked up, so this is almost instantaneous
+ * whatever the size of the snapshot.  Otherwise, all symbols are loaded and
+ * pushed over the existing ones right away.
+ * 
+ * Errors can come from the %G_FILE_ERROR domain if the file loading failed, or
+ * from the %CTPL_ENVIRON_ERROR domain if it is not a valid snapshot.
+ * 
+ * Returns: %TRUE on success, %FALSE otherwise.
+ * 
+ * Since: 0.4
+ */
+gboolean
+ctpl_environ_add_from_snapshot (CtplEnviron *env,
+                                const gchar *path,
+                                GError     **error)
+{
+  GMappedFile  *file;
+  GVariant     *snapshot;
+  const gchar  *magic = NULL;
+  guint32       version = 0;
+  
+  file = g_mapped_file_new (path, FALSE, error);
+  if (! file) {
+    return FALSE;
+  }
+  /* the data is validated on access, so this is safe even on a damaged or
+   * malicious file */
+  snapshot = g_variant_new_from_data (G_VARIANT_TYPE (SNAPSHOT_TYPE),
+                                      g_mapped_file_get_contents (file),
+                                      g_mapped_file_get_length (file), FALSE,
+                                      (GDestroyNotify) g_mapped_file_unref,
+                                      file);
+  g_variant_ref_sink (snapshot);
+  g_variant_get_child (snapshot, 1, "u", &version);
+  if (version == GUINT32_SWAP_LE_BE (SNAPSHOT_VERSION)) {
+    GVariant *swapped;
+    
+    /* written on a machine of the other endianness */
+    swapped = g_variant_byteswap (snapshot);
+    g_variant_unref (snapshot);
+    snapshot = swapped;
+    version = SNAPSHOT_VERSION;
+  }
+  g_variant_get_child (snapshot, 0, "&s", &magic);
+  if (strcmp (magic, SNAPSHOT_MAGIC) != 0 || version != SNAPSHOT_VERSION) {
+    gchar *name = g_filename_display_name (path);
+    
+    g_set_error (error, CTPL_ENVIRON_ERROR, CTPL_ENVIRON_ERROR_FAILED,
+                 _("File \"%s\" is not a valid environment snapshot"), name);
+    g_free (name);
+    g_variant_unref (snapshot);
+    return FALSE;
+  }
+  
+  if (env->symbol_table.symbols->len == 0 && ! env->snapshot) {
+    env->snapshot = g_variant_get_child_value (snapshot, 2);
+    log_reset (env);
+  } else {
+    GVariant *entries = g_variant_get_child_value (snapshot, 2);
+    gsize     n = g_variant_n_children (entries);
+    gsize     i;
+    
+    for (i = 0; i < n; i++) {
+      GVariant     *entry = g_variant_get_child_value (entries, i);
+      GVariant     *key = g_variant_get_child_value (entry, 0);
+      const gchar  *symbol = g_variant_get_bytestring (key);
+      CtplStack    *stack;
+      CtplValue    *old_value;
+      
+      stack = ctpl_environ_add_stack (env, symbol);
+      old_value = ctpl_stack_peek (stack);
+      snapshot_push_entry (entry, stack);
+      symbol_changed (env, symbol, old_value, ctpl_stack_peek (stack));
+      g_variant_unref (key);
+      g_variant_unref (entry);
+    }
+    g_variant_unref (entries);
+  }
+  g_variant_unref (snapshot);
+  
+  return TRUE;
+}
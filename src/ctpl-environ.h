@@ -74,6 +74,51 @@ typedef gboolean (*CtplEnvironForeachFunc)  (CtplEnviron     *env,
                                              const gchar     *symbol,
                                              const CtplValue *value,
                                              gpointer         user_data);
+/**
+ * CtplEnvironResolveFunc:
+ * @env: The #CtplEnviron in which @symbol was looked up
+ * @symbol: The symbol to resolve
+ * @value: A #CtplValue to fill with the symbol's value
+ * @user_data: User data passed to ctpl_environ_set_resolver()
+ * 
+ * User function for ctpl_environ_set_resolver(), called to get the value of
+ * a symbol that cannot be found in an environment.
+ * 
+ * Returns: %TRUE if @symbol was resolved and @value filled, %FALSE if the
+ *          symbol is unknown.
+ * 
+ * Since: 0.4
+ */
+typedef gboolean (*CtplEnvironResolveFunc)  (CtplEnviron     *env,
+                                             const gchar     *symbol,
+                                             CtplValue       *value,
+                                             gpointer         user_data);
+/**
+ * CtplEnvironFunction:
+ * @env: The #CtplEnviron in which the function is called
+ * @name: The name under which the function was called
+ * @args: (array length=n_args): The values of the arguments of the call.
+ *        They should not be modified or freed.
+ * @n_args: The number of arguments in @args
+ * @result: A #CtplValue to fill with the result of the call
+ * @user_data: User data passed to ctpl_environ_add_function()
+ * @error: Return location for errors, or %NULL to ignore them
+ * 
+ * User function for ctpl_environ_add_function(), implementing a function
+ * callable from templates.
+ * 
+ * Returns: %TRUE on success, %FALSE on failure, in which case @error should be
+ *          set.
+ * 
+ * Since: 0.4
+ */
+typedef gboolean (*CtplEnvironFunction)     (CtplEnviron      *env,
+                                             const gchar      *name,
+                                             const CtplValue **args,
+                                             guint             n_args,
+                                             CtplValue        *result,
+                                             gpointer          user_data,
+                                             GError          **error);
 
 
 GQuark            ctpl_environ_error_quark      (void) G_GNUC_CONST;
@@ -103,6 +148,20 @@ void              ctpl_environ_foreach          (CtplEnviron           *env,
 void              ctpl_environ_merge            (CtplEnviron        *env,
                                                  const CtplEnviron  *source,
                                                  gboolean            merge_symbols);
+guint64           ctpl_environ_get_fingerprint  (CtplEnviron *env);
+void              ctpl_environ_set_resolver     (CtplEnviron            *env,
+                                                 CtplEnvironResolveFunc  func,
+                                                 gboolean                memoize,
+                                                 gpointer                user_data,
+                                                 GDestroyNotify          destroy);
+void              ctpl_environ_forget_resolved  (CtplEnviron *env);
+void              ctpl_environ_add_function     (CtplEnviron         *env,
+                                                 const gchar         *name,
+                                                 CtplEnvironFunction  func,
+                                                 gpointer             user_data,
+                                                 GDestroyNotify       destroy);
+gboolean          ctpl_environ_remove_function  (CtplEnviron *env,
+                                                 const gchar *name);
 gboolean          ctpl_environ_add_from_stream  (CtplEnviron     *env,
                                                  CtplInputStream *stream,
                                                  GError         **error);
@@ -112,6 +171,16 @@ gboolean          ctpl_environ_add_from_string  (CtplEnviron  *env,
 gboolean          ctpl_environ_add_from_path    (CtplEnviron *env,
                                                  const gchar *path,
                                                  GError     **error);
+gboolean          ctpl_environ_add_from_path_parallel (CtplEnviron *env,
+                                                       const gchar *path,
+                                                       guint        n_threads,
+                                                       GError     **error);
+gboolean          ctpl_environ_add_from_snapshot (CtplEnviron *env,
+                                                  const gchar *path,
+                                                  GError     **error);
+gboolean          ctpl_environ_write_snapshot   (CtplEnviron *env,
+                                                 const gchar *path,
+                                                 GError     **error);
 
 
 G_END_DECLS
@@ -18,15 +18,22 @@
  */
 
 #include "ctpl-eval.h"
+#include "ctpl-eval-private.h"
 #include <string.h>
 #include <glib.h>
 #include "ctpl-i18n.h"
 #include "ctpl-lexer-private.h"
 #include "ctpl-environ.h"
+#include "ctpl-environ-private.h"
 #include "ctpl-value.h"
+#include "ctpl-value-private.h"
 #include "ctpl-token.h"
 #include "ctpl-token-private.h"
 #include "ctpl-mathutils.h"
+#include "ctpl-arena.h"
+#include "ctpl-arena-private.h"
+#include "ctpl-budget.h"
+#include "ctpl-parser.h"
 
 
 /**
@@ -58,34 +65,90 @@ ctpl_eval_error_quark (void)
 }
 
 
-static gboolean   ctpl_eval_bool_value      (const CtplValue *value);
+static gboolean         ctpl_eval_bool_value  (const CtplValue *value);
+static gboolean         ctpl_eval_value_base  (const CtplTokenExpr  *expr,
+                                               CtplEnviron          *env,
+                                               CtplValue            *value,
+                                               GError              **error);
+static const CtplValue *ctpl_eval_value_index (const CtplTokenExpr  *expr,
+                                               CtplEnviron          *env,
+                                               const CtplValue      *value,
+                                               CtplValue            *storage,
+                                               GError              **error);
 
 
-/* check if value types matches @vtype and try to convert if necessary
- * throw a CTPL_EVAL_ERROR_INVALID_OPERAND if cannot convert to requested type */
+/* throw a CTPL_EVAL_ERROR_INVALID_OPERAND for operands that cannot be used as
+ * @vtype, @lvalid telling whether the left one could */
+static void
+set_operands_type_error (GError          **error,
+                         const CtplValue  *lvalue,
+                         const CtplValue  *rvalue,
+                         gboolean          lvalid,
+                         CtplValueType     vtype,
+                         const gchar      *operator_name)
+{
+  g_set_error (error, CTPL_EVAL_ERROR, CTPL_EVAL_ERROR_INVALID_OPERAND,
+               _("Invalid operands for operator '%s' (have '%s' and '%s', "
+                 "expect operands compatible with '%s')"),
+               operator_name,
+               lvalid ? ctpl_value_type_get_name (vtype)
+                      : ctpl_value_get_held_type_name (lvalue),
+               ctpl_value_get_held_type_name (rvalue),
+               ctpl_value_type_get_name (vtype));
+}
+
+/* get the values of the operands as floats, using their numeric views rather
+ * than converting them
+ * throw a CTPL_EVAL_ERROR_INVALID_OPERAND if they are not compatible */
 static gboolean
-ensure_operands_type (CtplValue     *lvalue,
-                      CtplValue     *rvalue,
-                      CtplValueType  vtype,
-                      const gchar   *operator_name,
-                      GError       **error)
+get_float_operands (const CtplValue  *lvalue,
+                    const CtplValue  *rvalue,
+                    const gchar      *operator_name,
+                    gdouble          *lval,
+                    gdouble          *rval,
+                    GError          **error)
 {
-  gboolean rv = FALSE;
+  gboolean lvalid;
   
-  if (! ctpl_value_convert (lvalue, vtype) ||
-      ! ctpl_value_convert (rvalue, vtype)) {
-    g_set_error (error, CTPL_EVAL_ERROR, CTPL_EVAL_ERROR_INVALID_OPERAND,
-                 _("Invalid operands for operator '%s' (have '%s' and '%s', "
-                   "expect operands compatible with '%s')"),
-                 operator_name,
-                 ctpl_value_get_held_type_name (lvalue),
-                 ctpl_value_get_held_type_name (rvalue),
-                 ctpl_value_type_get_name (vtype));
-  } else {
-    rv = TRUE;
+  lvalid = ctpl_value_get_float_view (lvalue, lval);
+  if (! lvalid || ! ctpl_value_get_float_view (rvalue, rval)) {
+    set_operands_type_error (error, lvalue, rvalue, lvalid, CTPL_VTYPE_FLOAT,
+                             operator_name);
+    return FALSE;
   }
   
-  return rv;
+  return TRUE;
+}
+
+/* same as get_float_operands() for integers */
+static gboolean
+get_int_operands (const CtplValue  *lvalue,
+                  const CtplValue  *rvalue,
+                  const gchar      *operator_name,
+                  glong            *lval,
+                  glong            *rval,
+                  GError          **error)
+{
+  gboolean lvalid;
+  
+  lvalid = ctpl_value_get_int_view (lvalue, lval);
+  if (! lvalid || ! ctpl_value_get_int_view (rvalue, rval)) {
+    set_operands_type_error (error, lvalue, rvalue, lvalid, CTPL_VTYPE_INT,
+                             operator_name);
+    return FALSE;
+  }
+  
+  return TRUE;
+}
+
+/* converts @value to a regular array if it holds an iterator, since operators
+ * need all the items of their operands */
+static void
+materialize_operand (CtplValue *value)
+{
+  if (CTPL_VALUE_HOLDS_ITERATOR (value)) {
+    ctpl_value_convert (value, CTPL_VTYPE_ARRAY);
+  }
 }
 
 /* Tries to evaluate a subtraction operation */
@@ -95,12 +158,13 @@ ctpl_eval_operator_minus (CtplValue  *lvalue,
                           CtplValue  *value,
                           GError    **error)
 {
-  gboolean rv = TRUE;
+  gboolean  rv = TRUE;
+  gdouble   lval;
+  gdouble   rval;
   
-  rv = ensure_operands_type (lvalue, rvalue, CTPL_VTYPE_FLOAT, "-", error);
+  rv = get_float_operands (lvalue, rvalue, "-", &lval, &rval, error);
   if (rv) {
-    ctpl_value_set_float (value, ctpl_value_get_float (lvalue) -
-                                 ctpl_value_get_float (rvalue));
+    ctpl_value_set_float (value, lval - rval);
   }
   
   return rv;
@@ -143,13 +207,16 @@ ctpl_eval_operator_plus (CtplValue *lvalue,
       }
       /* WARNING: conditional break to fall back to floating conversion if one
        * operand is float */
-    case CTPL_VTYPE_FLOAT:
-      rv = ensure_operands_type (lvalue, rvalue, CTPL_VTYPE_FLOAT, "+", error);
+    case CTPL_VTYPE_FLOAT: {
+      gdouble lval;
+      gdouble rval;
+      
+      rv = get_float_operands (lvalue, rvalue, "+", &lval, &rval, error);
       if (rv) {
-        ctpl_value_set_float (value, ctpl_value_get_float (lvalue) +
-                                     ctpl_value_get_float (rvalue));
+        ctpl_value_set_float (value, lval + rval);
       }
       break;
+    }
     
     case CTPL_VTYPE_STRING:
       /* FIXME: should I use ctpl_value_to_string() or ctpl_value_convert()? */
@@ -180,40 +247,48 @@ ctpl_eval_operator_plus (CtplValue *lvalue,
         g_free (tmp);
       }
       break;
+    
+    case CTPL_VTYPE_ITERATOR:
+      /* operands are materialized by ctpl_eval_operator() */
+      g_assert_not_reached ();
   }
   
   return rv;
 }
 
+/* string multiplication results up to this size are allocated in the arena,
+ * larger ones had better be freed as soon as possible */
+#define MULTIPLY_ARENA_MAX  65536
+
 /*
  * do_multiply_string:
+ * @value: A #CtplValue to set to the result
  * @str: A string to multiply
  * @n: multiplication factor
+ * @arena: (allow-none): A #CtplArena for small results, or %NULL
+ * @error: Return location for an error, or %NULL to ignore them
  * 
  * Multiplies a string.
- * If @n is < 1, returns and empty string, otherwise, returns a new string
- * containing @str @n times.
+ * If @n is < 1, sets @value to an empty string, otherwise, sets it to a string
+ * containing @str @n times.  The result must fit in the limit of @arena, even
+ * if it is too large to be allocated there.
  * 
- * Returns: The result of the string multiplication, that must be freed with
- *          g_free() when no longer needed.
+ * Returns: %TRUE on success, %FALSE if the result cannot be allocated.
  */
-static gchar *
-do_multiply_string (const gchar  *str,
+static gboolean
+do_multiply_string (CtplValue    *value,
+                    const gchar  *str,
                     glong         n,
+                    CtplArena    *arena,
                     GError      **error)
 {
-  gchar *buf = NULL;
+  gboolean  rv      = TRUE;
+  gsize     str_len = strlen (str);
+  gsize     buf_len = 0;
+  gchar    *buf     = NULL;
+  gsize     done;
   
-  if (n < 1) {
-    buf = g_strdup ("");
-  } else if (n == 1) {
-    buf = g_strdup (str);
-  } else {
-    gsize       buf_len;
-    gsize       str_len;
-    gsize       i;
-    
-    str_len = strlen (str);
+  if (n >= 1) {
     /* detect possible integer overflow. last check is because we allocate one
      * more byte (string termination) */
     if (G_UNLIKELY ((str_len > 0 && (gsize)n > G_MAXSIZE / str_len) ||
@@ -222,30 +297,51 @@ do_multiply_string (const gchar  *str,
                    "String multiplication would overflow allocating "
                    "%"G_GSIZE_FORMAT"*%"G_GSIZE_FORMAT"+1 bytes",
                    (gsize)n, str_len);
+      rv = FALSE;
     } else {
       buf_len = str_len * (gsize)n;
-      buf = g_try_malloc (buf_len + 1);
-      if (G_UNLIKELY (! buf)) {
-        g_set_error (error, CTPL_EVAL_ERROR, CTPL_EVAL_ERROR_FAILED,
-                     "Cannot allocate %"G_GSIZE_FORMAT" bytes for string "
-                     "multiplication", buf_len + 1);
-      } else {
-        for (i = 0; i < (gsize)n; i++) {
-          memcpy (&buf[str_len * i], str, str_len);
-        }
-        buf[buf_len] = 0;
-      }
+    }
+  }
+  if (rv && arena && ! ctpl_arena_can_hold (arena, buf_len + 1)) {
+    /* check the memory budget before allocating anything */
+    g_set_error (error, CTPL_PARSER_ERROR, CTPL_PARSER_ERROR_MEMORY_LIMIT,
+                 _("String multiplication would exceed the memory budget of "
+                   "%"G_GSIZE_FORMAT" bytes allocating %"G_GSIZE_FORMAT" "
+                   "bytes"),
+                 ctpl_arena_get_limit (arena), buf_len + 1);
+    rv = FALSE;
+  }
+  if (rv) {
+    if (arena && buf_len <= MULTIPLY_ARENA_MAX) {
+      buf = ctpl_value_alloc_string (value, arena, buf_len);
+    } else if (G_UNLIKELY (! (buf = g_try_malloc (buf_len + 1)))) {
+      g_set_error (error, CTPL_EVAL_ERROR, CTPL_EVAL_ERROR_FAILED,
+                   "Cannot allocate %"G_GSIZE_FORMAT" bytes for string "
+                   "multiplication", buf_len + 1);
+      rv = FALSE;
+    } else {
+      buf[buf_len] = 0;
+      ctpl_value_take_string (value, buf);
+    }
+  }
+  if (rv && buf_len > 0) {
+    /* copy the string once, then double what's already there */
+    memcpy (buf, str, str_len);
+    for (done = str_len; done < buf_len; done *= 2) {
+      memcpy (&buf[done], buf, MIN (done, buf_len - done));
     }
   }
   
-  return buf;
+  return rv;
 }
 
-/* Tries to evaluate a multiplication operation */
+/* Tries to evaluate a multiplication operation, allocating a string result in
+ * @arena if not %NULL */
 static gboolean
 ctpl_eval_operator_mul (CtplValue *lvalue,
                         CtplValue *rvalue,
                         CtplValue *value,
+                        CtplArena *arena,
                         GError   **error)
 {
   gboolean      rv      = TRUE;
@@ -288,25 +384,32 @@ ctpl_eval_operator_mul (CtplValue *lvalue,
   if (rv) {
     switch (desttype) {
       case CTPL_VTYPE_ARRAY:
+      case CTPL_VTYPE_ITERATOR:
         /* fail, cannot multiply arrays */
         rv = FALSE;
         break;
       
-      case CTPL_VTYPE_INT:
-        rv = ensure_operands_type (lvalue, rvalue, CTPL_VTYPE_INT, "*", error);
+      case CTPL_VTYPE_INT: {
+        glong lval;
+        glong rval;
+        
+        rv = get_int_operands (lvalue, rvalue, "*", &lval, &rval, error);
         if (rv) {
-          ctpl_value_set_int (value, ctpl_value_get_int (lvalue) *
-                                     ctpl_value_get_int (rvalue));
+          ctpl_value_set_int (value, lval * rval);
         }
         break;
+      }
       
-      case CTPL_VTYPE_FLOAT:
-        rv = ensure_operands_type (lvalue, rvalue, CTPL_VTYPE_FLOAT, "*", error);
+      case CTPL_VTYPE_FLOAT: {
+        gdouble lval;
+        gdouble rval;
+        
+        rv = get_float_operands (lvalue, rvalue, "*", &lval, &rval, error);
         if (rv) {
-          ctpl_value_set_float (value, ctpl_value_get_float (lvalue) *
-                                       ctpl_value_get_float (rvalue));
+          ctpl_value_set_float (value, lval * rval);
         }
         break;
+      }
       
       case CTPL_VTYPE_STRING: {
         CtplValue *str_val;
@@ -329,18 +432,8 @@ ctpl_eval_operator_mul (CtplValue *lvalue,
                        ctpl_value_get_held_type_name (rvalue));
           rv = FALSE;
         } else {
-          gchar *str;
-          
-          /* hum, may we optimise for 1 and < 1 multiplications? */
-          str = do_multiply_string (ctpl_value_get_string (str_val),
-                                    ctpl_value_get_int (num_val),
-                                    error);
-          if (! str) {
-            rv = FALSE;
-          } else {
-            ctpl_value_set_string (value, str);
-            g_free (str);
-          }
+          rv = do_multiply_string (value, ctpl_value_get_string (str_val),
+                                   ctpl_value_get_int (num_val), arena, error);
         }
         break;
       }
@@ -359,15 +452,12 @@ ctpl_eval_operator_div (CtplValue *lvalue,
                         CtplValue *value,
                         GError   **error)
 {
-  gboolean rv = TRUE;
+  gboolean  rv = TRUE;
+  gdouble   lval;
+  gdouble   rval;
   
-  rv = ensure_operands_type (lvalue, rvalue, CTPL_VTYPE_FLOAT, "/", error);
+  rv = get_float_operands (lvalue, rvalue, "/", &lval, &rval, error);
   if (rv) {
-    gdouble lval;
-    gdouble rval;
-    
-    lval = ctpl_value_get_float (lvalue);
-    rval = ctpl_value_get_float (rvalue);
     if (CTPL_MATH_FLOAT_EQ (rval, 0)) {
       g_set_error (error, CTPL_EVAL_ERROR, CTPL_EVAL_ERROR_INVALID_OPERAND,
                    _("Division by zero"));
@@ -407,6 +497,9 @@ ctpl_eval_operator_cmp (CtplValue     *lvalue,
   gboolean rv = TRUE;
   
   *result = 0;
+  /* array items may be iterators too */
+  materialize_operand (lvalue);
+  materialize_operand (rvalue);
   switch (ctpl_value_get_held_type (lvalue)) {
     case CTPL_VTYPE_ARRAY:
       if (! CTPL_VALUE_HOLDS_ARRAY (rvalue)) {
@@ -457,15 +550,13 @@ ctpl_eval_operator_cmp (CtplValue     *lvalue,
       }
       /* WARNING: conditional break to fall back to floating conversion if one
        * operand is float */
-    case CTPL_VTYPE_FLOAT:
-      rv = ensure_operands_type (lvalue, rvalue, CTPL_VTYPE_FLOAT,
-                                 ctpl_operator_to_string (op), error);
+    case CTPL_VTYPE_FLOAT: {
+      gdouble lval;
+      gdouble rval;
+      
+      rv = get_float_operands (lvalue, rvalue, ctpl_operator_to_string (op),
+                               &lval, &rval, error);
       if (rv) {
-        gdouble lval;
-        gdouble rval;
-        
-        lval = ctpl_value_get_float (lvalue);
-        rval = ctpl_value_get_float (rvalue);
         if (CTPL_MATH_FLOAT_EQ (lval, rval)) {
           *result = 0;
         } else if (lval < rval) {
@@ -479,6 +570,7 @@ ctpl_eval_operator_cmp (CtplValue     *lvalue,
         }
       }
       break;
+    }
     
     case CTPL_VTYPE_STRING:
       if (CTPL_VALUE_HOLDS_ARRAY (rvalue)) {
@@ -489,6 +581,9 @@ ctpl_eval_operator_cmp (CtplValue     *lvalue,
                      ctpl_value_get_held_type_name (lvalue),
                      ctpl_value_get_held_type_name (rvalue));
         rv = FALSE;
+      } else if (CTPL_VALUE_HOLDS_STRING (rvalue)) {
+        *result = strcmp (ctpl_value_get_string (lvalue),
+                          ctpl_value_get_string (rvalue));
       } else {
         gchar *tmp;
         
@@ -497,6 +592,9 @@ ctpl_eval_operator_cmp (CtplValue     *lvalue,
         g_free (tmp);
       }
       break;
+    
+    case CTPL_VTYPE_ITERATOR:
+      g_assert_not_reached ();
   }
   
   return rv;
@@ -581,13 +679,12 @@ ctpl_eval_operator_modulo (CtplValue *lvalue,
                            CtplValue *value,
                            GError   **error)
 {
-  gboolean rv = TRUE;
+  gboolean  rv = TRUE;
+  glong     lval;
+  glong     rval;
   
-  rv = ensure_operands_type (lvalue, rvalue, CTPL_VTYPE_INT, "%", error);
+  rv = get_int_operands (lvalue, rvalue, "%", &lval, &rval, error);
   if (rv) {
-    glong lval = ctpl_value_get_int (lvalue);
-    glong rval = ctpl_value_get_int (rvalue);
-    
     if (rval == 0) {
       g_set_error (error, CTPL_EVAL_ERROR, CTPL_EVAL_ERROR_INVALID_OPERAND,
                    _("Division by zero through modulo"));
@@ -600,12 +697,249 @@ ctpl_eval_operator_modulo (CtplValue *lvalue,
   return rv;
 }
 
+/* Type-specialized operator kernels.
+ * These evaluate an operator for a given pair of operand types without
+ * converting the operands nor allocating temporaries, and give the same
+ * results as the generic functions above.  They are looked up in
+ * operator_kernels, pairs without a kernel falling back to the generic path.
+ * @value may be @lvalue. */
+typedef gboolean  (*OperatorKernel) (CtplOperator      op,
+                                     const CtplValue  *lvalue,
+                                     const CtplValue  *rvalue,
+                                     CtplValue        *value,
+                                     GError          **error);
+
+/* sets @value to the result of comparison operator @op given the
+ * strcmp()-like comparison result @r */
+static void
+set_comparison_result (CtplValue    *value,
+                       CtplOperator  op,
+                       gint          r)
+{
+  gboolean result = FALSE;
+  
+  switch (op) {
+    case CTPL_OPERATOR_EQUAL: result = (r == 0); break;
+    case CTPL_OPERATOR_NEQ:   result = (r != 0); break;
+    case CTPL_OPERATOR_INF:   result = (r <  0); break;
+    case CTPL_OPERATOR_INFEQ: result = (r <= 0); break;
+    case CTPL_OPERATOR_SUP:   result = (r >  0); break;
+    case CTPL_OPERATOR_SUPEQ: result = (r >= 0); break;
+    default: g_assert_not_reached ();
+  }
+  ctpl_value_set_int (value, result ? 1L : 0L);
+}
+
+/* integer with integer */
+static gboolean
+kernel_int_int (CtplOperator      op,
+                const CtplValue  *lvalue,
+                const CtplValue  *rvalue,
+                CtplValue        *value,
+                GError          **error)
+{
+  gboolean  rv    = TRUE;
+  glong     lval  = ctpl_value_get_int (lvalue);
+  glong     rval  = ctpl_value_get_int (rvalue);
+  
+  switch (op) {
+    case CTPL_OPERATOR_PLUS:
+      ctpl_value_set_int (value, lval + rval);
+      break;
+    
+    case CTPL_OPERATOR_MINUS:
+      /* the generic subtraction always computes floats */
+      ctpl_value_set_float (value, (gdouble)lval - (gdouble)rval);
+      break;
+    
+    case CTPL_OPERATOR_MUL:
+      ctpl_value_set_int (value, lval * rval);
+      break;
+    
+    case CTPL_OPERATOR_DIV:
+      if (rval == 0) {
+        g_set_error (error, CTPL_EVAL_ERROR, CTPL_EVAL_ERROR_INVALID_OPERAND,
+                     _("Division by zero"));
+        rv = FALSE;
+      } else {
+        ctpl_value_set_float (value, (gdouble)lval / (gdouble)rval);
+      }
+      break;
+    
+    case CTPL_OPERATOR_MODULO:
+      if (rval == 0) {
+        g_set_error (error, CTPL_EVAL_ERROR, CTPL_EVAL_ERROR_INVALID_OPERAND,
+                     _("Division by zero through modulo"));
+        rv = FALSE;
+      } else {
+        ctpl_value_set_int (value, lval % rval);
+      }
+      break;
+    
+    default:
+      /* no (lval - rval) because of possible over/underflow in subtraction */
+      set_comparison_result (value, op, (lval < rval) ? -1 : (lval > rval));
+  }
+  
+  return rv;
+}
+
+/* floating point or integer with floating point or integer, computing on
+ * floating point numbers */
+static gboolean
+kernel_numeric (CtplOperator      op,
+                const CtplValue  *lvalue,
+                const CtplValue  *rvalue,
+                CtplValue        *value,
+                GError          **error)
+{
+  #define NUMBER_OF(v)  (CTPL_VALUE_HOLDS_INT (v)         \
+                         ? (gdouble)ctpl_value_get_int (v) \
+                         : ctpl_value_get_float (v))
+  
+  gboolean  rv    = TRUE;
+  gdouble   lval  = NUMBER_OF (lvalue);
+  gdouble   rval  = NUMBER_OF (rvalue);
+  
+  #undef NUMBER_OF
+  
+  switch (op) {
+    case CTPL_OPERATOR_PLUS:
+      ctpl_value_set_float (value, lval + rval);
+      break;
+    
+    case CTPL_OPERATOR_MINUS:
+      ctpl_value_set_float (value, lval - rval);
+      break;
+    
+    case CTPL_OPERATOR_MUL:
+      ctpl_value_set_float (value, lval * rval);
+      break;
+    
+    case CTPL_OPERATOR_DIV:
+      if (CTPL_MATH_FLOAT_EQ (rval, 0)) {
+        g_set_error (error, CTPL_EVAL_ERROR, CTPL_EVAL_ERROR_INVALID_OPERAND,
+                     _("Division by zero"));
+        rv = FALSE;
+      } else {
+        ctpl_value_set_float (value, lval / rval);
+      }
+      break;
+    
+    default:
+      if (CTPL_MATH_FLOAT_EQ (lval, rval)) {
+        set_comparison_result (value, op, 0);
+      } else if (lval < rval) {
+        set_comparison_result (value, op, -1);
+      } else if (lval > rval) {
+        set_comparison_result (value, op, 1);
+      } else {
+        /* same as ctpl_eval_operator_cmp() */
+        g_return_val_if_reached (FALSE);
+      }
+  }
+  
+  return rv;
+}
+
+/* string with string */
+static gboolean
+kernel_string_string (CtplOperator      op,
+                      const CtplValue  *lvalue,
+                      const CtplValue  *rvalue,
+                      CtplValue        *value,
+                      GError          **error)
+{
+  const gchar *lval = ctpl_value_get_string (lvalue);
+  const gchar *rval = ctpl_value_get_string (rvalue);
+  
+  (void)error; /* cannot fail */
+  if (op == CTPL_OPERATOR_PLUS) {
+    ctpl_value_take_string (value, g_strconcat (lval, rval, NULL));
+  } else {
+    set_comparison_result (value, op, strcmp (lval, rval));
+  }
+  
+  return TRUE;
+}
+
+/* the types having kernels: INT, FLOAT and STRING */
+#define N_KERNEL_TYPES  (CTPL_VTYPE_STRING + 1)
+
+/* a [left type][right type] table */
+#define KERNEL_TABLE(int_int, int_float, float_int, float_float, string_string) \
+  { { int_int,    int_float,  NULL },                                          \
+    { float_int,  float_float, NULL },                                         \
+    { NULL,       NULL,       string_string } }
+#define NUMERIC_KERNELS \
+  KERNEL_TABLE (kernel_int_int, kernel_numeric, kernel_numeric, kernel_numeric, \
+                NULL)
+#define COMPARISON_KERNELS \
+  KERNEL_TABLE (kernel_int_int, kernel_numeric, kernel_numeric, kernel_numeric, \
+                kernel_string_string)
+
+/* keep order of CtplOperator */
+static const OperatorKernel operator_kernels[CTPL_OPERATOR_NONE]
+                                            [N_KERNEL_TYPES]
+                                            [N_KERNEL_TYPES] = {
+  /* AND: no conversion anyway */
+  KERNEL_TABLE (NULL, NULL, NULL, NULL, NULL),
+  /* DIV */
+  NUMERIC_KERNELS,
+  /* EQUAL */
+  COMPARISON_KERNELS,
+  /* INFEQ */
+  COMPARISON_KERNELS,
+  /* INF */
+  COMPARISON_KERNELS,
+  /* MINUS */
+  NUMERIC_KERNELS,
+  /* MODULO: floating point operands are converted to integers */
+  KERNEL_TABLE (kernel_int_int, NULL, NULL, NULL, NULL),
+  /* MUL */
+  NUMERIC_KERNELS,
+  /* NEQ */
+  COMPARISON_KERNELS,
+  /* OR: no conversion anyway */
+  KERNEL_TABLE (NULL, NULL, NULL, NULL, NULL),
+  /* PLUS */
+  KERNEL_TABLE (kernel_int_int, kernel_numeric, kernel_numeric, kernel_numeric,
+                kernel_string_string),
+  /* SUPEQ */
+  COMPARISON_KERNELS,
+  /* SUP */
+  COMPARISON_KERNELS
+};
+
+#undef COMPARISON_KERNELS
+#undef NUMERIC_KERNELS
+#undef KERNEL_TABLE
+
+/* gets the kernel for @op with @lvalue and @rvalue, or %NULL if the generic
+ * path has to be used */
+static OperatorKernel
+lookup_operator_kernel (CtplOperator      op,
+                        const CtplValue  *lvalue,
+                        const CtplValue  *rvalue)
+{
+  CtplValueType ltype = ctpl_value_get_held_type (lvalue);
+  CtplValueType rtype = ctpl_value_get_held_type (rvalue);
+  
+  if (op >= CTPL_OPERATOR_NONE ||
+      ltype >= N_KERNEL_TYPES || rtype >= N_KERNEL_TYPES) {
+    return NULL;
+  }
+  
+  return operator_kernels[op][ltype][rtype];
+}
+
 /* dispatches evaluation to specific functions. */
 static gboolean
 ctpl_eval_operator_internal (CtplOperator operator,
                              CtplValue   *lvalue,
                              CtplValue   *rvalue,
                              CtplValue   *value,
+                             CtplArena   *arena,
                              GError     **error)
 {
   gboolean rv = FALSE;
@@ -635,7 +969,7 @@ ctpl_eval_operator_internal (CtplOperator operator,
       break;
     
     case CTPL_OPERATOR_MUL:
-      rv = ctpl_eval_operator_mul (lvalue, rvalue, value, error);
+      rv = ctpl_eval_operator_mul (lvalue, rvalue, value, arena, error);
       break;
     
     case CTPL_OPERATOR_PLUS:
@@ -655,153 +989,1061 @@ ctpl_eval_operator_internal (CtplOperator operator,
   return rv;
 }
 
-/* 
- * ctpl_eval_operator:
- * @operator: An operator token
- * @env: then environment for the evaluation
- * @value: Value to fill with the operation result
- * @error: return location for an error, or %NULL to ignore them
- * 
- * Tries to evaluate an operation.
- * 
- * Returns: %TRUE on success, %FALSE otherwise.
- */
-static gboolean
-ctpl_eval_operator (const CtplTokenExpr  *operator,
-                    CtplEnviron          *env,
-                    CtplValue            *value,
-                    GError              **error)
+/* looks up the value of the symbol @expr in @env
+ * Returns: The value of the symbol, or %NULL if it cannot be found. */
+static const CtplValue *
+lookup_symbol (const CtplTokenExpr  *expr,
+               CtplEnviron          *env,
+               GError              **error)
 {
-  gboolean rv = TRUE;
-  CtplValue lvalue;
-  CtplValue rvalue;
+  const CtplValue *value;
   
-  ctpl_value_init (&lvalue);
-  ctpl_value_init (&rvalue);
-  if (! ctpl_eval_value (operator->token.t_operator->loperand,
-                         env, &lvalue, error)) {
-    rv = FALSE;
-  } else if (! ctpl_eval_value (operator->token.t_operator->roperand,
-                                env, &rvalue, error)) {
-    rv = FALSE;
-  } else {
-    rv = ctpl_eval_operator_internal (operator->token.t_operator->operator,
-                                      &lvalue, &rvalue, value, error);
+  value = ctpl_environ_lookup (env, expr->token.t_symbol);
+  if (! value) {
+    g_set_error (error, CTPL_EVAL_ERROR, CTPL_EVAL_ERROR_SYMBOL_NOT_FOUND,
+                 _("Symbol '%s' cannot be found in the environment"),
+                 expr->token.t_symbol);
   }
-  ctpl_value_free_value (&rvalue);
-  ctpl_value_free_value (&lvalue);
   
-  return rv;
+  return value;
 }
 
-static gboolean
-ctpl_eval_value_index (const CtplTokenExpr  *expr,
-                       CtplEnviron          *env,
-                       CtplValue            *value,
-                       GError              **error)
+/* Evaluates @expr, borrowing the value of symbols from @env and of literals
+ * from @expr rather than copying them, and indexing them by reference.  Other
+ * values are stored in @storage, that must have been initialized and has to
+ * be freed by the caller.
+ * Returns: The value of @expr, or %NULL on error. */
+static const CtplValue *
+eval_value_borrowed (const CtplTokenExpr  *expr,
+                     CtplEnviron          *env,
+                     CtplValue            *storage,
+                     GError              **error)
 {
-  gboolean  rv = TRUE;
-  GSList   *indexes;
+  const CtplValue *value = NULL;
   
-  for (indexes = expr->indexes; rv && indexes; indexes = indexes->next) {
-    gchar *value_str = NULL;
-    
-    #define VALUE_AS_STRING (value_str = ctpl_value_to_string (value))
-    
-    rv = FALSE;
-    /* FIXME: improve error messages? */
-    if (! CTPL_VALUE_HOLDS_ARRAY (value)) {
-      g_set_error (error, CTPL_EVAL_ERROR, CTPL_EVAL_ERROR_INVALID_OPERAND,
-                   _("Value '%s' cannot be indexed"), VALUE_AS_STRING);
-    } else {
-      CtplValue idx_value;
-      
-      ctpl_value_init (&idx_value);
-      if (ctpl_eval_value (indexes->data, env, &idx_value, error)) {
-        if (! ctpl_value_convert (&idx_value, CTPL_VTYPE_INT)) {
-          g_set_error (error, CTPL_EVAL_ERROR, CTPL_EVAL_ERROR_INVALID_OPERAND,
-                       _("Cannot convert index of value '%s' to integer"),
-                       VALUE_AS_STRING);
-        } else {
-          const CtplValue  *new_value;
-          glong             idx = ctpl_value_get_int (&idx_value);
-          
-          if (idx < 0 ||
-              ! (new_value = ctpl_value_array_index (value, (gsize)idx))) {
-            g_set_error (error, CTPL_EVAL_ERROR, CTPL_EVAL_ERROR_FAILED,
-                         _("Cannot index value '%s' at %ld"),
-                         VALUE_AS_STRING, idx);
-          } else {
-            ctpl_value_copy (new_value, value);
-            rv = TRUE;
-          }
-        }
-        ctpl_value_free_value (&idx_value);
+  switch (expr->type) {
+    case CTPL_TOKEN_EXPR_TYPE_SYMBOL:
+      value = lookup_symbol (expr, env, error);
+      /* values only valid until the next lookup have to be copied */
+      if (value && ctpl_environ_value_is_transient (env, value)) {
+        ctpl_value_copy (value, storage);
+        value = storage;
       }
-    }
+      break;
     
-    #undef VALUE_AS_STRING
+    case CTPL_TOKEN_EXPR_TYPE_VALUE:
+      value = &expr->token.t_value;
+      break;
     
-    g_free (value_str);
+    default:
+      if (ctpl_eval_value_base (expr, env, storage, error)) {
+        value = storage;
+      }
   }
-  if (! rv) {
-    ctpl_value_free_value (value);
+  if (value && expr->indexes) {
+    value = ctpl_eval_value_index (expr, env, value, storage, error);
   }
   
-  return rv;
+  return value;
 }
 
-/**
- * ctpl_eval_value:
- * @expr: The #CtplTokenExpr to evaluate
- * @env: The expression's environment, where lookup symbols
- * @value: #CtplValue where store the evaluation result on success
- * @error: Return location for errors, or %NULL to ignore them
- * 
- * Computes the given #CtplTokenExpr with the environ @env, storing the resutl
- * in @value.
- * 
- * Returns: %TRUE on success, %FALSE otherwise.
- * 
- * Since: 0.2
- */
-gboolean
-ctpl_eval_value (const CtplTokenExpr  *expr,
-                 CtplEnviron          *env,
-                 CtplValue            *value,
-                 GError              **error)
+/* a string built by concatenation, as a list of pieces only flattened once */
+typedef struct _Rope Rope;
+struct _Rope
 {
-  gboolean  rv = TRUE;
+  GArray     *pieces; /* const gchar *, in order */
+  GPtrArray  *owned;  /* pieces created for the rope, if not in @arena */
+  CtplArena  *arena;  /* where to allocate, or %NULL */
+  gsize       length;
+};
+
+static void
+rope_init (Rope       *rope,
+           CtplArena  *arena)
+{
+  rope->pieces = g_array_new (FALSE, FALSE, sizeof (const gchar *));
+  rope->owned = g_ptr_array_new_with_free_func (g_free);
+  rope->arena = arena;
+  rope->length = 0;
+}
+
+/* gets a copy of @str that lives as long as @rope */
+static const gchar *
+rope_own (Rope        *rope,
+          const gchar *str)
+{
+  gchar *piece;
   
-  switch (expr->type) {
-    case CTPL_TOKEN_EXPR_TYPE_VALUE:
-      ctpl_value_copy (&expr->token.t_value, value);
-      break;
-    
-    case CTPL_TOKEN_EXPR_TYPE_SYMBOL: {
-      const CtplValue *symbol_value;
-      
-      symbol_value = ctpl_environ_lookup (env, expr->token.t_symbol);
-      if (symbol_value) {
-        ctpl_value_copy (symbol_value, value);
-      } else {
-        g_set_error (error, CTPL_EVAL_ERROR, CTPL_EVAL_ERROR_SYMBOL_NOT_FOUND,
-                     _("Symbol '%s' cannot be found in the environment"),
-                     expr->token.t_symbol);
-        rv = FALSE;
-      }
-      break;
-    }
+  if (rope->arena) {
+    gsize len = strlen (str);
     
-    case CTPL_TOKEN_EXPR_TYPE_OPERATOR:
-      rv = ctpl_eval_operator (expr, env, value, error);
-      break;
-  }
-  if (rv) {
-    rv = ctpl_eval_value_index (expr, env, value, error);
+    piece = ctpl_arena_alloc (rope->arena, len + 1);
+    memcpy (piece, str, len + 1);
+  } else {
+    piece = g_strdup (str);
+    g_ptr_array_add (rope->owned, piece);
   }
   
-  return rv;
+  return piece;
+}
+
+static void
+rope_clear (Rope *rope)
+{
+  g_array_free (rope->pieces, TRUE);
+  g_ptr_array_free (rope->owned, TRUE);
+}
+
+/* appends the string form of @value to @rope, as the string + operator
+ * would.  String values are not copied, so @value must outlive @rope. */
+static gboolean
+rope_append (Rope             *rope,
+             const CtplValue  *value,
+             GError          **error)
+{
+  const gchar *piece = NULL;
+  
+  switch (ctpl_value_get_held_type (value)) {
+    case CTPL_VTYPE_STRING:
+      piece = ctpl_value_get_string (value);
+      break;
+    
+    case CTPL_VTYPE_INT: {
+      gchar buf[32];
+      
+      g_snprintf (buf, sizeof (buf), "%ld", ctpl_value_get_int (value));
+      piece = rope_own (rope, buf);
+      break;
+    }
+    
+    case CTPL_VTYPE_FLOAT: {
+      gchar buf[G_ASCII_DTOSTR_BUF_SIZE];
+      
+      piece = rope_own (rope, ctpl_math_dtostr (buf, sizeof (buf),
+                                                ctpl_value_get_float (value)));
+      break;
+    }
+    
+    case CTPL_VTYPE_ARRAY:
+    case CTPL_VTYPE_ITERATOR:
+      g_set_error (error, CTPL_EVAL_ERROR, CTPL_EVAL_ERROR_INVALID_OPERAND,
+                   _("Operator '+' cannot be used with '%s' and '%s' types"),
+                   ctpl_value_type_get_name (CTPL_VTYPE_STRING),
+                   ctpl_value_type_get_name (CTPL_VTYPE_ARRAY));
+      return FALSE;
+  }
+  g_array_append_val (rope->pieces, piece);
+  rope->length += strlen (piece);
+  
+  return TRUE;
+}
+
+/* sets @value to the string held by @rope, allocating it at once */
+static void
+rope_flatten (const Rope *rope,
+              CtplValue  *value)
+{
+  gchar  *p;
+  guint   i;
+  
+  p = ctpl_value_alloc_string (value, rope->arena, rope->length);
+  for (i = 0; i < rope->pieces->len; i++) {
+    const gchar  *piece = g_array_index (rope->pieces, const gchar *, i);
+    gsize         len = strlen (piece);
+    
+    memcpy (p, piece, len);
+    p += len;
+  }
+}
+
+/* whether @expr is an operation with operator @op */
+#define IS_OPERATOR(expr, op)                                                  \
+  ((expr)->type == CTPL_TOKEN_EXPR_TYPE_OPERATOR &&                            \
+   (expr)->token.t_operator->operator == (op))
+/* whether @expr is an addition that ctpl_eval_concat() can evaluate */
+#define IS_PLUS_CHAIN(expr) (IS_OPERATOR ((expr), CTPL_OPERATOR_PLUS))
+
+/*
+ * ctpl_eval_concat:
+ * @expr: An addition operator token
+ * @env: The environment for the evaluation
+ * @value: Value to fill with the result if it is not a string
+ * @rope: An initialized #Rope to fill with the result if it is a string, in
+ *        which case it is not empty
+ * @storage: (out): Return location for the values the pieces of @rope
+ *                  borrow, to free with free_concat_storage() after @rope
+ * @error: Return location for an error, or %NULL to ignore them
+ * 
+ * Evaluates a chain of additions, (((a + b) + c) + ...), without copying the
+ * string being built for each operator: as soon as the left operand is a
+ * string, all the remaining operands are appended to @rope.
+ * 
+ * Returns: %TRUE on success, %FALSE otherwise.
+ */
+static gboolean
+ctpl_eval_concat (const CtplTokenExpr  *expr,
+                  CtplEnviron          *env,
+                  CtplValue            *value,
+                  Rope                 *rope,
+                  GArray              **storage,
+                  GError              **error)
+{
+  const CtplTokenExpr  *node;
+  GSList               *operands = NULL;
+  GSList               *item;
+  gboolean              in_rope = FALSE;
+  gboolean              rv;
+  
+  /* the tree leans on the left, get the operands in order */
+  for (node = expr; IS_PLUS_CHAIN (node) && (node == expr || ! node->indexes);
+       node = node->token.t_operator->loperand) {
+    operands = g_slist_prepend (operands, node->token.t_operator->roperand);
+  }
+  *storage = g_array_new (FALSE, TRUE, sizeof (CtplValue *));
+  rv = ctpl_eval_value (node, env, value, error);
+  for (item = operands; rv && item; item = item->next) {
+    CtplValue        *stored = ctpl_value_new ();
+    const CtplValue  *operand;
+    OperatorKernel    kernel;
+    
+    g_array_append_val (*storage, stored);
+    operand = eval_value_borrowed (item->data, env, stored, error);
+    if (! operand) {
+      rv = FALSE;
+    } else if (in_rope) {
+      rv = rope_append (rope, operand, error);
+    } else if (CTPL_VALUE_HOLDS_STRING (value) &&
+               ! CTPL_VALUE_HOLDS_ARRAY (operand) &&
+               ! CTPL_VALUE_HOLDS_ITERATOR (operand)) {
+      CtplValue *lvalue = ctpl_value_new ();
+      
+      /* from now on, the result is a string: move it to the rope */
+      *lvalue = *value;
+      ctpl_value_init (value);
+      g_array_append_val (*storage, lvalue);
+      in_rope = rope_append (rope, lvalue, error) &&
+                rope_append (rope, operand, error);
+      rv = in_rope;
+    } else if ((kernel = lookup_operator_kernel (CTPL_OPERATOR_PLUS,
+                                                 value, operand))) {
+      rv = kernel (CTPL_OPERATOR_PLUS, value, operand, value, error);
+    } else {
+      CtplValue lvalue;
+      CtplValue rvalue;
+      
+      ctpl_value_init (&lvalue);
+      ctpl_value_init (&rvalue);
+      ctpl_value_copy (value, &lvalue);
+      ctpl_value_copy (operand, &rvalue);
+      materialize_operand (&lvalue);
+      materialize_operand (&rvalue);
+      rv = ctpl_eval_operator_plus (&lvalue, &rvalue, value, error);
+      ctpl_value_free_value (&rvalue);
+      ctpl_value_free_value (&lvalue);
+    }
+  }
+  g_slist_free (operands);
+  
+  return rv;
+}
+
+/* frees the storage of ctpl_eval_concat() */
+static void
+free_concat_storage (GArray *storage)
+{
+  guint i;
+  
+  for (i = 0; i < storage->len; i++) {
+    ctpl_value_free (g_array_index (storage, CtplValue *, i));
+  }
+  g_array_free (storage, TRUE);
+}
+
+/* 
+ * ctpl_eval_operator:
+ * @operator: An operator token
+ * @env: then environment for the evaluation
+ * @value: Value to fill with the operation result
+ * @error: return location for an error, or %NULL to ignore them
+ * 
+ * Tries to evaluate an operation.
+ * 
+ * Returns: %TRUE on success, %FALSE otherwise.
+ */
+static gboolean
+ctpl_eval_operator (const CtplTokenExpr  *operator,
+                    CtplEnviron          *env,
+                    CtplValue            *value,
+                    GError              **error)
+{
+  gboolean rv = TRUE;
+  CtplValue lvalue;
+  CtplValue rvalue;
+  
+  if (IS_PLUS_CHAIN (operator)) {
+    Rope    rope;
+    GArray *storage;
+    
+    rope_init (&rope, ctpl_environ_get_arena (env));
+    rv = ctpl_eval_concat (operator, env, value, &rope, &storage, error);
+    if (rv && rope.pieces->len > 0) {
+      rope_flatten (&rope, value);
+    }
+    rope_clear (&rope);
+    free_concat_storage (storage);
+  } else {
+    CtplOperator      op = operator->token.t_operator->operator;
+    const CtplValue  *lborrowed;
+    const CtplValue  *rborrowed = NULL;
+    OperatorKernel    kernel;
+    
+    ctpl_value_init (&lvalue);
+    ctpl_value_init (&rvalue);
+    lborrowed = eval_value_borrowed (operator->token.t_operator->loperand,
+                                     env, &lvalue, error);
+    if (lborrowed) {
+      rborrowed = eval_value_borrowed (operator->token.t_operator->roperand,
+                                       env, &rvalue, error);
+    }
+    if (! lborrowed || ! rborrowed) {
+      rv = FALSE;
+    } else if ((kernel = lookup_operator_kernel (op, lborrowed, rborrowed))) {
+      rv = kernel (op, lborrowed, rborrowed, value, error);
+    } else {
+      /* the generic path may modify the operands, so work on copies */
+      if (lborrowed != &lvalue) {
+        ctpl_value_copy (lborrowed, &lvalue);
+      }
+      if (rborrowed != &rvalue) {
+        ctpl_value_copy (rborrowed, &rvalue);
+      }
+      materialize_operand (&lvalue);
+      materialize_operand (&rvalue);
+      rv = ctpl_eval_operator_internal (op, &lvalue, &rvalue, value,
+                                        ctpl_environ_get_arena (env), error);
+    }
+    ctpl_value_free_value (&rvalue);
+    ctpl_value_free_value (&lvalue);
+  }
+  
+  return rv;
+}
+
+/* checks that function @name got between @min_args and @max_args arguments,
+ * @max_args being G_MAXUINT for no limit */
+static gboolean
+check_n_args (const gchar  *name,
+              guint         n_args,
+              guint         min_args,
+              guint         max_args,
+              GError      **error)
+{
+  if (n_args >= min_args && n_args <= max_args) {
+    return TRUE;
+  } else if (max_args == G_MAXUINT) {
+    g_set_error (error, CTPL_EVAL_ERROR, CTPL_EVAL_ERROR_INVALID_OPERAND,
+                 _("Wrong number of arguments for function '%s' (have %u, "
+                   "expect at least %u)"),
+                 name, n_args, min_args);
+  } else if (min_args == max_args) {
+    g_set_error (error, CTPL_EVAL_ERROR, CTPL_EVAL_ERROR_INVALID_OPERAND,
+                 _("Wrong number of arguments for function '%s' (have %u, "
+                   "expect %u)"),
+                 name, n_args, min_args);
+  } else {
+    g_set_error (error, CTPL_EVAL_ERROR, CTPL_EVAL_ERROR_INVALID_OPERAND,
+                 _("Wrong number of arguments for function '%s' (have %u, "
+                   "expect %u to %u)"),
+                 name, n_args, min_args, max_args);
+  }
+  
+  return FALSE;
+}
+
+/* sets an error for the argument @n of function @name, @value, not being
+ * of the @expected kind */
+static void
+set_invalid_argument_error (GError          **error,
+                            const gchar      *name,
+                            guint             n,
+                            const CtplValue  *value,
+                            const gchar      *expected)
+{
+  g_set_error (error, CTPL_EVAL_ERROR, CTPL_EVAL_ERROR_INVALID_OPERAND,
+               _("Invalid argument %u for function '%s' (have '%s', "
+                 "expect %s)"),
+               n + 1, name, ctpl_value_get_held_type_name (value), expected);
+}
+
+/* calls @func on each item of @value, that holds an array or an iterator, as
+ * long as it returns %TRUE */
+static void
+foreach_item (const CtplValue  *value,
+              gboolean        (*func) (const CtplValue *item,
+                                       gpointer         data),
+              gpointer          data)
+{
+  if (CTPL_VALUE_HOLDS_ITERATOR (value)) {
+    CtplValue item;
+    
+    ctpl_value_init (&item);
+    ctpl_value_iterator_reset (value);
+    while (ctpl_value_iterator_next (value, &item) && func (&item, data)) {
+      /* nothing to do */
+    }
+    ctpl_value_free_value (&item);
+  } else {
+    const GSList *items;
+    
+    for (items = ctpl_value_get_array (value);
+         items && func (items->data, data);
+         items = items->next) {
+      /* nothing to do */
+    }
+  }
+}
+
+/* whether @value holds something foreach_item() can walk */
+#define HOLDS_ITEMS(value) \
+  (CTPL_VALUE_HOLDS_ARRAY (value) || CTPL_VALUE_HOLDS_ITERATOR (value))
+
+/* state of an iterator generated by range() */
+typedef struct _RangeIter RangeIter;
+struct _RangeIter
+{
+  glong start;
+  glong stop;
+  glong step;
+  glong current;
+};
+
+static gboolean
+range_iter_next (CtplValue *item,
+                 gpointer   data)
+{
+  RangeIter *range = data;
+  
+  if (range->step > 0 ? range->current >= range->stop
+                      : range->current <= range->stop) {
+    return FALSE;
+  }
+  ctpl_value_set_int (item, range->current);
+  /* don't overflow on the last step */
+  if (range->step > 0 ? range->current > G_MAXLONG - range->step
+                      : range->current < G_MINLONG - range->step) {
+    range->current = range->stop;
+  } else {
+    range->current += range->step;
+  }
+  
+  return TRUE;
+}
+
+static void
+range_iter_reset (gpointer data)
+{
+  RangeIter *range = data;
+  
+  range->current = range->start;
+}
+
+static void
+range_iter_free (gpointer data)
+{
+  g_slice_free1 (sizeof (RangeIter), data);
+}
+
+/* range([start,] stop[, step]): the integers from start to stop, generated on
+ * demand */
+static gboolean
+ctpl_eval_function_range (CtplEnviron      *env,
+                          const gchar      *name,
+                          const CtplValue **args,
+                          guint             n_args,
+                          CtplValue        *result,
+                          gpointer          user_data,
+                          GError          **error)
+{
+  glong bounds[3] = {0, 0, 1};
+  guint i;
+  
+  if (! check_n_args (name, n_args, 1, 3, error)) {
+    return FALSE;
+  }
+  for (i = 0; i < n_args; i++) {
+    CtplValue bound;
+    gboolean  is_int;
+    
+    ctpl_value_init (&bound);
+    ctpl_value_copy (args[i], &bound);
+    is_int = ctpl_value_convert (&bound, CTPL_VTYPE_INT);
+    /* with only one argument, it is the stop */
+    bounds[n_args == 1 ? 1 : i] = is_int ? ctpl_value_get_int (&bound) : 0;
+    ctpl_value_free_value (&bound);
+    if (! is_int) {
+      set_invalid_argument_error (error, name, i, args[i], _("an integer"));
+      return FALSE;
+    }
+  }
+  if (bounds[2] == 0) {
+    g_set_error (error, CTPL_EVAL_ERROR, CTPL_EVAL_ERROR_INVALID_OPERAND,
+                 _("The step of function '%s' cannot be 0"), name);
+    return FALSE;
+  } else {
+    RangeIter *range;
+    
+    range = g_slice_alloc (sizeof *range);
+    range->start = range->current = bounds[0];
+    range->stop = bounds[1];
+    range->step = bounds[2];
+    ctpl_value_set_iterator (result, range_iter_next, range_iter_reset, range,
+                             range_iter_free);
+  }
+  
+  return TRUE;
+}
+
+static gboolean
+count_item (const CtplValue *item,
+            gpointer         data)
+{
+  (*(glong *) data) ++;
+  
+  return TRUE;
+}
+
+/* len(value): the number of items of an array or bytes of a string */
+static gboolean
+ctpl_eval_function_len (CtplEnviron      *env,
+                        const gchar      *name,
+                        const CtplValue **args,
+                        guint             n_args,
+                        CtplValue        *result,
+                        gpointer          user_data,
+                        GError          **error)
+{
+  glong len = 0;
+  
+  if (! check_n_args (name, n_args, 1, 1, error)) {
+    return FALSE;
+  }
+  switch (ctpl_value_get_held_type (args[0])) {
+    case CTPL_VTYPE_ARRAY:
+      len = (glong) ctpl_value_array_length (args[0]);
+      break;
+    
+    case CTPL_VTYPE_ITERATOR:
+      foreach_item (args[0], count_item, &len);
+      break;
+    
+    case CTPL_VTYPE_STRING:
+      len = (glong) strlen (ctpl_value_get_string (args[0]));
+      break;
+    
+    default:
+      set_invalid_argument_error (error, name, 0, args[0],
+                                  _("an array or a string"));
+      return FALSE;
+  }
+  ctpl_value_set_int (result, len);
+  
+  return TRUE;
+}
+
+/* the string form of the items to join, so the result can be allocated at
+ * once */
+typedef struct _JoinData JoinData;
+struct _JoinData
+{
+  GArray     *strings;      /* the items' strings, borrowed or from @pieces */
+  GPtrArray  *pieces;       /* the strings that had to be created */
+  gboolean    copy_strings; /* whether string items have to be copied too */
+  gsize       length;
+};
+
+static gboolean
+join_item (const CtplValue *item,
+           gpointer         data)
+{
+  JoinData     *join = data;
+  const gchar  *str;
+  
+  if (CTPL_VALUE_HOLDS_STRING (item) && ! join->copy_strings) {
+    str = ctpl_value_get_string (item);
+  } else {
+    gchar *piece = ctpl_value_to_string (item);
+    
+    g_ptr_array_add (join->pieces, piece);
+    str = piece;
+  }
+  g_array_append_val (join->strings, str);
+  join->length += strlen (str);
+  
+  return TRUE;
+}
+
+/* join(array[, separator]): the items of an array, separated by separator */
+static gboolean
+ctpl_eval_function_join (CtplEnviron      *env,
+                         const gchar      *name,
+                         const CtplValue **args,
+                         guint             n_args,
+                         CtplValue        *result,
+                         gpointer          user_data,
+                         GError          **error)
+{
+  JoinData      join;
+  gchar        *sep_str = NULL;
+  const gchar  *sep = "";
+  gsize         sep_len;
+  gchar        *p;
+  guint         i;
+  
+  if (! check_n_args (name, n_args, 1, 2, error)) {
+    return FALSE;
+  } else if (! HOLDS_ITEMS (args[0])) {
+    set_invalid_argument_error (error, name, 0, args[0], _("an array"));
+    return FALSE;
+  }
+  if (n_args > 1) {
+    if (CTPL_VALUE_HOLDS_STRING (args[1])) {
+      sep = ctpl_value_get_string (args[1]);
+    } else {
+      sep = sep_str = ctpl_value_to_string (args[1]);
+    }
+  }
+  sep_len = strlen (sep);
+  
+  /* first get all the strings to join, then copy them to a buffer of the
+   * right size */
+  join.length = 0;
+  join.strings = g_array_new (FALSE, FALSE, sizeof (const gchar *));
+  join.pieces = g_ptr_array_new_with_free_func (g_free);
+  /* array items outlive the join, but an iterator reuses the same item */
+  join.copy_strings = CTPL_VALUE_HOLDS_ITERATOR (args[0]);
+  foreach_item (args[0], join_item, &join);
+  if (join.strings->len > 1) {
+    join.length += sep_len * (join.strings->len - 1);
+  }
+  p = ctpl_value_alloc_string (result, ctpl_environ_get_arena (env),
+                               join.length);
+  for (i = 0; i < join.strings->len; i++) {
+    const gchar  *piece = g_array_index (join.strings, const gchar *, i);
+    gsize         len = strlen (piece);
+    
+    if (i > 0) {
+      memcpy (p, sep, sep_len);
+      p += sep_len;
+    }
+    memcpy (p, piece, len);
+    p += len;
+  }
+  
+  g_array_free (join.strings, TRUE);
+  g_ptr_array_free (join.pieces, TRUE);
+  g_free (sep_str);
+  
+  return TRUE;
+}
+
+/* state of the sum(), min() and max() aggregates */
+typedef struct _AggregateData AggregateData;
+struct _AggregateData
+{
+  const gchar  *name;
+  gint          sign;       /* 0 for a sum, -1 for a minimum, 1 for a maximum */
+  gboolean      is_float;
+  glong         v_int;      /* sum of integers, or best item for a minimum or
+                             * a maximum */
+  gdouble       v_float;    /* the same, as soon as one item is a float */
+  gboolean      empty;
+  GError       *error;
+};
+
+/* gets the numeric value of @item, converting strings that look like numbers */
+static gboolean
+aggregate_get_number (const CtplValue  *item,
+                      gboolean         *is_float,
+                      glong            *v_int,
+                      gdouble          *v_float)
+{
+  switch (ctpl_value_get_held_type (item)) {
+    case CTPL_VTYPE_INT:
+      *is_float = FALSE;
+      *v_int = ctpl_value_get_int (item);
+      return TRUE;
+    
+    case CTPL_VTYPE_FLOAT:
+      *is_float = TRUE;
+      *v_float = ctpl_value_get_float (item);
+      return TRUE;
+    
+    case CTPL_VTYPE_STRING:
+      /* the views remember the conversion in the string for the next
+       * aggregations */
+      if (ctpl_value_get_int_view (item, v_int)) {
+        *is_float = FALSE;
+        return TRUE;
+      } else if (ctpl_value_get_float_view (item, v_float)) {
+        *is_float = TRUE;
+        return TRUE;
+      }
+      /* Fallthrough */
+    
+    default:
+      return FALSE;
+  }
+}
+
+static gboolean
+aggregate_item (const CtplValue *item,
+                gpointer         data)
+{
+  AggregateData  *agg = data;
+  gboolean        is_float;
+  glong           v_int = 0;
+  gdouble         v_float = 0.0;
+  
+  if (! aggregate_get_number (item, &is_float, &v_int, &v_float)) {
+    g_set_error (&agg->error, CTPL_EVAL_ERROR, CTPL_EVAL_ERROR_INVALID_OPERAND,
+                 _("Invalid item for function '%s' (have '%s', expect a "
+                   "number)"),
+                 agg->name, ctpl_value_get_held_type_name (item));
+    return FALSE;
+  }
+  if (agg->sign == 0) {
+    if (! is_float && ! agg->is_float) {
+      agg->v_int += v_int;
+    } else {
+      if (! agg->is_float) {
+        agg->is_float = TRUE;
+        agg->v_float = (gdouble) agg->v_int;
+      }
+      agg->v_float += is_float ? v_float : (gdouble) v_int;
+    }
+  } else {
+    gboolean better;
+    
+    if (agg->empty) {
+      better = TRUE;
+    } else if (! is_float && ! agg->is_float) {
+      better = agg->sign < 0 ? v_int < agg->v_int : v_int > agg->v_int;
+    } else {
+      gdouble lval = is_float ? v_float : (gdouble) v_int;
+      gdouble rval = agg->is_float ? agg->v_float : (gdouble) agg->v_int;
+      
+      better = agg->sign < 0 ? lval < rval : lval > rval;
+    }
+    if (better) {
+      agg->is_float = is_float;
+      agg->v_int = v_int;
+      agg->v_float = v_float;
+    }
+  }
+  agg->empty = FALSE;
+  
+  return TRUE;
+}
+
+/* sum(), min() and max(), over the items of an array or over their
+ * arguments */
+static gboolean
+ctpl_eval_function_aggregate (CtplEnviron      *env,
+                              const gchar      *name,
+                              const CtplValue **args,
+                              guint             n_args,
+                              CtplValue        *result,
+                              gpointer          user_data,
+                              GError          **error)
+{
+  AggregateData agg;
+  
+  if (! check_n_args (name, n_args, 1, G_MAXUINT, error)) {
+    return FALSE;
+  }
+  agg.name = name;
+  agg.sign = GPOINTER_TO_INT (user_data);
+  agg.is_float = FALSE;
+  agg.v_int = 0;
+  agg.v_float = 0.0;
+  agg.empty = TRUE;
+  agg.error = NULL;
+  if (n_args == 1 && HOLDS_ITEMS (args[0])) {
+    foreach_item (args[0], aggregate_item, &agg);
+  } else {
+    guint i;
+    
+    for (i = 0; i < n_args && aggregate_item (args[i], &agg); i++) {
+      /* nothing to do */
+    }
+  }
+  if (agg.error) {
+    g_propagate_error (error, agg.error);
+    return FALSE;
+  } else if (agg.empty && agg.sign != 0) {
+    g_set_error (error, CTPL_EVAL_ERROR, CTPL_EVAL_ERROR_INVALID_OPERAND,
+                 _("Function '%s' needs at least one item"), name);
+    return FALSE;
+  } else if (agg.is_float) {
+    ctpl_value_set_float (result, agg.v_float);
+  } else {
+    ctpl_value_set_int (result, agg.v_int);
+  }
+  
+  return TRUE;
+}
+
+/* built-in functions, see ctpl_environ_add_function() */
+static const struct {
+  const gchar         *name;
+  CtplEnvironFunction  func;
+  gint                 data;
+} functions_array[] = {
+  { "join",   ctpl_eval_function_join,      0 },
+  { "len",    ctpl_eval_function_len,       0 },
+  { "max",    ctpl_eval_function_aggregate, 1 },
+  { "min",    ctpl_eval_function_aggregate, -1 },
+  { "range",  ctpl_eval_function_range,     0 },
+  { "sum",    ctpl_eval_function_aggregate, 0 }
+};
+
+/* Tries to evaluate a function call */
+static gboolean
+ctpl_eval_function (const CtplTokenExpr  *expr,
+                    CtplEnviron          *env,
+                    CtplValue            *value,
+                    GError              **error)
+{
+  const CtplTokenExprFunction  *function = expr->token.t_function;
+  CtplEnvironFunction           func = NULL;
+  gpointer                      user_data = NULL;
+  gboolean                      rv = FALSE;
+  guint                         i;
+  
+  if (! ctpl_environ_lookup_function (env, function->name, &func,
+                                      &user_data)) {
+    for (i = 0; ! func && i < G_N_ELEMENTS (functions_array); i++) {
+      if (strcmp (functions_array[i].name, function->name) == 0) {
+        func = functions_array[i].func;
+        user_data = GINT_TO_POINTER (functions_array[i].data);
+      }
+    }
+  }
+  if (! func) {
+    g_set_error (error, CTPL_EVAL_ERROR, CTPL_EVAL_ERROR_SYMBOL_NOT_FOUND,
+                 _("Function '%s' does not exist"), function->name);
+  } else {
+    const GSList     *arg;
+    const CtplValue **args;
+    CtplValue        *storage;
+    guint             n_args;
+    guint             n = 0;
+    
+    rv = TRUE;
+    n_args = g_slist_length (function->args);
+    args = g_new (const CtplValue *, n_args);
+    storage = g_new (CtplValue, n_args);
+    for (arg = function->args; rv && arg; arg = arg->next) {
+      ctpl_value_init (&storage[n]);
+      /* pass plain symbols by reference rather than copying them */
+      args[n] = eval_value_borrowed (arg->data, env, &storage[n], error);
+      rv = args[n++] != NULL;
+    }
+    if (rv) {
+      guint n_steps = ctpl_environ_suspend_steps (env);
+      
+      rv = func (env, function->name, args, n_args, value, user_data, error);
+      ctpl_environ_resume_steps (env, n_steps);
+    }
+    while (n > 0) {
+      ctpl_value_free_value (&storage[--n]);
+    }
+    g_free (storage);
+    g_free (args);
+  }
+  
+  return rv;
+}
+
+/* gets the integer value of the index @idx_expr of @value */
+static gboolean
+eval_index (const CtplTokenExpr  *idx_expr,
+            CtplEnviron          *env,
+            const CtplValue      *value,
+            glong                *idx,
+            GError              **error)
+{
+  gboolean rv = TRUE;
+  
+  if (idx_expr->type == CTPL_TOKEN_EXPR_TYPE_VALUE && ! idx_expr->indexes &&
+      CTPL_VALUE_HOLDS_INT (&idx_expr->token.t_value)) {
+    /* literal indexes are decoded by the lexer */
+    *idx = ctpl_value_get_int (&idx_expr->token.t_value);
+  } else {
+    CtplValue         storage;
+    const CtplValue  *idx_value;
+    
+    ctpl_value_init (&storage);
+    idx_value = eval_value_borrowed (idx_expr, env, &storage, error);
+    if (! idx_value) {
+      rv = FALSE;
+    } else if (! ctpl_value_get_int_view (idx_value, idx)) {
+      gchar *value_str = ctpl_value_to_string (value);
+      
+      g_set_error (error, CTPL_EVAL_ERROR, CTPL_EVAL_ERROR_INVALID_OPERAND,
+                   _("Cannot convert index of value '%s' to integer"),
+                   value_str);
+      g_free (value_str);
+      rv = FALSE;
+    }
+    ctpl_value_free_value (&storage);
+  }
+  
+  return rv;
+}
+
+/*
+ * ctpl_eval_value_index:
+ * @expr: The #CtplTokenExpr which indexes to apply
+ * @env: The expression's environment
+ * @value: The value of @expr without its indexes
+ * @storage: An initialized #CtplValue that may hold @value, and that can be
+ *           used for temporaries
+ * @error: Return location for errors, or %NULL to ignore them
+ * 
+ * Indexes @value by reference with the indexes of @expr, so neither the
+ * indexed values nor the result are copied.
+ * 
+ * Returns: The result, owned by @value or @storage, or %NULL on error.
+ */
+static const CtplValue *
+ctpl_eval_value_index (const CtplTokenExpr  *expr,
+                       CtplEnviron          *env,
+                       const CtplValue      *value,
+                       CtplValue            *storage,
+                       GError              **error)
+{
+  GSList *indexes;
+  
+  for (indexes = expr->indexes; value && indexes; indexes = indexes->next) {
+    glong idx;
+    
+    if (CTPL_VALUE_HOLDS_ITERATOR (value)) {
+      /* iterators have to be materialized to be indexed.  Copying an item of
+       * @storage to it is fine since the iterator is shared, not copied */
+      if (value != storage) {
+        ctpl_value_copy (value, storage);
+      }
+      materialize_operand (storage);
+      value = storage;
+    }
+    /* FIXME: improve error messages? */
+    if (! CTPL_VALUE_HOLDS_ARRAY (value)) {
+      gchar *value_str = ctpl_value_to_string (value);
+      
+      g_set_error (error, CTPL_EVAL_ERROR, CTPL_EVAL_ERROR_INVALID_OPERAND,
+                   _("Value '%s' cannot be indexed"), value_str);
+      g_free (value_str);
+      value = NULL;
+    } else if (! eval_index (indexes->data, env, value, &idx, error)) {
+      value = NULL;
+    } else {
+      const CtplValue *item = NULL;
+      
+      if (idx >= 0) {
+        item = ctpl_value_array_index (value, (gsize)idx);
+      }
+      if (! item) {
+        gchar *value_str = ctpl_value_to_string (value);
+        
+        g_set_error (error, CTPL_EVAL_ERROR, CTPL_EVAL_ERROR_FAILED,
+                     _("Cannot index value '%s' at %ld"), value_str, idx);
+        g_free (value_str);
+      }
+      value = item;
+    }
+  }
+  
+  return value;
+}
+
+/* evaluates @expr without its indexes */
+static gboolean
+ctpl_eval_value_base (const CtplTokenExpr  *expr,
+                      CtplEnviron          *env,
+                      CtplValue            *value,
+                      GError              **error)
+{
+  gboolean rv = TRUE;
+  
+  switch (expr->type) {
+    case CTPL_TOKEN_EXPR_TYPE_VALUE:
+      ctpl_value_copy (&expr->token.t_value, value);
+      break;
+    
+    case CTPL_TOKEN_EXPR_TYPE_SYMBOL: {
+      const CtplValue *symbol_value;
+      
+      symbol_value = lookup_symbol (expr, env, error);
+      if (symbol_value) {
+        ctpl_value_copy (symbol_value, value);
+      } else {
+        rv = FALSE;
+      }
+      break;
+    }
+    
+    case CTPL_TOKEN_EXPR_TYPE_OPERATOR:
+      rv = ctpl_eval_operator (expr, env, value, error);
+      break;
+    
+    case CTPL_TOKEN_EXPR_TYPE_FUNCTION:
+      rv = ctpl_eval_function (expr, env, value, error);
+      break;
+  }
+  
+  return rv;
+}
+
+/**
+ * ctpl_eval_value:
+ * @expr: The #CtplTokenExpr to evaluate
+ * @env: The expression's environment, where lookup symbols
+ * @value: #CtplValue where store the evaluation result on success
+ * @error: Return location for errors, or %NULL to ignore them
+ * 
+ * Computes the given #CtplTokenExpr with the environ @env, storing the resutl
+ * in @value.
+ * 
+ * Returns: %TRUE on success, %FALSE otherwise.
+ * 
+ * Since: 0.2
+ */
+gboolean
+ctpl_eval_value (const CtplTokenExpr  *expr,
+                 CtplEnviron          *env,
+                 CtplValue            *value,
+                 GError              **error)
+{
+  gboolean rv;
+  
+  if (! expr->indexes) {
+    rv = ctpl_eval_value_base (expr, env, value, error);
+  } else {
+    CtplValue         storage;
+    const CtplValue  *item;
+    
+    /* only copy the indexed item, not the indexed values */
+    ctpl_value_init (&storage);
+    item = eval_value_borrowed (expr, env, &storage, error);
+    rv = item != NULL;
+    if (rv) {
+      ctpl_value_copy (item, value);
+    }
+    ctpl_value_free_value (&storage);
+  }
+  
+  return rv;
 }
 
 /* Gets a boolean form a value */
@@ -832,6 +2074,11 @@ ctpl_eval_bool_value (const CtplValue *value)
       eval = (string && *string != 0);
       break;
     }
+    
+    case CTPL_VTYPE_ITERATOR:
+      /* true if there is at least one item */
+      eval = ! ctpl_value_iterator_is_empty (value);
+      break;
   }
   
   return eval;
@@ -858,18 +2105,297 @@ ctpl_eval_bool (const CtplTokenExpr  *expr,
                 CtplEnviron          *env,
                 gboolean             *result,
                 GError              **error)
+{
+  CtplValue         storage;
+  const CtplValue  *value;
+  
+  ctpl_value_init (&storage);
+  value = eval_value_borrowed (expr, env, &storage, error);
+  if (value && result) {
+    *result = ctpl_eval_bool_value (value);
+  }
+  ctpl_value_free_value (&storage);
+  
+  return value != NULL;
+}
+
+/* where ctpl_eval_write_counted() writes */
+typedef struct _Writer Writer;
+struct _Writer
+{
+  CtplOutputStream *output;
+  CtplBudget       *budget;   /* budget to write through, or %NULL */
+  gsize             written;  /* number of bytes written so far */
+};
+
+/* writes @length bytes of @data with @writer */
+static gboolean
+write_data (Writer       *writer,
+            const gchar  *data,
+            gsize         length,
+            GError      **error)
+{
+  if (writer->budget) {
+    gsize     written;
+    gboolean  rv;
+    
+    rv = ctpl_budget_write (writer->budget, writer->output, data, length,
+                            &written, error);
+    writer->written += written;
+    
+    return rv;
+  } else {
+    writer->written += length;
+    
+    return ctpl_output_stream_write (writer->output, data, (gssize)length,
+                                     error);
+  }
+}
+
+/* writes the string form of @value with @writer */
+static gboolean
+write_value (const CtplValue   *value,
+             Writer            *writer,
+             GError           **error)
+{
+  gboolean  rv = FALSE;
+  gchar    *strval;
+  
+  switch (ctpl_value_get_held_type (value)) {
+    /* scalars don't need a temporary string */
+    case CTPL_VTYPE_STRING:
+      rv = write_data (writer, ctpl_value_get_string (value),
+                       strlen (ctpl_value_get_string (value)), error);
+      break;
+    
+    case CTPL_VTYPE_INT: {
+      gchar buf[32];
+      
+      g_snprintf (buf, sizeof (buf), "%ld", ctpl_value_get_int (value));
+      rv = write_data (writer, buf, strlen (buf), error);
+      break;
+    }
+    
+    case CTPL_VTYPE_FLOAT: {
+      gchar buf[G_ASCII_DTOSTR_BUF_SIZE];
+      
+      strval = ctpl_math_dtostr (buf, sizeof (buf),
+                                 ctpl_value_get_float (value));
+      rv = write_data (writer, strval, strlen (strval), error);
+      break;
+    }
+    
+    default:
+      strval = ctpl_value_to_string (value);
+      if (! strval) {
+        g_set_error (error, CTPL_EVAL_ERROR, CTPL_EVAL_ERROR_FAILED,
+                     _("Cannot convert expression to a printable format"));
+      } else {
+        rv = write_data (writer, strval, strlen (strval), error);
+      }
+      g_free (strval);
+  }
+  
+  return rv;
+}
+
+/* size of the blocks in which write_multiplied_string() writes */
+#define MULTIPLY_BLOCK_SIZE 4096
+
+/* writes @str @n times with @writer, by blocks of at most MULTIPLY_BLOCK_SIZE
+ * bytes, see do_multiply_string() */
+static gboolean
+write_multiplied_string (const gchar       *str,
+                         glong              n,
+                         Writer            *writer,
+                         GError           **error)
+{
+  gboolean  rv = TRUE;
+  gsize     str_len = strlen (str);
+  
+  if (str_len * 2 > MULTIPLY_BLOCK_SIZE) {
+    for (; rv && n > 0; n--) {
+      rv = write_data (writer, str, str_len, error);
+    }
+  } else if (str_len > 0 && n > 0) {
+    gchar buf[MULTIPLY_BLOCK_SIZE];
+    glong count = 1;
+    
+    /* fill the block with as many copies as fit by doubling them */
+    memcpy (buf, str, str_len);
+    for (; count * 2 <= n && str_len * (gsize)count * 2 <= sizeof buf;
+         count *= 2) {
+      memcpy (&buf[str_len * (gsize)count], buf, str_len * (gsize)count);
+    }
+    for (; rv && n >= count; n -= count) {
+      rv = write_data (writer, buf, str_len * (gsize)count, error);
+    }
+    if (rv && n > 0) {
+      rv = write_data (writer, buf, str_len * (gsize)n, error);
+    }
+  }
+  
+  return rv;
+}
+
+/* writes the result of the multiplication @expr with @writer, without building
+ * the whole string if it is a string multiplication */
+static gboolean
+write_multiplication (const CtplTokenExpr  *expr,
+                      CtplEnviron          *env,
+                      Writer               *writer,
+                      GError              **error)
+{
+  gboolean          rv = FALSE;
+  CtplValue         lstorage;
+  CtplValue         rstorage;
+  const CtplValue  *lvalue;
+  const CtplValue  *rvalue = NULL;
+  
+  ctpl_value_init (&lstorage);
+  ctpl_value_init (&rstorage);
+  lvalue = eval_value_borrowed (expr->token.t_operator->loperand, env,
+                                &lstorage, error);
+  if (lvalue) {
+    rvalue = eval_value_borrowed (expr->token.t_operator->roperand, env,
+                                  &rstorage, error);
+  }
+  if (lvalue && rvalue) {
+    const CtplValue  *str_val = NULL;
+    const CtplValue  *num_val = NULL;
+    gboolean          stream = FALSE;
+    CtplValue         n;
+    
+    ctpl_value_init (&n);
+    if (CTPL_VALUE_HOLDS_STRING (lvalue)) {
+      str_val = lvalue;
+      num_val = rvalue;
+    } else if (CTPL_VALUE_HOLDS_STRING (rvalue)) {
+      str_val = rvalue;
+      num_val = lvalue;
+    }
+    if (str_val && (CTPL_VALUE_HOLDS_INT (num_val) ||
+                    CTPL_VALUE_HOLDS_FLOAT (num_val))) {
+      ctpl_value_copy (num_val, &n);
+      /* if it fails, let ctpl_eval_operator_mul() report the error */
+      stream = ctpl_value_convert (&n, CTPL_VTYPE_INT);
+    }
+    if (stream) {
+      rv = write_multiplied_string (ctpl_value_get_string (str_val),
+                                    ctpl_value_get_int (&n), writer, error);
+    } else {
+      CtplValue lcopy;
+      CtplValue rcopy;
+      CtplValue value;
+      
+      /* anything else, just like ctpl_eval_operator() */
+      ctpl_value_init (&lcopy);
+      ctpl_value_init (&rcopy);
+      ctpl_value_init (&value);
+      ctpl_value_copy (lvalue, &lcopy);
+      ctpl_value_copy (rvalue, &rcopy);
+      materialize_operand (&lcopy);
+      materialize_operand (&rcopy);
+      rv = ctpl_eval_operator_mul (&lcopy, &rcopy, &value,
+                                   ctpl_environ_get_arena (env), error);
+      if (rv) {
+        rv = write_value (&value, writer, error);
+      }
+      ctpl_value_free_value (&value);
+      ctpl_value_free_value (&rcopy);
+      ctpl_value_free_value (&lcopy);
+    }
+    ctpl_value_free_value (&n);
+  }
+  ctpl_value_free_value (&rstorage);
+  ctpl_value_free_value (&lstorage);
+  
+  return rv;
+}
+
+/*
+ * ctpl_eval_write:
+ * @expr: The #CtplTokenExpr to evaluate
+ * @env: The expression's environment, where lookup symbols
+ * @output: A #CtplOutputStream where write the result
+ * @error: Return location for errors, or %NULL to ignore them
+ * 
+ * Computes the given expression and writes its string form to @output.
+ * Strings built by concatenation are written piece by piece, and
+ * multiplied strings by blocks, without building the whole string.
+ * 
+ * Returns: %TRUE on success, %FALSE otherwise.
+ */
+gboolean
+ctpl_eval_write (const CtplTokenExpr  *expr,
+                 CtplEnviron          *env,
+                 CtplOutputStream     *output,
+                 GError              **error)
+{
+  gsize written;
+  
+  return ctpl_eval_write_counted (expr, env, output, NULL, &written, error);
+}
+
+/*
+ * ctpl_eval_write_counted:
+ * @expr: The #CtplTokenExpr to evaluate
+ * @env: The expression's environment, where lookup symbols
+ * @output: A #CtplOutputStream where write the result
+ * @budget: (allow-none): A #CtplBudget to write through, or %NULL
+ * @written: (out): Return location for the number of bytes written
+ * @error: Return location for errors, or %NULL to ignore them
+ * 
+ * Like ctpl_eval_write(), but also tells how many bytes were written, and
+ * writes through @budget if not %NULL.  On failure, @written is the number of
+ * bytes written before the failure.
+ * 
+ * Returns: %TRUE on success, %FALSE otherwise.
+ */
+gboolean
+ctpl_eval_write_counted (const CtplTokenExpr  *expr,
+                         CtplEnviron          *env,
+                         CtplOutputStream     *output,
+                         CtplBudget           *budget,
+                         gsize                *written,
+                         GError              **error)
 {
   CtplValue value;
+  Writer    writer;
   gboolean  rv;
   
+  writer.output = output;
+  writer.budget = budget;
+  writer.written = 0;
   ctpl_value_init (&value);
-  rv = ctpl_eval_value (expr, env, &value, error);
-  if (rv) {
-    if (result) {
-      *result = ctpl_eval_bool_value (&value);
+  if (IS_PLUS_CHAIN (expr) && ! expr->indexes) {
+    Rope    rope;
+    GArray *storage;
+    guint   i;
+    
+    rope_init (&rope, ctpl_environ_get_arena (env));
+    rv = ctpl_eval_concat (expr, env, &value, &rope, &storage, error);
+    for (i = 0; rv && i < rope.pieces->len; i++) {
+      const gchar *piece = g_array_index (rope.pieces, const gchar *, i);
+      
+      rv = write_data (&writer, piece, strlen (piece), error);
     }
-    ctpl_value_free_value (&value);
+    if (rv && rope.pieces->len == 0) {
+      rv = write_value (&value, &writer, error);
+    }
+    rope_clear (&rope);
+    free_concat_storage (storage);
+  } else if (IS_OPERATOR (expr, CTPL_OPERATOR_MUL) && ! expr->indexes) {
+    rv = write_multiplication (expr, env, &writer, error);
+  } else {
+    const CtplValue *borrowed;
+    
+    /* no need to copy what's only printed */
+    borrowed = eval_value_borrowed (expr, env, &value, error);
+    rv = borrowed && write_value (borrowed, &writer, error);
   }
+  ctpl_value_free_value (&value);
+  *written = writer.written;
   
   return rv;
 }
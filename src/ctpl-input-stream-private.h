@@ -0,0 +1,58 @@
+/* 
+ * 
+ * Copyright (C) 2009-2011 Colomban Wendling <ban@herbesfolles.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ */
+
+#ifndef H_CTPL_INPUT_STREAM_PRIVATE_H
+#define H_CTPL_INPUT_STREAM_PRIVATE_H
+
+#include <glib.h>
+#include "ctpl-input-stream.h"
+
+G_BEGIN_DECLS
+
+
+/*
+ * SECTION: input-stream-private
+ * @short_description: Private input stream API
+ * @include: ctpl/input-stream-private.h
+ * 
+ * Span scanning on top of a #CtplInputStream: these functions find a whole
+ * run of characters of some #CtplCharClass<!-- -->es in one pass over the
+ * stream's cache, rather than peeking and reading each character.
+ */
+
+
+G_GNUC_INTERNAL
+const gchar  *ctpl_input_stream_peek_span   (CtplInputStream *stream,
+                                             guint            classes,
+                                             gssize           max_len,
+                                             gsize           *length,
+                                             GError         **error);
+G_GNUC_INTERNAL
+gssize        ctpl_input_stream_skip_span   (CtplInputStream *stream,
+                                             guint            classes,
+                                             GError         **error);
+G_GNUC_INTERNAL
+gssize        ctpl_input_stream_skip_cspan  (CtplInputStream *stream,
+                                             guint            classes,
+                                             GError         **error);
+
+
+G_END_DECLS
+
+#endif /* guard */
@@ -18,6 +18,7 @@
  */
 
 #include "ctpl-input-stream.h"
+#include "ctpl-input-stream-private.h"
 #include <stdlib.h>
 #include <glib.h>
 #include <gio/gio.h>
@@ -27,6 +28,7 @@
 #include "ctpl-i18n.h"
 #include "ctpl-io.h"
 #include "ctpl-lexer-private.h"
+#include "ctpl-mathutils.h"
 #include "ctpl-value.h"
 
 
@@ -55,7 +57,6 @@
 
 #define INPUT_STREAM_BUF_SIZE   4096U
 #define INPUT_STREAM_GROW_SIZE  64U
-#define SKIP_BUF_SIZE           64U
 
 /**
  * CtplInputStream:
@@ -72,6 +73,9 @@ struct _CtplInputStream
   gsize         buf_pos;
   /* infos */
   gchar        *name;
+  /* line and pos are only exact at buffer[line_mark], they are brought up to
+   * date lazily, when needed or before discarding buffered data */
+  gsize         line_mark;
   guint         line;
   guint         pos;
 };
@@ -102,6 +106,7 @@ ctpl_input_stream_new (GInputStream *stream,
   self->buffer = g_malloc (self->buf_size);
   self->buf_pos = self->buf_size; /* force buffer filling */
   self->name = g_strdup (name);
+  self->line_mark = self->buf_pos;
   self->line = 1U;
   self->pos = 0U;
   
@@ -270,6 +275,67 @@ ctpl_input_stream_unref (CtplInputStream *stream)
   }
 }
 
+/*
+ * advance_line_info:
+ * @data: data to account
+ * @len: length of @data
+ * @line: (inout): line number to update
+ * @pos: (inout): line position to update
+ * 
+ * Updates @line and @pos as if @data was read from a position at @line, @pos.
+ * A <code>\n</code> starts a new line and a <code>\r</code> only resets the
+ * position in the line.
+ */
+static void
+advance_line_info (const gchar *data,
+                   gsize        len,
+                   guint       *line,
+                   guint       *pos)
+{
+  const gchar  *end = &data[len];
+  const gchar  *line_start = data;
+  const gchar  *nl;
+  const gchar  *p;
+  gboolean      new_line = FALSE;
+  
+  /* memchr() is vectorized by any decent libc, so let it find newlines */
+  while ((nl = memchr (line_start, '\n', (gsize)(end - line_start))) != NULL) {
+    (*line) ++;
+    line_start = nl + 1;
+    new_line = TRUE;
+  }
+  /* a \r in the last line also resets the position */
+  for (p = end; p > line_start; p--) {
+    if (p[-1] == '\r') {
+      line_start = p;
+      new_line = TRUE;
+      break;
+    }
+  }
+  if (new_line) {
+    *pos = 0U;
+  }
+  *pos += (guint)(end - line_start);
+}
+
+/*
+ * sync_line_info:
+ * @stream: A #CtplInputStream
+ * 
+ * Brings the line information of @stream up to date with the read position.
+ * This must be called before discarding data from the buffer.
+ */
+static void
+sync_line_info (CtplInputStream *stream)
+{
+  if (stream->buf_pos > stream->line_mark) {
+    advance_line_info (&stream->buffer[stream->line_mark],
+                       stream->buf_pos - stream->line_mark,
+                       &stream->line, &stream->pos);
+  }
+  stream->line_mark = stream->buf_pos;
+}
+
 /**
  * ctpl_input_stream_get_stream:
  * @stream: A #CtplInputStream
@@ -315,7 +381,15 @@ ctpl_input_stream_get_name (const CtplInputStream *stream)
 guint
 ctpl_input_stream_get_line (const CtplInputStream *stream)
 {
-  return stream->line;
+  guint line = stream->line;
+  guint pos = stream->pos;
+  
+  if (stream->buf_pos > stream->line_mark) {
+    advance_line_info (&stream->buffer[stream->line_mark],
+                       stream->buf_pos - stream->line_mark, &line, &pos);
+  }
+  
+  return line;
 }
 
 /**
@@ -332,7 +406,15 @@ ctpl_input_stream_get_line (const CtplInputStream *stream)
 guint
 ctpl_input_stream_get_line_position (const CtplInputStream *stream)
 {
-  return stream->pos;
+  guint line = stream->line;
+  guint pos = stream->pos;
+  
+  if (stream->buf_pos > stream->line_mark) {
+    advance_line_info (&stream->buffer[stream->line_mark],
+                       stream->buf_pos - stream->line_mark, &line, &pos);
+  }
+  
+  return pos;
 }
 
 /**
@@ -364,6 +446,7 @@ ctpl_input_stream_set_error (CtplInputStream  *stream,
     va_start (ap, format);
     message = g_strdup_vprintf (format, ap);
     va_end (ap);
+    sync_line_info (stream);
     g_set_error (error, domain, code, "%s:%u:%u: %s",
                  stream->name ? stream->name : _("<stream>"), stream->line,
                  stream->pos, message);
@@ -390,6 +473,7 @@ ensure_cache_filled (CtplInputStream *stream,
   if (stream->buf_pos >= stream->buf_size) {
     gssize read_size;
     
+    sync_line_info (stream);
     read_size = g_input_stream_read (stream->stream, stream->buffer,
                                      stream->buf_size, NULL, error);
     if (read_size < 0) {
@@ -397,6 +481,7 @@ ensure_cache_filled (CtplInputStream *stream,
     } else {
       stream->buf_size = (gsize)read_size;
       stream->buf_pos = 0U;
+      stream->line_mark = 0U;
     }
   }
   
@@ -450,6 +535,7 @@ resize_cache (CtplInputStream *stream,
       }
     }
   } else if (new_size < stream->buf_size) {
+    sync_line_info (stream);
     if (stream->buf_pos >= stream->buf_size) {
       /* we are at the end of the buffer, no need to care about its content,
        * just retrieve next data */
@@ -462,11 +548,13 @@ resize_cache (CtplInputStream *stream,
       if (new_start > stream->buf_pos) {
         /* we have too much data in the buffer, cannot shrink to the requested
          * size; shrink as much as we can */
-        new_start = stream->buf_size - stream->buf_pos;
+        new_start = stream->buf_pos;
         new_size = stream->buf_size - new_start;
       }
       /* OK, move the data and resize */
       memmove (stream->buffer, &stream->buffer[new_start], new_size);
+      stream->buf_pos -= new_start;
+      stream->line_mark = stream->buf_pos;
       stream->buf_size = new_size;
       stream->buffer = g_realloc (stream->buffer, stream->buf_size);
     }
@@ -475,6 +563,26 @@ resize_cache (CtplInputStream *stream,
   return success;
 }
 
+/*
+ * discard_read_data:
+ * @stream: A #CtplInputStream
+ * 
+ * Drops the already read data from the cache of a #CtplInputStream, moving the
+ * unread data at its start.
+ */
+static void
+discard_read_data (CtplInputStream *stream)
+{
+  if (stream->buf_pos > 0) {
+    sync_line_info (stream);
+    memmove (stream->buffer, &stream->buffer[stream->buf_pos],
+             stream->buf_size - stream->buf_pos);
+    stream->buf_size -= stream->buf_pos;
+    stream->buf_pos = 0U;
+    stream->line_mark = 0U;
+  }
+}
+
 /**
  * ctpl_input_stream_eof:
  * @stream: A #CtplInputStream
@@ -511,6 +619,217 @@ ctpl_input_stream_eof (CtplInputStream *stream,
   return eof;
 }
 
+/*
+ * span_in_cache:
+ * @stream: A #CtplInputStream
+ * @start: offset in the cache from where start scanning
+ * @table: a 256-entry table of character classes
+ * @classes: the classes from @table to look for
+ * @reject: whether to span over characters that are not part of @classes
+ *          rather than characters that are
+ * 
+ * Scans the cached data of @stream for a run of characters (not) being part
+ * of @classes.
+ * 
+ * Returns: The length of the run, that stops either on a non-matching
+ *          character or at the end of the cached data.
+ */
+static gsize
+span_in_cache (const CtplInputStream *stream,
+               gsize                  start,
+               const guint8          *table,
+               guint                  classes,
+               gboolean               reject)
+{
+  const guchar *p   = (const guchar *)&stream->buffer[start];
+  const guchar *end = (const guchar *)&stream->buffer[stream->buf_size];
+  
+  if (reject) {
+    while (p < end && ! (table[*p] & classes)) {
+      p++;
+    }
+  } else {
+    while (p < end && (table[*p] & classes)) {
+      p++;
+    }
+  }
+  
+  return (gsize)(p - (const guchar *)&stream->buffer[start]);
+}
+
+/*
+ * peek_span:
+ * @stream: A #CtplInputStream
+ * @table: a 256-entry table of character classes
+ * @classes: the classes from @table to accept
+ * @max_len: the maximum length of the span, or -1 for no limit
+ * @length: (out): return location for the length of the span
+ * @error: Return location for errors, or %NULL to ignore them
+ * 
+ * Finds the run of characters of @classes at the current position of @stream,
+ * growing the stream's cache so the whole run is available at once.
+ * 
+ * Returns: %TRUE on success, %FALSE otherwise.
+ */
+static gboolean
+peek_span (CtplInputStream *stream,
+           const guint8    *table,
+           guint            classes,
+           gssize           max_len,
+           gsize           *length,
+           GError         **error)
+{
+  gsize max_length;
+  gsize len = 0;
+  
+  max_length = (max_len < 0) ? G_MAXSIZE : (gsize)max_len;
+  if (! ensure_cache_filled (stream, error)) {
+    return FALSE;
+  }
+  while (len < max_length) {
+    gsize old_size;
+    
+    len += span_in_cache (stream, stream->buf_pos + len, table, classes, FALSE);
+    if (stream->buf_pos + len < stream->buf_size) {
+      break; /* found the end of the span */
+    }
+    /* the span reaches the end of the cache, grow it.  Grow by the cache's
+     * size not to read large spans with many small reads */
+    old_size = stream->buf_size;
+    discard_read_data (stream);
+    if (! resize_cache (stream,
+                        stream->buf_size + MAX (old_size,
+                                                INPUT_STREAM_GROW_SIZE),
+                        error)) {
+      return FALSE;
+    } else if (stream->buf_pos + len >= stream->buf_size) {
+      break; /* EOF */
+    }
+  }
+  *length = MIN (len, max_length);
+  
+  return TRUE;
+}
+
+/*
+ * skip_span:
+ * @stream: A #CtplInputStream
+ * @table: a 256-entry table of character classes
+ * @classes: the classes from @table to skip
+ * @reject: whether to skip characters not from @classes rather than
+ *          characters from @classes
+ * @error: Return location for errors, or %NULL to ignore them
+ * 
+ * Skips the run of characters (not) from @classes at the current position of
+ * @stream.  Unlike peek_span(), this never grows the cache.
+ * 
+ * Returns: The number of skipped bytes, or -1 on error.
+ */
+static gssize
+skip_span (CtplInputStream *stream,
+           const guint8    *table,
+           guint            classes,
+           gboolean         reject,
+           GError         **error)
+{
+  gssize n = 0;
+  
+  while (ensure_cache_filled (stream, error)) {
+    gsize len;
+    
+    len = span_in_cache (stream, stream->buf_pos, table, classes, reject);
+    stream->buf_pos += len;
+    n += (gssize)len;
+    if (stream->buf_pos < stream->buf_size || stream->buf_size < 1) {
+      return n; /* end of the span or EOF */
+    }
+  }
+  
+  return -1;
+}
+
+/* fills @table for characters from @chars to be of class 1 */
+static void
+build_class_table (guint8       table[256],
+                   const gchar *chars,
+                   gssize       chars_len)
+{
+  gsize len;
+  gsize i;
+  
+  len = (chars_len < 0) ? strlen (chars) : (gsize)chars_len;
+  memset (table, 0, 256);
+  for (i = 0; i < len; i++) {
+    table[(guchar)chars[i]] = 1;
+  }
+}
+
+/*
+ * ctpl_input_stream_peek_span:
+ * @stream: A #CtplInputStream
+ * @classes: A combination of #CtplCharClass<!-- -->es to accept
+ * @max_len: The maximum length of the span, or -1 for no limit
+ * @length: (out): Return location for the length of the span
+ * @error: Return location for errors, or %NULL to ignore them
+ * 
+ * Peeks the run of characters from @classes at the current position of
+ * @stream, without copying it.
+ * 
+ * Returns: A pointer to the @length bytes of the span, valid until next
+ *          operation on @stream; or %NULL on error.
+ */
+const gchar *
+ctpl_input_stream_peek_span (CtplInputStream *stream,
+                             guint            classes,
+                             gssize           max_len,
+                             gsize           *length,
+                             GError         **error)
+{
+  if (! peek_span (stream, ctpl_char_class_table, classes, max_len, length,
+                   error)) {
+    return NULL;
+  }
+  
+  return &stream->buffer[stream->buf_pos];
+}
+
+/*
+ * ctpl_input_stream_skip_span:
+ * @stream: A #CtplInputStream
+ * @classes: A combination of #CtplCharClass<!-- -->es to skip
+ * @error: Return location for errors, or %NULL to ignore them
+ * 
+ * Skips all characters from @classes at the current position of @stream.
+ * 
+ * Returns: The number of skipped bytes, or -1 on error.
+ */
+gssize
+ctpl_input_stream_skip_span (CtplInputStream *stream,
+                             guint            classes,
+                             GError         **error)
+{
+  return skip_span (stream, ctpl_char_class_table, classes, FALSE, error);
+}
+
+/*
+ * ctpl_input_stream_skip_cspan:
+ * @stream: A #CtplInputStream
+ * @classes: A combination of #CtplCharClass<!-- -->es on which stop
+ * @error: Return location for errors, or %NULL to ignore them
+ * 
+ * Skips all characters up to the first one from @classes (or to the end of
+ * the stream).
+ * 
+ * Returns: The number of skipped bytes, or -1 on error.
+ */
+gssize
+ctpl_input_stream_skip_cspan (CtplInputStream *stream,
+                              guint            classes,
+                              GError         **error)
+{
+  return skip_span (stream, ctpl_char_class_table, classes, TRUE, error);
+}
+
 /**
  * ctpl_input_stream_read:
  * @stream: A #CtplInputStream
@@ -540,28 +859,20 @@ ctpl_input_stream_read (CtplInputStream *stream,
     return -1;
   }
   
-  for (read_size = 0; count > 0; read_size ++) {
+  for (read_size = 0; count > 0; ) {
     if (! ensure_cache_filled (stream, error)) {
       read_size = -1;
       break;
     } else if (stream->buf_size < 1) {
       break;
     } else {
-      gchar c = stream->buffer[stream->buf_pos++];
+      gsize n = MIN (count, stream->buf_size - stream->buf_pos);
       
-      switch (c) {
-        case '\n':
-          stream->line ++;
-          /* Fallthrough */
-        case '\r':
-          stream->pos = 0U;
-          break;
-        
-        default:
-          stream->pos ++;
-      }
-      ((gchar *)buffer)[read_size] = c;
-      count --;
+      memcpy (&((gchar *)buffer)[read_size], &stream->buffer[stream->buf_pos],
+              n);
+      stream->buf_pos += n;
+      read_size += (gssize)n;
+      count -= n;
     }
   }
   
@@ -663,35 +974,20 @@ ctpl_input_stream_read_word (CtplInputStream *stream,
                              gsize           *length,
                              GError         **error)
 {
-  GError   *err = NULL;
-  GString  *word;
-  gsize     accept_length;
-  gsize     max_length;
+  guint8  table[256];
+  gchar  *word = NULL;
+  gsize   len;
   
-  accept_length = (accept_len < 0) ? strlen (accept) : (gsize)accept_len;
-  max_length = (max_len < 0) ? G_MAXSIZE : (gsize)max_len;
-  word = g_string_new (NULL);
-  while (! err && word->len <= max_length) {
-    gchar c;
-    
-    c = ctpl_input_stream_peek_c (stream, &err);
-    if (err || ctpl_input_stream_eof_fast (stream) ||
-        ! memchr (accept, c, accept_length)) {
-      break;
-    } else {
-      g_string_append_c (word, c);
-      ctpl_input_stream_get_c (stream, &err);
-    }
-  }
-  if (err) {
-    g_propagate_error (error, err);
-  } else {
+  build_class_table (table, accept, accept_len);
+  if (peek_span (stream, table, 1, max_len, &len, error)) {
+    word = g_strndup (&stream->buffer[stream->buf_pos], len);
+    stream->buf_pos += len;
     if (length) {
-      *length = word->len;
+      *length = len;
     }
   }
   
-  return g_string_free (word, err != NULL);
+  return word;
 }
 
 /**
@@ -712,40 +1008,27 @@ ctpl_input_stream_read_word (CtplInputStream *stream,
  * 
  * Since: 0.2
  */
-/* Same as ctpl_input_stream_read_word() but uses ctpl_is_symbol() instead of a
- * string of acceptable character to be faster */
+/* Same as ctpl_input_stream_read_word() but uses the symbol character class
+ * rather than building a table from a string of acceptable characters */
 gchar *
 ctpl_input_stream_read_symbol_full (CtplInputStream *stream,
                                     gssize           max_len,
                                     gsize           *length,
                                     GError         **error)
 {
-  GError   *err = NULL;
-  GString  *word;
-  gsize     max_length;
+  gchar  *word = NULL;
+  gsize   len;
   
-  max_length = (max_len < 0) ? G_MAXSIZE : (gsize)max_len;
-  word = g_string_new (NULL);
-  while (! err && word->len <= max_length) {
-    gchar c;
-    
-    c = ctpl_input_stream_peek_c (stream, &err);
-    if (err || ctpl_input_stream_eof_fast (stream) || ! ctpl_is_symbol (c)) {
-      break;
-    } else {
-      g_string_append_c (word, c);
-      ctpl_input_stream_get_c (stream, &err);
-    }
-  }
-  if (err) {
-    g_propagate_error (error, err);
-  } else {
+  if (peek_span (stream, ctpl_char_class_table, CTPL_CHAR_CLASS_SYMBOL,
+                 max_len, &len, error)) {
+    word = g_strndup (&stream->buffer[stream->buf_pos], len);
+    stream->buf_pos += len;
     if (length) {
-      *length = word->len;
+      *length = len;
     }
   }
   
-  return g_string_free (word, err != NULL);
+  return word;
 }
 
 /**
@@ -774,38 +1057,19 @@ ctpl_input_stream_peek_word (CtplInputStream *stream,
                              gsize           *length,
                              GError         **error)
 {
-  gboolean  success = FALSE;
-  GString  *word;
-  gsize     accept_length;
-  gsize     max_length;
+  guint8  table[256];
+  gchar  *word = NULL;
+  gsize   len;
   
-  accept_length = (accept_len < 0) ? strlen (accept) : (gsize)accept_len;
-  max_length = (max_len < 0) ? G_MAXSIZE : (gsize)max_len;
-  word = g_string_new (NULL);
-  if (ensure_cache_filled (stream, error)) {
-    gsize pos = stream->buf_pos;
-    
-    success = TRUE;
-    do {
-      gchar c = stream->buffer[pos++];
-      
-      if (memchr (accept, c, accept_length)) {
-        g_string_append_c (word, c);
-      } else {
-        break;
-      }
-      if (pos >= stream->buf_size) {
-        success = resize_cache (stream,
-                                stream->buf_size + INPUT_STREAM_GROW_SIZE,
-                                error);
-      }
-    } while (success && pos < stream->buf_size && word->len <= max_length);
-  }
-  if (success && length) {
-    *length = word->len;
+  build_class_table (table, accept, accept_len);
+  if (peek_span (stream, table, 1, max_len, &len, error)) {
+    word = g_strndup (&stream->buffer[stream->buf_pos], len);
+    if (length) {
+      *length = len;
+    }
   }
   
-  return g_string_free (word, ! success);
+  return word;
 }
 
 /**
@@ -824,44 +1088,26 @@ ctpl_input_stream_peek_word (CtplInputStream *stream,
  * 
  * Since: 0.2
  */
-/* Same as ctpl_input_stream_peek_word() but uses ctpl_is_symbol() instead of a
- * string of acceptable character to be faster */
+/* Same as ctpl_input_stream_peek_word() but uses the symbol character class
+ * rather than building a table from a string of acceptable characters */
 gchar *
 ctpl_input_stream_peek_symbol_full (CtplInputStream *stream,
                                     gssize           max_len,
                                     gsize           *length,
                                     GError         **error)
 {
-  gboolean  success = FALSE;
-  GString  *word;
-  gsize     max_length;
+  gchar  *word = NULL;
+  gsize   len;
   
-  max_length = (max_len < 0) ? G_MAXSIZE : (gsize)max_len;
-  word = g_string_new (NULL);
-  if (ensure_cache_filled (stream, error)) {
-    gsize pos = stream->buf_pos;
-    
-    success = TRUE;
-    do {
-      gchar c = stream->buffer[pos++];
-      
-      if (ctpl_is_symbol (c)) {
-        g_string_append_c (word, c);
-      } else {
-        break;
-      }
-      if (pos >= stream->buf_size) {
-        success = resize_cache (stream,
-                                stream->buf_size + INPUT_STREAM_GROW_SIZE,
-                                error);
-      }
-    } while (success && pos < stream->buf_size && word->len <= max_length);
-  }
-  if (success && length) {
-    *length = word->len;
+  if (peek_span (stream, ctpl_char_class_table, CTPL_CHAR_CLASS_SYMBOL,
+                 max_len, &len, error)) {
+    word = g_strndup (&stream->buffer[stream->buf_pos], len);
+    if (length) {
+      *length = len;
+    }
   }
   
-  return g_string_free (word, ! success);
+  return word;
 }
 
 /**
@@ -881,20 +1127,27 @@ ctpl_input_stream_skip (CtplInputStream *stream,
                         gsize            count,
                         GError         **error)
 {
-  gssize  n = 0;
-  gchar   buf[SKIP_BUF_SIZE];
+  gssize n = 0;
+  
+  if (G_UNLIKELY (count > G_MAXSSIZE)) {
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+                 "Too large count value passed to %s: %"G_GSIZE_FORMAT,
+                 G_STRFUNC, count);
+    return -1;
+  }
   
   while (count > 0) {
-    gssize n_read;
-    
-    n_read = ctpl_input_stream_read (stream, buf, MIN (count, SKIP_BUF_SIZE),
-                                     error);
-    if (n_read < 0) {
+    if (! ensure_cache_filled (stream, error)) {
       n = -1;
       break;
+    } else if (stream->buf_size < 1) {
+      break;
     } else {
-      n += n_read;
-      count -= (gsize)n_read;
+      gsize n_skip = MIN (count, stream->buf_size - stream->buf_pos);
+      
+      stream->buf_pos += n_skip;
+      n += (gssize)n_skip;
+      count -= n_skip;
     }
   }
   
@@ -921,29 +1174,11 @@ ctpl_input_stream_skip_word (CtplInputStream  *stream,
                              gssize            reject_len,
                              GError          **error)
 {
-  gssize  n = 0;
-  GError *err = NULL;
-  gsize   reject_length;
+  guint8 table[256];
   
-  reject_length = reject_len < 0 ? strlen (reject) : (gsize) reject_len;
-  while (! err) {
-    gchar c;
-    
-    c = ctpl_input_stream_peek_c (stream, &err);
-    if (err || ctpl_input_stream_eof_fast (stream) ||
-        ! memchr (reject, c, reject_length)) {
-      break;
-    } else {
-      ctpl_input_stream_get_c (stream, &err);
-      n++;
-    }
-  }
-  if (err) {
-    g_propagate_error (error, err);
-    n = -1;
-  }
+  build_class_table (table, reject, reject_len);
   
-  return n;
+  return skip_span (stream, table, 1, FALSE, error);
 }
 
 /**
@@ -958,33 +1193,14 @@ ctpl_input_stream_skip_word (CtplInputStream  *stream,
  * 
  * Since: 0.2
  */
-/* Same as ctpl_input_stream_skip_word() but uses ctpl_is_blank() instead of a
- * string of acceptable character to be faster */
+/* Same as ctpl_input_stream_skip_word() but uses the blank character class
+ * rather than building a table from a string of characters */
 gssize
 ctpl_input_stream_skip_blank (CtplInputStream  *stream,
                               GError          **error)
 {
-  gssize  n = 0;
-  GError *err = NULL;
-  
-  while (! err) {
-    gchar c;
-    
-    c = ctpl_input_stream_peek_c (stream, &err);
-    if (err || ctpl_input_stream_eof_fast (stream) ||
-        ! ctpl_is_blank (c)) {
-      break;
-    } else {
-      ctpl_input_stream_get_c (stream, &err);
-      n++;
-    }
-  }
-  if (err) {
-    g_propagate_error (error, err);
-    n = -1;
-  }
-  
-  return n;
+  return skip_span (stream, ctpl_char_class_table, CTPL_CHAR_CLASS_BLANK, FALSE,
+                    error);
 }
 
 /**
@@ -1025,20 +1241,30 @@ ctpl_input_stream_read_string_literal (CtplInputStream *stream,
     
     string = g_string_new ("");
     while (in_str && ! ctpl_input_stream_eof (stream, &err) && ! err) {
-      c = ctpl_input_stream_get_c (stream, &err);
-      if (! err) {
-        if (c == CTPL_ESCAPE_CHAR) {
-          escaped = ! escaped;
+      const gchar  *start = &stream->buffer[stream->buf_pos];
+      const gchar  *end   = &stream->buffer[stream->buf_size];
+      const gchar  *p     = start;
+      
+      if (escaped) {
+        /* an escaped character is taken as-is */
+        escaped = FALSE;
+        p++;
+      }
+      /* append the whole run of plain characters at once */
+      while (p < end &&
+             *p != CTPL_ESCAPE_CHAR && *p != CTPL_STRING_DELIMITER_CHAR) {
+        p++;
+      }
+      g_string_append_len (string, start, p - start);
+      if (p < end) {
+        if (*p == CTPL_ESCAPE_CHAR) {
+          escaped = TRUE;
         } else {
-          if (c == CTPL_STRING_DELIMITER_CHAR && ! escaped) {
-            in_str = FALSE;
-          }
-          escaped = FALSE;
-        }
-        if (in_str && ! escaped) {
-          g_string_append_c (string, c);
+          in_str = FALSE;
         }
+        p++;
       }
+      stream->buf_pos += (gsize)(p - start);
     }
     if (! err && in_str) {
       ctpl_input_stream_set_error (stream, &err,
@@ -1056,10 +1282,6 @@ ctpl_input_stream_read_string_literal (CtplInputStream *stream,
   return str;
 }
 
-#define READ_FLOAT  (1 << 0)
-#define READ_INT    (1 << 1)
-#define READ_BOTH   (READ_FLOAT | READ_INT)
-
 /*
  * ctpl_input_stream_read_number_internal:
  * @type: which kind of number match (float, int or both)
@@ -1072,217 +1294,28 @@ ctpl_input_stream_read_number_internal (CtplInputStream *stream,
                                         CtplValue       *value,
                                         GError         **error)
 {
-  gboolean  have_mantissa       = FALSE;
-  gboolean  have_exponent       = FALSE;
-  gboolean  have_exponent_delim = FALSE;
-  gboolean  have_sign           = FALSE;
-  gboolean  have_dot            = FALSE;
-  GString  *gstring;
-  GError   *err                 = NULL;
-  gboolean  in_number           = TRUE;
-  gint      base                = 10;
-  
-  #define ISSIGN(c)   ((c) == '+' || (c) == '-')
-  #define ISDIGIT(c)  ((c) >= '0' && (c) <= '9')
-  #define ISBDIGIT(c) ((c) == '0' || (c) == '1')
-  #define ISODIGIT(c) ((c) >= '0' && (c) <= '7')
-  #define ISXDIGIT(c) (ISDIGIT (c) || \
-                       ((c) >= 'a' && (c) <= 'f') || \
-                       ((c) >= 'A' && (c) <= 'F'))
+  const gchar  *span;
+  gsize         len;
+  gsize         n_read = 0;
+  GError       *err = NULL;
   
-  gstring = g_string_new ("");
-  while (in_number && ! err) {
-    gchar   buf[3];
-    gssize  buf_len;
-    
-    buf_len = ctpl_input_stream_peek (stream, buf, sizeof (buf), &err);
-    if (! err) {
-      gchar c = (buf_len > 0) ? buf[0] : CTPL_EOF;
-      
-      switch (c) {
-        case '.':
-          if (! have_dot && ! have_exponent_delim && (type & READ_FLOAT)) {
-            g_string_append_c (gstring, c);
-            have_dot = TRUE;
-            type &= READ_FLOAT;
-          } else {
-            in_number = FALSE;
-          }
-          break;
-        
-        case '+':
-        case '-':
-          if (! have_sign && (! have_mantissa ||
-                              (have_exponent_delim && ! have_exponent)) &&
-              /* ISDIGIT() is fine here even though we probably don't know the
-               * base yet because the default base is 10 and the exponent or
-               * power are also in base 10 */
-              buf_len > 1 && ISDIGIT (buf[1])) {
-            g_string_append_c (gstring, c);
-            have_sign = TRUE;
-          } else {
-            in_number = FALSE;
-          }
-          break;
-        
-        case 'e':
-        case 'E':
-          if (base < 15) {
-            if (have_mantissa && ! have_exponent_delim &&
-                (type & READ_FLOAT) && base == 10 &&
-                ((buf_len > 1 && ISDIGIT (buf[1])) ||
-                 (buf_len > 2 && ISSIGN (buf[1]) && ISDIGIT (buf[2])))) {
-              have_exponent_delim = TRUE;
-              have_sign = FALSE;
-              type &= READ_FLOAT;
-              g_string_append_c (gstring, 'e');
-            } else {
-              in_number = FALSE;
-            }
-            break;
-          }
-          /* Fallthrough */
-        case 'b':
-        case 'B':
-        case 'a':
-        case 'A':
-        case 'c':
-        case 'C':
-        case 'd':
-        case 'D':
-        case 'f':
-        case 'F':
-          if (base < 16 || have_exponent_delim /* exponent is decimal */) {
-            in_number = FALSE;
-            break;
-          }
-          /* Fallthrough */
-        case '8':
-        case '9':
-          if (base < 10) {
-            in_number = FALSE;
-            break;
-          }
-        case '2':
-        case '3':
-        case '4':
-        case '5':
-        case '6':
-        case '7':
-          if (base < 8) {
-            in_number = FALSE;
-            break;
-          }
-          /* Fallthrough */
-        case '0':
-          if (! have_mantissa && buf_len > 2) {
-            gboolean is_start = TRUE;
-            
-            if ((type & READ_INT) &&
-                (buf[1] == 'b' || buf[1] == 'B') && ISBDIGIT (buf[2])) {
-              type &= READ_INT;
-              base = 2;
-            } else if ((type & READ_INT) &&
-                       (buf[1] == 'o' || buf[1] == 'O') && ISODIGIT (buf[2])) {
-              type &= READ_INT;
-              base = 8;
-            } else if ((buf[1] == 'x' || buf[1] == 'X') && ISXDIGIT (buf[2])) {
-              /* needed for floating-points */
-              g_string_append_c (gstring, c);
-              g_string_append_c (gstring, buf[1]);
-              base = 16;
-            } else {
-              is_start = FALSE;
-            }
-            if (is_start) {
-              /* eat the character we just handled. no need to check the error
-               * since the data is already cached -- so no error can happen */
-              ctpl_input_stream_get_c (stream, NULL);
-              break;
-            }
-          }
-          /* Fallthrough */
-        case '1':
-          g_string_append_c (gstring, c);
-          if (! have_exponent_delim) {
-            have_mantissa = TRUE;
-          } else {
-            have_exponent = TRUE;
-          }
-          break;
-        
-        case 'p':
-        case 'P':
-          if (have_mantissa && ! have_exponent_delim &&
-              (type & READ_FLOAT) && base == 16 &&
-              ((buf_len > 1 && ISDIGIT (buf[1])) ||
-               (buf_len > 2 && ISSIGN (buf[1]) && ISDIGIT (buf[2])))) {
-            have_exponent_delim = TRUE;
-            have_sign = FALSE;
-            type &= READ_FLOAT;
-            g_string_append_c (gstring, 'p');
-          } else {
-            in_number = FALSE;
-          }
-          break;
-        
-        default:
-          in_number = FALSE;
-      }
-      if (in_number) {
-        ctpl_input_stream_get_c (stream, &err); /* eat character */
-      }
-    }
-  }
-  if (! err) {
-    if (! have_mantissa) {
-      ctpl_input_stream_set_error (stream, &err, CTPL_IO_ERROR,
-                                   CTPL_IO_ERROR_INVALID_NUMBER,
-                                   _("Missing mantissa in numeric constant"));
-    } else {
-      gchar  *nptr = gstring->str;
-      gchar  *endptr;
-      gdouble dblval = 0.0;
-      glong   longval = 0;
-      gint    errno_save = errno;
-      
-      errno = 0;
-      if (type & READ_INT) {
-        longval = strtol (nptr, &endptr, base);
-      } else {
-        dblval = g_ascii_strtod (nptr, &endptr);
-      }
-      if (! endptr || *endptr != 0) {
-        ctpl_input_stream_set_error (stream, &err, CTPL_IO_ERROR,
-                                     CTPL_IO_ERROR_INVALID_NUMBER,
-                                     _("Invalid base %d numeric constant \"%s\""),
-                                     base, nptr);
-      } else if (errno == ERANGE) {
-        ctpl_input_stream_set_error (stream, &err, CTPL_IO_ERROR,
-                                     CTPL_IO_ERROR_RANGE,
-                                     _("Overflow in numeric constant conversion"));
-      } else {
-        if (type & READ_INT) {
-          ctpl_value_set_int (value, longval);
-        } else {
-          ctpl_value_set_float (value, dblval);
-        }
-      }
-      errno = errno_save;
-    }
+  /* get all characters that may be part of the number at once */
+  span = ctpl_input_stream_peek_span (stream, CTPL_CHAR_CLASS_NUMBER, -1, &len,
+                                      error);
+  if (! span) {
+    return FALSE;
   }
+  ctpl_math_scan_number (span, len, type, value, &n_read, &err);
+  /* the data is cached, skipping it cannot fail */
+  stream->buf_pos += n_read;
   if (err) {
-    g_propagate_error (error, err);
+    ctpl_input_stream_set_error (stream, error, err->domain, err->code,
+                                 "%s", err->message);
+    g_error_free (err);
+    return FALSE;
   }
-  g_string_free (gstring, TRUE);
-  
-  #undef ISSIGN
-  #undef ISDIGIT
-  #undef ISBDIGIT
-  #undef ISODIGIT
-  #undef ISXDIGIT
   
-  return ! err;
+  return TRUE;
 }
 
 /**
@@ -1331,8 +1364,10 @@ ctpl_input_stream_read_number (CtplInputStream *stream,
                                CtplValue       *value,
                                GError         **error)
 {
-  return ctpl_input_stream_read_number_internal (stream, READ_BOTH, value,
-                                                 error);
+  return ctpl_input_stream_read_number_internal (stream,
+                                                 CTPL_MATH_NUMBER_INT |
+                                                 CTPL_MATH_NUMBER_FLOAT,
+                                                 value, error);
 }
 
 /**
@@ -1356,8 +1391,8 @@ ctpl_input_stream_read_float (CtplInputStream *stream,
   gdouble   v = 0.0;
   
   ctpl_value_init (&value);
-  if (ctpl_input_stream_read_number_internal (stream, READ_FLOAT, &value,
-                                              error)) {
+  if (ctpl_input_stream_read_number_internal (stream, CTPL_MATH_NUMBER_FLOAT,
+                                              &value, error)) {
     v = ctpl_value_get_float (&value);
   }
   ctpl_value_free_value (&value);
@@ -1527,8 +1562,8 @@ ctpl_input_stream_read_int (CtplInputStream *stream,
   glong     v = 0l;
   
   ctpl_value_init (&value);
-  if (ctpl_input_stream_read_number_internal (stream, READ_INT, &value,
-                                              error)) {
+  if (ctpl_input_stream_read_number_internal (stream, CTPL_MATH_NUMBER_INT,
+                                              &value, error)) {
     v = ctpl_value_get_int (&value);
   }
   ctpl_value_free_value (&value);
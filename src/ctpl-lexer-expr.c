@@ -27,6 +27,7 @@
 #include "ctpl-token-private.h"
 #include "ctpl-mathutils.h"
 #include "ctpl-input-stream.h"
+#include "ctpl-input-stream-private.h"
 #include "ctpl-io.h"
 #include "ctpl-value.h"
 
@@ -104,6 +105,74 @@
  *     </listitem>
  *   </varlistentry>
  *   <varlistentry>
+ *     <term>Function calls</term>
+ *     <listitem>
+ *       <para>
+ *         A function name directly followed by a parenthesized list of
+ *         comma-separated expressions, its arguments.  A function call is an
+ *         operand, so it may be indexed and used with operators.
+ *       </para>
+ *       <para>
+ *         The built-in functions are:
+ *         <variablelist>
+ *           <varlistentry>
+ *             <term><code>range(<replaceable>start</replaceable>,
+ *             <replaceable>stop</replaceable>,
+ *             <replaceable>step</replaceable>)</code></term>
+ *             <listitem>
+ *               <para>
+ *                 The integers from <replaceable>start</replaceable> (included)
+ *                 to <replaceable>stop</replaceable> (excluded), by steps of
+ *                 <replaceable>step</replaceable>.
+ *                 <replaceable>step</replaceable> defaults to 1, and if only
+ *                 one argument is given, it is <replaceable>stop</replaceable>
+ *                 and <replaceable>start</replaceable> is 0.
+ *                 The integers are generated as the <code>for</code> loop
+ *                 iterates over them, so the range takes no memory whatever
+ *                 its length.
+ *               </para>
+ *             </listitem>
+ *           </varlistentry>
+ *           <varlistentry>
+ *             <term><code>len(<replaceable>value</replaceable>)</code></term>
+ *             <listitem>
+ *               <para>
+ *                 The number of items of an array, or of bytes of a string.
+ *               </para>
+ *             </listitem>
+ *           </varlistentry>
+ *           <varlistentry>
+ *             <term><code>join(<replaceable>array</replaceable>,
+ *             <replaceable>separator</replaceable>)</code></term>
+ *             <listitem>
+ *               <para>
+ *                 The items of an array converted to strings, separated by
+ *                 <replaceable>separator</replaceable>, that defaults to the
+ *                 empty string.
+ *               </para>
+ *             </listitem>
+ *           </varlistentry>
+ *           <varlistentry>
+ *             <term><code>sum(<replaceable>array</replaceable>)</code>,
+ *             <code>min(<replaceable>array</replaceable>)</code>,
+ *             <code>max(<replaceable>array</replaceable>)</code></term>
+ *             <listitem>
+ *               <para>
+ *                 The sum, the minimum or the maximum of the items of an
+ *                 array of numbers.  They can also be given the numbers as
+ *                 several arguments, as in <code>max(a, b)</code>.
+ *               </para>
+ *             </listitem>
+ *           </varlistentry>
+ *         </variablelist>
+ *       </para>
+ *       <para>
+ *         Other functions can be added to an environment with
+ *         ctpl_environ_add_function().
+ *       </para>
+ *     </listitem>
+ *   </varlistentry>
+ *   <varlistentry>
  *     <term>Parentheses</term>
  *     <listitem>
  *       <para>
@@ -127,14 +196,20 @@
  *   </programlisting>
  * </example>
  * <example>
+ *   <title>An expression with a function call</title>
+ *   <programlisting>
+ *     range(0, n * 2, 2)
+ *   </programlisting>
+ * </example>
+ * <example>
  *   <title>An expression with indexes</title>
  *   <programlisting>
  *     array[array[idx + 1]] * array[idx]
  *   </programlisting>
  * </example>
  * Of course, the latter examples supposes that the environment contains the
- * variables @foo, @bar, @array and @idx, and that they contains appropriate
- * values for latter evaluation.
+ * variables @foo, @bar, @n, @array and @idx, and that they contains
+ * appropriate values for latter evaluation.
  */
 
 
@@ -191,19 +266,22 @@ read_symbol (CtplInputStream *stream,
              GError         **error)
 {
   CtplTokenExpr *token = NULL;
-  gchar         *symbol;
+  const gchar   *symbol;
+  gsize          len;
   
-  symbol = ctpl_input_stream_read_symbol (stream, error);
+  /* take the symbol right from the stream's cache */
+  symbol = ctpl_input_stream_peek_span (stream, CTPL_CHAR_CLASS_SYMBOL, -1,
+                                        &len, error);
   if (symbol) {
-    if (*symbol) {
-      token = ctpl_token_expr_new_symbol (symbol, -1);
+    if (len > 0) {
+      token = ctpl_token_expr_new_symbol (symbol, (gssize)len);
+      ctpl_input_stream_skip (stream, len, NULL);
     } else {
       ctpl_input_stream_set_error (stream, error, CTPL_LEXER_EXPR_ERROR,
                                    CTPL_LEXER_EXPR_ERROR_SYNTAX_ERROR,
                                    _("No valid symbol"));
     }
   }
-  g_free (symbol);
   
   return token;
 }
@@ -271,6 +349,43 @@ static const gsize operators_array_length = G_N_ELEMENTS (operators_array) - 1;
 #define            OPERATORS_STR_MAXLEN     (2)
 
 
+/*
+ * ctpl_char_class_table:
+ * 
+ * Classes of each byte, see #CtplCharClass.  Must be kept in sync with the
+ * CTPL_*_CHARS definitions.
+ */
+#define BL CTPL_CHAR_CLASS_BLANK
+#define SY CTPL_CHAR_CLASS_SYMBOL
+#define OP CTPL_CHAR_CLASS_OPERATOR
+#define NL CTPL_CHAR_CLASS_EOL
+#define NU CTPL_CHAR_CLASS_NUMBER
+const guint8 ctpl_char_class_table[256] = {
+  /* 00 */ 0    , 0    , 0    , 0    , 0    , 0    , 0    , 0,
+  /* 08 */ 0    , BL   , BL|NL, BL   , 0    , BL|NL, 0    , 0,
+  /* 10 */ 0    , 0    , 0    , 0    , 0    , 0    , 0    , 0,
+  /* 18 */ 0    , 0    , 0    , 0    , 0    , 0    , 0    , 0,
+  /* 20 */ BL   , OP   , 0    , 0    , 0    , OP   , OP   , 0,
+  /* 28 */ 0    , 0    , OP   , OP|NU, 0    , OP|NU, NU   , OP,
+  /* 30 */ SY|NU, SY|NU, SY|NU, SY|NU, SY|NU, SY|NU, SY|NU, SY|NU,
+  /* 38 */ SY|NU, SY|NU, 0    , 0    , OP   , OP   , OP   , 0,
+  /* 40 */ 0    , SY|NU, SY|NU, SY|NU, SY|NU, SY|NU, SY|NU, SY|NU,
+  /* 48 */ SY|NU, SY|NU, SY|NU, SY|NU, SY|NU, SY|NU, SY|NU, SY|NU,
+  /* 50 */ SY|NU, SY|NU, SY|NU, SY|NU, SY|NU, SY|NU, SY|NU, SY|NU,
+  /* 58 */ SY|NU, SY|NU, SY|NU, 0    , 0    , 0    , 0    , SY,
+  /* 60 */ 0    , SY|NU, SY|NU, SY|NU, SY|NU, SY|NU, SY|NU, SY|NU,
+  /* 68 */ SY|NU, SY|NU, SY|NU, SY|NU, SY|NU, SY|NU, SY|NU, SY|NU,
+  /* 70 */ SY|NU, SY|NU, SY|NU, SY|NU, SY|NU, SY|NU, SY|NU, SY|NU,
+  /* 78 */ SY|NU, SY|NU, SY|NU, 0    , OP   , 0    , 0    , 0
+  /* 80-ff: no class */
+};
+#undef BL
+#undef SY
+#undef OP
+#undef NL
+#undef NU
+
+
 /* Gets whether op1 has priority over op2.
  * If both operators have the same priority, returns %TRUE */
 static gboolean
@@ -462,6 +577,11 @@ lex_operand_index (CtplInputStream *stream,
         }
         ctpl_token_expr_free (idx);
       } else {
+        if (idx->type == CTPL_TOKEN_EXPR_TYPE_VALUE && ! idx->indexes) {
+          /* decode literal indexes once for all, the evaluation would have to
+           * convert them anyway.  If it fails, let the evaluation report it */
+          ctpl_value_convert (&idx->token.t_value, CTPL_VTYPE_INT);
+        }
         operand->indexes = g_slist_append (operand->indexes, idx);
         success = TRUE;
       }
@@ -471,6 +591,53 @@ lex_operand_index (CtplInputStream *stream,
   return success;
 }
 
+/* Reads the arguments of a call to the function named @name, starting at the
+ * opening parenthesis.
+ * Returns: A new #CtplTokenExpr on success, %NULL on error. */
+static CtplTokenExpr *
+lex_function_call (CtplInputStream *stream,
+                   const gchar     *name,
+                   GError         **error)
+{
+  CtplTokenExpr  *token = NULL;
+  GSList         *args = NULL;
+  GError         *err = NULL;
+  gchar           c = 0;
+  
+  ctpl_input_stream_get_c (stream, NULL); /* eat the ( */
+  if (ctpl_input_stream_skip_blank (stream, &err) >= 0 &&
+      ctpl_input_stream_peek_c (stream, &err) == ')') {
+    /* no arguments */
+    ctpl_input_stream_get_c (stream, &err);
+  } else {
+    do {
+      CtplTokenExpr *arg;
+      
+      arg = ctpl_lexer_expr_lex_full (stream, FALSE, &err);
+      if (arg) {
+        args = g_slist_prepend (args, arg);
+        c = ctpl_input_stream_get_c (stream, &err);
+        if (! err && c != ',' && c != ')') {
+          ctpl_input_stream_set_error (stream, &err, CTPL_LEXER_EXPR_ERROR,
+                                       CTPL_LEXER_EXPR_ERROR_SYNTAX_ERROR,
+                                       _("Unexpected character '%c', expected "
+                                         "',' or function call end"), c);
+        }
+      }
+    } while (! err && c == ',');
+  }
+  args = g_slist_reverse (args);
+  if (err) {
+    g_slist_foreach (args, (GFunc) ctpl_token_expr_free, NULL);
+    g_slist_free (args);
+    g_propagate_error (error, err);
+  } else {
+    token = ctpl_token_expr_new_function (name, -1, args);
+  }
+  
+  return token;
+}
+
 /* Reads an operand.
  * Returns: A new #CtplTokenExpr on success, %NULL on error. */
 static CtplTokenExpr *
@@ -492,6 +659,13 @@ lex_operand (CtplInputStream *stream,
       token = read_number (stream, error);
     } else if (ctpl_is_symbol (c)) {
       token = read_symbol (stream, error);
+      /* a symbol directly followed by a parenthesis is a function call */
+      if (token && ctpl_input_stream_peek_c (stream, NULL) == '(') {
+        CtplTokenExpr *symbol = token;
+        
+        token = lex_function_call (stream, symbol->token.t_symbol, error);
+        ctpl_token_expr_free (symbol);
+      }
     } else if (c == CTPL_STRING_DELIMITER_CHAR) {
       token = read_string_literal (stream, error);
     } else {
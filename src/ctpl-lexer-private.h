@@ -36,6 +36,47 @@ G_BEGIN_DECLS
  */
 
 
+/*
+ * CtplCharClass:
+ * @CTPL_CHAR_CLASS_BLANK: Characters from %CTPL_BLANK_CHARS
+ * @CTPL_CHAR_CLASS_SYMBOL: Characters from %CTPL_SYMBOL_CHARS
+ * @CTPL_CHAR_CLASS_OPERATOR: Characters from %CTPL_OPERATOR_CHARS
+ * @CTPL_CHAR_CLASS_EOL: Line ending characters (<code>\r</code> and
+ *                       <code>\n</code>)
+ * @CTPL_CHAR_CLASS_NUMBER: Characters that may be part of a numeric constant
+ * 
+ * Classes of characters, as found in %ctpl_char_class_table.  A character may
+ * be part of several classes.
+ */
+typedef enum _CtplCharClass
+{
+  CTPL_CHAR_CLASS_BLANK     = 1 << 0,
+  CTPL_CHAR_CLASS_SYMBOL    = 1 << 1,
+  CTPL_CHAR_CLASS_OPERATOR  = 1 << 2,
+  CTPL_CHAR_CLASS_EOL       = 1 << 3,
+  CTPL_CHAR_CLASS_NUMBER    = 1 << 4
+} CtplCharClass;
+
+/*
+ * ctpl_char_class_table:
+ * 
+ * The #CtplCharClass<!-- -->es of each byte value.
+ */
+G_GNUC_INTERNAL
+extern const guint8 ctpl_char_class_table[256];
+
+/*
+ * ctpl_char_is_class:
+ * @c: A character
+ * @classes: A combination of #CtplCharClass
+ * 
+ * Checks whether a character is part of any of @classes.
+ * 
+ * Returns: %TRUE if @c is part of one of @classes, %FALSE otherwise.
+ */
+#define ctpl_char_is_class(c, classes) \
+  ((ctpl_char_class_table[(guchar)(c)] & (classes)) != 0)
+
 /*
  * CTPL_BLANK_CHARS:
  * 
@@ -55,11 +96,7 @@ G_BEGIN_DECLS
  * 
  * Since: 0.2
  */
-#define ctpl_is_blank(c) ((c) == ' '  || \
-                          (c) == '\t' || \
-                          (c) == '\v' || \
-                          (c) == '\r' || \
-                          (c) == '\n')
+#define ctpl_is_blank(c) (ctpl_char_is_class ((c), CTPL_CHAR_CLASS_BLANK))
 /*
  * CTPL_SYMBOL_CHARS:
  * 
@@ -82,10 +119,7 @@ G_BEGIN_DECLS
  * 
  * Since: 0.2
  */
-#define ctpl_is_symbol(c) (((c) >= 'a' && (c) <= 'z') || \
-                           ((c) >= 'A' && (c) <= 'Z') || \
-                           ((c) >= '0' && (c) <= '9') || \
-                           (c) == '_')
+#define ctpl_is_symbol(c) (ctpl_char_is_class ((c), CTPL_CHAR_CLASS_SYMBOL))
 /*
  * CTPL_ESCAPE_CHAR:
  * 
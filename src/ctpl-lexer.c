@@ -39,6 +39,8 @@
  * To analyse some data, use ctpl_lexer_lex(), ctpl_lexer_lex_string() or
  * ctpl_lexer_lex_path(); to destroy the created token tree, use
  * ctpl_token_free().
+ * To analyse it one top-level statement at a time, e.g. to render a large
+ * template while reading it, use ctpl_lexer_lex_next().
  * 
  * <example>
  * <title>Usage of the lexer and error management</title>
@@ -60,40 +62,51 @@
  */
 
 
-/* statements constants */
+/* statements constants, the parts of the blocks being read */
 enum
 {
-  S_NONE,
   S_IF,
   S_ELSE,
-  S_FOR,
-  S_END,
-  S_DATA
+  S_FOR
+};
+
+typedef struct s_LexerBlock LexerBlock;
+
+/* LexerBlock:
+ * @part: The part of the block being read: S_IF or S_ELSE for an if block,
+ *        S_FOR for a for block.
+ * @expr: The condition of an if block, or the array of a for block.
+ * @iter: The iterator of a for block.
+ * @if_children: The tokens of the if part of an if block when reading its
+ *               else part.
+ * @children: The tokens read so far in the current part of the block.
+ * 
+ * A block whose end wasn't read yet.
+ */
+struct s_LexerBlock
+{
+  gint            part;
+  CtplTokenExpr  *expr;
+  gchar          *iter;
+  CtplToken      *if_children;
+  CtplToken      *children;
 };
 
 typedef struct s_LexerState LexerState;
 
 /* LexerState:
- * @block_depth: Depth of the current block.
- * @last_statement_type_if: Used to help reading if/else/end groups.
- *                          Set to:
- *                           - S_NONE if no previous token;
- *                           - S_IF when encountering an if statement;
- *                           - S_ELSE when encountering an else statement;
- *                           - S_END when encountering an end statement.
+ * @blocks: The LexerBlocks being read, innermost last.
  * 
- * State informations of the lexer.
+ * State informations of the lexer.  The blocks being read are kept on an
+ * explicit stack rather than read recursively, so their nesting depth is only
+ * limited by the memory.
  */
 struct s_LexerState
 {
-  gint  block_depth;
-  gint  last_statement_type_if;
+  GArray *blocks;
 };
 
 
-static CtplToken   *ctpl_lexer_lex_internal   (CtplInputStream *stream,
-                                               LexerState      *state,
-                                               GError         **error);
 static CtplToken   *ctpl_lexer_read_token     (CtplInputStream *stream,
                                                LexerState      *state,
                                                GError         **error);
@@ -113,6 +126,53 @@ ctpl_lexer_error_quark (void)
 }
 
 
+/* starts reading a block, that takes @expr and @iter */
+static void
+lexer_state_push_block (LexerState     *state,
+                        gint            part,
+                        CtplTokenExpr  *expr,
+                        gchar          *iter)
+{
+  LexerBlock *block;
+  
+  g_array_set_size (state->blocks, state->blocks->len + 1);
+  block = &g_array_index (state->blocks, LexerBlock, state->blocks->len - 1);
+  block->part = part;
+  block->expr = expr;
+  block->iter = iter;
+  block->if_children = NULL;
+  block->children = NULL;
+}
+
+/* gets the innermost block being read, or %NULL if reading the top level */
+static LexerBlock *
+lexer_state_get_block (LexerState *state)
+{
+  if (state->blocks->len == 0) {
+    return NULL;
+  }
+  
+  return &g_array_index (state->blocks, LexerBlock, state->blocks->len - 1);
+}
+
+/* frees the blocks that are still being read, e.g. after an error */
+static void
+lexer_state_clear (LexerState *state)
+{
+  guint i;
+  
+  for (i = 0; i < state->blocks->len; i++) {
+    LexerBlock *block = &g_array_index (state->blocks, LexerBlock, i);
+    
+    ctpl_token_expr_free (block->expr);
+    g_free (block->iter);
+    ctpl_token_free (block->if_children);
+    ctpl_token_free (block->children);
+  }
+  g_array_free (state->blocks, TRUE);
+}
+
+
 /* Reads a statement end (the "}" part) */
 static gboolean
 ctpl_lexer_read_stmt_end (CtplInputStream  *stream,
@@ -144,63 +204,35 @@ ctpl_lexer_read_stmt_end (CtplInputStream  *stream,
 }
 
 /* reads the data part of a if, aka the expression (e.g. " a > b" in "if a > b")
- * Return a new token or %NULL on error */
+ * and starts reading its block.
+ * Always returns %NULL, the token is returned when reading the block end */
 static CtplToken *
 ctpl_lexer_read_token_tpl_if (CtplInputStream *stream,
                               LexerState      *state,
                               GError         **error)
 {
-  CtplToken      *token = NULL;
-  CtplTokenExpr  *expr;
+  CtplTokenExpr *expr;
   
   expr = ctpl_lexer_expr_lex_full (stream, FALSE, error);
   if (expr) {
     if (ctpl_lexer_read_stmt_end (stream, "if", error)) {
-      GError     *err = NULL;
-      CtplToken  *if_token;
-      CtplToken  *else_token = NULL;
-      LexerState  substate = *state;
-      
-      substate.block_depth ++;
-      substate.last_statement_type_if = S_IF;
-      if_token = ctpl_lexer_lex_internal (stream, &substate, &err);
-      if (! err) {
-        if (substate.last_statement_type_if == S_ELSE) {
-          else_token = ctpl_lexer_lex_internal (stream, &substate, &err);
-        }
-        if (! err /* don't override errors */ &&
-            state->block_depth != substate.block_depth) {
-          /* if a block was not closed, fail */
-          ctpl_input_stream_set_error (stream, &err, CTPL_LEXER_ERROR,
-                                       CTPL_LEXER_ERROR_SYNTAX_ERROR,
-                                       _("Unclosed 'if/else' block"));
-        }
-        if (! err) {
-          token = ctpl_token_new_if (expr, if_token, else_token);
-          /* set expr to NULL not to free it since it is now used */
-          expr = NULL;
-        } else {
-          ctpl_token_free (if_token);
-          ctpl_token_free (else_token);
-          g_propagate_error (error, err);
-        }
-      }
+      lexer_state_push_block (state, S_IF, expr, NULL);
+    } else {
+      ctpl_token_expr_free (expr);
     }
-    ctpl_token_expr_free (expr);
   }
   
-  return token;
+  return NULL;
 }
 
-/* reads the data part of a for, eg " i in array" for a "for i in array"
- * Return a new token or %NULL on error */
+/* reads the data part of a for, eg " i in array" for a "for i in array", and
+ * starts reading its block.
+ * Always returns %NULL, the token is returned when reading the block end */
 static CtplToken *
 ctpl_lexer_read_token_tpl_for (CtplInputStream *stream,
                                LexerState      *state,
                                GError         **error)
 {
-  CtplToken  *token = NULL;
-  
   if (ctpl_input_stream_skip_blank (stream, error) >= 0) {
     gchar *iter_name;
     
@@ -232,27 +264,10 @@ ctpl_lexer_read_token_tpl_for (CtplInputStream *stream,
           array_expr = ctpl_lexer_expr_lex_full (stream, FALSE, error);
           if (array_expr) {
             if (ctpl_lexer_read_stmt_end (stream, "for", error)) {
-              GError     *err = NULL;
-              CtplToken  *for_children;
-              LexerState  substate = *state;
-              
-              substate.block_depth ++;
-              for_children = ctpl_lexer_lex_internal (stream, &substate, &err);
-              if (! err) {
-                if (state->block_depth != substate.block_depth) {
-                  ctpl_input_stream_set_error (stream, &err, CTPL_LEXER_ERROR,
-                                               CTPL_LEXER_ERROR_SYNTAX_ERROR,
-                                               _("Unclosed 'for' block"));
-                  ctpl_token_free (for_children);
-                } else {
-                  token = ctpl_token_new_for (array_expr, iter_name,
-                                              for_children);
-                  array_expr = NULL; /* avoid freeing expression */
-                }
-              }
-              if (err) {
-                g_propagate_error (error, err);
-              }
+              lexer_state_push_block (state, S_FOR, array_expr, iter_name);
+              /* avoid freeing expression and iterator */
+              array_expr = NULL;
+              iter_name = NULL;
             }
             ctpl_token_expr_free (array_expr);
           }
@@ -263,48 +278,83 @@ ctpl_lexer_read_token_tpl_for (CtplInputStream *stream,
     g_free (iter_name);
   }
   
-  return token;
+  return NULL;
 }
 
 /* reads an end block end (} of a {end} block)
- * Always returns %NULL to stop lexing pass or notify an error. */
+ * Returns: The token of the block it ends, or %NULL on error */
 static CtplToken *
 ctpl_lexer_read_token_tpl_end (CtplInputStream *stream,
                                LexerState      *state,
                                GError         **error)
 {
+  CtplToken *token = NULL;
+  
   if (ctpl_lexer_read_stmt_end (stream, "end", error)) {
-    state->block_depth --;
-    if (state->block_depth < 0) {
+    LexerBlock *block = lexer_state_get_block (state);
+    
+    if (! block) {
       /* a non-opened block was closed, fail */
       ctpl_input_stream_set_error (stream, error, CTPL_LEXER_ERROR,
                                    CTPL_LEXER_ERROR_SYNTAX_ERROR,
                                    _("Unmatched 'end' statement (needs a 'if' "
                                      "or 'for' before)"));
     } else {
-      state->last_statement_type_if = S_END;
+      switch (block->part) {
+        case S_IF:
+          token = ctpl_token_new_if (block->expr, block->children, NULL);
+          break;
+        
+        case S_ELSE:
+          token = ctpl_token_new_if (block->expr, block->if_children,
+                                     block->children);
+          break;
+        
+        case S_FOR:
+          token = ctpl_token_new_for (block->expr, block->iter,
+                                      block->children);
+          g_free (block->iter);
+          break;
+      }
+      g_array_set_size (state->blocks, state->blocks->len - 1);
     }
   }
   
-  return NULL;
+  return token;
 }
 
 /* reads an else block end (} of a {else} block)
- * Always returns %NULL to stop lexing pass or notify an error. */
+ * Always returns %NULL, the token is returned when reading the block end */
 static CtplToken *
 ctpl_lexer_read_token_tpl_else (CtplInputStream *stream,
                                 LexerState      *state,
                                 GError         **error)
 {
   if (ctpl_lexer_read_stmt_end (stream, "else", error)) {
-    if (state->last_statement_type_if != S_IF) {
+    LexerBlock *block = lexer_state_get_block (state);
+    guint       i;
+    
+    /* the else of an if may follow for blocks that weren't closed */
+    i = state->blocks->len;
+    while (i > 0 &&
+           g_array_index (state->blocks, LexerBlock, i - 1).part == S_FOR) {
+      i--;
+    }
+    if (i == 0 ||
+        g_array_index (state->blocks, LexerBlock, i - 1).part != S_IF) {
       /* else but no opened if, fail */
       ctpl_input_stream_set_error (stream, error, CTPL_LEXER_ERROR,
                                    CTPL_LEXER_ERROR_SYNTAX_ERROR,
                                    _("Unmatched 'else' statement (needs an "
                                      "'if' before)"));
+    } else if (block->part == S_FOR) {
+      ctpl_input_stream_set_error (stream, error, CTPL_LEXER_ERROR,
+                                   CTPL_LEXER_ERROR_SYNTAX_ERROR,
+                                   _("Unclosed 'for' block"));
     } else {
-      state->last_statement_type_if = S_ELSE;
+      block->part = S_ELSE;
+      block->if_children = block->children;
+      block->children = NULL;
     }
   }
   
@@ -481,34 +531,62 @@ ctpl_lexer_read_token (CtplInputStream *stream,
 /*
  * ctpl_lexer_lex_internal:
  * @stream: A #CtplInputStream
- * @state: The current lexer state
+ * @single: Whether to stop after the first top-level token
  * @error: Return location for an error, or %NULL to ignore errors
  * 
- * Lexes all tokens of the current state from @stream.
- * To lex the whole input, give a state set to {0, S_NONE}.
+ * Lexes the tokens from @stream up to its end, or only the first top-level
+ * one if @single is %TRUE.
  * 
  * Returns: A new #CtplToken tree holding all read tokens or %NULL if an error
- *          occurred or if the @stream was empty (as the point of view of the
- *          lexer with its current state, then %NULL can be returned for empty
- *          if or for blocks).
+ *          occurred or if the @stream was empty.
  */
 static CtplToken *
 ctpl_lexer_lex_internal (CtplInputStream *stream,
-                         LexerState      *state,
+                         gboolean         single,
                          GError         **error)
 {
-  CtplToken  *token = NULL;
+  LexerState  state;
   CtplToken  *root = NULL;
   GError     *err = NULL;
   
-  while ((token = ctpl_lexer_read_token (stream, state, &err)) != NULL &&
-         err == NULL) {
-    if (! root) {
-      root = token;
+  state.blocks = g_array_new (FALSE, FALSE, sizeof (LexerBlock));
+  while (! err && ! (single && root)) {
+    LexerBlock *block;
+    
+    /* TRUE on error too */
+    if (ctpl_input_stream_eof (stream, &err)) {
+      block = lexer_state_get_block (&state);
+      if (block && ! err) {
+        /* if a block was not closed, fail */
+        ctpl_input_stream_set_error (stream, &err, CTPL_LEXER_ERROR,
+                                     CTPL_LEXER_ERROR_SYNTAX_ERROR, "%s",
+                                     block->part == S_FOR
+                                     ? _("Unclosed 'for' block")
+                                     : _("Unclosed 'if/else' block"));
+      }
+      break;
     } else {
-      ctpl_token_append (root, token);
+      CtplToken *token;
+      
+      token = ctpl_lexer_read_token (stream, &state, &err);
+      if (token) {
+        /* the read token may have closed a block, get the one it goes in */
+        block = lexer_state_get_block (&state);
+        if (! block) {
+          if (! root) {
+            root = token;
+          } else {
+            ctpl_token_append (root, token);
+          }
+        } else if (! block->children) {
+          block->children = token;
+        } else {
+          ctpl_token_append (block->children, token);
+        }
+      }
     }
   }
+  lexer_state_clear (&state);
   if (err) {
     ctpl_token_free (root);
     root = NULL;
@@ -536,10 +614,9 @@ ctpl_lexer_lex (CtplInputStream *stream,
                 GError         **error)
 {
   CtplToken  *root;
-  LexerState  lex_state = {0, S_NONE};
   GError     *err = NULL;
   
-  root = ctpl_lexer_lex_internal (stream, &lex_state, &err);
+  root = ctpl_lexer_lex_internal (stream, FALSE, &err);
   if (err) {
     g_propagate_error (error, err);
   } else if (! root) {
@@ -553,6 +630,51 @@ ctpl_lexer_lex (CtplInputStream *stream,
   return root;
 }
 
+/**
+ * ctpl_lexer_lex_next:
+ * @stream: A #CtplInputStream holding the data to analyse
+ * @error: A #GError return location for error reporting, or %NULL to ignore
+ *         errors.
+ * 
+ * Analyses the next top-level token of some given data: a data token, an
+ * expression, or a whole <code>if</code> or <code>for</code> block with its
+ * children.  Only the data of this token is read from @stream, so a template
+ * can be rendered while it is read, holding no more than its largest block in
+ * memory:
+ * 
+ * <example>
+ *   <title>Rendering a template while reading it</title>
+ *   <programlisting>
+ * CtplToken *token;
+ * GError    *error = NULL;
+ * 
+ * while ((token = ctpl_lexer_lex_next (input, &error)) != NULL &&
+ *        ctpl_parser_parse (token, env, output, &error)) {
+ *   ctpl_token_free (token);
+ * }
+ * ctpl_token_free (token);
+ * if (error) {
+ *   /<!-- -->* handle the error *<!-- -->/
+ * }
+ *   </programlisting>
+ * </example>
+ * 
+ * Note that contrary to ctpl_lexer_lex(), a syntax error is only reported when
+ * reaching the token containing it, after the previous ones were returned.
+ * 
+ * Returns: A new #CtplToken that should be freed with ctpl_token_free() when no
+ *          longer needed, or %NULL if the end of @stream was reached or an
+ *          error occurred, in which case @error is set.
+ * 
+ * Since: 0.4
+ */
+CtplToken *
+ctpl_lexer_lex_next (CtplInputStream *stream,
+                     GError         **error)
+{
+  return ctpl_lexer_lex_internal (stream, TRUE, error);
+}
+
 /**
  * ctpl_lexer_lex_string:
  * @template: A string containing the template data
@@ -22,6 +22,9 @@
 #include <stdlib.h>
 #include <glib.h>
 #include <errno.h>
+#include "ctpl-i18n.h"
+#include "ctpl-io.h"
+#include "ctpl-value.h"
 
 
 /*
@@ -72,3 +75,308 @@ ctpl_math_string_to_int (const gchar *string,
   return (*endptr) == 0 && string != endptr &&
          (errno != EINVAL && errno != ERANGE);
 }
+
+/*
+ * ctpl_math_scan_number:
+ * @str: A buffer starting with a number
+ * @len: Length of @str
+ * @types: The kinds of numbers to accept, a combination of
+ *         %CTPL_MATH_NUMBER_INT and %CTPL_MATH_NUMBER_FLOAT
+ * @value: A #CtplValue to fill with the read number
+ * @n_read: (out): Return location for the number of bytes of @str that were
+ *                 part of the number, even on error
+ * @error: Return location for errors, or %NULL to ignore them
+ * 
+ * Reads a number at the start of a buffer.  This implements the number syntax
+ * of ctpl_input_stream_read_number(), see it for details.
+ * Errors are from the %CTPL_IO_ERROR domain and hold no location information.
+ * 
+ * Returns: %TRUE on success, %FALSE otherwise.
+ */
+gboolean
+ctpl_math_scan_number (const gchar *str,
+                       gsize        len,
+                       gint         types,
+                       CtplValue   *value,
+                       gsize       *n_read,
+                       GError     **error)
+{
+  gboolean  have_mantissa       = FALSE;
+  gboolean  have_exponent       = FALSE;
+  gboolean  have_exponent_delim = FALSE;
+  gboolean  have_sign           = FALSE;
+  gboolean  have_dot            = FALSE;
+  GString  *gstring;
+  gboolean  in_number           = TRUE;
+  gboolean  success             = FALSE;
+  gint      base                = 10;
+  gint      type                = types;
+  gsize     i                   = 0;
+  
+  #define ISSIGN(c)   ((c) == '+' || (c) == '-')
+  #define ISDIGIT(c)  ((c) >= '0' && (c) <= '9')
+  #define ISBDIGIT(c) ((c) == '0' || (c) == '1')
+  #define ISODIGIT(c) ((c) >= '0' && (c) <= '7')
+  #define ISXDIGIT(c) (ISDIGIT (c) || \
+                       ((c) >= 'a' && (c) <= 'f') || \
+                       ((c) >= 'A' && (c) <= 'F'))
+  /* largest integer all smaller ones of which are exact doubles */
+  #define MAX_EXACT_DIGITS  (G_GUINT64_CONSTANT (1) << 53)
+  
+  /* fast path for plain decimal integers, by far the most common numbers */
+  if (types & CTPL_MATH_NUMBER_INT) {
+    gboolean  negative  = FALSE;
+    gulong    absval    = 0;
+    gulong    limit     = G_MAXLONG;
+    
+    if (i < len && ISSIGN (str[i])) {
+      negative = (str[i] == '-');
+      limit += negative ? 1 : 0;
+      i++;
+    }
+    /* leading zeros may introduce a base prefix */
+    if (i < len && ISDIGIT (str[i]) && str[i] != '0') {
+      for (; i < len && ISDIGIT (str[i]); i++) {
+        guint digit = (guint) (str[i] - '0');
+        
+        if (absval > (limit - digit) / 10) {
+          break; /* overflow, let the generic code report it */
+        }
+        absval = absval * 10 + digit;
+      }
+      if (i >= len || ! (ISDIGIT (str[i]) || str[i] == '.' ||
+                         g_ascii_isalpha (str[i]))) {
+        ctpl_value_set_int (value, negative ? (glong) (0 - absval)
+                                            : (glong) absval);
+        *n_read = i;
+        
+        return TRUE;
+      }
+    }
+    i = 0;
+  }
+  /* fast path for plain decimal floats: when both the digits and the power of
+   * ten they are divided by are exact doubles, the division is correctly
+   * rounded, just like the conversion of strtod() */
+  if (types & CTPL_MATH_NUMBER_FLOAT) {
+    static const gdouble powers_of_ten[] = {
+      1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+      1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+    gboolean  negative  = FALSE;
+    guint64   digits    = 0;
+    gsize     start;
+    gsize     dot;
+    
+    if (i < len && ISSIGN (str[i])) {
+      negative = (str[i] == '-');
+      i++;
+    }
+    start = i;
+    for (; i < len && ISDIGIT (str[i]) && digits < MAX_EXACT_DIGITS / 10; i++) {
+      digits = digits * 10 + (guint64) (str[i] - '0');
+    }
+    dot = i;
+    if (dot > start && dot < len && str[dot] == '.') {
+      for (i++; i < len && ISDIGIT (str[i]) && digits < MAX_EXACT_DIGITS / 10;
+           i++) {
+        digits = digits * 10 + (guint64) (str[i] - '0');
+      }
+      if (i > dot + 1 && i - dot - 1 < G_N_ELEMENTS (powers_of_ten) &&
+          (i >= len || ! (ISDIGIT (str[i]) || str[i] == '.' ||
+                          g_ascii_isalpha (str[i])))) {
+        gdouble v = (gdouble) digits / powers_of_ten[i - dot - 1];
+        
+        ctpl_value_set_float (value, negative ? -v : v);
+        *n_read = i;
+        
+        return TRUE;
+      }
+    }
+    i = 0;
+  }
+  
+  gstring = g_string_new ("");
+  while (in_number) {
+    const gchar  *buf     = &str[i];
+    gsize         buf_len = len - i;
+    gchar         c       = (buf_len > 0) ? buf[0] : 0;
+    
+    switch (c) {
+      case '.':
+        if (! have_dot && ! have_exponent_delim &&
+            (type & CTPL_MATH_NUMBER_FLOAT)) {
+          g_string_append_c (gstring, c);
+          have_dot = TRUE;
+          type &= CTPL_MATH_NUMBER_FLOAT;
+        } else {
+          in_number = FALSE;
+        }
+        break;
+      
+      case '+':
+      case '-':
+        if (! have_sign && (! have_mantissa ||
+                            (have_exponent_delim && ! have_exponent)) &&
+            /* ISDIGIT() is fine here even though we probably don't know the
+             * base yet because the default base is 10 and the exponent or
+             * power are also in base 10 */
+            buf_len > 1 && ISDIGIT (buf[1])) {
+          g_string_append_c (gstring, c);
+          have_sign = TRUE;
+        } else {
+          in_number = FALSE;
+        }
+        break;
+      
+      case 'e':
+      case 'E':
+        if (base < 15) {
+          if (have_mantissa && ! have_exponent_delim &&
+              (type & CTPL_MATH_NUMBER_FLOAT) && base == 10 &&
+              ((buf_len > 1 && ISDIGIT (buf[1])) ||
+               (buf_len > 2 && ISSIGN (buf[1]) && ISDIGIT (buf[2])))) {
+            have_exponent_delim = TRUE;
+            have_sign = FALSE;
+            type &= CTPL_MATH_NUMBER_FLOAT;
+            g_string_append_c (gstring, 'e');
+          } else {
+            in_number = FALSE;
+          }
+          break;
+        }
+        /* Fallthrough */
+      case 'b':
+      case 'B':
+      case 'a':
+      case 'A':
+      case 'c':
+      case 'C':
+      case 'd':
+      case 'D':
+      case 'f':
+      case 'F':
+        if (base < 16 || have_exponent_delim /* exponent is decimal */) {
+          in_number = FALSE;
+          break;
+        }
+        /* Fallthrough */
+      case '8':
+      case '9':
+        if (base < 10) {
+          in_number = FALSE;
+          break;
+        }
+      case '2':
+      case '3':
+      case '4':
+      case '5':
+      case '6':
+      case '7':
+        if (base < 8) {
+          in_number = FALSE;
+          break;
+        }
+        /* Fallthrough */
+      case '0':
+        if (! have_mantissa && buf_len > 2) {
+          gboolean is_start = TRUE;
+          
+          if ((type & CTPL_MATH_NUMBER_INT) &&
+              (buf[1] == 'b' || buf[1] == 'B') && ISBDIGIT (buf[2])) {
+            type &= CTPL_MATH_NUMBER_INT;
+            base = 2;
+          } else if ((type & CTPL_MATH_NUMBER_INT) &&
+                     (buf[1] == 'o' || buf[1] == 'O') && ISODIGIT (buf[2])) {
+            type &= CTPL_MATH_NUMBER_INT;
+            base = 8;
+          } else if ((buf[1] == 'x' || buf[1] == 'X') && ISXDIGIT (buf[2])) {
+            /* needed for floating-points */
+            g_string_append_c (gstring, c);
+            g_string_append_c (gstring, buf[1]);
+            base = 16;
+          } else {
+            is_start = FALSE;
+          }
+          if (is_start) {
+            /* eat the character we just handled */
+            i++;
+            break;
+          }
+        }
+        /* Fallthrough */
+      case '1':
+        g_string_append_c (gstring, c);
+        if (! have_exponent_delim) {
+          have_mantissa = TRUE;
+        } else {
+          have_exponent = TRUE;
+        }
+        break;
+      
+      case 'p':
+      case 'P':
+        if (have_mantissa && ! have_exponent_delim &&
+            (type & CTPL_MATH_NUMBER_FLOAT) && base == 16 &&
+            ((buf_len > 1 && ISDIGIT (buf[1])) ||
+             (buf_len > 2 && ISSIGN (buf[1]) && ISDIGIT (buf[2])))) {
+          have_exponent_delim = TRUE;
+          have_sign = FALSE;
+          type &= CTPL_MATH_NUMBER_FLOAT;
+          g_string_append_c (gstring, 'p');
+        } else {
+          in_number = FALSE;
+        }
+        break;
+      
+      default:
+        in_number = FALSE;
+    }
+    if (in_number) {
+      i++; /* eat character */
+    }
+  }
+  if (! have_mantissa) {
+    g_set_error (error, CTPL_IO_ERROR, CTPL_IO_ERROR_INVALID_NUMBER,
+                 "%s", _("Missing mantissa in numeric constant"));
+  } else {
+    gchar  *nptr = gstring->str;
+    gchar  *endptr;
+    gdouble dblval = 0.0;
+    glong   longval = 0;
+    gint    errno_save = errno;
+    
+    errno = 0;
+    if (type & CTPL_MATH_NUMBER_INT) {
+      longval = strtol (nptr, &endptr, base);
+    } else {
+      dblval = g_ascii_strtod (nptr, &endptr);
+    }
+    if (! endptr || *endptr != 0) {
+      g_set_error (error, CTPL_IO_ERROR, CTPL_IO_ERROR_INVALID_NUMBER,
+                   _("Invalid base %d numeric constant \"%s\""), base, nptr);
+    } else if (errno == ERANGE) {
+      g_set_error (error, CTPL_IO_ERROR, CTPL_IO_ERROR_RANGE,
+                   "%s", _("Overflow in numeric constant conversion"));
+    } else {
+      if (type & CTPL_MATH_NUMBER_INT) {
+        ctpl_value_set_int (value, longval);
+      } else {
+        ctpl_value_set_float (value, dblval);
+      }
+      success = TRUE;
+    }
+    errno = errno_save;
+  }
+  g_string_free (gstring, TRUE);
+  *n_read = i;
+  
+  #undef ISSIGN
+  #undef ISDIGIT
+  #undef ISBDIGIT
+  #undef ISODIGIT
+  #undef ISXDIGIT
+  #undef MAX_EXACT_DIGITS
+  
+  return success;
+}
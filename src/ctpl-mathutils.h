@@ -26,6 +26,7 @@
 #include <glib.h>
 #include <stdlib.h>
 #include <math.h>
+#include "ctpl-value.h"
 
 G_BEGIN_DECLS
 
@@ -54,6 +55,27 @@ G_GNUC_INTERNAL
 gboolean    ctpl_math_string_to_int     (const gchar *string,
                                          glong       *value);
 
+/*
+ * CTPL_MATH_NUMBER_INT:
+ * 
+ * Flag for ctpl_math_scan_number() to accept integers.
+ */
+#define CTPL_MATH_NUMBER_INT    (1 << 1)
+/*
+ * CTPL_MATH_NUMBER_FLOAT:
+ * 
+ * Flag for ctpl_math_scan_number() to accept floating-point numbers.
+ */
+#define CTPL_MATH_NUMBER_FLOAT  (1 << 0)
+
+G_GNUC_INTERNAL
+gboolean    ctpl_math_scan_number       (const gchar *str,
+                                         gsize        len,
+                                         gint         types,
+                                         CtplValue   *value,
+                                         gsize       *n_read,
+                                         GError     **error);
+
 /*
  * ctpl_math_dtostr:
  * @buf: A buffer to write to
@@ -18,13 +18,19 @@
  */
 
 #include "ctpl-parser.h"
+#include "ctpl-parser-private.h"
 #include <glib.h>
+#include <gio/gio.h>
 #include <string.h>
-#include "ctpl-i18n.h"
 #include "ctpl-eval.h"
 #include "ctpl-token.h"
 #include "ctpl-token-private.h"
 #include "ctpl-output-stream.h"
+#include "ctpl-environ-private.h"
+#include "ctpl-arena.h"
+#include "ctpl-cache.h"
+#include "ctpl-renderer.h"
+#include "ctpl-renderer-private.h"
 
 
 /**
@@ -34,7 +40,12 @@
  * 
  * Parses a #CtplToken tree against a #CtplEnviron.
  * 
- * To parse a token tree, use ctpl_parser_parse().
+ * To parse a token tree, use ctpl_parser_parse(), or
+ * ctpl_parser_parse_with_arena() to provide the memory for the temporary
+ * values, or ctpl_parser_parse_with_options() to limit the resources a
+ * rendering may use.  ctpl_parser_parse_to_buffer() gives the output in memory, and
+ * ctpl_parser_parse_async() renders without blocking on the output.  To render
+ * a bit at a time, see #CtplRenderer.
  */
 
 /* The only useful thing is to be able to push or pop variables/constants :
@@ -92,157 +103,622 @@ ctpl_parser_error_quark (void)
 }
 
 
-/* "parses" a data token */
-static gboolean
-ctpl_parser_parse_token_data (const gchar      *data,
-                              CtplOutputStream *output,
-                              GError          **error)
+/*
+ * ctpl_parser_parse_token:
+ * @token: A #CtplToken
+ * @env: A #CtplEnviron with an arena set
+ * @output: A #CtplOutputStream
+ * @error: Return location for errors, or %NULL to ignore them
+ * 
+ * Tries to parse a token, without its siblings, with the state machine of
+ * #CtplRenderer.
+ * 
+ * Returns: %TRUE on success, %FALSE otherwise.
+ */
+gboolean
+ctpl_parser_parse_token (const CtplToken   *token,
+                         CtplEnviron       *env,
+                         CtplOutputStream  *output,
+                         GError           **error)
 {
-  return ctpl_output_stream_write (output, data, -1, error);
+  CtplRenderer  renderer;
+  gboolean      rv;
+  
+  ctpl_renderer_init (&renderer, token, FALSE, env, output);
+  rv = ctpl_renderer_run (&renderer, error);
+  ctpl_renderer_clear (&renderer);
+  
+  return rv;
 }
 
-/* Tries to parse a `for` token */
+/* parses @tree with @options if not %NULL, in their arena if any */
 static gboolean
-ctpl_parser_parse_token_for (const CtplTokenFor  *token,
-                             CtplEnviron         *env,
-                             CtplOutputStream    *output,
-                             GError             **error)
-{
-  /* we can safely assume token holds array here */
-  CtplValue value;
-  gboolean  rv = FALSE;
-  
-  ctpl_value_init (&value);
-  if (ctpl_eval_value (token->array, env, &value, error)) {
-    if (! CTPL_VALUE_HOLDS_ARRAY (&value)) {
-      gchar *array_name;
-      
-      array_name = ctpl_value_to_string (&value);
-      g_set_error (error, CTPL_PARSER_ERROR, CTPL_PARSER_ERROR_INCOMPATIBLE_SYMBOL,
-                   _("Cannot iterate over value '%s'"),
-                   array_name);
-      g_free (array_name);
-    } else {
-      const GSList *array_items;
-      
-      rv = TRUE;
-      array_items = ctpl_value_get_array (&value);
-      for (; rv && array_items; array_items = array_items->next) {
-        ctpl_environ_push (env, token->iter, array_items->data);
-        rv = ctpl_parser_parse (token->children, env, output, error);
-        ctpl_environ_pop (env, token->iter, NULL);
-      }
-    }
+ctpl_parser_parse_full (const CtplToken          *tree,
+                        CtplEnviron              *env,
+                        CtplOutputStream         *output,
+                        const CtplParserOptions  *options,
+                        GError                  **error)
+{
+  CtplRenderer  renderer;
+  gboolean      rv;
+  CtplArena    *arena;
+  CtplArena    *env_arena = ctpl_environ_get_arena (env);
+  
+  if (options && options->arena) {
+    arena = ctpl_arena_ref (options->arena);
+  } else if (env_arena) {
+    /* already rendering with @env, e.g. from a host function */
+    arena = ctpl_arena_ref (env_arena);
+  } else {
+    arena = ctpl_arena_new ();
+  }
+  ctpl_environ_set_arena (env, arena);
+  ctpl_environ_begin_render (env);
+  ctpl_renderer_init (&renderer, tree, TRUE, env, output);
+  if (options) {
+    ctpl_renderer_set_options (&renderer, options, arena);
   }
-  ctpl_value_free_value (&value);
+  ctpl_environ_begin_step (env);
+  rv = ctpl_renderer_run (&renderer, error);
+  ctpl_renderer_clear (&renderer);
+  ctpl_environ_end_step (env);
+  ctpl_environ_set_arena (env, env_arena);
+  ctpl_environ_end_render (env);
+  ctpl_arena_unref (arena);
   
   return rv;
 }
 
-/* Tries to parse an `if` token */
-static gboolean
-ctpl_parser_parse_token_if (const CtplTokenIf  *token,
-                            CtplEnviron        *env,
-                            CtplOutputStream   *output,
-                            GError            **error)
+/**
+ * ctpl_parser_parse:
+ * @tree: A #CtplToken from which start parsing
+ * @env: A #CtplEnviron representing the parsing environment
+ * @output: A #CtplInputStream in which write parsing output
+ * @error: Location where return a #GError or %NULL to ignore errors
+ * 
+ * Parses a token tree against an environment and outputs the result to @output.
+ * 
+ * Returns: %TRUE on success, %FALSE otherwise, in which case @error shall be
+ *          set to the error that occurred.
+ */
+gboolean
+ctpl_parser_parse (const CtplToken   *tree,
+                   CtplEnviron       *env,
+                   CtplOutputStream  *output,
+                   GError           **error)
 {
-  gboolean  rv = FALSE;
-  gboolean  eval;
+  return ctpl_parser_parse_full (tree, env, output, NULL, error);
+}
+
+/**
+ * ctpl_parser_parse_with_arena:
+ * @tree: A #CtplToken from which start parsing
+ * @env: A #CtplEnviron representing the parsing environment
+ * @output: A #CtplInputStream in which write parsing output
+ * @arena: (allow-none): A #CtplArena in which allocate the temporary values,
+ *         or %NULL to use a new one
+ * @error: Location where return a #GError or %NULL to ignore errors
+ * 
+ * Parses a token tree against an environment and outputs the result to @output,
+ * like ctpl_parser_parse(), allocating the temporary values in @arena.
+ * Reusing the same arena for several parsings avoids allocating its memory
+ * again each time.
+ * 
+ * Returns: %TRUE on success, %FALSE otherwise, in which case @error shall be
+ *          set to the error that occurred.
+ * 
+ * Since: 0.4
+ */
+gboolean
+ctpl_parser_parse_with_arena (const CtplToken   *tree,
+                              CtplEnviron       *env,
+                              CtplOutputStream  *output,
+                              CtplArena         *arena,
+                              GError           **error)
+{
+  CtplParserOptions options = { 0 };
   
-  if (ctpl_eval_bool (token->condition, env, &eval, error)) {
-    rv = ctpl_parser_parse (eval ? token->if_children
-                                 : token->else_children,
-                            env, output, error);
-  }
+  options.arena = arena;
   
-  return rv;
+  return ctpl_parser_parse_full (tree, env, output, &options, error);
 }
 
-/* Tries to parse an expression (a variable, a complete expression, ...). */
-static gboolean
-ctpl_parser_parse_token_expr (CtplTokenExpr    *expr,
-                              CtplEnviron      *env,
-                              CtplOutputStream *output,
-                              GError          **error)
+/**
+ * ctpl_parser_parse_with_options:
+ * @tree: A #CtplToken from which start parsing
+ * @env: A #CtplEnviron representing the parsing environment
+ * @output: A #CtplInputStream in which write parsing output
+ * @options: The #CtplParserOptions of the rendering
+ * @error: Location where return a #GError or %NULL to ignore errors
+ * 
+ * Parses a token tree against an environment and outputs the result to @output,
+ * like ctpl_parser_parse(), but fails as soon as one of the limits of @options
+ * is exceeded, so that no environment can make a rendering run or grow
+ * unbounded.
+ * 
+ * The limits are checked at each loop iteration and each write, so the
+ * deadline and the memory budget may be exceeded by what a single expression
+ * takes, but a string multiplication that wouldn't fit in the memory budget
+ * fails before allocating anything.  When a limit is exceeded, the rendering
+ * fails with %CTPL_PARSER_ERROR_TIMED_OUT, %CTPL_PARSER_ERROR_OUTPUT_LIMIT,
+ * %CTPL_PARSER_ERROR_ITERATION_LIMIT or %CTPL_PARSER_ERROR_MEMORY_LIMIT.
+ * @output then holds the beginning of what the full rendering would have
+ * written, and nothing more: exactly @options->max_output bytes of it if the
+ * output limit was exceeded, and what was rendered before the failing check
+ * otherwise.
+ * 
+ * The temporary values are allocated in @options->arena if set, like
+ * ctpl_parser_parse_with_arena() does, and the statements are replayed from
+ * @options->cache if set, like ctpl_parser_parse_cached() does.  Replayed
+ * output counts toward the output limit like rendered output, and a statement
+ * whose rendering exceeded a limit isn't stored in the cache.
+ * 
+ * <example>
+ *   <title>Rendering with at most 100 ms and 1 MiB of output</title>
+ *   <programlisting>
+ * CtplParserOptions options = { 0 };
+ * GTimeVal          now;
+ * 
+ * g_get_current_time (&now);
+ * options.deadline = now.tv_sec * G_USEC_PER_SEC + now.tv_usec + 100 * 1000;
+ * options.max_output = 1024 * 1024;
+ * if (! ctpl_parser_parse_with_options (tree, env, output, &options, &error)) {
+ *   /<!-- -->* ... *<!-- -->/
+ * }
+ *   </programlisting>
+ * </example>
+ * 
+ * Returns: %TRUE on success, %FALSE otherwise, in which case @error shall be
+ *          set to the error that occurred.
+ * 
+ * Since: 0.4
+ */
+gboolean
+ctpl_parser_parse_with_options (const CtplToken          *tree,
+                                CtplEnviron              *env,
+                                CtplOutputStream         *output,
+                                const CtplParserOptions  *options,
+                                GError                  **error)
+{
+  return ctpl_parser_parse_full (tree, env, output, options, error);
+}
+
+/**
+ * ctpl_parser_parse_cached:
+ * @tree: A #CtplToken from which start parsing
+ * @env: A #CtplEnviron representing the parsing environment
+ * @output: A #CtplInputStream in which write parsing output
+ * @cache: A #CtplCache
+ * @error: Location where return a #GError or %NULL to ignore errors
+ * 
+ * Parses a token tree against an environment and outputs the result to @output,
+ * like ctpl_parser_parse(), but replays the output of the <code>for</code> and
+ * <code>if</code> statements of @tree from @cache when they were already
+ * rendered with the same values, and stores it there otherwise.
+ * See #CtplCache for which statements can be cached.
+ * 
+ * Returns: %TRUE on success, %FALSE otherwise, in which case @error shall be
+ *          set to the error that occurred.
+ * 
+ * Since: 0.4
+ */
+gboolean
+ctpl_parser_parse_cached (const CtplToken   *tree,
+                          CtplEnviron       *env,
+                          CtplOutputStream  *output,
+                          CtplCache         *cache,
+                          GError           **error)
+{
+  CtplParserOptions options = { 0 };
+  
+  options.cache = cache;
+  
+  return ctpl_parser_parse_full (tree, env, output, &options, error);
+}
+
+/* the size to allocate for an output of @size bytes, leaving room for it to
+ * grow a bit and for expressions not counted in the estimate */
+#define SIZE_WITH_MARGIN(size) ((size) + (size) / 8 + 64)
+
+/**
+ * ctpl_parser_parse_to_buffer:
+ * @tree: A #CtplToken from which start parsing
+ * @env: A #CtplEnviron representing the parsing environment
+ * @size_hint: (inout) (allow-none): Location of the output size hint of @tree,
+ *             or %NULL
+ * @length: (out) (allow-none): Return location for the length of the output,
+ *          or %NULL
+ * @error: Location where return a #GError or %NULL to ignore errors
+ * 
+ * Parses a token tree against an environment like ctpl_parser_parse(), and
+ * returns the output in a newly allocated buffer.
+ * 
+ * The buffer is allocated up front to the size @size_hint points to, so that
+ * writing an output fitting in it needs neither reallocation nor copy.  If
+ * @size_hint is %NULL or points to 0, the size is estimated from the data of
+ * @tree.  On success, @size_hint is updated to suit the length of the output,
+ * so keeping one hint per template, initialized to 0, and passing it to each
+ * rendering of that template lets the next ones allocate the right size right
+ * away.
+ * 
+ * Returns: The output of @tree, with a terminating 0 byte not counted in
+ *          @length, or %NULL on failure, in which case @error shall be set to
+ *          the error that occurred.  Free with g_free().
+ * 
+ * Since: 0.4
+ */
+gchar *
+ctpl_parser_parse_to_buffer (const CtplToken   *tree,
+                             CtplEnviron       *env,
+                             gsize             *size_hint,
+                             gsize             *length,
+                             GError           **error)
 {
-  CtplValue eval_value;
-  gboolean  rv = FALSE;
+  GOutputStream    *ostream;
+  CtplOutputStream *stream;
+  gsize             size;
+  gchar            *output = NULL;
   
-  ctpl_value_init (&eval_value);
-  if (ctpl_eval_value (expr, env, &eval_value, error)) {
-    gchar *strval;
+  size = size_hint ? *size_hint : 0;
+  if (size == 0) {
+    size = SIZE_WITH_MARGIN (ctpl_token_get_data_size (tree) + 1);
+  }
+  ostream = g_memory_output_stream_new (g_malloc (size), size,
+                                        g_realloc, g_free);
+  stream = ctpl_output_stream_new (ostream);
+  if (ctpl_parser_parse (tree, env, stream, error) &&
+      ctpl_output_stream_put_c (stream, 0, error)) {
+    GMemoryOutputStream  *mstream = G_MEMORY_OUTPUT_STREAM (ostream);
+    gsize                 output_size;
     
-    strval = ctpl_value_to_string (&eval_value);
-    if (! strval) {
-      g_set_error (error, CTPL_PARSER_ERROR, CTPL_PARSER_ERROR_FAILED,
-                   _("Cannot convert expression to a printable format"));
-    } else {
-      rv = ctpl_output_stream_write (output, strval, -1, error);
+    output_size = g_memory_output_stream_get_data_size (mstream);
+    /* grow the hint if the output didn't fit, and shrink it if the output
+     * used less than half of it */
+    if (size_hint && (output_size > size || output_size < size / 2)) {
+      *size_hint = SIZE_WITH_MARGIN (output_size);
+    } else if (size_hint) {
+      *size_hint = size;
+    }
+    if (length) {
+      *length = output_size - 1;
     }
-    g_free (strval);
+    g_output_stream_close (ostream, NULL, NULL);
+    output = g_memory_output_stream_steal_data (mstream);
   }
-  ctpl_value_free_value (&eval_value);
+  ctpl_output_stream_unref (stream);
+  g_object_unref (ostream);
   
-  return rv;
+  return output;
+}
+
+
+/* the high-water mark of asynchronous renderings if none is given */
+#define DEFAULT_HIGH_WATER_MARK (64 * 1024)
+/* the number of tokens an asynchronous rendering renders at most before
+ * letting other sources run */
+#define ASYNC_SLICE_TOKENS 1024
+
+typedef struct _ParseAsyncData ParseAsyncData;
+struct _ParseAsyncData
+{
+  GSimpleAsyncResult   *result;
+  CtplRenderer         *renderer;     /* the rendering, or %NULL once done */
+  GOutputStream        *output;
+  gsize                 high_water_mark;
+  gint                  io_priority;
+  GCancellable         *cancellable;
+  GError               *error;        /* first error that occurred */
+  GMainContext         *context;      /* context where the rendering runs */
+  GSource              *render_source; /* source rendering, or %NULL if
+                                        * paused */
+  
+  GOutputStream        *buffer;       /* memory stream being rendered to */
+  CtplOutputStream     *buffer_stream;
+  gchar                *spare;        /* memory to reuse for the next buffer */
+  gsize                 spare_size;
+  gchar                *write_data;   /* data being written, or %NULL */
+  gsize                 write_size;   /* allocated size of @write_data */
+  gsize                 write_length;
+  gsize                 write_pos;
+};
+
+static void     parse_async_write_ready     (GObject       *object,
+                                             GAsyncResult  *result,
+                                             gpointer       user_data);
+
+
+/* creates a new buffer for @data to render to, reusing the spare memory */
+static void
+parse_async_new_buffer (ParseAsyncData *data)
+{
+  data->buffer = g_memory_output_stream_new (data->spare, data->spare_size,
+                                             g_realloc, g_free);
+  data->buffer_stream = ctpl_output_stream_new (data->buffer);
+  data->spare = NULL;
+  data->spare_size = 0;
+}
+
+/* gets the length of what was rendered and not yet written */
+static gsize
+parse_async_buffered (ParseAsyncData *data)
+{
+  return g_memory_output_stream_get_data_size (G_MEMORY_OUTPUT_STREAM (data->buffer));
+}
+
+/* writes the rest of the data being written */
+static void
+parse_async_write (ParseAsyncData *data)
+{
+  g_output_stream_write_async (data->output,
+                               data->write_data + data->write_pos,
+                               data->write_length - data->write_pos,
+                               data->io_priority, data->cancellable,
+                               parse_async_write_ready, data);
+}
+
+/* starts writing what was rendered, and renders to a new buffer */
+static void
+parse_async_flush (ParseAsyncData *data)
+{
+  GMemoryOutputStream *mstream = G_MEMORY_OUTPUT_STREAM (data->buffer);
+  
+  g_output_stream_close (data->buffer, NULL, NULL);
+  data->write_length = g_memory_output_stream_get_data_size (mstream);
+  data->write_size = g_memory_output_stream_get_size (mstream);
+  data->write_pos = 0;
+  data->write_data = g_memory_output_stream_steal_data (mstream);
+  ctpl_output_stream_unref (data->buffer_stream);
+  g_object_unref (data->buffer);
+  parse_async_new_buffer (data);
+  if (data->renderer) {
+    ctpl_renderer_set_output (data->renderer, data->buffer_stream);
+  }
+  parse_async_write (data);
+}
+
+static void
+parse_async_data_free (ParseAsyncData *data)
+{
+  ctpl_output_stream_unref (data->buffer_stream);
+  g_object_unref (data->buffer);
+  g_free (data->spare);
+  g_free (data->write_data);
+  if (data->error) {
+    g_error_free (data->error);
+  }
+  if (data->cancellable) {
+    g_object_unref (data->cancellable);
+  }
+  g_object_unref (data->output);
+  if (data->context) {
+    g_main_context_unref (data->context);
+  }
+  if (data->renderer) {
+    ctpl_renderer_unref (data->renderer);
+  }
+  g_object_unref (data->result);
+  g_slice_free1 (sizeof *data, data);
+}
+
+/* reports the result of the rendering */
+static void
+parse_async_complete (ParseAsyncData *data)
+{
+  if (data->error) {
+    g_simple_async_result_set_from_error (data->result, data->error);
+  } else {
+    g_simple_async_result_set_op_res_gboolean (data->result, TRUE);
+  }
+  g_simple_async_result_complete (data->result);
+  parse_async_data_free (data);
+}
+
+/* stops rendering, e.g. once done */
+static void
+parse_async_stop (ParseAsyncData *data)
+{
+  if (data->renderer) {
+    ctpl_renderer_unref (data->renderer);
+    data->renderer = NULL;
+  }
 }
 
-/* Tries to parse a token by dispatching calls to specific parsers. */
+/* renders tokens until the buffer reaches the high-water mark */
 static gboolean
-ctpl_parser_parse_token (const CtplToken   *token,
-                         CtplEnviron       *env,
-                         CtplOutputStream  *output,
-                         GError           **error)
+parse_async_render (gpointer user_data)
 {
-  gboolean rv = FALSE;
+  ParseAsyncData *data = user_data;
+  GError         *err = NULL;
   
-  switch (ctpl_token_get_type (token)) {
-    case CTPL_TOKEN_TYPE_DATA:
-      rv = ctpl_parser_parse_token_data (token->token.t_data, output, error);
-      break;
-    
-    case CTPL_TOKEN_TYPE_FOR:
-      rv = ctpl_parser_parse_token_for (token->token.t_for, env, output, error);
-      break;
-    
-    case CTPL_TOKEN_TYPE_IF:
-      rv = ctpl_parser_parse_token_if (token->token.t_if, env, output, error);
-      break;
-    
-    case CTPL_TOKEN_TYPE_EXPR:
-      rv = ctpl_parser_parse_token_expr (token->token.t_expr, env, output, error);
-      break;
-    
-    default:
-      g_critical ("Invalid/unknown token type %d", ctpl_token_get_type (token));
-      g_assert_not_reached ();
+  if (! g_cancellable_set_error_if_cancelled (data->cancellable, &err) &&
+      ctpl_renderer_step (data->renderer,
+                          data->high_water_mark - parse_async_buffered (data),
+                          ASYNC_SLICE_TOKENS, &err) ==
+        CTPL_RENDERER_STATUS_DONE) {
+    parse_async_stop (data);
+  }
+  if (err) {
+    data->error = err;
+    /* don't write anything after a failure */
+    parse_async_stop (data);
+  } else if (! data->write_data && parse_async_buffered (data) > 0) {
+    parse_async_flush (data);
   }
   
-  return rv;
+  if (data->renderer && parse_async_buffered (data) < data->high_water_mark) {
+    /* keep rendering */
+    return TRUE;
+  } else {
+    /* pause until what is being written drained */
+    data->render_source = NULL;
+    if (! data->write_data) {
+      parse_async_complete (data);
+    }
+    return FALSE;
+  }
+}
+
+/* resumes rendering, from the context the rendering was started from */
+static void
+parse_async_resume (ParseAsyncData *data)
+{
+  data->render_source = g_idle_source_new ();
+  g_source_set_priority (data->render_source, data->io_priority);
+  g_source_set_callback (data->render_source, parse_async_render, data, NULL);
+  g_source_attach (data->render_source, data->context);
+  /* the context holds it until it is destroyed */
+  g_source_unref (data->render_source);
+}
+
+static void
+parse_async_write_ready (GObject      *object,
+                         GAsyncResult *result,
+                         gpointer      user_data)
+{
+  ParseAsyncData *data = user_data;
+  gssize          written;
+  GError         *err = NULL;
+  
+  written = g_output_stream_write_finish (data->output, result, &err);
+  if (written < 0) {
+    if (! data->error) {
+      data->error = err;
+    } else {
+      g_error_free (err);
+    }
+    parse_async_stop (data);
+    if (data->render_source) {
+      g_source_destroy (data->render_source);
+      data->render_source = NULL;
+    }
+    parse_async_complete (data);
+  } else {
+    data->write_pos += (gsize) written;
+    if (data->write_pos < data->write_length) {
+      parse_async_write (data);
+    } else {
+      /* drained, keep the memory for the next buffer */
+      g_free (data->spare);
+      data->spare = data->write_data;
+      data->spare_size = data->write_size;
+      data->write_data = NULL;
+      if (parse_async_buffered (data) > 0 && ! data->error) {
+        parse_async_flush (data);
+      }
+      if (data->render_source) {
+        /* still rendering */
+      } else if (data->renderer) {
+        parse_async_resume (data);
+      } else if (! data->write_data) {
+        parse_async_complete (data);
+      }
+    }
+  }
 }
 
 /**
- * ctpl_parser_parse:
+ * ctpl_parser_parse_async:
  * @tree: A #CtplToken from which start parsing
  * @env: A #CtplEnviron representing the parsing environment
- * @output: A #CtplInputStream in which write parsing output
+ * @output: A #CtplOutputStream in which write parsing output
+ * @options: (allow-none): The #CtplParserOptions of the rendering, or %NULL
+ * @high_water_mark: The size of the rendered data waiting to be written at
+ *                   which the rendering pauses, or 0 for a default value
+ * @io_priority: The I/O priority of the request
+ * @cancellable: (allow-none): Optional #GCancellable object, %NULL to ignore
+ * @callback: (scope async): Callback to call when the rendering is done
+ * @user_data: (closure): Data to pass to @callback
+ * 
+ * Parses a token tree against an environment and outputs the result to @output
+ * asynchronously, like ctpl_parser_parse() but without blocking on the output.
+ * 
+ * The tree is rendered from the thread-default main context, a few tokens at a
+ * time with a #CtplRenderer, to an internal buffer that is written to @output
+ * with g_output_stream_write_async().  When what is rendered but not yet
+ * written reaches @high_water_mark bytes, the rendering pauses until the
+ * output drained it, so a slow output doesn't make the buffer grow.  The
+ * rendering can pause between any two tokens, even inside loops, so the
+ * buffer only exceeds @high_water_mark by the output of a single data or
+ * expression token.
+ * 
+ * @tree must not be freed, and @env must not be modified until the rendering
+ * is done.  If @cancellable is cancelled, the rendering stops as soon as
+ * possible and fails with %G_IO_ERROR_CANCELLED.  On failure, what was
+ * rendered before the failure may have been written.
+ * 
+ * When the rendering is done, @callback is called, from which you should call
+ * ctpl_parser_parse_finish() to get its result.
+ * 
+ * If @options is not %NULL, the rendering honours it like
+ * ctpl_parser_parse_with_options() does.  The deadline only bounds the
+ * rendering, not the writes to @output.
+ * 
+ * Since: 0.4
+ */
+void
+ctpl_parser_parse_async (const CtplToken          *tree,
+                         CtplEnviron              *env,
+                         CtplOutputStream         *output,
+                         const CtplParserOptions  *options,
+                         gsize                     high_water_mark,
+                         gint                      io_priority,
+                         GCancellable             *cancellable,
+                         GAsyncReadyCallback       callback,
+                         gpointer                  user_data)
+{
+  ParseAsyncData *data;
+  
+  data = g_slice_alloc (sizeof *data);
+  data->output = g_object_ref (ctpl_output_stream_get_stream (output));
+  data->result = g_simple_async_result_new (G_OBJECT (data->output), callback,
+                                            user_data,
+                                            ctpl_parser_parse_async);
+  data->high_water_mark = high_water_mark > 0 ? high_water_mark
+                                              : DEFAULT_HIGH_WATER_MARK;
+  data->io_priority = io_priority;
+  data->cancellable = cancellable ? g_object_ref (cancellable) : NULL;
+  data->error = NULL;
+  data->context = g_main_context_get_thread_default ();
+  if (data->context) {
+    g_main_context_ref (data->context);
+  }
+  data->spare = NULL;
+  data->spare_size = 0;
+  data->write_data = NULL;
+  data->write_size = 0;
+  data->write_length = 0;
+  data->write_pos = 0;
+  parse_async_new_buffer (data);
+  data->renderer = ctpl_renderer_new (tree, env, data->buffer_stream,
+                                      options);
+  parse_async_resume (data);
+}
+
+/**
+ * ctpl_parser_parse_finish:
+ * @result: The #GAsyncResult passed to the callback of
+ *          ctpl_parser_parse_async()
  * @error: Location where return a #GError or %NULL to ignore errors
  * 
- * Parses a token tree against an environment and outputs the result to @output.
+ * Gets the result of a rendering started with ctpl_parser_parse_async().
  * 
  * Returns: %TRUE on success, %FALSE otherwise, in which case @error shall be
  *          set to the error that occurred.
+ * 
+ * Since: 0.4
  */
 gboolean
-ctpl_parser_parse (const CtplToken   *tree,
-                   CtplEnviron       *env,
-                   CtplOutputStream  *output,
-                   GError           **error)
+ctpl_parser_parse_finish (GAsyncResult  *result,
+                          GError       **error)
 {
-  gboolean rv = TRUE;
+  GSimpleAsyncResult *simple = G_SIMPLE_ASYNC_RESULT (result);
   
-  for (; rv && tree; tree = tree->next) {
-    rv = ctpl_parser_parse_token (tree, env, output, error);
+  g_return_val_if_fail (g_simple_async_result_get_source_tag (simple) ==
+                        ctpl_parser_parse_async, FALSE);
+  
+  if (g_simple_async_result_propagate_error (simple, error)) {
+    return FALSE;
   }
   
-  return rv;
+  return g_simple_async_result_get_op_res_gboolean (simple);
 }
@@ -25,9 +25,12 @@
 #define H_CTPL_PARSER_H
 
 #include <glib.h>
+#include <gio/gio.h>
 #include "ctpl-token.h"
 #include "ctpl-environ.h"
 #include "ctpl-output-stream.h"
+#include "ctpl-arena.h"
+#include "ctpl-cache.h"
 
 G_BEGIN_DECLS
 
@@ -47,6 +50,14 @@ G_BEGIN_DECLS
  *                                      environment.
  * @CTPL_PARSER_ERROR_FAILED: An error occurred without any precision on what
  *                            failed.
+ * @CTPL_PARSER_ERROR_TIMED_OUT: The rendering didn't end before its deadline.
+ *                               Since: 0.4
+ * @CTPL_PARSER_ERROR_OUTPUT_LIMIT: The output exceeded its maximum size.
+ *                                  Since: 0.4
+ * @CTPL_PARSER_ERROR_ITERATION_LIMIT: The loops exceeded their maximum number
+ *                                     of iterations.  Since: 0.4
+ * @CTPL_PARSER_ERROR_MEMORY_LIMIT: The temporary values exceeded their memory
+ *                                  budget.  Since: 0.4
  * 
  * Error codes that parsing functions can throw, from the %CTPL_PARSER_ERROR
  * domain.
@@ -55,15 +66,82 @@ typedef enum _CtplParserError
 {
   CTPL_PARSER_ERROR_INCOMPATIBLE_SYMBOL,
   CTPL_PARSER_ERROR_SYMBOL_NOT_FOUND,
-  CTPL_PARSER_ERROR_FAILED
+  CTPL_PARSER_ERROR_FAILED,
+  CTPL_PARSER_ERROR_TIMED_OUT,
+  CTPL_PARSER_ERROR_OUTPUT_LIMIT,
+  CTPL_PARSER_ERROR_ITERATION_LIMIT,
+  CTPL_PARSER_ERROR_MEMORY_LIMIT
 } CtplParserError;
 
+/**
+ * CtplParserOptions:
+ * @deadline: The time at which the rendering fails if it isn't done, in
+ *            microseconds since January 1, 1970 UTC like g_get_real_time()
+ *            returns, or 0 for no deadline
+ * @max_output: The maximum number of bytes to output, or 0 for no limit
+ * @max_iterations: The maximum number of loop iterations, counting those of
+ *                  all loops, or 0 for no limit
+ * @max_memory: The maximum size of the memory holding the temporary values,
+ *              in bytes, or 0 for no limit
+ * @arena: The #CtplArena in which allocate the temporary values, or %NULL to
+ *         use a new one, see ctpl_parser_parse_with_arena()
+ * @cache: The #CtplCache from which replay the output of the statements, or
+ *         %NULL not to use any, see ctpl_parser_parse_cached()
+ * 
+ * Options of a rendering, see ctpl_parser_parse_with_options().  Fields left
+ * to 0 or %NULL don't limit nor change anything, so initialize the structure
+ * to all zeros before setting the options you want.
+ * 
+ * Since: 0.4
+ */
+typedef struct _CtplParserOptions CtplParserOptions;
+struct _CtplParserOptions
+{
+  gint64      deadline;
+  gsize       max_output;
+  guint64     max_iterations;
+  gsize       max_memory;
+  CtplArena  *arena;
+  CtplCache  *cache;
+};
+
 
-GQuark    ctpl_parser_error_quark   (void) G_GNUC_CONST;
-gboolean  ctpl_parser_parse         (const CtplToken   *tree,
-                                     CtplEnviron       *env,
-                                     CtplOutputStream  *output,
-                                     GError           **error);
+GQuark    ctpl_parser_error_quark         (void) G_GNUC_CONST;
+gboolean  ctpl_parser_parse               (const CtplToken   *tree,
+                                           CtplEnviron       *env,
+                                           CtplOutputStream  *output,
+                                           GError           **error);
+gboolean  ctpl_parser_parse_with_arena    (const CtplToken   *tree,
+                                           CtplEnviron       *env,
+                                           CtplOutputStream  *output,
+                                           CtplArena         *arena,
+                                           GError           **error);
+gboolean  ctpl_parser_parse_with_options  (const CtplToken          *tree,
+                                           CtplEnviron              *env,
+                                           CtplOutputStream         *output,
+                                           const CtplParserOptions  *options,
+                                           GError                  **error);
+gboolean  ctpl_parser_parse_cached        (const CtplToken   *tree,
+                                           CtplEnviron       *env,
+                                           CtplOutputStream  *output,
+                                           CtplCache         *cache,
+                                           GError           **error);
+gchar    *ctpl_parser_parse_to_buffer     (const CtplToken   *tree,
+                                           CtplEnviron       *env,
+                                           gsize             *size_hint,
+                                           gsize             *length,
+                                           GError           **error);
+void      ctpl_parser_parse_async         (const CtplToken          *tree,
+                                           CtplEnviron              *env,
+                                           CtplOutputStream         *output,
+                                           const CtplParserOptions  *options,
+                                           gsize                     high_water_mark,
+                                           gint                      io_priority,
+                                           GCancellable             *cancellable,
+                                           GAsyncReadyCallback       callback,
+                                           gpointer                  user_data);
+gboolean  ctpl_parser_parse_finish        (GAsyncResult  *result,
+                                           GError       **error);
 
 
 G_END_DECLS
@@ -0,0 +1,91 @@
+/* 
+ * 
+ * Copyright (C) 2009-2011 Colomban Wendling <ban@herbesfolles.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ */
+
+#ifndef H_CTPL_RENDERER_PRIVATE_H
+#define H_CTPL_RENDERER_PRIVATE_H
+
+#include <glib.h>
+#include "ctpl-renderer.h"
+#include "ctpl-token.h"
+#include "ctpl-environ.h"
+#include "ctpl-output-stream.h"
+#include "ctpl-arena.h"
+#include "ctpl-budget.h"
+#include "ctpl-cache.h"
+#include "ctpl-parser.h"
+
+G_BEGIN_DECLS
+
+
+/*
+ * SECTION: renderer-private
+ * @short_description: Private renderer API
+ * @include: ctpl/renderer-private.h
+ * 
+ * Renderers living on the stack, for the parser to render with the state
+ * machine without allocating a #CtplRenderer.
+ */
+
+
+struct _CtplRenderer
+{
+  gint                ref_count;
+  CtplEnviron        *env;
+  CtplOutputStream   *output;
+  CtplArena          *arena;    /* arena to render in, or %NULL to use the
+                                 * one already set on @env */
+  GArray             *stack;    /* CtplRendererFrame of the statements being
+                                 * rendered, innermost last */
+  gboolean            attached; /* whether the iterators of the loops being
+                                 * rendered are pushed in @env */
+  CtplBudget         *budget;   /* limits to enforce, or %NULL: either
+                                 * @budget_data or the one of the renderer
+                                 * rendering this one's tree */
+  CtplBudget          budget_data;
+  CtplCache          *cache;    /* cache of the statements output, or %NULL */
+  CtplRendererStatus  status;
+  GError             *error;    /* the error if the rendering failed */
+  gsize               n_bytes;
+  gsize               n_tokens;
+};
+
+
+G_GNUC_INTERNAL
+void          ctpl_renderer_init            (CtplRenderer      *renderer,
+                                             const CtplToken   *tree,
+                                             gboolean           siblings,
+                                             CtplEnviron       *env,
+                                             CtplOutputStream  *output);
+G_GNUC_INTERNAL
+gboolean      ctpl_renderer_run             (CtplRenderer  *renderer,
+                                             GError       **error);
+G_GNUC_INTERNAL
+void          ctpl_renderer_clear           (CtplRenderer *renderer);
+G_GNUC_INTERNAL
+void          ctpl_renderer_set_options     (CtplRenderer            *renderer,
+                                             const CtplParserOptions *options,
+                                             CtplArena               *arena);
+G_GNUC_INTERNAL
+void          ctpl_renderer_set_output      (CtplRenderer     *renderer,
+                                             CtplOutputStream *output);
+
+
+G_END_DECLS
+
+#endif /* guard */
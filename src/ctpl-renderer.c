@@ -0,0 +1,830 @@
+/* 
+ * 
+ * Copyright (C) 2009-2011 Colomban Wendling <ban@herbesfolles.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ */
+
+#include "ctpl-renderer.h"
+#include "ctpl-renderer-private.h"
+#include <string.h>
+#include <glib.h>
+#include "ctpl-i18n.h"
+#include "ctpl-arena.h"
+#include "ctpl-arena-private.h"
+#include "ctpl-budget.h"
+#include "ctpl-cache.h"
+#include "ctpl-cache-private.h"
+#include "ctpl-environ.h"
+#include "ctpl-environ-private.h"
+#include "ctpl-eval.h"
+#include "ctpl-eval-private.h"
+#include "ctpl-output-stream.h"
+#include "ctpl-parser.h"
+#include "ctpl-token.h"
+#include "ctpl-token-private.h"
+#include "ctpl-value.h"
+
+
+/**
+ * SECTION: renderer
+ * @short_description: Step by step rendering
+ * @include: ctpl/ctpl.h
+ * 
+ * A #CtplRenderer renders a token tree against an environment like
+ * ctpl_parser_parse(), but a piece at a time: each call to ctpl_renderer_step()
+ * renders up to a given number of bytes or of tokens, and returns whether the
+ * rendering is done, failed, or is suspended until the next step.  This lets
+ * a main loop interleave many renderings fairly without threads, each one
+ * rendering a bit from an idle callback.
+ * 
+ * The statements being rendered are kept on an explicit stack rather than on
+ * the C stack, so the nesting depth of a template is only limited by the
+ * memory, and a rendering can stop and resume anywhere, even in the middle of
+ * a loop.  ctpl_parser_parse() uses the same machine to render in a single
+ * step.
+ * 
+ * A #CtplRenderer is created with ctpl_renderer_new(), and uses a refcounting
+ * through ctpl_renderer_ref() and ctpl_renderer_unref().  How much it rendered
+ * so far can be known with ctpl_renderer_get_n_bytes() and
+ * ctpl_renderer_get_n_tokens().
+ * 
+ * <example>
+ *   <title>Rendering a template from an idle callback</title>
+ *   <programlisting>
+ * static gboolean
+ * render_some (gpointer data)
+ * {
+ *   CtplRenderer *renderer = data;
+ *   GError       *error = NULL;
+ *   
+ *   switch (ctpl_renderer_step (renderer, 4096, 0, &error)) {
+ *     case CTPL_RENDERER_STATUS_SUSPENDED:
+ *       return TRUE;
+ *     
+ *     case CTPL_RENDERER_STATUS_FAILED:
+ *       g_warning ("Rendering failed: %s", error->message);
+ *       g_error_free (error);
+ *       break;
+ *     
+ *     case CTPL_RENDERER_STATUS_DONE:
+ *       break;
+ *   }
+ *   ctpl_renderer_unref (renderer);
+ *   
+ *   return FALSE;
+ * }
+ * 
+ * g_idle_add (render_some, ctpl_renderer_new (tree, env, output, NULL));
+ *   </programlisting>
+ * </example>
+ */
+
+
+typedef enum _CtplRendererFrameType
+{
+  FRAME_TREE, /* the rendered tree */
+  FRAME_IF,   /* the taken branch of an if statement */
+  FRAME_FOR   /* the children of a for loop */
+} CtplRendererFrameType;
+
+/* a statement being rendered */
+typedef struct _CtplRendererFrame CtplRendererFrame;
+struct _CtplRendererFrame
+{
+  CtplRendererFrameType type;
+  const CtplToken      *token;    /* next token to render, or %NULL */
+  gboolean              siblings; /* whether to render the siblings of
+                                   * @token */
+  gboolean              cached;   /* whether the statements of the frame may
+                                   * be replayed from the cache */
+  CtplArenaMark         mark;     /* arena position before the statement,
+                                   * unused for FRAME_TREE */
+  
+  /* loops only */
+  const CtplTokenFor   *loop;
+  CtplValue             array;    /* the array or iterator looped over */
+  const GSList         *items;    /* the next items of an array */
+  const CtplValue      *array_item; /* the current item of an array */
+  CtplValue             item;     /* the current item of an iterator */
+  gboolean              has_item; /* whether there is a current item */
+};
+
+
+/* pushes a new frame on @renderer's stack */
+static CtplRendererFrame *
+push_frame (CtplRenderer          *renderer,
+            CtplRendererFrameType  type,
+            const CtplToken       *token,
+            gboolean               siblings,
+            gboolean               cached,
+            const CtplArenaMark   *mark)
+{
+  CtplRendererFrame *frame;
+  
+  g_array_set_size (renderer->stack, renderer->stack->len + 1);
+  frame = &g_array_index (renderer->stack, CtplRendererFrame,
+                          renderer->stack->len - 1);
+  frame->type = type;
+  frame->token = token;
+  frame->siblings = siblings;
+  frame->cached = cached;
+  if (mark) {
+    frame->mark = *mark;
+  }
+  frame->loop = NULL;
+  ctpl_value_init (&frame->array);
+  frame->items = NULL;
+  frame->array_item = NULL;
+  ctpl_value_init (&frame->item);
+  frame->has_item = FALSE;
+  
+  return frame;
+}
+
+/* gets the current item of the loop of @frame, or %NULL */
+static const CtplValue *
+get_item (const CtplRendererFrame *frame)
+{
+  if (! frame->has_item) {
+    return NULL;
+  } else if (CTPL_VALUE_HOLDS_ITERATOR (&frame->array)) {
+    return &frame->item;
+  } else {
+    return frame->array_item;
+  }
+}
+
+/* pushes the iterators of the loops being rendered in the environ */
+static void
+attach (CtplRenderer *renderer)
+{
+  guint i;
+  
+  for (i = 0; i < renderer->stack->len; i++) {
+    CtplRendererFrame *frame;
+    
+    frame = &g_array_index (renderer->stack, CtplRendererFrame, i);
+    if (frame->has_item) {
+      ctpl_environ_push (renderer->env, frame->loop->iter, get_item (frame));
+    }
+  }
+  renderer->attached = TRUE;
+}
+
+/* pops the iterators pushed by attach() */
+static void
+detach (CtplRenderer *renderer)
+{
+  guint i;
+  
+  for (i = renderer->stack->len; i > 0; i--) {
+    CtplRendererFrame *frame;
+    
+    frame = &g_array_index (renderer->stack, CtplRendererFrame, i - 1);
+    if (frame->has_item) {
+      ctpl_environ_pop (renderer->env, frame->loop->iter, NULL);
+    }
+  }
+  renderer->attached = FALSE;
+}
+
+/* pops the innermost frame from @renderer's stack, releasing its
+ * temporaries */
+static void
+pop_frame (CtplRenderer *renderer)
+{
+  CtplRendererFrame *frame;
+  
+  frame = &g_array_index (renderer->stack, CtplRendererFrame,
+                          renderer->stack->len - 1);
+  if (frame->has_item && renderer->attached) {
+    ctpl_environ_pop (renderer->env, frame->loop->iter, NULL);
+  }
+  ctpl_value_free_value (&frame->item);
+  ctpl_value_free_value (&frame->array);
+  if (frame->type != FRAME_TREE) {
+    ctpl_arena_release (ctpl_environ_get_arena (renderer->env), &frame->mark);
+  }
+  g_array_set_size (renderer->stack, renderer->stack->len - 1);
+}
+
+/* pops all frames, e.g. after a failure */
+static void
+unwind (CtplRenderer *renderer)
+{
+  while (renderer->stack->len > 0) {
+    pop_frame (renderer);
+  }
+}
+
+/* pushes the next item of the loop of @frame as its iterator and rewinds its
+ * children if there is one, which tells frame->has_item; fails if it exceeds
+ * the budget */
+static gboolean
+next_item (CtplRenderer       *renderer,
+           CtplRendererFrame  *frame,
+           GError            **error)
+{
+  if (frame->has_item) {
+    ctpl_environ_pop (renderer->env, frame->loop->iter, NULL);
+  }
+  if (CTPL_VALUE_HOLDS_ITERATOR (&frame->array)) {
+    /* iterators generate their items one by one, don't materialize them */
+    frame->has_item = ctpl_value_iterator_next (&frame->array, &frame->item);
+  } else {
+    frame->has_item = frame->items != NULL;
+    if (frame->items) {
+      frame->array_item = frame->items->data;
+      frame->items = frame->items->next;
+    }
+  }
+  if (frame->has_item) {
+    ctpl_environ_push (renderer->env, frame->loop->iter, get_item (frame));
+    frame->token = frame->loop->children;
+    if (renderer->budget) {
+      return ctpl_budget_iterate (renderer->budget, error);
+    }
+  }
+  
+  return TRUE;
+}
+
+/* starts rendering the loop @loop, whose arena position is @mark, which is
+ * released once the loop is done or on failure */
+static gboolean
+render_for (CtplRenderer        *renderer,
+            const CtplTokenFor  *loop,
+            const CtplArenaMark *mark,
+            GError             **error)
+{
+  CtplValue value;
+  gboolean  rv = FALSE;
+  
+  ctpl_value_init (&value);
+  if (ctpl_eval_value (loop->array, renderer->env, &value, error)) {
+    if (CTPL_VALUE_HOLDS_ITERATOR (&value) ||
+        CTPL_VALUE_HOLDS_ARRAY (&value)) {
+      CtplRendererFrame *frame;
+      
+      /* like the cached parsing always did, loops are rendered without
+       * replaying statements inside them */
+      frame = push_frame (renderer, FRAME_FOR, NULL, TRUE, FALSE, mark);
+      frame->loop = loop;
+      /* the frame owns the value from now on */
+      frame->array = value;
+      ctpl_value_init (&value);
+      if (CTPL_VALUE_HOLDS_ITERATOR (&frame->array)) {
+        ctpl_value_iterator_reset (&frame->array);
+      } else {
+        frame->items = ctpl_value_get_array (&frame->array);
+      }
+      rv = next_item (renderer, frame, error);
+      if (! rv || ! frame->has_item) {
+        pop_frame (renderer);
+      }
+      /* popping the frame released @mark */
+      mark = NULL;
+    } else {
+      gchar *array_name;
+      
+      array_name = ctpl_value_to_string (&value);
+      g_set_error (error, CTPL_PARSER_ERROR, CTPL_PARSER_ERROR_INCOMPATIBLE_SYMBOL,
+                   _("Cannot iterate over value '%s'"),
+                   array_name);
+      g_free (array_name);
+    }
+  }
+  ctpl_value_free_value (&value);
+  if (mark) {
+    ctpl_arena_release (ctpl_environ_get_arena (renderer->env), mark);
+  }
+  
+  return rv;
+}
+
+/* writes @data within the budget of @renderer */
+static gboolean
+write_data (CtplRenderer  *renderer,
+            const gchar   *data,
+            gsize          length,
+            GError       **error)
+{
+  gboolean rv;
+  
+  if (renderer->budget) {
+    rv = ctpl_budget_write (renderer->budget, renderer->output, data, length,
+                            &length, error);
+  } else {
+    rv = ctpl_output_stream_write (renderer->output, data, (gssize)length,
+                                   error);
+  }
+  renderer->n_bytes += length;
+  
+  return rv;
+}
+
+/* renders the cacheable statement @token whole, replaying its output from the
+ * cache of @renderer if it is stored there under @key, and storing it there
+ * otherwise; takes @key */
+static gboolean
+render_fragment (CtplRenderer     *renderer,
+                 const CtplToken  *token,
+                 gchar            *key,
+                 GError          **error)
+{
+  gboolean      rv;
+  const gchar  *data;
+  gsize         length;
+  
+  if (ctpl_cache_lookup (renderer->cache, key, &data, &length)) {
+    /* replayed output counts toward the output limit */
+    rv = length == 0 || write_data (renderer, data, length, error);
+    g_free (key);
+  } else {
+    GOutputStream    *ostream;
+    CtplOutputStream *stream;
+    CtplRenderer      fragment;
+    gchar            *output_data;
+    
+    ostream = g_memory_output_stream_new (NULL, 0, g_realloc, g_free);
+    stream = ctpl_output_stream_new (ostream);
+    ctpl_renderer_init (&fragment, token, FALSE, renderer->env, stream);
+    /* the output is counted by the budget as it is rendered */
+    fragment.budget = renderer->budget;
+    rv = ctpl_renderer_run (&fragment, error);
+    ctpl_renderer_clear (&fragment);
+    g_output_stream_close (ostream, NULL, NULL);
+    length = g_memory_output_stream_get_data_size (G_MEMORY_OUTPUT_STREAM (ostream));
+    output_data = g_memory_output_stream_steal_data (G_MEMORY_OUTPUT_STREAM (ostream));
+    ctpl_output_stream_unref (stream);
+    g_object_unref (ostream);
+    /* write what was output even on failure, as without cache */
+    if (length > 0) {
+      if (rv) {
+        rv = ctpl_output_stream_write (renderer->output, output_data,
+                                       (gssize) length, error);
+      } else {
+        ctpl_output_stream_write (renderer->output, output_data,
+                                  (gssize) length, NULL);
+      }
+      renderer->n_bytes += length;
+    }
+    if (rv) {
+      ctpl_cache_store (renderer->cache, key, output_data, length);
+    } else {
+      g_free (output_data);
+      g_free (key);
+    }
+  }
+  
+  return rv;
+}
+
+/* renders @token, or starts rendering it if it is a statement, replaying it
+ * from the cache if @cached is %TRUE and it can */
+static gboolean
+render_token (CtplRenderer     *renderer,
+              const CtplToken  *token,
+              gboolean          cached,
+              GError          **error)
+{
+  CtplEnviron    *env = renderer->env;
+  gboolean        rv = FALSE;
+  CtplArenaMark   mark;
+  CtplTokenType   type = ctpl_token_get_type (token);
+  
+  renderer->n_tokens++;
+  /* the temporaries of a token are released once it's done */
+  ctpl_arena_mark (ctpl_environ_get_arena (env), &mark);
+  if (cached && renderer->cache &&
+      (type == CTPL_TOKEN_TYPE_FOR || type == CTPL_TOKEN_TYPE_IF)) {
+    gchar *key = ctpl_cache_build_key (token, env);
+    
+    if (key) {
+      rv = render_fragment (renderer, token, key, error);
+      ctpl_arena_release (ctpl_environ_get_arena (env), &mark);
+      
+      return rv;
+    }
+  }
+  switch (type) {
+    case CTPL_TOKEN_TYPE_DATA:
+      rv = write_data (renderer, token->token.t_data,
+                       strlen (token->token.t_data), error);
+      break;
+    
+    case CTPL_TOKEN_TYPE_EXPR: {
+      gsize written;
+      
+      rv = ctpl_eval_write_counted (token->token.t_expr, env, renderer->output,
+                                    renderer->budget, &written, error);
+      renderer->n_bytes += written;
+      break;
+    }
+    
+    case CTPL_TOKEN_TYPE_IF: {
+      const CtplTokenIf  *token_if = token->token.t_if;
+      gboolean            eval;
+      
+      rv = ctpl_eval_bool (token_if->condition, env, &eval, error);
+      if (rv) {
+        /* the taken branch may still hold cacheable statements */
+        push_frame (renderer, FRAME_IF,
+                    eval ? token_if->if_children : token_if->else_children,
+                    TRUE, cached, &mark);
+        /* released when the frame is popped */
+        return TRUE;
+      }
+      break;
+    }
+    
+    case CTPL_TOKEN_TYPE_FOR:
+      return render_for (renderer, token->token.t_for, &mark, error);
+    
+    default:
+      g_critical ("Invalid/unknown token type %d", type);
+      g_assert_not_reached ();
+  }
+  ctpl_arena_release (ctpl_environ_get_arena (env), &mark);
+  
+  return rv;
+}
+
+/*
+ * render:
+ * @renderer: A #CtplRenderer whose environ has an arena set
+ * @max_bytes: The number of bytes after which stop, or 0 for no limit
+ * @max_tokens: The number of tokens after which stop, or 0 for no limit
+ * @error: Return location for errors, or %NULL to ignore them
+ * 
+ * Renders tokens until either limit is reached or the rendering is done, and
+ * updates the status of @renderer.  At least one token is rendered if there
+ * is any left, and a token is always rendered whole, so the output may
+ * exceed @max_bytes by the output of the last token.
+ * 
+ * Returns: %TRUE on success, %FALSE otherwise.
+ */
+static gboolean
+render (CtplRenderer  *renderer,
+        gsize          max_bytes,
+        gsize          max_tokens,
+        GError       **error)
+{
+  gboolean  rv = TRUE;
+  gsize     n_bytes = renderer->n_bytes;
+  gsize     n_tokens = renderer->n_tokens;
+  
+  while (rv && renderer->stack->len > 0) {
+    CtplRendererFrame *frame;
+    
+    frame = &g_array_index (renderer->stack, CtplRendererFrame,
+                            renderer->stack->len - 1);
+    if (! frame->token) {
+      /* the frame is done, unless its loop has more items */
+      if (frame->type == FRAME_FOR) {
+        rv = next_item (renderer, frame, error);
+      }
+      if (rv && ! frame->has_item) {
+        pop_frame (renderer);
+      }
+    } else if ((max_bytes > 0 && renderer->n_bytes - n_bytes >= max_bytes) ||
+               (max_tokens > 0 && renderer->n_tokens - n_tokens >= max_tokens)) {
+      break;
+    } else {
+      const CtplToken *token = frame->token;
+      
+      frame->token = frame->siblings ? token->next : NULL;
+      /* this may push a frame, invalidating @frame */
+      rv = render_token (renderer, token, frame->cached, error);
+    }
+  }
+  if (! rv) {
+    unwind (renderer);
+    renderer->status = CTPL_RENDERER_STATUS_FAILED;
+  } else if (renderer->stack->len == 0) {
+    renderer->status = CTPL_RENDERER_STATUS_DONE;
+  }
+  
+  return rv;
+}
+
+/*
+ * ctpl_renderer_init:
+ * @renderer: A #CtplRenderer to initialize
+ * @tree: The #CtplToken to render
+ * @siblings: Whether to render the siblings of @tree too, or only @tree
+ * @env: The #CtplEnviron in which render @tree
+ * @output: The #CtplOutputStream to write to
+ * 
+ * Initializes a #CtplRenderer, e.g. one allocated on the stack, to render
+ * with the arena set on @env by the caller.  Clear it with
+ * ctpl_renderer_clear().
+ */
+void
+ctpl_renderer_init (CtplRenderer      *renderer,
+                    const CtplToken   *tree,
+                    gboolean           siblings,
+                    CtplEnviron       *env,
+                    CtplOutputStream  *output)
+{
+  renderer->ref_count = 1;
+  renderer->env = ctpl_environ_ref (env);
+  ctpl_environ_begin_render (env);
+  renderer->output = ctpl_output_stream_ref (output);
+  renderer->arena = NULL;
+  renderer->stack = g_array_sized_new (FALSE, FALSE, sizeof (CtplRendererFrame),
+                                       8);
+  renderer->attached = TRUE;
+  renderer->budget = NULL;
+  renderer->cache = NULL;
+  renderer->status = CTPL_RENDERER_STATUS_SUSPENDED;
+  renderer->error = NULL;
+  renderer->n_bytes = 0;
+  renderer->n_tokens = 0;
+  push_frame (renderer, FRAME_TREE, tree, siblings, TRUE, NULL);
+}
+
+/*
+ * ctpl_renderer_set_options:
+ * @renderer: A #CtplRenderer initialized with ctpl_renderer_init()
+ * @options: The #CtplParserOptions to render with
+ * @arena: The #CtplArena @renderer renders in
+ * 
+ * Makes @renderer enforce the limits of @options, and replay statements from
+ * the cache of @options if it has one.  The arena of @options is not used,
+ * @arena is the one to render in.  This must be called before rendering
+ * anything.
+ */
+void
+ctpl_renderer_set_options (CtplRenderer            *renderer,
+                           const CtplParserOptions *options,
+                           CtplArena               *arena)
+{
+  if (options->cache) {
+    renderer->cache = ctpl_cache_ref (options->cache);
+  }
+  ctpl_budget_init (&renderer->budget_data, options, arena);
+  renderer->budget = &renderer->budget_data;
+}
+
+/*
+ * ctpl_renderer_run:
+ * @renderer: A #CtplRenderer initialized with ctpl_renderer_init()
+ * @error: Return location for errors, or %NULL to ignore them
+ * 
+ * Renders all what is left to render with @renderer, in the arena set on its
+ * environ.
+ * 
+ * Returns: %TRUE on success, %FALSE otherwise.
+ */
+gboolean
+ctpl_renderer_run (CtplRenderer  *renderer,
+                   GError       **error)
+{
+  return render (renderer, 0, 0, error);
+}
+
+/*
+ * ctpl_renderer_clear:
+ * @renderer: A #CtplRenderer initialized with ctpl_renderer_init()
+ * 
+ * Releases the resources held by @renderer, stopping its rendering if it is
+ * not done.
+ */
+void
+ctpl_renderer_clear (CtplRenderer *renderer)
+{
+  if (renderer->stack->len > 0) {
+    CtplArena *env_arena = ctpl_environ_get_arena (renderer->env);
+    
+    /* the temporaries of the frames are in our arena */
+    if (renderer->arena) {
+      ctpl_environ_set_arena (renderer->env, renderer->arena);
+    }
+    ctpl_environ_begin_step (renderer->env);
+    unwind (renderer);
+    ctpl_environ_end_step (renderer->env);
+    if (renderer->arena) {
+      ctpl_environ_set_arena (renderer->env, env_arena);
+    }
+  }
+  g_array_free (renderer->stack, TRUE);
+  if (renderer->budget == &renderer->budget_data) {
+    ctpl_budget_clear (&renderer->budget_data);
+  }
+  if (renderer->cache) {
+    ctpl_cache_unref (renderer->cache);
+  }
+  if (renderer->error) {
+    g_error_free (renderer->error);
+  }
+  if (renderer->arena) {
+    ctpl_arena_unref (renderer->arena);
+  }
+  ctpl_output_stream_unref (renderer->output);
+  ctpl_environ_end_render (renderer->env);
+  ctpl_environ_unref (renderer->env);
+}
+
+/*
+ * ctpl_renderer_set_output:
+ * @renderer: A #CtplRenderer
+ * @output: A #CtplOutputStream
+ * 
+ * Changes the stream the next steps of @renderer write to.
+ */
+void
+ctpl_renderer_set_output (CtplRenderer     *renderer,
+                          CtplOutputStream *output)
+{
+  ctpl_output_stream_ref (output);
+  ctpl_output_stream_unref (renderer->output);
+  renderer->output = output;
+}
+
+/**
+ * ctpl_renderer_new:
+ * @tree: The #CtplToken tree to render
+ * @env: The #CtplEnviron in which render @tree
+ * @output: The #CtplOutputStream to write to
+ * @options: (allow-none): The #CtplParserOptions to render with, or %NULL
+ * 
+ * Creates a new #CtplRenderer rendering a token tree against an environment.
+ * Nothing is rendered until ctpl_renderer_step() is called.
+ * 
+ * If @options is not %NULL, the rendering is done in its arena and replays its
+ * cache like ctpl_parser_parse_with_options() does, and fails as soon as one
+ * of its limits is exceeded.  The limits span the whole rendering, not each
+ * step, and a statement replayed from the cache is rendered whole by a single
+ * step.
+ * 
+ * @tree must not be modified nor freed while the renderer exists.  The
+ * iterators of the loops being rendered are only pushed in @env during the
+ * steps, so @env is left as it was between two steps and several renderers
+ * can share it.  Changes made to @env between two steps are seen by the next
+ * ones.
+ * 
+ * Returns: A new #CtplRenderer
+ * 
+ * Since: 0.4
+ */
+CtplRenderer *
+ctpl_renderer_new (const CtplToken         *tree,
+                   CtplEnviron             *env,
+                   CtplOutputStream        *output,
+                   const CtplParserOptions *options)
+{
+  CtplRenderer *renderer;
+  
+  renderer = g_slice_alloc (sizeof *renderer);
+  ctpl_renderer_init (renderer, tree, TRUE, env, output);
+  if (options && options->arena) {
+    renderer->arena = ctpl_arena_ref (options->arena);
+  } else {
+    renderer->arena = ctpl_arena_new ();
+  }
+  if (options) {
+    ctpl_renderer_set_options (renderer, options, renderer->arena);
+  }
+  /* only attached while stepping */
+  renderer->attached = FALSE;
+  
+  return renderer;
+}
+
+/**
+ * ctpl_renderer_ref:
+ * @renderer: A #CtplRenderer
+ * 
+ * Adds a reference to a #CtplRenderer.
+ * 
+ * Returns: The renderer
+ * 
+ * Since: 0.4
+ */
+CtplRenderer *
+ctpl_renderer_ref (CtplRenderer *renderer)
+{
+  g_atomic_int_inc (&renderer->ref_count);
+  
+  return renderer;
+}
+
+/**
+ * ctpl_renderer_unref:
+ * @renderer: A #CtplRenderer
+ * 
+ * Removes a reference from a #CtplRenderer.  When its reference count reaches
+ * 0, the renderer is freed, stopping its rendering if it is not done.
+ * 
+ * Since: 0.4
+ */
+void
+ctpl_renderer_unref (CtplRenderer *renderer)
+{
+  if (g_atomic_int_dec_and_test (&renderer->ref_count)) {
+    ctpl_renderer_clear (renderer);
+    g_slice_free1 (sizeof *renderer, renderer);
+  }
+}
+
+/**
+ * ctpl_renderer_step:
+ * @renderer: A #CtplRenderer
+ * @max_bytes: The number of bytes after which suspend the rendering, or 0 for
+ *             no limit
+ * @max_tokens: The number of tokens after which suspend the rendering, or 0
+ *              for no limit
+ * @error: Return location for errors, or %NULL to ignore them
+ * 
+ * Renders the next tokens of a #CtplRenderer, until either @max_bytes bytes
+ * were written or @max_tokens tokens were rendered, or the rendering is done.
+ * With no limit at all, the whole rest of the tree is rendered.
+ * 
+ * At least one token is rendered by each step if there is any left.  Tokens
+ * are always rendered whole, so a step may write more than @max_bytes bytes
+ * by the output of its last token.  Entering an <code>if</code> or a
+ * <code>for</code> statement counts as rendering a token, but going to the
+ * next iteration of a loop doesn't.
+ * 
+ * Once the rendering is done or failed, further steps do nothing and return
+ * the same status, and the same error on failure.
+ * 
+ * Returns: %CTPL_RENDERER_STATUS_SUSPENDED if there is more to render,
+ *          %CTPL_RENDERER_STATUS_DONE if the rendering is done, or
+ *          %CTPL_RENDERER_STATUS_FAILED if it failed, in which case @error
+ *          shall be set to the error that occurred.
+ * 
+ * Since: 0.4
+ */
+CtplRendererStatus
+ctpl_renderer_step (CtplRenderer  *renderer,
+                    gsize          max_bytes,
+                    guint          max_tokens,
+                    GError       **error)
+{
+  if (renderer->status == CTPL_RENDERER_STATUS_SUSPENDED) {
+    CtplArena *env_arena = ctpl_environ_get_arena (renderer->env);
+    
+    /* the environment may be used by others between two steps, so only set
+     * our arena and push our iterators while rendering */
+    ctpl_environ_set_arena (renderer->env, renderer->arena);
+    ctpl_environ_begin_step (renderer->env);
+    attach (renderer);
+    render (renderer, max_bytes, max_tokens, &renderer->error);
+    detach (renderer);
+    ctpl_environ_end_step (renderer->env);
+    ctpl_environ_set_arena (renderer->env, env_arena);
+  }
+  if (renderer->status == CTPL_RENDERER_STATUS_FAILED) {
+    g_propagate_error (error, g_error_copy (renderer->error));
+  }
+  
+  return renderer->status;
+}
+
+/**
+ * ctpl_renderer_get_n_bytes:
+ * @renderer: A #CtplRenderer
+ * 
+ * Gets the number of bytes a #CtplRenderer wrote so far.
+ * 
+ * Returns: The number of bytes written by @renderer
+ * 
+ * Since: 0.4
+ */
+gsize
+ctpl_renderer_get_n_bytes (const CtplRenderer *renderer)
+{
+  return renderer->n_bytes;
+}
+
+/**
+ * ctpl_renderer_get_n_tokens:
+ * @renderer: A #CtplRenderer
+ * 
+ * Gets the number of tokens a #CtplRenderer rendered so far.  The tokens of
+ * loops are counted once per iteration.
+ * 
+ * Returns: The number of tokens rendered by @renderer
+ * 
+ * Since: 0.4
+ */
+gsize
+ctpl_renderer_get_n_tokens (const CtplRenderer *renderer)
+{
+  return renderer->n_tokens;
+}
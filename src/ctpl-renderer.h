@@ -0,0 +1,72 @@
+/* 
+ * 
+ * Copyright (C) 2009-2011 Colomban Wendling <ban@herbesfolles.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ */
+
+#if ! defined (H_CTPL_H_INSIDE) && ! defined (CTPL_COMPILATION)
+# error "Only <ctpl/ctpl.h> can be included directly."
+#endif
+
+#ifndef H_CTPL_RENDERER_H
+#define H_CTPL_RENDERER_H
+
+#include <glib.h>
+#include "ctpl-token.h"
+#include "ctpl-environ.h"
+#include "ctpl-output-stream.h"
+#include "ctpl-parser.h"
+
+G_BEGIN_DECLS
+
+
+/**
+ * CtplRendererStatus:
+ * @CTPL_RENDERER_STATUS_FAILED: The rendering failed.
+ * @CTPL_RENDERER_STATUS_SUSPENDED: The rendering is suspended and has more to
+ *                                  render.
+ * @CTPL_RENDERER_STATUS_DONE: The whole tree was rendered.
+ * 
+ * The state in which ctpl_renderer_step() leaves a #CtplRenderer.
+ * 
+ * Since: 0.4
+ */
+typedef enum _CtplRendererStatus
+{
+  CTPL_RENDERER_STATUS_FAILED,
+  CTPL_RENDERER_STATUS_SUSPENDED,
+  CTPL_RENDERER_STATUS_DONE
+} CtplRendererStatus;
+
+typedef struct _CtplRenderer CtplRenderer;
+
+CtplRenderer       *ctpl_renderer_new           (const CtplToken          *tree,
+                                                 CtplEnviron              *env,
+                                                 CtplOutputStream         *output,
+                                                 const CtplParserOptions  *options);
+CtplRenderer       *ctpl_renderer_ref           (CtplRenderer *renderer);
+void                ctpl_renderer_unref         (CtplRenderer *renderer);
+CtplRendererStatus  ctpl_renderer_step          (CtplRenderer  *renderer,
+                                                 gsize          max_bytes,
+                                                 guint          max_tokens,
+                                                 GError       **error);
+gsize               ctpl_renderer_get_n_bytes   (const CtplRenderer *renderer);
+gsize               ctpl_renderer_get_n_tokens  (const CtplRenderer *renderer);
+
+
+G_END_DECLS
+
+#endif /* guard */
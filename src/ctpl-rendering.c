@@ -0,0 +1,754 @@
+/* 
+ * 
+ * Copyright (C) 2009-2011 Colomban Wendling <ban@herbesfolles.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ */
+
+#include "ctpl-rendering.h"
+#include <string.h>
+#include <glib.h>
+#include <gio/gio.h>
+#include "ctpl-arena.h"
+#include "ctpl-arena-private.h"
+#include "ctpl-environ.h"
+#include "ctpl-environ-private.h"
+#include "ctpl-eval.h"
+#include "ctpl-output-stream.h"
+#include "ctpl-parser-private.h"
+#include "ctpl-token.h"
+#include "ctpl-token-private.h"
+#include "ctpl-value.h"
+
+
+/**
+ * SECTION: rendering
+ * @short_description: Incremental rendering
+ * @include: ctpl/ctpl.h
+ * 
+ * A #CtplRendering keeps the output of a template rendered in an environment,
+ * and keeps it up to date as the environment changes by only rendering again
+ * the parts of the template that depend on the symbols that changed.  The
+ * output is always the same as what ctpl_parser_parse() would give, but when
+ * only a few symbols changed, updating it costs much less than rendering the
+ * whole template again.
+ * 
+ * A #CtplRendering is created with ctpl_rendering_new(), rendered and updated
+ * with ctpl_rendering_update(), and its output is written with
+ * ctpl_rendering_write().  It uses a refcounting through ctpl_rendering_ref()
+ * and ctpl_rendering_unref().
+ * 
+ * The output is split in fragments: each top-level token of the template, and
+ * the tokens of the branches <code>if</code> statements take, recursively;
+ * the length of each fragment is known so the output of one can be replaced
+ * without touching the others.
+ * Each fragment knows which symbols it reads, and the environment logs the
+ * symbols pushed or popped, so an update only renders the fragments reading
+ * one of them.  Fragments calling functions added with
+ * ctpl_environ_add_function(), or reading iterators or values from a resolver
+ * that doesn't memoize them, may change without the environment changing and
+ * are rendered on each update.  Adding or removing functions, changing the
+ * resolver or calling ctpl_environ_forget_resolved() renders everything again.
+ * 
+ * <example>
+ *   <title>Keeping a page up to date</title>
+ *   <programlisting>
+ * CtplRendering *rendering = ctpl_rendering_new (tree, env);
+ * 
+ * while (ctpl_rendering_update (rendering, &error)) {
+ *   ctpl_rendering_write (rendering, output, &error);
+ *   /<!-- -->* ... *<!-- -->/
+ *   ctpl_environ_pop (env, "time", NULL);
+ *   ctpl_environ_push_int (env, "time", now);
+ * }
+ * ctpl_rendering_unref (rendering);
+ *   </programlisting>
+ * </example>
+ */
+
+
+/* a fragment of the output */
+typedef struct _CtplRenderingNode CtplRenderingNode;
+struct _CtplRenderingNode
+{
+  const CtplToken    *token;    /* %NULL for the root */
+  CtplRenderingNode  *parent;
+  guint               index;    /* position in the parent's children */
+  gsize               length;   /* length of the output of the node and its
+                                 * children */
+  gboolean            dirty;    /* needs to be rendered again */
+  
+  GPtrArray          *symbols;  /* symbols the node reads, owned by the token
+                                 * tree */
+  GPtrArray          *links;    /* links of the node in the queues of
+                                 * CtplRendering::readers, by symbol */
+  GList              *volatile_link; /* link in CtplRendering::volatile_nodes,
+                                      * if the node is volatile */
+  
+  gchar              *data;     /* output of a leaf node */
+  GPtrArray          *children; /* nodes of the root or of the taken branch of
+                                 * an if statement, or %NULL */
+};
+
+/**
+ * CtplRendering:
+ * 
+ * An opaque object keeping the output of a template up to date.
+ * 
+ * Since: 0.4
+ */
+struct _CtplRendering
+{
+  gint                ref_count;
+  const CtplToken    *tree;
+  CtplEnviron        *env;
+  CtplArena          *arena;
+  CtplRenderingNode  *root;           /* %NULL if not rendered */
+  guint               serial;         /* change serial of @env at the last
+                                       * update */
+  GHashTable         *readers;        /* symbol -> GQueue of the nodes reading
+                                       * it */
+  GQueue              volatile_nodes; /* nodes to render on each update */
+  guint               n_rendered;
+};
+
+
+/**
+ * ctpl_rendering_new:
+ * @tree: A #CtplToken tree
+ * @env: The #CtplEnviron in which render @tree
+ * 
+ * Creates a new #CtplRendering of a template in an environment.  Nothing is
+ * rendered until ctpl_rendering_update() is called.
+ * 
+ * @tree must not be modified nor freed while the rendering exists.
+ * 
+ * Returns: A new #CtplRendering
+ * 
+ * Since: 0.4
+ */
+CtplRendering *
+ctpl_rendering_new (const CtplToken *tree,
+                    CtplEnviron     *env)
+{
+  CtplRendering *rendering;
+  
+  rendering = g_slice_alloc (sizeof *rendering);
+  rendering->ref_count = 1;
+  rendering->tree = tree;
+  rendering->env = ctpl_environ_ref (env);
+  rendering->arena = ctpl_arena_new ();
+  rendering->root = NULL;
+  rendering->serial = 0;
+  rendering->readers = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+                                              (GDestroyNotify) g_queue_free);
+  g_queue_init (&rendering->volatile_nodes);
+  rendering->n_rendered = 0;
+  ctpl_environ_log_changes (env, TRUE);
+  
+  return rendering;
+}
+
+/**
+ * ctpl_rendering_ref:
+ * @rendering: A #CtplRendering
+ * 
+ * Adds a reference to a #CtplRendering.
+ * 
+ * Returns: The rendering
+ * 
+ * Since: 0.4
+ */
+CtplRendering *
+ctpl_rendering_ref (CtplRendering *rendering)
+{
+  g_atomic_int_inc (&rendering->ref_count);
+  
+  return rendering;
+}
+
+static void node_free (CtplRendering     *rendering,
+                       CtplRenderingNode *node);
+
+/**
+ * ctpl_rendering_unref:
+ * @rendering: A #CtplRendering
+ * 
+ * Removes a reference from a #CtplRendering.  When its reference count reaches
+ * 0, the rendering is freed.
+ * 
+ * Since: 0.4
+ */
+void
+ctpl_rendering_unref (CtplRendering *rendering)
+{
+  if (g_atomic_int_dec_and_test (&rendering->ref_count)) {
+    if (rendering->root) {
+      node_free (rendering, rendering->root);
+    }
+    g_hash_table_destroy (rendering->readers);
+    ctpl_arena_unref (rendering->arena);
+    ctpl_environ_log_changes (rendering->env, FALSE);
+    ctpl_environ_unref (rendering->env);
+    g_slice_free1 (sizeof *rendering, rendering);
+  }
+}
+
+
+static CtplRenderingNode *
+node_new (const CtplToken    *token,
+          CtplRenderingNode  *parent,
+          guint               index)
+{
+  CtplRenderingNode *node;
+  
+  node = g_slice_alloc (sizeof *node);
+  node->token = token;
+  node->parent = parent;
+  node->index = index;
+  node->length = 0;
+  node->dirty = FALSE;
+  node->symbols = g_ptr_array_new ();
+  node->links = g_ptr_array_new ();
+  node->volatile_link = NULL;
+  node->data = NULL;
+  node->children = NULL;
+  
+  return node;
+}
+
+/* drops the output of @node and its children, and forgets what they read */
+static void
+node_clear (CtplRendering     *rendering,
+            CtplRenderingNode *node)
+{
+  guint i;
+  
+  for (i = 0; i < node->symbols->len; i++) {
+    GQueue *readers = g_hash_table_lookup (rendering->readers,
+                                           node->symbols->pdata[i]);
+    
+    g_queue_delete_link (readers, node->links->pdata[i]);
+    if (g_queue_is_empty (readers)) {
+      g_hash_table_remove (rendering->readers, node->symbols->pdata[i]);
+    }
+  }
+  g_ptr_array_set_size (node->symbols, 0);
+  g_ptr_array_set_size (node->links, 0);
+  if (node->volatile_link) {
+    g_queue_delete_link (&rendering->volatile_nodes, node->volatile_link);
+    node->volatile_link = NULL;
+  }
+  g_free (node->data);
+  node->data = NULL;
+  if (node->children) {
+    GPtrArray *nodes = node->children;
+    
+    /* free the descendants with an explicit stack rather than recursively,
+     * so deeply nested trees don't overflow the stack */
+    node->children = NULL;
+    while (nodes->len > 0) {
+      CtplRenderingNode *child = g_ptr_array_index (nodes, nodes->len - 1);
+      
+      g_ptr_array_set_size (nodes, nodes->len - 1);
+      if (child->children) {
+        for (i = 0; i < child->children->len; i++) {
+          g_ptr_array_add (nodes, child->children->pdata[i]);
+        }
+        g_ptr_array_free (child->children, TRUE);
+        child->children = NULL;
+      }
+      node_free (rendering, child);
+    }
+    g_ptr_array_free (nodes, TRUE);
+  }
+  node->length = 0;
+}
+
+static void
+node_free (CtplRendering     *rendering,
+           CtplRenderingNode *node)
+{
+  node_clear (rendering, node);
+  g_ptr_array_free (node->symbols, TRUE);
+  g_ptr_array_free (node->links, TRUE);
+  g_slice_free1 (sizeof *node, node);
+}
+
+/* records that @node reads its symbols, and whether it is volatile because
+ * it calls one of @functions or reads a value that may change by itself */
+static void
+node_register (CtplRendering     *rendering,
+               CtplRenderingNode *node,
+               GPtrArray         *functions)
+{
+  CtplEnviron  *env = rendering->env;
+  gboolean      is_volatile = FALSE;
+  guint         i;
+  
+  for (i = 0; ! is_volatile && i < functions->len; i++) {
+    CtplEnvironFunction func;
+    gpointer            user_data;
+    
+    is_volatile = ctpl_environ_lookup_function (env, functions->pdata[i],
+                                                &func, &user_data);
+  }
+  for (i = 0; i < node->symbols->len; i++) {
+    GQueue *readers;
+    
+    if (! ctpl_environ_symbol_is_stable (env, node->symbols->pdata[i])) {
+      is_volatile = TRUE;
+    }
+    readers = g_hash_table_lookup (rendering->readers, node->symbols->pdata[i]);
+    if (! readers) {
+      readers = g_queue_new ();
+      g_hash_table_insert (rendering->readers, node->symbols->pdata[i],
+                           readers);
+    }
+    g_queue_push_tail (readers, node);
+    g_ptr_array_add (node->links, readers->tail);
+  }
+  if (is_volatile) {
+    g_queue_push_tail (&rendering->volatile_nodes, node);
+    node->volatile_link = rendering->volatile_nodes.tail;
+  }
+}
+
+/* renders a token with all its children as a single piece of output */
+static gboolean
+node_render_leaf (CtplRendering     *rendering,
+                  CtplRenderingNode *node,
+                  GError           **error)
+{
+  GOutputStream    *ostream;
+  CtplOutputStream *stream;
+  gboolean          rv;
+  
+  ostream = g_memory_output_stream_new (NULL, 0, g_realloc, g_free);
+  stream = ctpl_output_stream_new (ostream);
+  rv = ctpl_parser_parse_token (node->token, rendering->env, stream, error);
+  g_output_stream_close (ostream, NULL, NULL);
+  node->length = g_memory_output_stream_get_data_size (G_MEMORY_OUTPUT_STREAM (ostream));
+  node->data = g_memory_output_stream_steal_data (G_MEMORY_OUTPUT_STREAM (ostream));
+  ctpl_output_stream_unref (stream);
+  g_object_unref (ostream);
+  
+  return rv;
+}
+
+/*
+ * node_render_one:
+ * @rendering: A #CtplRendering
+ * @node: A #CtplRenderingNode
+ * @children: Return location for the tokens to render as the children of
+ *            @node, if it has some
+ * @error: Return location for errors, or %NULL to ignore them
+ * 
+ * Renders @node but not its children: if it has some, creates its array of
+ * children and sets @children to the tokens to render in it.  The environ
+ * must have an arena set.
+ * 
+ * Returns: %TRUE on success, %FALSE otherwise.
+ */
+static gboolean
+node_render_one (CtplRendering      *rendering,
+                 CtplRenderingNode  *node,
+                 const CtplToken   **children,
+                 GError            **error)
+{
+  gboolean    rv = TRUE;
+  GPtrArray  *functions;
+  
+  node_clear (rendering, node);
+  if (! node->token) {
+    node->children = g_ptr_array_new ();
+    *children = rendering->tree;
+    return TRUE;
+  }
+  
+  functions = g_ptr_array_new ();
+  switch (ctpl_token_get_type (node->token)) {
+    case CTPL_TOKEN_TYPE_DATA:
+      /* never changes, and is written straight from the token */
+      node->length = strlen (node->token->token.t_data);
+      break;
+    
+    case CTPL_TOKEN_TYPE_IF: {
+      const CtplTokenIf  *token = node->token->token.t_if;
+      CtplArena          *arena = ctpl_environ_get_arena (rendering->env);
+      CtplArenaMark       mark;
+      gboolean            eval;
+      
+      /* the node only depends on the condition, the taken branch is split in
+       * other nodes */
+      ctpl_token_expr_collect_dependencies (token->condition, node->symbols,
+                                            functions);
+      node_register (rendering, node, functions);
+      ctpl_arena_mark (arena, &mark);
+      rv = ctpl_eval_bool (token->condition, rendering->env, &eval, error);
+      ctpl_arena_release (arena, &mark);
+      if (rv) {
+        node->children = g_ptr_array_new ();
+        *children = eval ? token->if_children : token->else_children;
+      }
+      rendering->n_rendered++;
+      break;
+    }
+    
+    default:
+      ctpl_token_collect_dependencies (node->token, FALSE, node->symbols,
+                                       functions);
+      node_register (rendering, node, functions);
+      rv = node_render_leaf (rendering, node, error);
+      rendering->n_rendered++;
+  }
+  g_ptr_array_free (functions, TRUE);
+  
+  return rv;
+}
+
+/* a node whose children are being rendered */
+typedef struct _CtplRenderingFrame CtplRenderingFrame;
+struct _CtplRenderingFrame
+{
+  CtplRenderingNode  *node;
+  const CtplToken    *tokens; /* next tokens to render as children of @node */
+};
+
+/*
+ * node_render:
+ * @rendering: A #CtplRendering
+ * @node: A #CtplRenderingNode
+ * @error: Return location for errors, or %NULL to ignore them
+ * 
+ * (Re)renders @node, that is, computes its output, and registers what it
+ * reads.  The nodes whose children are being rendered are kept on an
+ * explicit stack, so deeply nested trees don't overflow the stack.  The
+ * environ must have an arena set.
+ * 
+ * Returns: %TRUE on success, %FALSE otherwise.
+ */
+static gboolean
+node_render (CtplRendering     *rendering,
+             CtplRenderingNode *node,
+             GError           **error)
+{
+  GArray             *stack = g_array_new (FALSE, FALSE,
+                                           sizeof (CtplRenderingFrame));
+  CtplRenderingFrame  frame;
+  gboolean            rv;
+  
+  frame.node = node;
+  rv = node_render_one (rendering, node, &frame.tokens, error);
+  if (rv && node->children) {
+    g_array_append_val (stack, frame);
+  }
+  while (rv && stack->len > 0) {
+    CtplRenderingFrame *top;
+    
+    top = &g_array_index (stack, CtplRenderingFrame, stack->len - 1);
+    if (! top->tokens) {
+      guint i;
+      
+      /* all children are rendered */
+      for (i = 0; i < top->node->children->len; i++) {
+        CtplRenderingNode *child = top->node->children->pdata[i];
+        
+        top->node->length += child->length;
+      }
+      g_array_set_size (stack, stack->len - 1);
+    } else {
+      frame.node = node_new (top->tokens, top->node,
+                             top->node->children->len);
+      g_ptr_array_add (top->node->children, frame.node);
+      top->tokens = top->tokens->next;
+      rv = node_render_one (rendering, frame.node, &frame.tokens, error);
+      if (rv && frame.node->children) {
+        g_array_append_val (stack, frame);
+      }
+    }
+  }
+  g_array_free (stack, TRUE);
+  
+  return rv;
+}
+
+/* marks @node dirty and adds it to @nodes, unless already done */
+static void
+mark_dirty (CtplRenderingNode *node,
+            GPtrArray         *nodes)
+{
+  if (! node->dirty) {
+    node->dirty = TRUE;
+    g_ptr_array_add (nodes, node);
+  }
+}
+
+static guint
+node_get_depth (const CtplRenderingNode *node)
+{
+  guint depth = 0;
+  
+  for (; node->parent; node = node->parent) {
+    depth++;
+  }
+  
+  return depth;
+}
+
+/* GCompareFunc sorting nodes in the order of the output */
+static gint
+compare_nodes (gconstpointer a,
+               gconstpointer b)
+{
+  const CtplRenderingNode  *node_a = *(CtplRenderingNode *const *) a;
+  const CtplRenderingNode  *node_b = *(CtplRenderingNode *const *) b;
+  guint                     depth_a = node_get_depth (node_a);
+  guint                     depth_b = node_get_depth (node_b);
+  gint                      shallower = 0;
+  
+  /* an ancestor comes before its children */
+  for (; depth_a > depth_b; depth_a--) {
+    node_a = node_a->parent;
+    shallower = 1;
+  }
+  for (; depth_b > depth_a; depth_b--) {
+    node_b = node_b->parent;
+    shallower = -1;
+  }
+  if (node_a == node_b) {
+    return shallower;
+  }
+  while (node_a->parent != node_b->parent) {
+    node_a = node_a->parent;
+    node_b = node_b->parent;
+  }
+  
+  return node_a->index < node_b->index ? -1 : 1;
+}
+
+/* whether an ancestor of @node is dirty, so @node will go away */
+static gboolean
+has_dirty_ancestor (const CtplRenderingNode *node)
+{
+  for (node = node->parent; node; node = node->parent) {
+    if (node->dirty) {
+      return TRUE;
+    }
+  }
+  
+  return FALSE;
+}
+
+/* renders again the nodes that read one of the symbols in @changes, or all
+ * if @all is %TRUE, and the volatile ones */
+static gboolean
+update_nodes (CtplRendering  *rendering,
+              GPtrArray      *changes,
+              gboolean        all,
+              GError        **error)
+{
+  GPtrArray  *dirty = g_ptr_array_new ();
+  GPtrArray  *nodes = g_ptr_array_new ();
+  gboolean    rv = TRUE;
+  GList      *link;
+  guint       i;
+  
+  if (all) {
+    mark_dirty (rendering->root, dirty);
+  }
+  for (i = 0; i < changes->len; i++) {
+    GQueue *readers = g_hash_table_lookup (rendering->readers,
+                                           changes->pdata[i]);
+    
+    if (readers) {
+      for (link = readers->head; link; link = link->next) {
+        mark_dirty (link->data, dirty);
+      }
+    }
+  }
+  for (link = rendering->volatile_nodes.head; link; link = link->next) {
+    mark_dirty (link->data, dirty);
+  }
+  /* children of dirty nodes are rendered with them */
+  for (i = 0; i < dirty->len; i++) {
+    if (! has_dirty_ancestor (dirty->pdata[i])) {
+      g_ptr_array_add (nodes, dirty->pdata[i]);
+    }
+  }
+  for (i = 0; i < dirty->len; i++) {
+    ((CtplRenderingNode *) dirty->pdata[i])->dirty = FALSE;
+  }
+  /* render in the order of the output as a full rendering would, in case
+   * some functions have side effects */
+  g_ptr_array_sort (nodes, compare_nodes);
+  for (i = 0; rv && i < nodes->len; i++) {
+    CtplRenderingNode  *node = nodes->pdata[i];
+    gsize               old_length = node->length;
+    CtplRenderingNode  *parent;
+    
+    rv = node_render (rendering, node, error);
+    for (parent = node->parent; parent; parent = parent->parent) {
+      parent->length = parent->length - old_length + node->length;
+    }
+  }
+  g_ptr_array_free (nodes, TRUE);
+  g_ptr_array_free (dirty, TRUE);
+  
+  return rv;
+}
+
+/**
+ * ctpl_rendering_update:
+ * @rendering: A #CtplRendering
+ * @error: Return location for errors, or %NULL to ignore them
+ * 
+ * Brings the output of a #CtplRendering up to date with its environment.  The
+ * first call renders the whole template, the next ones only the parts that
+ * may have changed since the previous call.
+ * 
+ * On failure, the output is lost and the next call renders the whole template
+ * again.
+ * 
+ * Returns: %TRUE on success, %FALSE otherwise, in which case @error shall be
+ *          set to the error that occurred.
+ * 
+ * Since: 0.4
+ */
+gboolean
+ctpl_rendering_update (CtplRendering  *rendering,
+                       GError        **error)
+{
+  CtplArena  *env_arena = ctpl_environ_get_arena (rendering->env);
+  GPtrArray  *changes = g_ptr_array_new ();
+  gboolean    all;
+  gboolean    rv;
+  
+  /* the rendering's own changes are not logged, but the ones of the host code
+   * it calls are, and are seen by the next update */
+  rendering->serial = ctpl_environ_get_changes (rendering->env,
+                                                rendering->serial, changes,
+                                                &all);
+  ctpl_environ_set_arena (rendering->env,
+                          env_arena ? env_arena : rendering->arena);
+  ctpl_environ_begin_render (rendering->env);
+  ctpl_environ_begin_step (rendering->env);
+  rendering->n_rendered = 0;
+  if (rendering->root) {
+    rv = update_nodes (rendering, changes, all, error);
+  } else {
+    rendering->root = node_new (NULL, NULL, 0);
+    rv = node_render (rendering, rendering->root, error);
+  }
+  if (! rv) {
+    node_free (rendering, rendering->root);
+    rendering->root = NULL;
+  }
+  ctpl_environ_end_step (rendering->env);
+  ctpl_environ_set_arena (rendering->env, env_arena);
+  ctpl_environ_end_render (rendering->env);
+  g_ptr_array_free (changes, TRUE);
+  
+  return rv;
+}
+
+/* writes the output of @node, walking its descendants in the order of the
+ * output with their parent links rather than recursively */
+static gboolean
+node_write (const CtplRenderingNode  *node,
+            CtplOutputStream         *output,
+            GError                  **error)
+{
+  const CtplRenderingNode  *root = node;
+  gboolean                  rv = TRUE;
+  
+  while (rv && node) {
+    if (node->children && node->children->len > 0) {
+      node = node->children->pdata[0];
+    } else {
+      if (! node->children && node->length > 0) {
+        const gchar *data = node->data ? node->data : node->token->token.t_data;
+        
+        rv = ctpl_output_stream_write (output, data, (gssize) node->length,
+                                       error);
+      }
+      /* go to the next sibling of the node or of its nearest ancestor having
+       * one */
+      while (node != root &&
+             node->index + 1 == node->parent->children->len) {
+        node = node->parent;
+      }
+      node = (node == root) ? NULL
+                            : node->parent->children->pdata[node->index + 1];
+    }
+  }
+  
+  return rv;
+}
+
+/**
+ * ctpl_rendering_write:
+ * @rendering: A #CtplRendering
+ * @output: A #CtplOutputStream
+ * @error: Return location for errors, or %NULL to ignore them
+ * 
+ * Writes the output of a #CtplRendering as of the last successful call to
+ * ctpl_rendering_update().  Nothing is written if it wasn't rendered.
+ * 
+ * Returns: %TRUE on success, %FALSE otherwise.
+ * 
+ * Since: 0.4
+ */
+gboolean
+ctpl_rendering_write (const CtplRendering  *rendering,
+                      CtplOutputStream     *output,
+                      GError              **error)
+{
+  return ! rendering->root || node_write (rendering->root, output, error);
+}
+
+/**
+ * ctpl_rendering_get_length:
+ * @rendering: A #CtplRendering
+ * 
+ * Gets the length of the output of a #CtplRendering, see
+ * ctpl_rendering_write().
+ * 
+ * Returns: The length of the output, in bytes.
+ * 
+ * Since: 0.4
+ */
+gsize
+ctpl_rendering_get_length (const CtplRendering *rendering)
+{
+  return rendering->root ? rendering->root->length : 0;
+}
+
+/**
+ * ctpl_rendering_get_n_rendered:
+ * @rendering: A #CtplRendering
+ * 
+ * Gets how many fragments the last call to ctpl_rendering_update() rendered.
+ * This tells how much work an update needed.
+ * 
+ * Returns: The number of fragments rendered.
+ * 
+ * Since: 0.4
+ */
+guint
+ctpl_rendering_get_n_rendered (const CtplRendering *rendering)
+{
+  return rendering->n_rendered;
+}
@@ -0,0 +1,52 @@
+/* 
+ * 
+ * Copyright (C) 2009-2011 Colomban Wendling <ban@herbesfolles.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ */
+
+#if ! defined (H_CTPL_H_INSIDE) && ! defined (CTPL_COMPILATION)
+# error "Only <ctpl/ctpl.h> can be included directly."
+#endif
+
+#ifndef H_CTPL_RENDERING_H
+#define H_CTPL_RENDERING_H
+
+#include <glib.h>
+#include "ctpl-token.h"
+#include "ctpl-environ.h"
+#include "ctpl-output-stream.h"
+
+G_BEGIN_DECLS
+
+
+typedef struct _CtplRendering CtplRendering;
+
+CtplRendering  *ctpl_rendering_new            (const CtplToken *tree,
+                                               CtplEnviron     *env);
+CtplRendering  *ctpl_rendering_ref            (CtplRendering *rendering);
+void            ctpl_rendering_unref          (CtplRendering *rendering);
+gboolean        ctpl_rendering_update         (CtplRendering  *rendering,
+                                               GError        **error);
+gboolean        ctpl_rendering_write          (const CtplRendering  *rendering,
+                                               CtplOutputStream     *output,
+                                               GError              **error);
+gsize           ctpl_rendering_get_length     (const CtplRendering *rendering);
+guint           ctpl_rendering_get_n_rendered (const CtplRendering *rendering);
+
+
+G_END_DECLS
+
+#endif /* guard */
@@ -55,18 +55,6 @@
  */
 
 
-/*
- * CtplStack:
- * 
- * Opaque object representing a stack.
- */
-struct _CtplStack
-{
-  /*<private>*/
-  GSList *head;   /* head of the elements list */
-};
-
-
 /*
  * ctpl_stack_new:
  * 
@@ -80,7 +68,7 @@ ctpl_stack_new (void)
   CtplStack *stack;
   
   stack = g_slice_alloc (sizeof *stack);
-  stack->head = NULL;
+  ctpl_stack_init (stack);
   
   return stack;
 }
@@ -96,16 +84,43 @@ void
 ctpl_stack_free (CtplStack *stack,
                  GFreeFunc  free_func)
 {
-  while (stack->head) {
-    GSList *next = stack->head->next;
+  ctpl_stack_clear (stack, free_func);
+  g_slice_free1 (sizeof *stack, stack);
+}
+
+/*
+ * ctpl_stack_init:
+ * @stack: An uninitialized #CtplStack
+ * 
+ * Initializes a #CtplStack embedded in another structure.  Such a stack is
+ * released with ctpl_stack_clear() rather than ctpl_stack_free().
+ */
+void
+ctpl_stack_init (CtplStack *stack)
+{
+  stack->top = NULL;
+  stack->below = NULL;
+  stack->empty = TRUE;
+}
+
+/*
+ * ctpl_stack_clear:
+ * @stack: A #CtplStack
+ * @free_func: A function used to free stack's elements, or %NULL
+ * 
+ * Removes all the elements of a #CtplStack, leaving it empty.
+ */
+void
+ctpl_stack_clear (CtplStack *stack,
+                  GFreeFunc  free_func)
+{
+  while (! stack->empty) {
+    gpointer data = ctpl_stack_pop (stack);
     
     if (free_func) {
-      free_func (stack->head->data);
+      free_func (data);
     }
-    g_slist_free_1 (stack->head);
-    stack->head = next;
   }
-  g_slice_free1 (sizeof *stack, stack);
 }
 
 /*
@@ -119,7 +134,13 @@ void
 ctpl_stack_push (CtplStack *stack,
                  gpointer   data)
 {
-  stack->head = g_slist_prepend (stack->head, data);
+  /* the top is kept out of the list, so stacks holding a single element, like
+   * most symbols, need no list node */
+  if (! stack->empty) {
+    stack->below = g_slist_prepend (stack->below, stack->top);
+  }
+  stack->top = data;
+  stack->empty = FALSE;
 }
 
 /*
@@ -137,14 +158,17 @@ ctpl_stack_push (CtplStack *stack,
 gpointer
 ctpl_stack_pop (CtplStack *stack)
 {
-  gpointer data = NULL;
+  gpointer data = stack->top;
   
-  if (stack->head) {
-    GSList *next = stack->head->next;
+  if (stack->below) {
+    GSList *next = stack->below->next;
     
-    data = stack->head->data;
-    g_slist_free_1 (stack->head);
-    stack->head = next;
+    stack->top = stack->below->data;
+    g_slist_free_1 (stack->below);
+    stack->below = next;
+  } else {
+    stack->top = NULL;
+    stack->empty = TRUE;
   }
   
   return data;
@@ -163,7 +187,7 @@ ctpl_stack_pop (CtplStack *stack)
 gpointer
 ctpl_stack_peek (const CtplStack *stack)
 {
-  return (stack->head) ? stack->head->data : NULL;
+  return stack->top;
 }
 
 /*
@@ -177,5 +201,24 @@ ctpl_stack_peek (const CtplStack *stack)
 gboolean
 ctpl_stack_is_empty (const CtplStack *stack)
 {
-  return stack->head == NULL;
+  return stack->empty;
+}
+
+/*
+ * ctpl_stack_foreach:
+ * @stack: A #CtplStack
+ * @func: A function to call on each element of @stack
+ * @user_data: User data to pass to @func
+ * 
+ * Calls @func on each element of @stack, from the top to the bottom.
+ */
+void
+ctpl_stack_foreach (const CtplStack *stack,
+                    GFunc            func,
+                    gpointer         user_data)
+{
+  if (! stack->empty) {
+    func (stack->top, user_data);
+    g_slist_foreach (stack->below, func, user_data);
+  }
 }
@@ -27,12 +27,31 @@ G_BEGIN_DECLS
 
 typedef struct _CtplStack CtplStack;
 
+/* Public in order to be able to embed stacks in other structures. */
+/*
+ * CtplStack:
+ * 
+ * Represents a stack.
+ */
+struct _CtplStack
+{
+  /*<private>*/
+  gpointer  top;    /* topmost element */
+  GSList   *below;  /* elements under @top, from the top */
+  gboolean  empty;  /* whether there is no element, not even @top */
+};
+
 
 G_GNUC_INTERNAL
 CtplStack  *ctpl_stack_new      (void);
 G_GNUC_INTERNAL
 void        ctpl_stack_free     (CtplStack *stack,
                                  GFreeFunc  free_func);
+G_GNUC_INTERNAL
+void        ctpl_stack_init     (CtplStack *stack);
+G_GNUC_INTERNAL
+void        ctpl_stack_clear    (CtplStack *stack,
+                                 GFreeFunc  free_func);
 
 G_GNUC_INTERNAL
 void        ctpl_stack_push     (CtplStack *stack,
@@ -43,6 +62,10 @@ G_GNUC_INTERNAL
 gpointer    ctpl_stack_peek     (const CtplStack *stack);
 G_GNUC_INTERNAL
 gboolean    ctpl_stack_is_empty (const CtplStack *stack);
+G_GNUC_INTERNAL
+void        ctpl_stack_foreach  (const CtplStack *stack,
+                                 GFunc            func,
+                                 gpointer         user_data);
 
 
 G_END_DECLS
@@ -43,8 +43,8 @@ G_BEGIN_DECLS
  * To dump a #CtplToken, use ctpl_token_dump().
  * 
  * A #CtplTokenExpr is created with ctpl_token_expr_new_operator(), 
- * ctpl_token_expr_new_value() or ctpl_token_expr_new_symbol(), and freed with
- * ctpl_token_expr_free().
+ * ctpl_token_expr_new_value(), ctpl_token_expr_new_symbol() or
+ * ctpl_token_expr_new_function(), and freed with ctpl_token_expr_free().
  * To dump a #CtplTokenExpr, use ctpl_token_expr_dump().
  */
 
@@ -69,7 +69,8 @@ G_BEGIN_DECLS
  * 
  * See also ctpl_operator_to_string() and ctpl_operator_from_string().
  */
-/* keep order as needed by operators_array in lexer-expr.c */
+/* keep order as needed by operators_array in lexer-expr.c and
+ * operator_kernels in eval.c */
 typedef enum {
   CTPL_OPERATOR_AND,
   CTPL_OPERATOR_DIV,
@@ -111,6 +112,7 @@ typedef enum _CtplTokenType
  *            (<link linkend="CtplOperator"><code>CTPL_OPERATOR_*</code></link>)
  * @CTPL_TOKEN_EXPR_TYPE_VALUE:     An inline value value
  * @CTPL_TOKEN_EXPR_TYPE_SYMBOL:    A symbol (a name to be found in the environ)
+ * @CTPL_TOKEN_EXPR_TYPE_FUNCTION:  A function call
  * 
  * Possibles types of an expression token.
  */
@@ -118,12 +120,14 @@ typedef enum _CtplTokenExprType
 {
   CTPL_TOKEN_EXPR_TYPE_OPERATOR,
   CTPL_TOKEN_EXPR_TYPE_VALUE,
-  CTPL_TOKEN_EXPR_TYPE_SYMBOL
+  CTPL_TOKEN_EXPR_TYPE_SYMBOL,
+  CTPL_TOKEN_EXPR_TYPE_FUNCTION
 } CtplTokenExprType;
 
 typedef struct _CtplTokenFor          CtplTokenFor;
 typedef struct _CtplTokenIf           CtplTokenIf;
 typedef struct _CtplTokenExprOperator CtplTokenExprOperator;
+typedef struct _CtplTokenExprFunction CtplTokenExprFunction;
 
 /*
  * CtplTokenFor:
@@ -170,11 +174,25 @@ struct _CtplTokenExprOperator
   CtplTokenExpr  *roperand;
 };
 
+/*
+ * CtplTokenExprFunction:
+ * @name: The name of the function
+ * @args: (element-type CtplTokenExpr): The arguments of the call, in order
+ * 
+ * Represents a function call token in an expression.
+ */
+struct _CtplTokenExprFunction
+{
+  gchar  *name;
+  GSList *args;
+};
+
 /*
  * CtplTokenExprValue:
  * @t_operator: The value of an operator token
  * @t_value: The value of an inline value token
  * @t_symbol: The name of a symbol token
+ * @t_function: The value of a function call token
  * 
  * Represents the possible values of an expression token (see #CtplTokenExpr).
  */
@@ -183,6 +201,7 @@ union _CtplTokenExprValue
   CtplTokenExprOperator  *t_operator;
   CtplValue               t_value;
   gchar                  *t_symbol;
+  CtplTokenExprFunction  *t_function;
 };
 typedef union _CtplTokenExprValue CtplTokenExprValue;
 
@@ -260,6 +279,10 @@ CtplTokenExpr *ctpl_token_expr_new_value    (const CtplValue *value);
 G_GNUC_INTERNAL
 CtplTokenExpr *ctpl_token_expr_new_symbol   (const gchar *symbol,
                                              gssize       len);
+G_GNUC_INTERNAL
+CtplTokenExpr *ctpl_token_expr_new_function (const gchar *name,
+                                             gssize       len,
+                                             GSList      *args);
 /* ctpl_token_free(): see token.h */
 G_GNUC_INTERNAL
 void          ctpl_token_expr_free_full     (CtplTokenExpr *token,
@@ -272,6 +295,17 @@ G_GNUC_INTERNAL
 void          ctpl_token_prepend            (CtplToken *token,
                                              CtplToken *brother);
 G_GNUC_INTERNAL
+void          ctpl_token_collect_dependencies (const CtplToken *token,
+                                               gboolean         siblings,
+                                               GPtrArray       *symbols,
+                                               GPtrArray       *functions);
+G_GNUC_INTERNAL
+void          ctpl_token_expr_collect_dependencies (const CtplTokenExpr *expr,
+                                                    GPtrArray           *symbols,
+                                                    GPtrArray           *functions);
+G_GNUC_INTERNAL
+gsize         ctpl_token_get_data_size      (const CtplToken *tree);
+G_GNUC_INTERNAL
 void          ctpl_token_dump               (const CtplToken *token);
 G_GNUC_INTERNAL
 void          ctpl_token_expr_dump          (const CtplTokenExpr *token);
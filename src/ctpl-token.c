@@ -269,6 +269,36 @@ ctpl_token_expr_new_symbol (const char *symbol,
   return token;
 }
 
+/*
+ * ctpl_token_expr_new_function:
+ * @name: String holding the function name
+ * @len: Length to read from @name or -1 to read the whole string.
+ * @args: (element-type CtplTokenExpr) (transfer full): The arguments of the
+ *        call
+ * 
+ * Creates a new #CtplTokenExpr holding a function call.
+ * 
+ * Returns: A new #CtplTokenExpr that should be freed with
+ *          ctpl_token_expr_free() when no longer needed.
+ */
+CtplTokenExpr *
+ctpl_token_expr_new_function (const gchar *name,
+                              gssize       len,
+                              GSList      *args)
+{
+  CtplTokenExpr *token;
+  
+  token = ctpl_token_expr_new ();
+  if (token) {
+    token->type = CTPL_TOKEN_EXPR_TYPE_FUNCTION;
+    token->token.t_function = g_slice_alloc (sizeof *token->token.t_function);
+    token->token.t_function->name = g_strndup (name, GET_LEN (name, len));
+    token->token.t_function->args = args;
+  }
+  
+  return token;
+}
+
 
 /*
  * ctpl_token_expr_free_full:
@@ -299,6 +329,15 @@ ctpl_token_expr_free_full (CtplTokenExpr *token,
       case CTPL_TOKEN_EXPR_TYPE_VALUE:
         ctpl_value_free_value (&token->token.t_value);
         break;
+      
+      case CTPL_TOKEN_EXPR_TYPE_FUNCTION:
+        /* like indexes, arguments are never shared */
+        g_slist_foreach (token->token.t_function->args,
+                         (GFunc) ctpl_token_expr_free, NULL);
+        g_slist_free (token->token.t_function->args);
+        g_free (token->token.t_function->name);
+        g_slice_free1 (sizeof *token->token.t_function, token->token.t_function);
+        break;
     }
     while (token->indexes) {
       GSList *next = token->indexes->next;
@@ -323,6 +362,22 @@ ctpl_token_expr_free (CtplTokenExpr *token)
   ctpl_token_expr_free_full (token, TRUE);
 }
 
+/* links @tokens before @next, returns the first of them */
+static CtplToken *
+token_chain (CtplToken *tokens,
+             CtplToken *next)
+{
+  CtplToken *last;
+  
+  if (! tokens) {
+    return next;
+  }
+  for (last = tokens; last->next; last = last->next);
+  last->next = next;
+  
+  return tokens;
+}
+
 /**
  * ctpl_token_free:
  * @token: A #CtplToken to free
@@ -333,8 +388,10 @@ void
 ctpl_token_free (CtplToken *token)
 {
   while (token) {
-    CtplToken *next;
+    CtplToken *next = token->next;
     
+    /* the children of the blocks are freed with the siblings rather than
+     * recursively, so deeply nested trees don't overflow the stack */
     switch (token->type) {
       case CTPL_TOKEN_TYPE_DATA:
         g_free (token->token.t_data);
@@ -348,7 +405,7 @@ ctpl_token_free (CtplToken *token)
         ctpl_token_expr_free (token->token.t_for->array);
         g_free (token->token.t_for->iter);
         
-        ctpl_token_free (token->token.t_for->children);
+        next = token_chain (token->token.t_for->children, next);
         
         g_slice_free1 (sizeof *token->token.t_for, token->token.t_for);
         break;
@@ -356,18 +413,301 @@ ctpl_token_free (CtplToken *token)
       case CTPL_TOKEN_TYPE_IF:
         ctpl_token_expr_free (token->token.t_if->condition);
         
-        ctpl_token_free (token->token.t_if->if_children);
-        ctpl_token_free (token->token.t_if->else_children);
+        next = token_chain (token->token.t_if->else_children, next);
+        next = token_chain (token->token.t_if->if_children, next);
         
         g_slice_free1 (sizeof *token->token.t_if, token->token.t_if);
         break;
     }
-    next = token->next;
     g_slice_free1 (sizeof *token, token);
     token = next;
   }
 }
 
+/* adds @name to @names unless it's already there */
+static void
+add_name (GPtrArray   *names,
+          const gchar *name)
+{
+  guint i;
+  
+  for (i = 0; i < names->len; i++) {
+    if (strcmp (names->pdata[i], name) == 0) {
+      return;
+    }
+  }
+  g_ptr_array_add (names, (gpointer) name);
+}
+
+/* checks whether @name is the iterator of an enclosing for loop */
+static gboolean
+is_bound (const GSList *bound,
+          const gchar  *name)
+{
+  for (; bound; bound = bound->next) {
+    if (strcmp (bound->data, name) == 0) {
+      return TRUE;
+    }
+  }
+  
+  return FALSE;
+}
+
+static void
+expr_collect_dependencies (const CtplTokenExpr *expr,
+                           const GSList        *bound,
+                           GPtrArray           *symbols,
+                           GPtrArray           *functions)
+{
+  const GSList *item;
+  
+  switch (expr->type) {
+    case CTPL_TOKEN_EXPR_TYPE_OPERATOR:
+      expr_collect_dependencies (expr->token.t_operator->loperand, bound,
+                                 symbols, functions);
+      expr_collect_dependencies (expr->token.t_operator->roperand, bound,
+                                 symbols, functions);
+      break;
+    
+    case CTPL_TOKEN_EXPR_TYPE_VALUE:
+      break;
+    
+    case CTPL_TOKEN_EXPR_TYPE_SYMBOL:
+      if (! is_bound (bound, expr->token.t_symbol)) {
+        add_name (symbols, expr->token.t_symbol);
+      }
+      break;
+    
+    case CTPL_TOKEN_EXPR_TYPE_FUNCTION:
+      if (functions) {
+        add_name (functions, expr->token.t_function->name);
+      }
+      for (item = expr->token.t_function->args; item; item = item->next) {
+        expr_collect_dependencies (item->data, bound, symbols, functions);
+      }
+      break;
+  }
+  for (item = expr->indexes; item; item = item->next) {
+    expr_collect_dependencies (item->data, bound, symbols, functions);
+  }
+}
+
+/* tokens whose dependencies are being collected */
+typedef struct _DependenciesFrame DependenciesFrame;
+struct _DependenciesFrame
+{
+  const CtplToken  *token;      /* next token to walk, or %NULL */
+  gboolean          siblings;   /* whether to walk the siblings of @token */
+  GSList           *bound;      /* iterators of the enclosing loops */
+  gboolean          owns_bound; /* whether the first link of @bound is the
+                                 * frame's */
+};
+
+static void
+push_dependencies_frame (GArray          *stack,
+                         const CtplToken *token,
+                         gboolean         siblings,
+                         GSList          *bound,
+                         gboolean         owns_bound)
+{
+  DependenciesFrame frame;
+  
+  frame.token = token;
+  frame.siblings = siblings;
+  frame.bound = bound;
+  frame.owns_bound = owns_bound;
+  g_array_append_val (stack, frame);
+}
+
+/* walks the blocks with an explicit stack rather than recursively, so deeply
+ * nested trees don't overflow the stack */
+static void
+token_collect_dependencies (const CtplToken *token,
+                            gboolean         siblings,
+                            GPtrArray       *symbols,
+                            GPtrArray       *functions)
+{
+  GArray *stack = g_array_new (FALSE, FALSE, sizeof (DependenciesFrame));
+  
+  push_dependencies_frame (stack, token, siblings, NULL, FALSE);
+  while (stack->len > 0) {
+    DependenciesFrame  *frame;
+    GSList             *bound;
+    
+    frame = &g_array_index (stack, DependenciesFrame, stack->len - 1);
+    token = frame->token;
+    bound = frame->bound;
+    if (! token) {
+      if (frame->owns_bound) {
+        g_slist_free_1 (bound);
+      }
+      g_array_set_size (stack, stack->len - 1);
+    } else {
+      frame->token = frame->siblings ? token->next : NULL;
+      /* pushing frames invalidates @frame */
+      switch (token->type) {
+        case CTPL_TOKEN_TYPE_DATA:
+          break;
+        
+        case CTPL_TOKEN_TYPE_EXPR:
+          expr_collect_dependencies (token->token.t_expr, bound,
+                                     symbols, functions);
+          break;
+        
+        case CTPL_TOKEN_TYPE_FOR:
+          /* the array is evaluated before the iterator is bound */
+          expr_collect_dependencies (token->token.t_for->array, bound,
+                                     symbols, functions);
+          push_dependencies_frame (stack, token->token.t_for->children, TRUE,
+                                   g_slist_prepend (bound,
+                                                    token->token.t_for->iter),
+                                   TRUE);
+          break;
+        
+        case CTPL_TOKEN_TYPE_IF:
+          expr_collect_dependencies (token->token.t_if->condition, bound,
+                                     symbols, functions);
+          /* the last pushed is walked first */
+          push_dependencies_frame (stack, token->token.t_if->else_children,
+                                   TRUE, bound, FALSE);
+          push_dependencies_frame (stack, token->token.t_if->if_children,
+                                   TRUE, bound, FALSE);
+          break;
+      }
+    }
+  }
+  g_array_free (stack, TRUE);
+}
+
+/*
+ * ctpl_token_collect_dependencies:
+ * @token: A #CtplToken
+ * @siblings: Whether to also walk the tokens following @token
+ * @symbols: (element-type utf8): Array where add the symbols @token reads
+ * @functions: (element-type utf8) (allow-none): Array where add the functions
+ *             @token calls, or %NULL
+ * 
+ * Adds the names of the symbols a token reads from its environment to
+ * @symbols, and the names of the functions it calls to @functions, each only
+ * once and in the order of their first use.  The iterators of the for loops
+ * are not counted inside their loops.
+ * The names are owned by @token.
+ */
+void
+ctpl_token_collect_dependencies (const CtplToken *token,
+                                 gboolean         siblings,
+                                 GPtrArray       *symbols,
+                                 GPtrArray       *functions)
+{
+  token_collect_dependencies (token, siblings, symbols, functions);
+}
+
+/*
+ * ctpl_token_expr_collect_dependencies:
+ * @expr: A #CtplTokenExpr
+ * @symbols: (element-type utf8): Array where add the symbols @expr reads
+ * @functions: (element-type utf8) (allow-none): Array where add the functions
+ *             @expr calls, or %NULL
+ * 
+ * Like ctpl_token_collect_dependencies(), but for an expression.
+ */
+void
+ctpl_token_expr_collect_dependencies (const CtplTokenExpr *expr,
+                                      GPtrArray           *symbols,
+                                      GPtrArray           *functions)
+{
+  expr_collect_dependencies (expr, NULL, symbols, functions);
+}
+
+/* copies the names in @names to a new string vector */
+static gchar **
+names_to_strv (GPtrArray *names)
+{
+  gchar **strv = g_new (gchar *, names->len + 1);
+  guint   i;
+  
+  for (i = 0; i < names->len; i++) {
+    strv[i] = g_strdup (names->pdata[i]);
+  }
+  strv[i] = NULL;
+  
+  return strv;
+}
+
+/**
+ * ctpl_token_get_dependencies:
+ * @tree: A #CtplToken
+ * @functions: (out) (allow-none): Return location for the names of the
+ *             functions @tree calls, or %NULL
+ * 
+ * Lists the symbols a template reads from its environment, which is, the
+ * symbols it uses but the iterators of its <code>for</code> loops inside the
+ * loops.  This can be used to know whether the output of a template may change
+ * when some symbols change: it only depends on these symbols and on the
+ * functions it calls.
+ * 
+ * Returns: A %NULL-terminated array of symbol names, in the order of their
+ *          first use.  Free with g_strfreev().
+ * 
+ * Since: 0.4
+ */
+gchar **
+ctpl_token_get_dependencies (const CtplToken  *tree,
+                             gchar          ***functions)
+{
+  GPtrArray  *symbols = g_ptr_array_new ();
+  GPtrArray  *function_names = g_ptr_array_new ();
+  gchar     **strv;
+  
+  ctpl_token_collect_dependencies (tree, TRUE, symbols, function_names);
+  strv = names_to_strv (symbols);
+  if (functions) {
+    *functions = names_to_strv (function_names);
+  }
+  g_ptr_array_free (function_names, TRUE);
+  g_ptr_array_free (symbols, TRUE);
+  
+  return strv;
+}
+
+/*
+ * ctpl_token_get_data_size:
+ * @tree: A #CtplToken
+ * 
+ * Computes the size of the data of a token tree, which is, of everything but
+ * its statements.  The data in loops and in both branches of if statements is
+ * counted once.
+ * 
+ * Returns: The size of the data of @tree, in bytes
+ */
+gsize
+ctpl_token_get_data_size (const CtplToken *tree)
+{
+  gsize size = 0;
+  
+  for (; tree; tree = tree->next) {
+    switch (tree->type) {
+      case CTPL_TOKEN_TYPE_DATA:
+        size += strlen (tree->token.t_data);
+        break;
+      
+      case CTPL_TOKEN_TYPE_EXPR:
+        break;
+      
+      case CTPL_TOKEN_TYPE_FOR:
+        size += ctpl_token_get_data_size (tree->token.t_for->children);
+        break;
+      
+      case CTPL_TOKEN_TYPE_IF:
+        size += ctpl_token_get_data_size (tree->token.t_if->if_children);
+        size += ctpl_token_get_data_size (tree->token.t_if->else_children);
+        break;
+    }
+  }
+  
+  return size;
+}
+
 /*
  * ctpl_token_append:
  * @token: A #CtplToken
@@ -451,6 +791,16 @@ ctpl_token_expr_dump_internal (const CtplTokenExpr *expr)
       case CTPL_TOKEN_EXPR_TYPE_SYMBOL:
         g_print ("%s", expr->token.t_symbol);
         break;
+      
+      case CTPL_TOKEN_EXPR_TYPE_FUNCTION: {
+        const GSList *arg;
+        
+        g_print ("%s", expr->token.t_function->name);
+        for (arg = expr->token.t_function->args; arg; arg = arg->next) {
+          ctpl_token_expr_dump_internal (arg->data);
+        }
+        break;
+      }
     }
   }
   g_print (")");
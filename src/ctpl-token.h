@@ -45,6 +45,8 @@ typedef struct _CtplTokenExpr         CtplTokenExpr;
 
 void          ctpl_token_free               (CtplToken *token);
 void          ctpl_token_expr_free          (CtplTokenExpr *token);
+gchar       **ctpl_token_get_dependencies   (const CtplToken  *tree,
+                                             gchar          ***functions);
 
 
 G_END_DECLS
@@ -0,0 +1,70 @@
+/* 
+ * 
+ * Copyright (C) 2009-2011 Colomban Wendling <ban@herbesfolles.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ */
+
+#ifndef H_CTPL_VALUE_PRIVATE_H
+#define H_CTPL_VALUE_PRIVATE_H
+
+#include <glib.h>
+#include "ctpl-value.h"
+#include "ctpl-arena.h"
+
+G_BEGIN_DECLS
+
+
+G_GNUC_INTERNAL
+CtplValue    *ctpl_value_new_in_arena         (CtplArena *arena);
+G_GNUC_INTERNAL
+gboolean      ctpl_value_is_in_arena          (const CtplValue *value);
+G_GNUC_INTERNAL
+void          ctpl_value_take_string          (CtplValue *value,
+                                               gchar     *val);
+G_GNUC_INTERNAL
+void          ctpl_value_borrow_string        (CtplValue      *value,
+                                               const gchar    *val,
+                                               gpointer        owner,
+                                               GDestroyNotify  release);
+G_GNUC_INTERNAL
+gchar        *ctpl_value_alloc_string         (CtplValue *value,
+                                               CtplArena *arena,
+                                               gsize      length);
+G_GNUC_INTERNAL
+gchar        *ctpl_value_alloc_shared_string  (CtplValue *value,
+                                               CtplArena *arena,
+                                               gsize      length);
+G_GNUC_INTERNAL
+void          ctpl_value_take_array           (CtplValue *value,
+                                               GSList    *values);
+G_GNUC_INTERNAL
+void          ctpl_value_take_arena_array     (CtplValue *value,
+                                               GSList    *values);
+G_GNUC_INTERNAL
+gboolean      ctpl_value_get_int_view         (const CtplValue *value,
+                                               glong           *v);
+G_GNUC_INTERNAL
+gboolean      ctpl_value_get_float_view       (const CtplValue *value,
+                                               gdouble         *v);
+G_GNUC_INTERNAL
+gboolean      ctpl_value_iterator_is_empty    (const CtplValue *value);
+G_GNUC_INTERNAL
+guint64       ctpl_value_hash64               (const CtplValue *value);
+
+
+G_END_DECLS
+
+#endif /* guard */
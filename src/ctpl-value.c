@@ -18,9 +18,13 @@
  */
 
 #include "ctpl-value.h"
+#include "ctpl-value-private.h"
 #include "ctpl-mathutils.h"
+#include "ctpl-arena.h"
+#include "ctpl-arena-private.h"
 #include <glib.h>
 #include <stdarg.h>
+#include <string.h>
 #include "ctpl-i18n.h"
 
 
@@ -88,6 +92,189 @@ static void   ctpl_value_set_array_internal   (CtplValue     *value,
                                                const GSList  *values);
 
 
+/* the host iterator held by a %CTPL_VTYPE_ITERATOR value, shared between
+ * copies of the value */
+struct _CtplValueIterator
+{
+  gint                    ref_count;
+  CtplValueIterNextFunc   next;
+  CtplValueIterResetFunc  reset;
+  gpointer                user_data;
+  GDestroyNotify          destroy;
+  GSList                 *pending;  /* items read ahead, returned by the next
+                                     * calls to @next before its own items */
+};
+
+/* the string held by a %CTPL_VTYPE_STRING value, shared between copies of the
+ * value, with its numeric interpretations computed on demand.  Values may be
+ * read by several threads at once, so an interpretation is stored before its
+ * flags are atomically set, see string_add_views() */
+struct _CtplValueString
+{
+  gint            ref_count;
+  guint           views;    /* the STRING_VIEW_* flags */
+  glong           v_int;
+  gdouble         v_float;
+  gchar          *str;
+  gboolean        in_arena; /* allocated in a CtplArena, not shared nor
+                             * freed */
+  gpointer        owner;    /* what @str is borrowed from, or %NULL if @str
+                             * is owned.  If @str follows the structure, they
+                             * both live in @owner */
+  GDestroyNotify  release;  /* releases @owner */
+};
+
+enum {
+  STRING_VIEW_INT_CACHED    = 1 << 0, /* v_int is computed */
+  STRING_VIEW_INT_VALID     = 1 << 1, /* the string is an integer */
+  STRING_VIEW_FLOAT_CACHED  = 1 << 2, /* v_float is computed */
+  STRING_VIEW_FLOAT_VALID   = 1 << 3  /* the string is a floating point number */
+};
+
+/* flags kept in the type of a value, besides its #CtplValueType */
+enum {
+  VALUE_IN_ARENA        = 1 << 16,  /* the value lives in a CtplArena, see
+                                     * ctpl_value_new_in_arena() */
+  VALUE_ARRAY_IN_ARENA  = 1 << 17   /* the list of the array lives in a
+                                     * CtplArena, see
+                                     * ctpl_value_take_arena_array() */
+};
+
+#define VALUE_FLAGS       (VALUE_IN_ARENA | VALUE_ARRAY_IN_ARENA)
+/* the #CtplValueType held by @value */
+#define VALUE_TYPE(value) ((value)->type & ~VALUE_FLAGS)
+
+/* atomically adds the STRING_VIEW_* flags @views to the flags of @string */
+static void
+string_add_views (struct _CtplValueString *string,
+                  guint                    views)
+{
+  #if GLIB_CHECK_VERSION (2, 30, 0)
+  g_atomic_int_or (&string->views, views);
+  #else
+  gint old;
+  
+  do {
+    old = g_atomic_int_get ((gint *) &string->views);
+  } while (! g_atomic_int_compare_and_exchange ((gint *) &string->views,
+                                                old, old | (gint) views));
+  #endif
+}
+
+/* creates a string, taking ownership of @str */
+static struct _CtplValueString *
+ctpl_value_string_new_take (gchar *str)
+{
+  struct _CtplValueString *string;
+  
+  string = g_slice_alloc (sizeof *string);
+  string->ref_count = 1;
+  string->views = 0;
+  string->v_int = 0;
+  string->v_float = 0.0;
+  string->str = str;
+  string->in_arena = FALSE;
+  string->owner = NULL;
+  
+  return string;
+}
+
+/* creates a string holding a copy of the @length first bytes of @str, in a
+ * single allocation */
+static struct _CtplValueString *
+ctpl_value_string_new (const gchar *str,
+                       gsize        length)
+{
+  struct _CtplValueString *string;
+  
+  string = g_malloc (sizeof *string + length + 1);
+  string->ref_count = 1;
+  string->views = 0;
+  string->v_int = 0;
+  string->v_float = 0.0;
+  string->str = (gchar *) (string + 1);
+  string->in_arena = FALSE;
+  string->owner = NULL;
+  if (str) {
+    memcpy (string->str, str, length);
+  }
+  string->str[length] = 0;
+  
+  return string;
+}
+
+static struct _CtplValueString *
+ctpl_value_string_ref (struct _CtplValueString *string)
+{
+  g_atomic_int_inc (&string->ref_count);
+  
+  return string;
+}
+
+static void
+ctpl_value_string_unref (struct _CtplValueString *string)
+{
+  if (! string->in_arena && g_atomic_int_dec_and_test (&string->ref_count)) {
+    if (string->owner) {
+      gpointer        owner = string->owner;
+      GDestroyNotify  release = string->release;
+      
+      /* from ctpl_value_borrow_string(), or from
+       * ctpl_value_alloc_shared_string() if it lives in @owner */
+      if (string->str != (gchar *) (string + 1)) {
+        g_slice_free1 (sizeof *string, string);
+      }
+      release (owner);
+    } else if (string->str == (gchar *) (string + 1)) {
+      /* from ctpl_value_string_new() */
+      g_free (string);
+    } else {
+      g_free (string->str);
+      g_slice_free1 (sizeof *string, string);
+    }
+  }
+}
+
+static struct _CtplValueIterator *
+ctpl_value_iterator_ref (struct _CtplValueIterator *iter)
+{
+  g_atomic_int_inc (&iter->ref_count);
+  
+  return iter;
+}
+
+/* frees the items @iter read ahead */
+static void
+ctpl_value_iterator_drop_pending (struct _CtplValueIterator *iter)
+{
+  while (iter->pending) {
+    ctpl_value_free (iter->pending->data);
+    iter->pending = g_slist_delete_link (iter->pending, iter->pending);
+  }
+}
+
+static void
+ctpl_value_iterator_unref (struct _CtplValueIterator *iter)
+{
+  if (g_atomic_int_dec_and_test (&iter->ref_count)) {
+    if (iter->destroy) {
+      iter->destroy (iter->user_data);
+    }
+    ctpl_value_iterator_drop_pending (iter);
+    g_slice_free1 (sizeof *iter, iter);
+  }
+}
+
+
+/* sets the type held by @value, keeping its flags */
+static void
+value_set_type (CtplValue     *value,
+                CtplValueType  type)
+{
+  value->type = (value->type & VALUE_FLAGS) | (gint) type;
+}
+
+
 /**
  * ctpl_value_init:
  * @value: An uninitialized #CtplValue
@@ -127,6 +314,42 @@ ctpl_value_new (void)
   return value;
 }
 
+/*
+ * ctpl_value_new_in_arena:
+ * @arena: A #CtplArena
+ * 
+ * Creates a new empty #CtplValue in @arena, for values allocated in bulk.  It
+ * is freed with ctpl_value_free() as any other value, but its memory is only
+ * given back with @arena, that must then outlive it.
+ * 
+ * Returns: A new #CtplValue
+ */
+CtplValue *
+ctpl_value_new_in_arena (CtplArena *arena)
+{
+  CtplValue *value;
+  
+  value = ctpl_arena_alloc (arena, sizeof *value);
+  ctpl_value_init (value);
+  value->type |= VALUE_IN_ARENA;
+  
+  return value;
+}
+
+/*
+ * ctpl_value_is_in_arena:
+ * @value: A #CtplValue
+ * 
+ * Checks whether a #CtplValue was created by ctpl_value_new_in_arena().
+ * 
+ * Returns: %TRUE if @value lives in an arena, %FALSE otherwise.
+ */
+gboolean
+ctpl_value_is_in_arena (const CtplValue *value)
+{
+  return (value->type & VALUE_IN_ARENA) != 0;
+}
+
 /**
  * ctpl_value_copy:
  * @src_value: A #CtplValue to copy
@@ -149,14 +372,37 @@ ctpl_value_copy (const CtplValue *src_value,
       ctpl_value_set_float (dst_value, ctpl_value_get_float (src_value));
       break;
     
-    case CTPL_VTYPE_STRING:
-      ctpl_value_set_string (dst_value, ctpl_value_get_string (src_value));
+    case CTPL_VTYPE_STRING: {
+      struct _CtplValueString *string;
+      
+      if (src_value->value.v_string->in_arena) {
+        /* the copy may outlive the arena */
+        ctpl_value_set_string (dst_value, ctpl_value_get_string (src_value));
+        break;
+      }
+      /* the string is shared, not copied */
+      string = ctpl_value_string_ref (src_value->value.v_string);
+      ctpl_value_free_value (dst_value);
+      value_set_type (dst_value, CTPL_VTYPE_STRING);
+      dst_value->value.v_string = string;
       break;
+    }
     
     case CTPL_VTYPE_ARRAY:
       ctpl_value_set_array_internal (dst_value,
                                      ctpl_value_get_array (src_value));
       break;
+    
+    case CTPL_VTYPE_ITERATOR: {
+      struct _CtplValueIterator *iter;
+      
+      /* the iterator is shared, not copied */
+      iter = ctpl_value_iterator_ref (src_value->value.v_iterator);
+      ctpl_value_free_value (dst_value);
+      value_set_type (dst_value, CTPL_VTYPE_ITERATOR);
+      dst_value->value.v_iterator = iter;
+      break;
+    }
   }
 }
 
@@ -193,10 +439,13 @@ ctpl_value_dup (const CtplValue *value)
 void
 ctpl_value_free_value (CtplValue *value)
 {
-  switch (value->type) {
+  switch (VALUE_TYPE (value)) {
     case CTPL_VTYPE_STRING:
-      g_free (value->value.v_string);
-      value->value.v_string = NULL;
+      /* the value may already have been freed */
+      if (value->value.v_string) {
+        ctpl_value_string_unref (value->value.v_string);
+        value->value.v_string = NULL;
+      }
       break;
     
     case CTPL_VTYPE_ARRAY: {
@@ -205,10 +454,21 @@ ctpl_value_free_value (CtplValue *value)
         for (i = value->value.v_array; i != NULL; i = i->next) {
           ctpl_value_free (i->data);
         }
-        g_slist_free (value->value.v_array);
+        if (! (value->type & VALUE_ARRAY_IN_ARENA)) {
+          g_slist_free (value->value.v_array);
+        }
         value->value.v_array = NULL;
+        value->type &= ~VALUE_ARRAY_IN_ARENA;
       break;
     }
+    
+    case CTPL_VTYPE_ITERATOR:
+      /* the value may already have been freed */
+      if (value->value.v_iterator) {
+        ctpl_value_iterator_unref (value->value.v_iterator);
+        value->value.v_iterator = NULL;
+      }
+      break;
   }
 }
 
@@ -226,7 +486,9 @@ ctpl_value_free (CtplValue *value)
 {
   if (value) {
     ctpl_value_free_value (value);
-    g_slice_free1 (sizeof *value, value);
+    if (! (value->type & VALUE_IN_ARENA)) {
+      g_slice_free1 (sizeof *value, value);
+    }
   }
 }
 
@@ -355,6 +617,36 @@ ctpl_value_new_array (CtplValueType type,
   return value;
 }
 
+/**
+ * ctpl_value_new_iterator:
+ * @next: A #CtplValueIterNextFunc generating the items
+ * @reset: (allow-none): A #CtplValueIterResetFunc restarting the iteration, or
+ *         %NULL if it cannot be restarted
+ * @user_data: User data to pass to @next and @reset
+ * @destroy: (allow-none): A function to call to free @user_data when the value
+ *           is freed, or %NULL
+ * 
+ * Creates a new #CtplValue holding an iterator.
+ * See ctpl_value_new() and ctpl_value_set_iterator().
+ * 
+ * Returns: A newly allocated #CtplValue that holds an iterator.
+ * 
+ * Since: 0.4
+ */
+CtplValue *
+ctpl_value_new_iterator (CtplValueIterNextFunc  next,
+                         CtplValueIterResetFunc reset,
+                         gpointer               user_data,
+                         GDestroyNotify         destroy)
+{
+  CtplValue *value;
+  
+  value = ctpl_value_new ();
+  ctpl_value_set_iterator (value, next, reset, user_data, destroy);
+  
+  return value;
+}
+
 /**
  * ctpl_value_set_int:
  * @value: A #CtplValue
@@ -367,7 +659,7 @@ ctpl_value_set_int (CtplValue *value,
                     glong      val)
 {
   ctpl_value_free_value (value);
-  value->type = CTPL_VTYPE_INT;
+  value_set_type (value, CTPL_VTYPE_INT);
   value->value.v_int = val;
 }
 
@@ -383,7 +675,7 @@ ctpl_value_set_float (CtplValue *value,
                       gdouble    val)
 {
   ctpl_value_free_value (value);
-  value->type = CTPL_VTYPE_FLOAT;
+  value_set_type (value, CTPL_VTYPE_FLOAT);
   value->value.v_float = val;
 }
 
@@ -399,12 +691,168 @@ void
 ctpl_value_set_string (CtplValue   *value,
                        const gchar *val)
 {
-  gchar *val_dup;
+  struct _CtplValueString *string;
+  
+  string = ctpl_value_string_new (val, strlen (val));
+  ctpl_value_free_value (value);
+  value_set_type (value, CTPL_VTYPE_STRING);
+  value->value.v_string = string;
+}
+
+/*
+ * ctpl_value_take_string:
+ * @value: A #CtplValue
+ * @val: A string
+ * 
+ * Sets the value of a #CtplValue to the given string, taking ownership of it.
+ * See ctpl_value_set_string().
+ */
+void
+ctpl_value_take_string (CtplValue *value,
+                        gchar     *val)
+{
+  ctpl_value_free_value (value);
+  value_set_type (value, CTPL_VTYPE_STRING);
+  value->value.v_string = ctpl_value_string_new_take (val);
+}
+
+/*
+ * ctpl_value_borrow_string:
+ * @value: A #CtplValue
+ * @val: A string owned by @owner
+ * @owner: What @val belongs to
+ * @release: Function releasing a reference to @owner
+ * 
+ * Sets the value of a #CtplValue to the given string without copying it.
+ * @val must not change as long as @owner is alive, and a reference to @owner is
+ * given to @value, to release with @release once neither @value nor any of its
+ * copies use @val anymore.  See ctpl_value_set_string().
+ */
+void
+ctpl_value_borrow_string (CtplValue      *value,
+                          const gchar    *val,
+                          gpointer        owner,
+                          GDestroyNotify  release)
+{
+  struct _CtplValueString *string;
   
-  val_dup = g_strdup (val);
   ctpl_value_free_value (value);
-  value->type = CTPL_VTYPE_STRING;
-  value->value.v_string = val_dup;
+  string = ctpl_value_string_new_take ((gchar *) val);
+  string->owner = owner;
+  string->release = release;
+  value_set_type (value, CTPL_VTYPE_STRING);
+  value->value.v_string = string;
+}
+
+/*
+ * ctpl_value_alloc_string:
+ * @value: A #CtplValue
+ * @arena: (allow-none): A #CtplArena in which allocate the string, or %NULL
+ * @length: The length of the string
+ * 
+ * Sets the value of a #CtplValue to a new string of @length bytes for the
+ * caller to fill.  The previous content of @value is freed first.
+ * If @arena is not %NULL, the string lives in it, and @value must not be used
+ * anymore once the arena is released; copies of @value are not affected.
+ * 
+ * Returns: The string, of @length + 1 bytes, the last one being already 0.
+ */
+gchar *
+ctpl_value_alloc_string (CtplValue *value,
+                         CtplArena *arena,
+                         gsize      length)
+{
+  struct _CtplValueString *string;
+  
+  ctpl_value_free_value (value);
+  if (arena) {
+    string = ctpl_arena_alloc (arena, sizeof *string + length + 1);
+    string->ref_count = 1;
+    string->views = 0;
+    string->v_int = 0;
+    string->v_float = 0.0;
+    string->str = (gchar *)(string + 1);
+    string->in_arena = TRUE;
+    string->owner = NULL;
+  } else {
+    string = ctpl_value_string_new (NULL, length);
+  }
+  string->str[length] = 0;
+  value_set_type (value, CTPL_VTYPE_STRING);
+  value->value.v_string = string;
+  
+  return string->str;
+}
+
+/*
+ * ctpl_value_alloc_shared_string:
+ * @value: A #CtplValue
+ * @arena: A #CtplArena in which allocate the string
+ * @length: The length of the string
+ * 
+ * Like ctpl_value_alloc_string(), but the string keeps a reference to @arena
+ * so it is shared between copies of @value like any other string, and can
+ * outlive the caller's reference to @arena.  This is meant for many strings
+ * that are likely to live as long as each other, as they don't get allocated
+ * one by one.
+ * 
+ * Returns: The string, of @length + 1 bytes, the last one being already 0.
+ */
+gchar *
+ctpl_value_alloc_shared_string (CtplValue *value,
+                                CtplArena *arena,
+                                gsize      length)
+{
+  struct _CtplValueString *string;
+  
+  ctpl_value_free_value (value);
+  string = ctpl_arena_alloc (arena, sizeof *string + length + 1);
+  string->ref_count = 1;
+  string->views = 0;
+  string->v_int = 0;
+  string->v_float = 0.0;
+  string->str = (gchar *) (string + 1);
+  string->in_arena = FALSE;
+  string->owner = ctpl_arena_ref (arena);
+  string->release = (GDestroyNotify) ctpl_arena_unref;
+  string->str[length] = 0;
+  value_set_type (value, CTPL_VTYPE_STRING);
+  value->value.v_string = string;
+  
+  return string->str;
+}
+
+/*
+ * ctpl_value_take_array:
+ * @value: A #CtplValue
+ * @values: A #GSList of #CtplValue<!-- -->s
+ * 
+ * Sets the value of a #CtplValue to an array of the given values, taking
+ * ownership of both the list and the values.
+ */
+void
+ctpl_value_take_array (CtplValue *value,
+                       GSList    *values)
+{
+  ctpl_value_free_value (value);
+  value_set_type (value, CTPL_VTYPE_ARRAY);
+  value->value.v_array = values;
+}
+
+/*
+ * ctpl_value_take_arena_array:
+ * @value: A #CtplValue
+ * @values: A #GSList of #CtplValue<!-- -->s, which nodes live in an arena
+ * 
+ * Like ctpl_value_take_array(), but the nodes of @values are not freed with
+ * @value, their arena must then outlive it.  The array must not be modified.
+ */
+void
+ctpl_value_take_arena_array (CtplValue *value,
+                             GSList    *values)
+{
+  ctpl_value_take_array (value, values);
+  value->type |= VALUE_ARRAY_IN_ARENA;
 }
 
 /*
@@ -425,7 +873,7 @@ ctpl_value_set_array_internal (CtplValue     *value,
   }
   new_values = g_slist_reverse (new_values);
   ctpl_value_free_value (value);
-  value->type = CTPL_VTYPE_ARRAY;
+  value_set_type (value, CTPL_VTYPE_ARRAY);
   value->value.v_array = new_values;
 }
 
@@ -454,7 +902,7 @@ ctpl_value_set_arrayv (CtplValue     *value,
                        va_list        ap)
 {
   ctpl_value_free_value (value);
-  value->type = CTPL_VTYPE_ARRAY;
+  value_set_type (value, CTPL_VTYPE_ARRAY);
   value->value.v_array = NULL; /* needed by the GSList at first appending */
   
   switch (type) {
@@ -482,7 +930,8 @@ ctpl_value_set_arrayv (CtplValue     *value,
       break;
     }
     
-    case CTPL_VTYPE_ARRAY: {
+    case CTPL_VTYPE_ARRAY:
+    case CTPL_VTYPE_ITERATOR: {
       g_critical ("Cannot build arrays of arrays this way"); 
       break;
     }
@@ -645,6 +1094,55 @@ ctpl_value_set_array_string (CtplValue *value,
   va_end (ap);
 }
 
+/**
+ * ctpl_value_set_iterator:
+ * @value: A #CtplValue
+ * @next: A #CtplValueIterNextFunc generating the items
+ * @reset: (allow-none): A #CtplValueIterResetFunc restarting the iteration, or
+ *         %NULL if it cannot be restarted
+ * @user_data: User data to pass to @next and @reset
+ * @destroy: (allow-none): A function to call to free @user_data when the value
+ *           is freed, or %NULL
+ * 
+ * Sets the value of a #CtplValue to an iterator.  An iterator is an array whose
+ * items are generated one at a time by @next, so iterating over it with a
+ * <code>for</code> loop only needs memory for one item, whatever the number of
+ * items.
+ * 
+ * Copies of the value share the same iteration.  Each <code>for</code> loop
+ * over the value restarts it with @reset, so if @reset is %NULL the value can
+ * only be iterated over once.  Items read ahead without being iterated over,
+ * e.g. to check whether the value is empty in an <code>if</code> statement or
+ * to convert it, are kept so that the next loop still gets them.
+ * 
+ * Other uses of the value, like indexing it or comparing it, first convert it
+ * to a regular array holding all its items, see ctpl_value_convert().
+ * 
+ * Since: 0.4
+ */
+void
+ctpl_value_set_iterator (CtplValue             *value,
+                         CtplValueIterNextFunc  next,
+                         CtplValueIterResetFunc reset,
+                         gpointer               user_data,
+                         GDestroyNotify         destroy)
+{
+  struct _CtplValueIterator *iter;
+  
+  g_return_if_fail (next != NULL);
+  
+  iter = g_slice_alloc (sizeof *iter);
+  iter->ref_count = 1;
+  iter->next = next;
+  iter->reset = reset;
+  iter->user_data = user_data;
+  iter->destroy = destroy;
+  iter->pending = NULL;
+  ctpl_value_free_value (value);
+  value_set_type (value, CTPL_VTYPE_ITERATOR);
+  value->value.v_iterator = iter;
+}
+
 /**
  * ctpl_value_array_append:
  * @value: A #CtplValue holding an array
@@ -822,6 +1320,123 @@ ctpl_value_array_index (const CtplValue *value,
   return tmp ? tmp->data : NULL;
 }
 
+/**
+ * ctpl_value_iterator_reset:
+ * @value: A #CtplValue holding an iterator
+ * 
+ * Restarts the iteration of a #CtplValue holding an iterator, if possible.
+ * See ctpl_value_set_iterator().
+ * 
+ * Since: 0.4
+ */
+void
+ctpl_value_iterator_reset (const CtplValue *value)
+{
+  struct _CtplValueIterator *iter;
+  
+  g_return_if_fail (CTPL_VALUE_HOLDS_ITERATOR (value));
+  
+  iter = value->value.v_iterator;
+  if (iter->reset) {
+    ctpl_value_iterator_drop_pending (iter);
+    iter->reset (iter->user_data);
+  }
+}
+
+/**
+ * ctpl_value_iterator_next:
+ * @value: A #CtplValue holding an iterator
+ * @item: A #CtplValue to fill with the next item
+ * 
+ * Gets the next item of a #CtplValue holding an iterator.
+ * See ctpl_value_set_iterator().
+ * 
+ * Returns: %TRUE if @item was filled, %FALSE if there are no more items.
+ * 
+ * Since: 0.4
+ */
+gboolean
+ctpl_value_iterator_next (const CtplValue *value,
+                          CtplValue       *item)
+{
+  struct _CtplValueIterator *iter;
+  
+  g_return_val_if_fail (CTPL_VALUE_HOLDS_ITERATOR (value), FALSE);
+  
+  iter = value->value.v_iterator;
+  if (iter->pending) {
+    CtplValue *pending = iter->pending->data;
+    
+    iter->pending = g_slist_delete_link (iter->pending, iter->pending);
+    ctpl_value_copy (pending, item);
+    ctpl_value_free (pending);
+    
+    return TRUE;
+  }
+  
+  return iter->next (item, iter->user_data);
+}
+
+/*
+ * ctpl_value_iterator_is_empty:
+ * @value: A #CtplValue holding an iterator
+ * 
+ * Restarts the iteration of a #CtplValue holding an iterator if possible, and
+ * checks whether it has any item left.  The item read to know it is kept for
+ * the next call to ctpl_value_iterator_next(), so it is not lost if the
+ * iteration cannot be restarted.
+ * 
+ * Returns: %TRUE if the iteration has no item, %FALSE otherwise.
+ */
+gboolean
+ctpl_value_iterator_is_empty (const CtplValue *value)
+{
+  struct _CtplValueIterator *iter;
+  
+  g_return_val_if_fail (CTPL_VALUE_HOLDS_ITERATOR (value), TRUE);
+  
+  iter = value->value.v_iterator;
+  ctpl_value_iterator_reset (value);
+  if (! iter->pending) {
+    CtplValue *item = ctpl_value_new ();
+    
+    if (iter->next (item, iter->user_data)) {
+      iter->pending = g_slist_prepend (NULL, item);
+    } else {
+      ctpl_value_free (item);
+    }
+  }
+  
+  return iter->pending == NULL;
+}
+
+/* replaces the iterator held by @value with an array of all its items.  If the
+ * iteration cannot be restarted, copies of the items are kept for the next
+ * iteration over other copies of the value */
+static void
+ctpl_value_iterator_materialize (CtplValue *value)
+{
+  struct _CtplValueIterator  *iter = value->value.v_iterator;
+  GSList                     *items = NULL;
+  CtplValue                  *item;
+  
+  ctpl_value_iterator_reset (value);
+  item = ctpl_value_new ();
+  while (ctpl_value_iterator_next (value, item)) {
+    items = g_slist_prepend (items, item);
+    item = ctpl_value_new ();
+  }
+  ctpl_value_free (item);
+  if (! iter->reset) {
+    GSList *i;
+    
+    for (i = items; i; i = i->next) {
+      iter->pending = g_slist_prepend (iter->pending, ctpl_value_dup (i->data));
+    }
+  }
+  ctpl_value_take_array (value, g_slist_reverse (items));
+}
+
 /**
  * ctpl_value_get_held_type:
  * @value: A #CtplValue
@@ -833,7 +1448,7 @@ ctpl_value_array_index (const CtplValue *value,
 CtplValueType
 ctpl_value_get_held_type (const CtplValue *value)
 {
-  return value->type;
+  return (CtplValueType) VALUE_TYPE (value);
 }
 
 /**
@@ -862,6 +1477,9 @@ ctpl_value_type_get_name (CtplValueType type)
       /* TODO: return the array type? (e.g. "array of int",
        * "array of strings and floats", etc?) */
       return _("array");
+    
+    case CTPL_VTYPE_ITERATOR:
+      return _("iterator");
   }
   
   return "???";
@@ -913,7 +1531,7 @@ ctpl_value_get_string (const CtplValue *value)
 {
   g_return_val_if_fail (CTPL_VALUE_HOLDS_STRING (value), NULL);
   
-  return value->value.v_string;
+  return value->value.v_string->str;
 }
 
 /**
@@ -1058,7 +1676,7 @@ ctpl_value_get_array_string (const CtplValue *value,
     if (! CTPL_VALUE_HOLDS_STRING (v)) {
       goto fail;
     } else {
-      array[n] = g_strdup (v->value.v_string);
+      array[n] = g_strdup (v->value.v_string->str);
     }
   }
   array[n] = NULL;
@@ -1127,13 +1745,217 @@ ctpl_value_to_string (const CtplValue *value)
       break;
     
     case CTPL_VTYPE_STRING:
-      val = g_strdup (value->value.v_string);
+      val = g_strdup (value->value.v_string->str);
+      break;
+    
+    case CTPL_VTYPE_ITERATOR: {
+      CtplValue array;
+      
+      ctpl_value_init (&array);
+      ctpl_value_copy (value, &array);
+      ctpl_value_iterator_materialize (&array);
+      val = ctpl_value_to_string (&array);
+      ctpl_value_free_value (&array);
       break;
+    }
   }
   
   return val;
 }
 
+/*
+ * ctpl_value_get_int_view:
+ * @value: A #CtplValue
+ * @v: (out): Return location for the integer value of @value
+ * 
+ * Gets the integer interpretation of @value, as converting it to an integer
+ * with ctpl_value_convert() would, but without modifying it.
+ * The interpretation of a string is only computed once, then cached in the
+ * string which is shared by all the copies of the value.
+ * 
+ * Returns: %TRUE if @value has an integer interpretation, %FALSE otherwise.
+ */
+gboolean
+ctpl_value_get_int_view (const CtplValue *value,
+                         glong           *v)
+{
+  gboolean rv = TRUE;
+  
+  switch (ctpl_value_get_held_type (value)) {
+    case CTPL_VTYPE_INT:
+      *v = ctpl_value_get_int (value);
+      break;
+    
+    case CTPL_VTYPE_FLOAT: {
+      gdouble val = ctpl_value_get_float (value);
+      
+      rv = CTPL_MATH_FLOAT_EQ (val, (gdouble)(glong)val);
+      *v = (glong)val;
+      break;
+    }
+    
+    case CTPL_VTYPE_STRING: {
+      struct _CtplValueString *string = value->value.v_string;
+      guint                    views;
+      
+      /* concurrent computations would only store the same thing */
+      views = (guint) g_atomic_int_get ((gint *) &string->views);
+      if (! (views & STRING_VIEW_INT_CACHED)) {
+        glong val = 0;
+        
+        views = STRING_VIEW_INT_CACHED;
+        if (ctpl_math_string_to_int (string->str, &val)) {
+          views |= STRING_VIEW_INT_VALID;
+        }
+        string->v_int = val;
+        string_add_views (string, views);
+      }
+      rv = (views & STRING_VIEW_INT_VALID) != 0;
+      *v = string->v_int;
+      break;
+    }
+    
+    default:
+      rv = FALSE;
+  }
+  
+  return rv;
+}
+
+/*
+ * ctpl_value_get_float_view:
+ * @value: A #CtplValue
+ * @v: (out): Return location for the floating point value of @value
+ * 
+ * Gets the floating point interpretation of @value, as converting it to a
+ * float with ctpl_value_convert() would, but without modifying it.
+ * See ctpl_value_get_int_view().
+ * 
+ * Returns: %TRUE if @value has a floating point interpretation, %FALSE
+ *          otherwise.
+ */
+gboolean
+ctpl_value_get_float_view (const CtplValue *value,
+                           gdouble         *v)
+{
+  gboolean rv = TRUE;
+  
+  switch (ctpl_value_get_held_type (value)) {
+    case CTPL_VTYPE_INT:
+      *v = (gdouble)ctpl_value_get_int (value);
+      break;
+    
+    case CTPL_VTYPE_FLOAT:
+      *v = ctpl_value_get_float (value);
+      break;
+    
+    case CTPL_VTYPE_STRING: {
+      struct _CtplValueString *string = value->value.v_string;
+      guint                    views;
+      
+      views = (guint) g_atomic_int_get ((gint *) &string->views);
+      if (! (views & STRING_VIEW_FLOAT_CACHED)) {
+        gdouble val = 0.0;
+        
+        views = STRING_VIEW_FLOAT_CACHED;
+        if (ctpl_math_string_to_float (string->str, &val)) {
+          views |= STRING_VIEW_FLOAT_VALID;
+        }
+        string->v_float = val;
+        string_add_views (string, views);
+      }
+      rv = (views & STRING_VIEW_FLOAT_VALID) != 0;
+      *v = string->v_float;
+      break;
+    }
+    
+    default:
+      rv = FALSE;
+  }
+  
+  return rv;
+}
+
+/* FNV-1a over @length bytes of @data, continuing from @hash */
+static guint64
+hash_bytes (guint64       hash,
+            gconstpointer data,
+            gsize         length)
+{
+  const guchar *p = data;
+  gsize         i;
+  
+  for (i = 0; i < length; i++) {
+    hash = (hash ^ p[i]) * G_GUINT64_CONSTANT (0x100000001b3);
+  }
+  
+  return hash;
+}
+
+/*
+ * ctpl_value_hash64:
+ * @value: A #CtplValue
+ * 
+ * Computes a structural hash of @value: values of the same type and content
+ * have the same hash, whichever way they were built.  Arrays are hashed item
+ * by item, but iterators by identity since their items may change, so two
+ * copies of an iterator value have the same hash but two iterators over the
+ * same items don't.
+ * 
+ * Returns: The hash of @value.
+ */
+guint64
+ctpl_value_hash64 (const CtplValue *value)
+{
+  guint64 hash = G_GUINT64_CONSTANT (0xcbf29ce484222325);
+  guchar  type = (guchar) ctpl_value_get_held_type (value);
+  
+  hash = hash_bytes (hash, &type, 1);
+  switch (ctpl_value_get_held_type (value)) {
+    case CTPL_VTYPE_INT: {
+      gint64 v = ctpl_value_get_int (value);
+      
+      hash = hash_bytes (hash, &v, sizeof v);
+      break;
+    }
+    
+    case CTPL_VTYPE_FLOAT: {
+      gdouble v = ctpl_value_get_float (value);
+      
+      hash = hash_bytes (hash, &v, sizeof v);
+      break;
+    }
+    
+    case CTPL_VTYPE_STRING: {
+      const gchar *v = ctpl_value_get_string (value);
+      
+      /* including the terminating 0 keeps "a", "b" apart from "ab" in arrays */
+      hash = hash_bytes (hash, v, strlen (v) + 1);
+      break;
+    }
+    
+    case CTPL_VTYPE_ARRAY: {
+      const GSList *item;
+      
+      for (item = value->value.v_array; item; item = item->next) {
+        guint64 item_hash = ctpl_value_hash64 (item->data);
+        
+        hash = hash_bytes (hash, &item_hash, sizeof item_hash);
+      }
+      /* keeps nested arrays apart from flat ones */
+      hash = hash_bytes (hash, "]", 1);
+      break;
+    }
+    
+    case CTPL_VTYPE_ITERATOR:
+      hash = hash_bytes (hash, &value->value.v_iterator,
+                         sizeof value->value.v_iterator);
+      break;
+  }
+  
+  return hash;
+}
+
 /**
  * ctpl_value_convert:
  * @value: A #CtplValue to convert
@@ -1196,6 +2018,10 @@ ctpl_value_convert (CtplValue     *value,
             break;
           }
           
+          case CTPL_VTYPE_ITERATOR:
+            ctpl_value_iterator_materialize (value);
+            break;
+          
           default:
             rv = FALSE;
         }
@@ -1204,18 +2030,11 @@ ctpl_value_convert (CtplValue     *value,
       /* convert to float */
       case CTPL_VTYPE_FLOAT:
         switch (actual_type) {
-          case CTPL_VTYPE_INT: {
-            glong val;
-            
-            val = ctpl_value_get_int (value);
-            ctpl_value_set_float (value, (gdouble)val);
-            break;
-          }
-          
+          case CTPL_VTYPE_INT:
           case CTPL_VTYPE_STRING: {
             gdouble vfloat;
             
-            rv = ctpl_math_string_to_float (ctpl_value_get_string (value), &vfloat);
+            rv = ctpl_value_get_float_view (value, &vfloat);
             if (rv) {
               ctpl_value_set_float (value, vfloat);
             }
@@ -1230,22 +2049,11 @@ ctpl_value_convert (CtplValue     *value,
       /* convert to integer */
       case CTPL_VTYPE_INT:
         switch (actual_type) {
-          case CTPL_VTYPE_FLOAT: {
-            gdouble val;
-            
-            val = ctpl_value_get_float (value);
-            if (! CTPL_MATH_FLOAT_EQ (val, (gdouble)(glong)val)) {
-              rv = FALSE;
-            } else {
-              ctpl_value_set_int (value, (glong)val);
-            }
-            break;
-          }
-          
+          case CTPL_VTYPE_FLOAT:
           case CTPL_VTYPE_STRING: {
             glong vint;
             
-            rv = ctpl_math_string_to_int (ctpl_value_get_string (value), &vint);
+            rv = ctpl_value_get_int_view (value, &vint);
             if (rv) {
               ctpl_value_set_int (value, vint);
             }
@@ -1267,6 +2075,11 @@ ctpl_value_convert (CtplValue     *value,
         g_free (val);
         break;
       }
+      
+      /* nothing can be converted to an iterator */
+      case CTPL_VTYPE_ITERATOR:
+        rv = FALSE;
+        break;
     }
   }
   
@@ -36,6 +36,8 @@ G_BEGIN_DECLS
  * @CTPL_VTYPE_FLOAT: Floating point value (C's double)
  * @CTPL_VTYPE_STRING: 0-terminated string (C string)
  * @CTPL_VTYPE_ARRAY: Array of #CtplValue<!-- -->s
+ * @CTPL_VTYPE_ITERATOR: Sequence of #CtplValue<!-- -->s generated on demand,
+ *                       see ctpl_value_set_iterator() (Since: 0.4)
  * 
  * Represents the types that a #CtplValue can hold.
  */
@@ -44,7 +46,8 @@ typedef enum _CtplValueType
   CTPL_VTYPE_INT,
   CTPL_VTYPE_FLOAT,
   CTPL_VTYPE_STRING,
-  CTPL_VTYPE_ARRAY
+  CTPL_VTYPE_ARRAY,
+  CTPL_VTYPE_ITERATOR
 } CtplValueType;
 
 typedef struct _CtplValue CtplValue;
@@ -62,11 +65,37 @@ struct _CtplValue
   union {
     glong     v_int;
     gdouble   v_float;
-    gchar    *v_string;
+    struct _CtplValueString *v_string;
     GSList   *v_array;
+    struct _CtplValueIterator *v_iterator;
   } value;
 };
 
+/**
+ * CtplValueIterNextFunc:
+ * @item: A #CtplValue to fill with the next item
+ * @user_data: User data passed to ctpl_value_set_iterator()
+ * 
+ * User function for ctpl_value_set_iterator() generating the items of an
+ * iterator value, one at a time.
+ * 
+ * Returns: %TRUE if @item was filled, %FALSE if there are no more items.
+ * 
+ * Since: 0.4
+ */
+typedef gboolean  (*CtplValueIterNextFunc)  (CtplValue *item,
+                                             gpointer   user_data);
+/**
+ * CtplValueIterResetFunc:
+ * @user_data: User data passed to ctpl_value_set_iterator()
+ * 
+ * User function for ctpl_value_set_iterator() restarting the iteration, so
+ * that the next call to the #CtplValueIterNextFunc generates the first item.
+ * 
+ * Since: 0.4
+ */
+typedef void      (*CtplValueIterResetFunc) (gpointer user_data);
+
 
 /**
  * CTPL_VALUE_HOLDS:
@@ -119,6 +148,18 @@ struct _CtplValue
  */
 #define CTPL_VALUE_HOLDS_ARRAY(value) \
   (CTPL_VALUE_HOLDS (value, CTPL_VTYPE_ARRAY))
+/**
+ * CTPL_VALUE_HOLDS_ITERATOR:
+ * @value: A #CtplValue
+ * 
+ * Check whether a #CtplValue holds an iterator.
+ * 
+ * Returns: %TRUE if @value holds an iterator, %FALSE otherwise.
+ * 
+ * Since: 0.4
+ */
+#define CTPL_VALUE_HOLDS_ITERATOR(value) \
+  (CTPL_VALUE_HOLDS (value, CTPL_VTYPE_ITERATOR))
 
 
 void          ctpl_value_init                 (CtplValue *value);
@@ -137,6 +178,10 @@ CtplValue    *ctpl_value_new_arrayv           (CtplValueType type,
 CtplValue    *ctpl_value_new_array            (CtplValueType  type,
                                                gsize          count,
                                                ...) G_GNUC_NULL_TERMINATED;
+CtplValue    *ctpl_value_new_iterator         (CtplValueIterNextFunc  next,
+                                               CtplValueIterResetFunc reset,
+                                               gpointer               user_data,
+                                               GDestroyNotify         destroy);
 void          ctpl_value_set_int              (CtplValue *value,
                                                glong      val);
 void          ctpl_value_set_float            (CtplValue *value,
@@ -169,6 +214,11 @@ void          ctpl_value_set_array_stringv    (CtplValue     *value,
 void          ctpl_value_set_array_string     (CtplValue     *value,
                                                gsize          count,
                                                ...) G_GNUC_NULL_TERMINATED;
+void          ctpl_value_set_iterator         (CtplValue             *value,
+                                               CtplValueIterNextFunc  next,
+                                               CtplValueIterResetFunc reset,
+                                               gpointer               user_data,
+                                               GDestroyNotify         destroy);
 void          ctpl_value_array_append         (CtplValue       *value,
                                                const CtplValue *val);
 void          ctpl_value_array_prepend        (CtplValue       *value,
@@ -188,6 +238,9 @@ void          ctpl_value_array_prepend_string (CtplValue       *value,
 gsize         ctpl_value_array_length         (const CtplValue *value);
 CtplValue *   ctpl_value_array_index          (const CtplValue *value,
                                                gsize            idx);
+void          ctpl_value_iterator_reset       (const CtplValue *value);
+gboolean      ctpl_value_iterator_next        (const CtplValue *value,
+                                               CtplValue       *item);
 CtplValueType ctpl_value_get_held_type        (const CtplValue *value);
 glong         ctpl_value_get_int              (const CtplValue *value);
 gdouble       ctpl_value_get_float            (const CtplValue *value);
@@ -45,11 +45,17 @@
 /* options */
 static gchar      **OPT_env_files     = NULL;
 static gchar      **OPT_env_chunks    = NULL;
+static gchar       *OPT_env_snapshot  = NULL;
+static gchar       *OPT_write_env_snapshot = NULL;
 static gchar      **OPT_input_files   = NULL;
 static gchar       *OPT_output_file   = NULL;
 static gboolean     OPT_verbose       = FALSE;
 static gboolean     OPT_print_version = FALSE;
 static gchar       *OPT_encoding      = NULL;
+static gchar       *OPT_compile       = NULL;
+static gboolean     OPT_analyze       = FALSE;
+static gint         OPT_loop_iterations = 10;
+static gboolean     OPT_stream        = FALSE;
 
 static GOptionEntry option_entries[] = {
   { "output", 'o', 0, G_OPTION_ARG_FILENAME, &OPT_output_file,
@@ -61,12 +67,31 @@ static GOptionEntry option_entries[] = {
   { "env-chunk", 'c', 0, G_OPTION_ARG_STRING_ARRAY, &OPT_env_chunks,
     N_("Add environment chunk CHUNK. This option may appear more than once."),
     N_("CHUNK") },
+  { "env-snapshot", 's', 0, G_OPTION_ARG_FILENAME, &OPT_env_snapshot,
+    N_("Load environment snapshot SNAPSHOT before any other environment."),
+    N_("SNAPSHOT") },
+  { "write-env-snapshot", 0, 0, G_OPTION_ARG_FILENAME, &OPT_write_env_snapshot,
+    N_("Write a snapshot of the environment to SNAPSHOT."),
+    N_("SNAPSHOT") },
   { "verbose", 'v', 0, G_OPTION_ARG_NONE, &OPT_verbose,
     N_("Be verbose."), NULL },
   { "version", 0, 0, G_OPTION_ARG_NONE, &OPT_print_version,
     N_("Print the version information and exit."), NULL },
   { "encoding", 0, 0, G_OPTION_ARG_STRING, &OPT_encoding,
     N_("Specify the encoding of the input and output files."), N_("ENCODING") },
+  { "compile", 0, 0, G_OPTION_ARG_STRING, &OPT_compile,
+    N_("Write the C source of a function FUNCTION rendering the input file "
+       "rather than rendering it."), N_("FUNCTION") },
+  { "analyze", 0, 0, G_OPTION_ARG_NONE, &OPT_analyze,
+    N_("Write a JSON report of the symbols, loops and estimated cost of the "
+       "input file rather than rendering it."), NULL },
+  { "loop-iterations", 0, 0, G_OPTION_ARG_INT, &OPT_loop_iterations,
+    N_("Assume loops over values only known at rendering time repeat N times "
+       "when analyzing. Defaults to 10."), N_("N") },
+  { "stream", 0, 0, G_OPTION_ARG_NONE, &OPT_stream,
+    N_("Render each top-level statement of the input files as soon as it is "
+       "read rather than reading whole files first. Output starts earlier and "
+       "needs less memory, but is written up to a syntax error."), NULL },
   { G_OPTION_REMAINING, 0, 0, G_OPTION_ARG_FILENAME_ARRAY, &OPT_input_files,
     N_("Input files"), N_("INPUTFILE[...]") },
   { NULL, 0, 0, G_OPTION_ARG_NONE, NULL, NULL, NULL }
@@ -149,9 +174,26 @@ parse_options (gint    *argc,
     if (OPT_print_version) {
       printf (_("CTPL %s\n"), VERSION);
       exit (0);
-    } else if (OPT_input_files == NULL) {
+    } else if (OPT_input_files == NULL && OPT_write_env_snapshot == NULL) {
       g_set_error (error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE,
                    _("Missing input file(s)"));
+    } else if (OPT_compile &&
+               (! OPT_input_files || g_strv_length (OPT_input_files) != 1)) {
+      g_set_error (error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE,
+                   _("Compiling needs exactly one input file"));
+    } else if (OPT_analyze && OPT_compile) {
+      g_set_error (error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE,
+                   _("Cannot both compile and analyze"));
+    } else if (OPT_analyze &&
+               (! OPT_input_files || g_strv_length (OPT_input_files) != 1)) {
+      g_set_error (error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE,
+                   _("Analyzing needs exactly one input file"));
+    } else if (OPT_stream && (OPT_compile || OPT_analyze)) {
+      g_set_error (error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE,
+                   _("Streaming only applies to rendering"));
+    } else if (OPT_loop_iterations < 0) {
+      g_set_error (error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE,
+                   _("The number of loop iterations cannot be negative"));
     } else {
       if (! OPT_encoding) {
         const gchar *local_charset;
@@ -214,7 +256,7 @@ open_input_stream (const gchar *arg,
   return stream;
 }
 
-/* build the environment (OPT_env_files and OPT_env_chunks) */
+/* build the environment (OPT_env_snapshot, OPT_env_files and OPT_env_chunks) */
 static CtplEnviron *
 build_environ (void)
 {
@@ -222,6 +264,18 @@ build_environ (void)
   CtplEnviron  *env     = NULL;
   
   env = ctpl_environ_new ();
+  /* load the snapshot first, so it can be loaded lazily */
+  if (success && OPT_env_snapshot) {
+    GError *err = NULL;
+    
+    printv (_("Loading environment snapshot '%s'...\n"), OPT_env_snapshot);
+    if (! ctpl_environ_add_from_snapshot (env, OPT_env_snapshot, &err)) {
+      printerr (_("Failed to load environment snapshot '%s': %s\n"),
+                OPT_env_snapshot, err->message);
+      g_error_free (err);
+      success = FALSE;
+    }
+  }
   /* load environment files */
   if (success && OPT_env_files) {
     gsize i;
@@ -271,6 +325,19 @@ build_environ (void)
       g_free (chunk);
     }
   }
+  /* write the snapshot */
+  if (success && OPT_write_env_snapshot) {
+    GError *err = NULL;
+    
+    printv (_("Writing environment snapshot '%s'...\n"),
+            OPT_write_env_snapshot);
+    if (! ctpl_environ_write_snapshot (env, OPT_write_env_snapshot, &err)) {
+      printerr (_("Failed to write environment snapshot '%s': %s\n"),
+                OPT_write_env_snapshot, err->message);
+      g_error_free (err);
+      success = FALSE;
+    }
+  }
   if (! success) {
     ctpl_environ_unref (env);
     env = NULL;
@@ -279,6 +346,31 @@ build_environ (void)
   return env;
 }
 
+/* parses a template from @stream, rendering each top-level token as soon as it
+ * is read, so that only the block being read is in memory */
+static gboolean
+stream_template (CtplInputStream  *stream,
+                 CtplOutputStream *output,
+                 CtplEnviron      *env,
+                 GError          **error)
+{
+  CtplArena  *arena = ctpl_arena_new ();
+  CtplToken  *token;
+  GError     *err = NULL;
+  
+  while ((token = ctpl_lexer_lex_next (stream, &err)) != NULL &&
+         ctpl_parser_parse_with_arena (token, env, output, arena, &err)) {
+    ctpl_token_free (token);
+  }
+  ctpl_token_free (token);
+  ctpl_arena_unref (arena);
+  if (err) {
+    g_propagate_error (error, err);
+  }
+  
+  return err == NULL;
+}
+
 /* parses a template from a file */
 static gboolean
 parse_template (const gchar      *filename,
@@ -290,7 +382,10 @@ parse_template (const gchar      *filename,
   CtplInputStream  *stream;
   
   stream = open_input_stream (filename, error);
-  if (stream) {
+  if (stream && OPT_stream) {
+    rv = stream_template (stream, output, env, error);
+    ctpl_input_stream_unref (stream);
+  } else if (stream) {
     CtplToken *tree;
     
     tree = ctpl_lexer_lex (stream, error);
@@ -330,6 +425,73 @@ parse_templates (CtplEnviron       *env,
   return success;
 }
 
+/* writes the C source of a function rendering the template in @filename */
+static gboolean
+compile_template (const gchar      *filename,
+                  CtplOutputStream *output)
+{
+  gboolean          rv = FALSE;
+  GError           *err = NULL;
+  CtplInputStream  *stream;
+  
+  printv (_("Compiling template '%s'...\n"), filename);
+  stream = open_input_stream (filename, &err);
+  if (stream) {
+    CtplToken *tree;
+    
+    tree = ctpl_lexer_lex (stream, &err);
+    ctpl_input_stream_unref (stream);
+    if (tree) {
+      rv = ctpl_codegen_write (tree, OPT_compile, output, &err);
+    }
+    ctpl_token_free (tree);
+  }
+  if (! rv) {
+    printerr (_("Failed to compile template '%s': %s\n"),
+              filename, err->message);
+    g_error_free (err);
+  }
+  
+  return rv;
+}
+
+/* writes the JSON report of the analysis of the template in @filename */
+static gboolean
+analyze_template (const gchar      *filename,
+                  CtplOutputStream *output)
+{
+  gboolean          rv = FALSE;
+  GError           *err = NULL;
+  CtplInputStream  *stream;
+  
+  printv (_("Analyzing template '%s'...\n"), filename);
+  stream = open_input_stream (filename, &err);
+  if (stream) {
+    CtplToken *tree;
+    
+    tree = ctpl_lexer_lex (stream, &err);
+    ctpl_input_stream_unref (stream);
+    if (tree) {
+      CtplAnalysis *analysis;
+      gchar        *json;
+      
+      analysis = ctpl_analysis_new (tree, (gulong) OPT_loop_iterations);
+      json = ctpl_analysis_to_json (analysis);
+      rv = ctpl_output_stream_write (output, json, -1, &err);
+      g_free (json);
+      ctpl_analysis_unref (analysis);
+    }
+    ctpl_token_free (tree);
+  }
+  if (! rv) {
+    printerr (_("Failed to analyze template '%s': %s\n"),
+              filename, err->message);
+    g_error_free (err);
+  }
+  
+  return rv;
+}
+
 static CtplOutputStream *
 get_output_stream (void)
 {
@@ -402,12 +564,35 @@ int main (int     argc,
     printerr (_("Option parsing failed: %s\n"), error->message);
     g_clear_error (&error);
     err = 1;
+  } else if (OPT_compile) {
+    CtplOutputStream *ostream = get_output_stream ();
+    
+    /* the environment is only needed when rendering */
+    if (ostream) {
+      if (compile_template (OPT_input_files[0], ostream)) {
+        err = 0;
+      }
+      ctpl_output_stream_unref (ostream);
+    }
+  } else if (OPT_analyze) {
+    CtplOutputStream *ostream = get_output_stream ();
+    
+    if (ostream) {
+      if (analyze_template (OPT_input_files[0], ostream)) {
+        err = 0;
+      }
+      ctpl_output_stream_unref (ostream);
+    }
   } else {
     CtplEnviron  *env;
     
     env = build_environ ();
     if (! env) {
       err = 1;
+    } else if (! OPT_input_files) {
+      /* nothing to parse, we were only asked to write a snapshot */
+      err = 0;
+      ctpl_environ_unref (env);
     } else {
       CtplOutputStream *ostream = get_output_stream ();
       
@@ -22,11 +22,17 @@
 
 #define H_CTPL_H_INSIDE
 
+#include "ctpl-analysis.h"
+#include "ctpl-arena.h"
+#include "ctpl-cache.h"
+#include "ctpl-codegen.h"
 #include "ctpl-environ.h"
 #include "ctpl-eval.h"
 #include "ctpl-lexer-expr.h"
 #include "ctpl-lexer.h"
 #include "ctpl-parser.h"
+#include "ctpl-renderer.h"
+#include "ctpl-rendering.h"
 #include "ctpl-io.h"
 #include "ctpl-input-stream.h"
 #include "ctpl-output-stream.h"
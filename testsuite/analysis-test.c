@@ -0,0 +1,196 @@
+/* Checks for CtplAnalysis */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include <gio/gio.h>
+
+#include "../src/ctpl.h"
+
+
+
+/* analyzes the template @str */
+static CtplAnalysis *
+analyze_string (const gchar *str,
+                gulong       default_iterations)
+{
+  CtplToken    *tree;
+  CtplAnalysis *analysis;
+  GError       *err = NULL;
+  
+  tree = ctpl_lexer_lex_string (str, &err);
+  g_assert_no_error (err);
+  analysis = ctpl_analysis_new (tree, default_iterations);
+  ctpl_token_free (tree);
+  
+  return analysis;
+}
+
+/* checks the loop number @loop of @analysis */
+static void
+check_loop (const CtplAnalysis *analysis,
+            guint               loop,
+            const gchar        *iterator,
+            guint               depth,
+            gulong              iterations,
+            gboolean            exact,
+            guint64             multiplier)
+{
+  gboolean is_exact;
+  
+  g_assert_cmpstr (ctpl_analysis_get_loop_iterator (analysis, loop),
+                   ==, iterator);
+  g_assert_cmpuint (ctpl_analysis_get_loop_depth (analysis, loop), ==, depth);
+  g_assert_cmpuint (ctpl_analysis_get_loop_iterations (analysis, loop,
+                                                       &is_exact),
+                    ==, iterations);
+  g_assert_cmpint (is_exact, ==, exact);
+  g_assert_cmpuint (ctpl_analysis_get_loop_multiplier (analysis, loop),
+                    ==, multiplier);
+}
+
+/* checks the report of a template using most of the language */
+static void
+check_report (void)
+{
+  CtplAnalysis *analysis;
+  gchar       **names;
+  
+  analysis = analyze_string ("<h1>{title}</h1>"
+                             "{for i in items}"
+                               "<li>{i}{for j in range(3)}{j + n}{end}</li>"
+                             "{end}"
+                             "{for k in range(2)}{k}{end}"
+                             "{if len(items) > n}{title}{else}x{end}", 5);
+  
+  /* the iterators are not symbols in their loops */
+  names = ctpl_analysis_get_symbols (analysis);
+  g_assert_cmpuint (g_strv_length (names), ==, 3);
+  g_assert_cmpstr (names[0], ==, "title");
+  g_assert_cmpstr (names[1], ==, "items");
+  g_assert_cmpstr (names[2], ==, "n");
+  g_strfreev (names);
+  g_assert_cmpuint (ctpl_analysis_get_symbol_reads (analysis, "title"), ==, 2);
+  g_assert_cmpuint (ctpl_analysis_get_symbol_reads (analysis, "items"), ==, 2);
+  g_assert_cmpuint (ctpl_analysis_get_symbol_reads (analysis, "n"), ==, 2);
+  g_assert_cmpuint (ctpl_analysis_get_symbol_reads (analysis, "i"), ==, 0);
+  
+  names = ctpl_analysis_get_functions (analysis);
+  g_assert_cmpuint (g_strv_length (names), ==, 2);
+  g_assert_cmpstr (names[0], ==, "range");
+  g_assert_cmpstr (names[1], ==, "len");
+  g_strfreev (names);
+  g_assert_cmpuint (ctpl_analysis_get_function_calls (analysis, "range"), ==, 2);
+  g_assert_cmpuint (ctpl_analysis_get_function_calls (analysis, "len"), ==, 1);
+  
+  g_assert_cmpuint (ctpl_analysis_get_literal_size (analysis), ==, 19);
+  g_assert_cmpuint (ctpl_analysis_get_max_loop_depth (analysis), ==, 2);
+  g_assert_cmpuint (ctpl_analysis_get_n_loops (analysis), ==, 3);
+  check_loop (analysis, 0, "i", 1, 5, FALSE, 5);
+  check_loop (analysis, 1, "j", 2, 3, TRUE, 15);
+  check_loop (analysis, 2, "k", 1, 2, TRUE, 2);
+  
+  /* 3 + (1 + 5 * (1 + 3 + (2 + 3 * (1 + 3)))) + (2 + 2 * (1 + 1)) + (4 + 1) */
+  g_assert_cmpuint (ctpl_analysis_get_cost (analysis), ==, 105);
+  /* 17 + 5 * (12 + 3 * 8 + 5) + 2 * 8 + 8 */
+  g_assert_cmpuint (ctpl_analysis_get_output_size (analysis), ==, 246);
+  
+  ctpl_analysis_unref (analysis);
+}
+
+/* checks the number of iterations of loops over range() */
+static void
+check_ranges (void)
+{
+  CtplAnalysis *analysis;
+  
+  analysis = analyze_string ("{for i in range(10, 0, -3)}{end}"
+                             "{for i in range(5, 5)}{end}"
+                             "{for i in range(1, 8, 2)}{end}"
+                             "{for i in range(n)}{end}"
+                             "{for i in range(1, 2, 3, 4)}{end}", 7);
+  check_loop (analysis, 0, "i", 1, 4, TRUE, 4);
+  check_loop (analysis, 1, "i", 1, 0, TRUE, 0);
+  check_loop (analysis, 2, "i", 1, 4, TRUE, 4);
+  check_loop (analysis, 3, "i", 1, 7, FALSE, 7);
+  check_loop (analysis, 4, "i", 1, 7, FALSE, 7);
+  ctpl_analysis_unref (analysis);
+  
+  /* the estimates saturate rather than overflow */
+  analysis = analyze_string ("{for i in a}{for j in b}{for k in c}"
+                             "{i}{j}{k}"
+                             "{end}{end}{end}", G_MAXULONG);
+  check_loop (analysis, 2, "k", 3, G_MAXULONG, FALSE, G_MAXUINT64);
+  g_assert_cmpuint (ctpl_analysis_get_cost (analysis), ==, G_MAXUINT64);
+  g_assert_cmpuint (ctpl_analysis_get_output_size (analysis), ==, G_MAXUINT64);
+  ctpl_analysis_unref (analysis);
+}
+
+/* checks that iterators shadowing symbols are only excluded in their loops */
+static void
+check_scopes (void)
+{
+  CtplAnalysis *analysis;
+  
+  analysis = analyze_string ("{for x in x}{x}{for y in x}{y}{end}{end}{y}", 1);
+  g_assert_cmpuint (ctpl_analysis_get_symbol_reads (analysis, "x"), ==, 1);
+  g_assert_cmpuint (ctpl_analysis_get_symbol_reads (analysis, "y"), ==, 1);
+  ctpl_analysis_unref (analysis);
+}
+
+/* checks the JSON report */
+static void
+check_json (void)
+{
+  CtplAnalysis *analysis;
+  gchar        *json;
+  
+  analysis = analyze_string ("{for i in items}{i}, {end}", 10);
+  json = ctpl_analysis_to_json (analysis);
+  g_assert_cmpstr (json, ==,
+                   "{\n"
+                   "  \"symbols\": {\"items\": 1},\n"
+                   "  \"functions\": {},\n"
+                   "  \"literal_size\": 2,\n"
+                   "  \"max_loop_depth\": 1,\n"
+                   "  \"loops\": [\n"
+                   "    {\"iterator\": \"i\", \"depth\": 1, \"iterations\": 10, "
+                       "\"exact\": false, \"multiplier\": 10}\n"
+                   "  ],\n"
+                   "  \"cost\": 31,\n"
+                   "  \"output_size\": 100\n"
+                   "}\n");
+  g_free (json);
+  ctpl_analysis_unref (analysis);
+  
+  analysis = analyze_string ("data", 10);
+  json = ctpl_analysis_to_json (analysis);
+  g_assert_cmpstr (json, ==,
+                   "{\n"
+                   "  \"symbols\": {},\n"
+                   "  \"functions\": {},\n"
+                   "  \"literal_size\": 4,\n"
+                   "  \"max_loop_depth\": 0,\n"
+                   "  \"loops\": [],\n"
+                   "  \"cost\": 1,\n"
+                   "  \"output_size\": 4\n"
+                   "}\n");
+  g_free (json);
+  ctpl_analysis_unref (analysis);
+}
+
+
+int
+main (int     argc,
+      char  **argv)
+{
+  g_type_init ();
+  
+  check_report ();
+  check_ranges ();
+  check_scopes ();
+  check_json ();
+  
+  return 0;
+}
@@ -0,0 +1,331 @@
+/* Checks for ctpl_parser_parse_async() */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include <gio/gio.h>
+#ifdef G_OS_UNIX
+# include <sys/socket.h>
+#endif
+
+#include "../src/ctpl.h"
+#include "ctpl-test-lib.h"
+
+
+/* the size of the output of a chunk of the test template, at most */
+#define CHUNK_SIZE      104
+#define N_CHUNKS        20000
+#define HIGH_WATER_MARK 4096
+
+
+/* creates a template of @n_chunks chunks, each of at most CHUNK_SIZE bytes of
+ * output */
+static CtplToken *
+new_template (guint n_chunks)
+{
+  GString    *str = g_string_new (NULL);
+  CtplToken  *tree;
+  GError     *err = NULL;
+  guint       i;
+  
+  for (i = 0; i < n_chunks; i++) {
+    g_string_append (str, "{count()} ");
+    g_string_append (str, "the quick brown fox jumps over the lazy dog, "
+                          "the quick brown fox jumps over the lazy dog\n");
+  }
+  tree = ctpl_lexer_lex_string (str->str, &err);
+  g_assert_no_error (err);
+  g_string_free (str, TRUE);
+  
+  return tree;
+}
+
+typedef struct _AsyncState AsyncState;
+struct _AsyncState
+{
+  gboolean  done;
+  gboolean  rv;
+  GError   *error;
+};
+
+static void
+parse_ready (GObject      *object,
+             GAsyncResult *result,
+             gpointer      user_data)
+{
+  AsyncState *state = user_data;
+  
+  state->rv = ctpl_parser_parse_finish (result, &state->error);
+  state->done = TRUE;
+}
+
+/* renders @tree in @env with @options to a memory stream asynchronously */
+static gchar *
+render_async (const CtplToken          *tree,
+              CtplEnviron              *env,
+              const CtplParserOptions  *options,
+              GError                  **error)
+{
+  GOutputStream    *ostream;
+  CtplOutputStream *stream;
+  AsyncState        state = { FALSE, FALSE, NULL };
+  gchar            *output = NULL;
+  
+  ostream = g_memory_output_stream_new (NULL, 0, g_realloc, g_free);
+  stream = ctpl_output_stream_new (ostream);
+  ctpl_parser_parse_async (tree, env, stream, options, HIGH_WATER_MARK,
+                           G_PRIORITY_DEFAULT, NULL, parse_ready, &state);
+  /* nothing happens before the main loop runs */
+  g_assert_cmpuint (g_memory_output_stream_get_data_size (G_MEMORY_OUTPUT_STREAM (ostream)),
+                    ==, 0);
+  while (! state.done) {
+    g_main_context_iteration (NULL, TRUE);
+  }
+  if (! state.rv) {
+    g_propagate_error (error, state.error);
+  } else {
+    ctpl_output_stream_put_c (stream, 0, NULL);
+    g_output_stream_close (ostream, NULL, NULL);
+    output = g_memory_output_stream_steal_data (G_MEMORY_OUTPUT_STREAM (ostream));
+  }
+  ctpl_output_stream_unref (stream);
+  g_object_unref (ostream);
+  
+  return output;
+}
+
+/* checks that an asynchronous rendering outputs the same as a synchronous
+ * one, and reports the same errors */
+static void
+check_output (void)
+{
+  CtplEnviron       *env = ctpl_environ_new ();
+  CtplToken         *tree;
+  CtplParserOptions  options = { 0 };
+  guint              count = 0;
+  gchar             *expected;
+  gchar             *output;
+  GError            *err = NULL;
+  
+  ctpl_environ_add_function (env, "count", ctpltest_count_function, &count,
+                             NULL);
+  tree = new_template (1000);
+  expected = ctpltest_render_checked (tree, env);
+  count = 0;
+  output = render_async (tree, env, NULL, &err);
+  g_assert_no_error (err);
+  g_assert_cmpstr (output, ==, expected);
+  g_free (output);
+  g_free (expected);
+  ctpl_token_free (tree);
+  
+  /* an empty template */
+  output = render_async (NULL, env, NULL, &err);
+  g_assert_no_error (err);
+  g_assert_cmpstr (output, ==, "");
+  g_free (output);
+  
+  tree = ctpl_lexer_lex_string ("{count()} {missing}", &err);
+  g_assert_no_error (err);
+  g_assert (render_async (tree, env, NULL, &err) == NULL);
+  g_assert_error (err, CTPL_EVAL_ERROR, CTPL_EVAL_ERROR_SYMBOL_NOT_FOUND);
+  g_clear_error (&err);
+  ctpl_token_free (tree);
+  
+  /* the limits of the options apply */
+  tree = ctpl_lexer_lex_string ("{for i in range(1000000000)}{i}{end}", &err);
+  g_assert_no_error (err);
+  options.max_iterations = 1000;
+  g_assert (render_async (tree, env, &options, &err) == NULL);
+  g_assert_error (err, CTPL_PARSER_ERROR, CTPL_PARSER_ERROR_ITERATION_LIMIT);
+  g_clear_error (&err);
+  ctpl_token_free (tree);
+  
+  ctpl_environ_unref (env);
+}
+
+/* checks that the rendering runs from the main context that was the
+ * thread-default one when it was started */
+static void
+check_thread_default_context (void)
+{
+  CtplEnviron      *env = ctpl_environ_new ();
+  CtplToken        *tree;
+  GMainContext     *context = g_main_context_new ();
+  GOutputStream    *ostream;
+  CtplOutputStream *stream;
+  AsyncState        state = { FALSE, FALSE, NULL };
+  guint             count = 0;
+  gchar            *expected;
+  
+  ctpl_environ_add_function (env, "count", ctpltest_count_function, &count,
+                             NULL);
+  tree = new_template (100);
+  expected = ctpltest_render_checked (tree, env);
+  count = 0;
+  
+  ostream = g_memory_output_stream_new (NULL, 0, g_realloc, g_free);
+  stream = ctpl_output_stream_new (ostream);
+  g_main_context_push_thread_default (context);
+  ctpl_parser_parse_async (tree, env, stream, NULL, HIGH_WATER_MARK,
+                           G_PRIORITY_DEFAULT, NULL, parse_ready, &state);
+  /* the global default context doesn't render anything */
+  while (g_main_context_iteration (NULL, FALSE));
+  g_assert (! state.done);
+  g_assert_cmpuint (count, ==, 0);
+  g_assert_cmpuint (g_memory_output_stream_get_data_size (G_MEMORY_OUTPUT_STREAM (ostream)),
+                    ==, 0);
+  while (! state.done) {
+    g_main_context_iteration (context, TRUE);
+  }
+  g_main_context_pop_thread_default (context);
+  g_assert (state.rv);
+  g_assert_no_error (state.error);
+  g_assert_cmpuint (g_memory_output_stream_get_data_size (G_MEMORY_OUTPUT_STREAM (ostream)),
+                    ==, strlen (expected));
+  g_assert (memcmp (g_memory_output_stream_get_data (G_MEMORY_OUTPUT_STREAM (ostream)),
+                    expected, strlen (expected)) == 0);
+  
+  ctpl_output_stream_unref (stream);
+  g_object_unref (ostream);
+  g_main_context_unref (context);
+  g_free (expected);
+  ctpl_token_free (tree);
+  ctpl_environ_unref (env);
+}
+
+#ifdef G_OS_UNIX
+
+/* gets the length of the output of the first @n_chunks chunks of @output */
+static gsize
+rendered_length (const gchar *output,
+                 guint        n_chunks)
+{
+  const gchar *p = output;
+  
+  for (; n_chunks > 0 && (p = strchr (p, '\n')); n_chunks--) {
+    p++;
+  }
+  
+  return p ? (gsize) (p - output) : strlen (output);
+}
+
+/* reads what is available from @socket, appending it to @str */
+static void
+read_available (GSocket *socket,
+                GString *str)
+{
+  gchar   buf[4096];
+  gssize  n;
+  
+  while ((n = g_socket_receive (socket, buf, sizeof buf, NULL, NULL)) > 0) {
+    g_string_append_len (str, buf, n);
+  }
+}
+
+/* runs the main loop until there is nothing more to do without the output
+ * draining */
+static void
+run_until_blocked (void)
+{
+  while (g_main_context_iteration (NULL, FALSE));
+}
+
+/* checks that a rendering to a slow socket pauses, and resumes when the
+ * socket drains */
+static void
+check_socket (gboolean cancel)
+{
+  CtplEnviron        *env = ctpl_environ_new ();
+  CtplToken          *tree;
+  guint               count = 0;
+  gint                fds[2];
+  GSocket            *sockets[2];
+  GSocketConnection  *connection;
+  CtplOutputStream   *stream;
+  GCancellable       *cancellable = g_cancellable_new ();
+  GString            *received = g_string_new (NULL);
+  AsyncState          state = { FALSE, FALSE, NULL };
+  gchar              *expected;
+  GError             *err = NULL;
+  
+  ctpl_environ_add_function (env, "count", ctpltest_count_function, &count,
+                             NULL);
+  tree = new_template (N_CHUNKS);
+  expected = ctpltest_render_checked (tree, env);
+  count = 0;
+  
+  g_assert (socketpair (AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+  sockets[0] = g_socket_new_from_fd (fds[0], &err);
+  g_assert_no_error (err);
+  sockets[1] = g_socket_new_from_fd (fds[1], &err);
+  g_assert_no_error (err);
+  g_socket_set_blocking (sockets[1], FALSE);
+  connection = g_socket_connection_factory_create_connection (sockets[0]);
+  stream = ctpl_output_stream_new (g_io_stream_get_output_stream (G_IO_STREAM (connection)));
+  
+  ctpl_parser_parse_async (tree, env, stream, NULL, HIGH_WATER_MARK,
+                           G_PRIORITY_DEFAULT, cancellable, parse_ready,
+                           &state);
+  /* the socket doesn't take the whole output, so the rendering pauses with at
+   * most two buffers of data not written */
+  run_until_blocked ();
+  g_assert (! state.done);
+  g_assert_cmpuint (count, <, N_CHUNKS);
+  read_available (sockets[1], received);
+  g_assert_cmpuint (rendered_length (expected, count), <=,
+                    received->len + 2 * (HIGH_WATER_MARK + CHUNK_SIZE));
+  
+  if (cancel) {
+    guint paused_count = count;
+    
+    g_cancellable_cancel (cancellable);
+    while (! state.done) {
+      g_main_context_iteration (NULL, TRUE);
+    }
+    g_assert (! state.rv);
+    g_assert_error (state.error, G_IO_ERROR, G_IO_ERROR_CANCELLED);
+    g_clear_error (&state.error);
+    g_assert_cmpuint (count, ==, paused_count);
+  } else {
+    while (! state.done) {
+      run_until_blocked ();
+      read_available (sockets[1], received);
+    }
+    read_available (sockets[1], received);
+    g_assert (state.rv);
+    g_assert_no_error (state.error);
+    g_assert_cmpuint (received->len, ==, strlen (expected));
+    g_assert (memcmp (received->str, expected, received->len) == 0);
+  }
+  
+  ctpl_output_stream_unref (stream);
+  g_object_unref (connection);
+  g_object_unref (sockets[0]);
+  g_object_unref (sockets[1]);
+  g_object_unref (cancellable);
+  g_string_free (received, TRUE);
+  g_free (expected);
+  ctpl_token_free (tree);
+  ctpl_environ_unref (env);
+}
+
+#endif /* G_OS_UNIX */
+
+
+int
+main (int     argc,
+      char  **argv)
+{
+  g_type_init ();
+  
+  check_output ();
+  check_thread_default_context ();
+#ifdef G_OS_UNIX
+  check_socket (FALSE);
+  check_socket (TRUE);
+#endif
+
+  return 0;
+}
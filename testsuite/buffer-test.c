@@ -0,0 +1,114 @@
+/* Checks for ctpl_parser_parse_to_buffer() */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include <gio/gio.h>
+
+#include "../src/ctpl.h"
+#include "ctpl-test-lib.h"
+
+
+
+/* renders @tree in @env with ctpl_parser_parse_to_buffer() and checks the
+ * output is the same as with ctpl_parser_parse() */
+static void
+check_render (const CtplToken *tree,
+              CtplEnviron     *env,
+              gsize           *size_hint)
+{
+  gchar  *expected;
+  gchar  *output;
+  gsize   length;
+  GError *err = NULL;
+  
+  expected = ctpltest_render_checked (tree, env);
+  output = ctpl_parser_parse_to_buffer (tree, env, size_hint, &length, &err);
+  g_assert_no_error (err);
+  g_assert_cmpstr (output, ==, expected);
+  g_assert_cmpuint (length, ==, strlen (expected));
+  if (size_hint) {
+    /* the next rendering of the same output fits */
+    g_assert_cmpuint (*size_hint, >, length);
+  }
+  g_free (output);
+  g_free (expected);
+}
+
+/* checks how the size hint follows the size of the output */
+static void
+check_size_hint (void)
+{
+  CtplEnviron  *env = ctpl_environ_new ();
+  CtplToken    *tree;
+  gsize         size_hint = 0;
+  gsize         previous_hint;
+  GError       *err = NULL;
+  
+  tree = ctpl_lexer_lex_string ("<ul>{for i in range(n)}<li>{i}</li>{end}</ul>",
+                                &err);
+  g_assert_no_error (err);
+  ctpl_environ_push_int (env, "n", 3);
+  
+  check_render (tree, env, NULL);
+  check_render (tree, env, &size_hint);
+  /* the same output keeps the same hint */
+  previous_hint = size_hint;
+  check_render (tree, env, &size_hint);
+  g_assert_cmpuint (size_hint, ==, previous_hint);
+  
+  /* a larger output grows it */
+  ctpl_environ_push_int (env, "n", 1000);
+  check_render (tree, env, &size_hint);
+  g_assert_cmpuint (size_hint, >, previous_hint);
+  previous_hint = size_hint;
+  check_render (tree, env, &size_hint);
+  g_assert_cmpuint (size_hint, ==, previous_hint);
+  
+  /* a much smaller output shrinks it */
+  ctpl_environ_pop (env, "n", NULL);
+  check_render (tree, env, &size_hint);
+  g_assert_cmpuint (size_hint, <, previous_hint);
+  
+  /* a failure leaves it alone */
+  previous_hint = size_hint;
+  ctpl_environ_pop (env, "n", NULL);
+  g_assert (ctpl_parser_parse_to_buffer (tree, env, &size_hint, NULL,
+                                         &err) == NULL);
+  g_assert_error (err, CTPL_EVAL_ERROR, CTPL_EVAL_ERROR_SYMBOL_NOT_FOUND);
+  g_clear_error (&err);
+  g_assert_cmpuint (size_hint, ==, previous_hint);
+  
+  ctpl_token_free (tree);
+  ctpl_environ_unref (env);
+}
+
+/* checks an empty output */
+static void
+check_empty (void)
+{
+  CtplEnviron  *env = ctpl_environ_new ();
+  CtplToken    *tree;
+  gsize         size_hint = 0;
+  GError       *err = NULL;
+  
+  tree = ctpl_lexer_lex_string ("{if 0}never{end}", &err);
+  g_assert_no_error (err);
+  check_render (tree, env, &size_hint);
+  ctpl_token_free (tree);
+  ctpl_environ_unref (env);
+}
+
+
+int
+main (int     argc,
+      char  **argv)
+{
+  g_type_init ();
+  
+  check_size_hint ();
+  check_empty ();
+  
+  return 0;
+}
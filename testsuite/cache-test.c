@@ -0,0 +1,309 @@
+/* Checks for CtplCache and template dependencies */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include <gio/gio.h>
+
+#include "../src/ctpl.h"
+#include "ctpl-test-lib.h"
+
+
+
+/* checks that rendering @tree with @cache outputs the same as without it */
+static void
+check_render (const CtplToken *tree,
+              CtplEnviron     *env,
+              CtplCache       *cache,
+              const gchar     *expected)
+{
+  gchar  *output;
+  GError *err = NULL;
+  
+  output = ctpltest_render_checked (tree, env);
+  g_assert_cmpstr (output, ==, expected);
+  g_free (output);
+  g_assert (ctpltest_render (tree, env, cache, NULL, NULL, &output, &err));
+  g_assert_no_error (err);
+  g_assert_cmpstr (output, ==, expected);
+  g_free (output);
+}
+
+static void
+push_int (CtplEnviron *env,
+          const gchar *symbol,
+          glong        n)
+{
+  CtplValue *value = ctpl_value_new_int (n);
+  
+  ctpl_environ_push (env, symbol, value);
+  ctpl_value_free (value);
+}
+
+/* checks the symbols and functions a template depends on */
+static void
+check_dependencies (void)
+{
+  CtplToken  *tree;
+  gchar     **symbols;
+  gchar     **functions;
+  GError     *err = NULL;
+  
+  tree = ctpl_lexer_lex_string ("{a}{for i in items}{i + b[c]}{end}"
+                                "{if len(a) > max(d, i)}{a}{else}{e}{end}",
+                                &err);
+  g_assert_no_error (err);
+  symbols = ctpl_token_get_dependencies (tree, &functions);
+  /* the loop iterator is only a dependency out of its loop */
+  g_assert_cmpuint (g_strv_length (symbols), ==, 7);
+  g_assert_cmpstr (symbols[0], ==, "a");
+  g_assert_cmpstr (symbols[1], ==, "items");
+  g_assert_cmpstr (symbols[2], ==, "b");
+  g_assert_cmpstr (symbols[3], ==, "c");
+  g_assert_cmpstr (symbols[4], ==, "d");
+  g_assert_cmpstr (symbols[5], ==, "i");
+  g_assert_cmpstr (symbols[6], ==, "e");
+  g_assert_cmpuint (g_strv_length (functions), ==, 2);
+  g_assert_cmpstr (functions[0], ==, "len");
+  g_assert_cmpstr (functions[1], ==, "max");
+  g_strfreev (symbols);
+  g_strfreev (functions);
+  ctpl_token_free (tree);
+}
+
+/* checks that fragments are replayed only when their dependencies match */
+static void
+check_hits (void)
+{
+  CtplEnviron  *env = ctpl_environ_new ();
+  CtplCache    *cache = ctpl_cache_new (1024 * 1024);
+  CtplToken    *tree;
+  GError       *err = NULL;
+  
+  tree = ctpl_lexer_lex_string ("<{n}>{for i in range(n)}{i * k},{end}"
+                                "{if n > 2}big{else}small{end}", &err);
+  g_assert_no_error (err);
+  push_int (env, "n", 3);
+  push_int (env, "k", 2);
+  
+  check_render (tree, env, cache, "<3>0,2,4,big");
+  g_assert_cmpuint (ctpl_cache_get_hits (cache), ==, 0);
+  g_assert_cmpuint (ctpl_cache_get_misses (cache), ==, 2);
+  g_assert_cmpuint (ctpl_cache_get_size (cache), >, 0);
+  check_render (tree, env, cache, "<3>0,2,4,big");
+  g_assert_cmpuint (ctpl_cache_get_hits (cache), ==, 2);
+  g_assert_cmpuint (ctpl_cache_get_misses (cache), ==, 2);
+  
+  /* a changed dependency misses, the other fragment still hits */
+  push_int (env, "k", 3);
+  check_render (tree, env, cache, "<3>0,3,6,big");
+  g_assert_cmpuint (ctpl_cache_get_hits (cache), ==, 3);
+  g_assert_cmpuint (ctpl_cache_get_misses (cache), ==, 3);
+  /* the previous value is still cached */
+  ctpl_environ_pop (env, "k", NULL);
+  check_render (tree, env, cache, "<3>0,2,4,big");
+  g_assert_cmpuint (ctpl_cache_get_hits (cache), ==, 5);
+  g_assert_cmpuint (ctpl_cache_get_misses (cache), ==, 3);
+  
+  /* a value of another type is another entry */
+  ctpl_environ_pop (env, "k", NULL);
+  ctpl_environ_push_string (env, "k", "2");
+  check_render (tree, env, cache, "<3>,2,22,big");
+  g_assert_cmpuint (ctpl_cache_get_hits (cache), ==, 6);
+  g_assert_cmpuint (ctpl_cache_get_misses (cache), ==, 4);
+  
+  ctpl_cache_invalidate (cache);
+  g_assert_cmpuint (ctpl_cache_get_size (cache), ==, 0);
+  check_render (tree, env, cache, "<3>,2,22,big");
+  g_assert_cmpuint (ctpl_cache_get_hits (cache), ==, 6);
+  g_assert_cmpuint (ctpl_cache_get_misses (cache), ==, 6);
+  
+  ctpl_token_free (tree);
+  ctpl_cache_unref (cache);
+  ctpl_environ_unref (env);
+}
+
+/* checks that fragments calling host functions are not cached, but that the
+ * cacheable fragments they contain are */
+static void
+check_host_functions (void)
+{
+  CtplEnviron  *env = ctpl_environ_new ();
+  CtplCache    *cache = ctpl_cache_new (1024 * 1024);
+  CtplToken    *tree;
+  gchar        *output;
+  guint         count = 0;
+  GError       *err = NULL;
+  
+  tree = ctpl_lexer_lex_string ("{for i in range(2)}{count()}{end}"
+                                "{if count() >= 0}{for i in range(3)}{i}{end}"
+                                "{end}", &err);
+  g_assert_no_error (err);
+  ctpl_environ_add_function (env, "count", ctpltest_count_function, &count,
+                             NULL);
+  g_assert (ctpltest_render (tree, env, cache, NULL, NULL, &output, &err));
+  g_assert_no_error (err);
+  g_assert_cmpstr (output, ==, "01012");
+  g_free (output);
+  g_assert (ctpltest_render (tree, env, cache, NULL, NULL, &output, &err));
+  g_assert_no_error (err);
+  g_assert_cmpstr (output, ==, "34012");
+  g_free (output);
+  g_assert_cmpuint (ctpl_cache_get_hits (cache), ==, 1);
+  g_assert_cmpuint (ctpl_cache_get_misses (cache), ==, 1);
+  
+  ctpl_token_free (tree);
+  ctpl_cache_unref (cache);
+  ctpl_environ_unref (env);
+}
+
+/* resolves any symbol to 1 and 0 in turn, counting calls in @user_data */
+static gboolean
+toggle_resolver (CtplEnviron  *env,
+                 const gchar  *symbol,
+                 CtplValue    *value,
+                 gpointer      user_data)
+{
+  guint *n_calls = user_data;
+  
+  ctpl_value_set_int (value, (*n_calls)++ % 2 == 0);
+  
+  return TRUE;
+}
+
+/* checks that fragments reading values a resolver doesn't memoize are not
+ * cached, since the value the key was built from may not be the one the
+ * rendering reads */
+static void
+check_resolver (void)
+{
+  CtplEnviron  *env = ctpl_environ_new ();
+  CtplCache    *cache = ctpl_cache_new (1024 * 1024);
+  CtplToken    *tree;
+  gchar        *output;
+  guint         n_calls = 0;
+  guint         i;
+  GError       *err = NULL;
+  
+  tree = ctpl_lexer_lex_string ("{if n}<{n}>{end}", &err);
+  g_assert_no_error (err);
+  ctpl_environ_set_resolver (env, toggle_resolver, FALSE, &n_calls, NULL);
+  for (i = 0; i < 2; i++) {
+    g_assert (ctpltest_render (tree, env, cache, NULL, NULL, &output, &err));
+    g_assert_no_error (err);
+    g_assert_cmpstr (output, ==, "<0>");
+    g_free (output);
+  }
+  g_assert_cmpuint (n_calls, ==, 4);
+  g_assert_cmpuint (ctpl_cache_get_hits (cache), ==, 0);
+  g_assert_cmpuint (ctpl_cache_get_misses (cache), ==, 0);
+  g_assert_cmpuint (ctpl_cache_get_size (cache), ==, 0);
+  
+  /* memoized values are read once per rendering, so they can be cached */
+  n_calls = 0;
+  ctpl_environ_set_resolver (env, toggle_resolver, TRUE, &n_calls, NULL);
+  g_assert (ctpltest_render (tree, env, cache, NULL, NULL, &output, &err));
+  g_assert_no_error (err);
+  g_assert_cmpstr (output, ==, "<1>");
+  g_free (output);
+  g_assert_cmpuint (n_calls, ==, 1);
+  g_assert_cmpuint (ctpl_cache_get_misses (cache), ==, 1);
+  g_assert_cmpuint (ctpl_cache_get_size (cache), >, 0);
+  
+  ctpl_token_free (tree);
+  ctpl_cache_unref (cache);
+  ctpl_environ_unref (env);
+}
+
+/* checks that the least recently used entries are dropped first */
+static void
+check_eviction (void)
+{
+  CtplEnviron  *env = ctpl_environ_new ();
+  CtplCache    *cache;
+  CtplToken    *tree;
+  gsize         entry_size;
+  GError       *err = NULL;
+  
+  tree = ctpl_lexer_lex_string ("{if n}{n * 100}{end}", &err);
+  g_assert_no_error (err);
+  cache = ctpl_cache_new (1024 * 1024);
+  push_int (env, "n", 1);
+  check_render (tree, env, cache, "100");
+  entry_size = ctpl_cache_get_size (cache);
+  ctpl_cache_unref (cache);
+  
+  /* room for two entries of the same size */
+  cache = ctpl_cache_new (entry_size * 2);
+  check_render (tree, env, cache, "100");
+  push_int (env, "n", 2);
+  check_render (tree, env, cache, "200");
+  g_assert_cmpuint (ctpl_cache_get_size (cache), ==, entry_size * 2);
+  /* use n = 1 so that n = 2 is the least recently used */
+  ctpl_environ_pop (env, "n", NULL);
+  check_render (tree, env, cache, "100");
+  g_assert_cmpuint (ctpl_cache_get_hits (cache), ==, 1);
+  push_int (env, "n", 3);
+  check_render (tree, env, cache, "300");
+  g_assert_cmpuint (ctpl_cache_get_size (cache), ==, entry_size * 2);
+  ctpl_environ_pop (env, "n", NULL);
+  check_render (tree, env, cache, "100");
+  g_assert_cmpuint (ctpl_cache_get_hits (cache), ==, 2);
+  push_int (env, "n", 2);
+  check_render (tree, env, cache, "200");
+  g_assert_cmpuint (ctpl_cache_get_hits (cache), ==, 2);
+  ctpl_cache_unref (cache);
+  
+  /* an entry larger than the cache is not stored */
+  cache = ctpl_cache_new (entry_size - 1);
+  check_render (tree, env, cache, "200");
+  g_assert_cmpuint (ctpl_cache_get_size (cache), ==, 0);
+  check_render (tree, env, cache, "200");
+  g_assert_cmpuint (ctpl_cache_get_hits (cache), ==, 0);
+  ctpl_cache_unref (cache);
+  
+  ctpl_token_free (tree);
+  ctpl_environ_unref (env);
+}
+
+/* checks that errors are reported the same way, and not cached */
+static void
+check_errors (void)
+{
+  CtplEnviron  *env = ctpl_environ_new ();
+  CtplCache    *cache = ctpl_cache_new (1024 * 1024);
+  CtplToken    *tree;
+  gchar        *output;
+  GError       *err = NULL;
+  
+  tree = ctpl_lexer_lex_string ("{if n}{n / 0}{end}", &err);
+  g_assert_no_error (err);
+  push_int (env, "n", 1);
+  g_assert (! ctpltest_render (tree, env, cache, NULL, NULL, &output, &err));
+  g_assert (err != NULL);
+  g_clear_error (&err);
+  g_free (output);
+  g_assert_cmpuint (ctpl_cache_get_size (cache), ==, 0);
+  
+  ctpl_token_free (tree);
+  ctpl_cache_unref (cache);
+  ctpl_environ_unref (env);
+}
+
+
+int
+main (int     argc,
+      char  **argv)
+{
+  g_type_init ();
+  
+  check_dependencies ();
+  check_hits ();
+  check_host_functions ();
+  check_resolver ();
+  check_eviction ();
+  check_errors ();
+  
+  return 0;
+}
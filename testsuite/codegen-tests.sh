@@ -0,0 +1,119 @@
+#!/bin/sh
+
+#
+# compiles the success templates to C with the CLI tool's --compile option,
+# and checks that the compiled templates render the same as the interpreter.
+#
+# CC, CTPL_TEST_CFLAGS and CTPL_TEST_LIBS tell how to build against the
+# library, and LIBTOOL how to link and run; set it empty not to use libtool.
+#
+
+# automake tests integration
+top_srcdir="${top_srcdir:-..}"
+top_builddir="${top_builddir:-..}"
+srcdir="${srcdir:-.}"
+LIBTOOL="${LIBTOOL-${top_builddir}/libtool}"
+CC="${CC:-cc}"
+CTPL_TEST_LIBS="${CTPL_TEST_LIBS:-${top_builddir}/src/libctpl.la}"
+
+TESTPRG="${CTPL:-${LIBTOOL:+$LIBTOOL --mode=execute }${top_builddir}/src/ctpl}"
+
+ARGS="-e ${srcdir}/environ"
+
+tmpdir="$(mktemp -d)" || exit 1
+
+# display error on exit
+trap "
+rm -rf '$tmpdir'
+echo                             >&2
+echo '*************************' >&2
+echo '***      FAILED!      ***' >&2
+echo '*************************' >&2
+" EXIT
+
+# the generated code includes <ctpl/ctpl.h>
+ln -s "$(cd "${top_srcdir}/src" && pwd)" "$tmpdir/ctpl" || exit 1
+
+cat > "$tmpdir/main.c" << EOF
+#include <stdio.h>
+#include <glib.h>
+#include <gio/gio.h>
+#include <ctpl/ctpl.h>
+
+gboolean render_template (CtplEnviron       *env,
+                          CtplOutputStream  *output,
+                          GError           **error);
+
+int
+main (int     argc,
+      char  **argv)
+{
+  CtplEnviron      *env;
+  GOutputStream    *ostream;
+  CtplOutputStream *stream;
+  GError           *err = NULL;
+
+  g_type_init ();
+
+  env = ctpl_environ_new ();
+  ostream = g_memory_output_stream_new (NULL, 0, g_realloc, g_free);
+  stream = ctpl_output_stream_new (ostream);
+  if (! ctpl_environ_add_from_path (env, argv[1], &err) ||
+      ! render_template (env, stream, &err)) {
+    fprintf (stderr, "%s\n", err->message);
+    return 1;
+  }
+  fwrite (g_memory_output_stream_get_data (G_MEMORY_OUTPUT_STREAM (ostream)),
+          1, g_memory_output_stream_get_data_size (G_MEMORY_OUTPUT_STREAM (ostream)),
+          stdout);
+  ctpl_output_stream_unref (stream);
+  g_object_unref (ostream);
+  ctpl_environ_unref (env);
+
+  return 0;
+}
+EOF
+
+for f in $(ls "${srcdir}/"success/* | grep -v -e '-output$'); do
+  echo "*** codegen test '$f'"
+  $TESTPRG --compile=render_template -o "$tmpdir/template.c" "$f" || exit 1
+  echo "  * building..."
+  ${LIBTOOL:+$LIBTOOL --mode=link} $CC $CTPL_TEST_CFLAGS -I"$tmpdir" \
+    -o "$tmpdir/template" "$tmpdir/template.c" "$tmpdir/main.c" \
+    $CTPL_TEST_LIBS || exit 1
+  $TESTPRG $ARGS "$f" > "$tmpdir/expected" || exit 1
+  ${LIBTOOL:+$LIBTOOL --mode=execute} "$tmpdir/template" "${srcdir}/environ" \
+    > "$tmpdir/output" || exit 1
+  echo "  * checking output..."
+  if ! diff -u "$tmpdir/expected" "$tmpdir/output"; then
+    echo "*** Compiled template output differs from the interpreter's" >&2
+    exit 1
+  fi
+done
+
+# the templates that can be compiled must fail with the interpreter's error
+for f in "${srcdir}/"fail/*; do
+  echo "*** codegen fail test '$f'"
+  $TESTPRG --compile=render_template -o "$tmpdir/template.c" "$f" \
+    2>/dev/null || continue
+  echo "  * building..."
+  ${LIBTOOL:+$LIBTOOL --mode=link} $CC $CTPL_TEST_CFLAGS -I"$tmpdir" \
+    -o "$tmpdir/template" "$tmpdir/template.c" "$tmpdir/main.c" \
+    $CTPL_TEST_LIBS || exit 1
+  $TESTPRG $ARGS "$f" > /dev/null 2> "$tmpdir/expected-error" && exit 1
+  ${LIBTOOL:+$LIBTOOL --mode=execute} "$tmpdir/template" "${srcdir}/environ" \
+    > /dev/null 2> "$tmpdir/error" && exit 1
+  echo "  * checking error..."
+  if ! grep -F -e "$(cat "$tmpdir/error")" "$tmpdir/expected-error" >/dev/null; then
+    echo "*** Compiled template error differs from the interpreter's" >&2
+    exit 1
+  fi
+done
+
+# remove error on exit
+trap "rm -rf '$tmpdir'" EXIT
+
+echo
+echo '*************************'
+echo '*** ALL TESTS PASSED! ***'
+echo '*************************'
@@ -5,12 +5,164 @@
 #include <glib.h>
 #include <gio/gio.h>
 #include <string.h>
-#include <stdlib.h>
 
 #include "../src/ctpl.h"
 #include "ctpl-test-lib.h"
 
 
+/* gets the data written to @ostream as a new string */
+static gchar *
+get_output (GOutputStream *ostream)
+{
+  gchar    *output;
+  gpointer  p;
+  gsize     size;
+  
+  p = g_memory_output_stream_get_data (G_MEMORY_OUTPUT_STREAM (ostream));
+  #if GLIB_CHECK_VERSION (2, 18, 0)
+  size = g_memory_output_stream_get_data_size (G_MEMORY_OUTPUT_STREAM (ostream));
+  #else
+  /* this is wrong but hope it's correct enough... */
+  size = g_memory_output_stream_get_size (G_MEMORY_OUTPUT_STREAM (ostream));
+  #endif
+  output = g_malloc (size + 1);
+  memcpy (output, p, size);
+  output[size] = 0;
+  
+  return output;
+}
+
+/* renders @tree in @env, with @cache, @arena and @options if not %NULL, and
+ * sets @output to what was written, even on failure.  @cache and @arena
+ * override those of @options */
+gboolean
+ctpltest_render (const CtplToken          *tree,
+                 CtplEnviron              *env,
+                 CtplCache                *cache,
+                 CtplArena                *arena,
+                 const CtplParserOptions  *options,
+                 gchar                   **output,
+                 GError                  **error)
+{
+  GOutputStream    *ostream;
+  CtplOutputStream *stream;
+  gboolean          rv;
+  
+  ostream = g_memory_output_stream_new (NULL, 0, g_realloc, g_free);
+  stream = ctpl_output_stream_new (ostream);
+  if (options || (cache && arena)) {
+    CtplParserOptions combined = { 0 };
+    
+    if (options) {
+      combined = *options;
+    }
+    if (cache) {
+      combined.cache = cache;
+    }
+    if (arena) {
+      combined.arena = arena;
+    }
+    rv = ctpl_parser_parse_with_options (tree, env, stream, &combined, error);
+  } else if (cache) {
+    rv = ctpl_parser_parse_cached (tree, env, stream, cache, error);
+  } else if (arena) {
+    rv = ctpl_parser_parse_with_arena (tree, env, stream, arena, error);
+  } else {
+    rv = ctpl_parser_parse (tree, env, stream, error);
+  }
+  /* the output stream is still usable after a failure */
+  g_assert (ctpl_output_stream_put_c (stream, 0, NULL));
+  g_output_stream_close (ostream, NULL, NULL);
+  *output = g_memory_output_stream_steal_data (G_MEMORY_OUTPUT_STREAM (ostream));
+  ctpl_output_stream_unref (stream);
+  g_object_unref (ostream);
+  
+  return rv;
+}
+
+/* renders @tree in @env, checking that it succeeds, and returns the output */
+gchar *
+ctpltest_render_checked (const CtplToken *tree,
+                         CtplEnviron     *env)
+{
+  gchar  *output;
+  GError *err = NULL;
+  
+  g_assert (ctpltest_render (tree, env, NULL, NULL, NULL, &output, &err));
+  g_assert_no_error (err);
+  
+  return output;
+}
+
+/* lexes @template, that must be valid, and renders it in @env like
+ * ctpltest_render(), returning the output, even on failure */
+gchar *
+ctpltest_render_string (const gchar             *template,
+                        CtplEnviron             *env,
+                        CtplArena               *arena,
+                        const CtplParserOptions *options,
+                        GError                 **error)
+{
+  CtplToken  *tree;
+  GError     *err = NULL;
+  gchar      *output;
+  
+  tree = ctpl_lexer_lex_string (template, &err);
+  g_assert_no_error (err);
+  ctpltest_render (tree, env, NULL, arena, options, &output, error);
+  ctpl_token_free (tree);
+  
+  return output;
+}
+
+/* renders @template in @env, checking that it succeeds, and returns the
+ * output */
+gchar *
+ctpltest_render_string_checked (const gchar *template,
+                                CtplEnviron *env)
+{
+  gchar  *output;
+  GError *err = NULL;
+  
+  output = ctpltest_render_string (template, env, NULL, NULL, &err);
+  g_assert_no_error (err);
+  
+  return output;
+}
+
+/* a host function returning how many times it was called before, counting
+ * calls in @user_data, a guint */
+gboolean
+ctpltest_count_function (CtplEnviron      *env,
+                         const gchar      *name,
+                         const CtplValue **args,
+                         guint             n_args,
+                         CtplValue        *result,
+                         gpointer          user_data,
+                         GError          **error)
+{
+  guint *count = user_data;
+  
+  ctpl_value_set_int (result, (*count)++);
+  
+  return TRUE;
+}
+
+/* a resolver resolving any symbol to the number of calls so far, counting
+ * them in @user_data, a guint */
+gboolean
+ctpltest_count_resolver (CtplEnviron  *env,
+                         const gchar  *symbol,
+                         CtplValue    *value,
+                         gpointer      user_data)
+{
+  guint *n_calls = user_data;
+  
+  ctpl_value_set_int (value, ++ (*n_calls));
+  
+  return TRUE;
+}
+
 /* parses a string with CTPL, returns the output, or %NULL on failure */
 gchar *
 ctpltest_parse_string (const gchar  *string,
@@ -25,28 +177,10 @@ ctpltest_parse_string (const gchar  *string,
   if (ctpl_environ_add_from_string (env, env_string, error)) {
     tree = ctpl_lexer_lex_string (string, error);
     if (tree) {
-      GOutputStream    *ostream;
-      CtplOutputStream *stream;
-      
-      ostream = g_memory_output_stream_new (NULL, 0, realloc, free);
-      stream = ctpl_output_stream_new (ostream);
-      if (ctpl_parser_parse (tree, env, stream, error)) {
-        gpointer  p;
-        gsize     size;
-        
-        p = g_memory_output_stream_get_data (G_MEMORY_OUTPUT_STREAM (ostream));
-        #if GLIB_CHECK_VERSION (2, 18, 0)
-        size = g_memory_output_stream_get_data_size (G_MEMORY_OUTPUT_STREAM (ostream));
-        #else
-        /* this is wrong but hope it's correct enough... */
-        size = g_memory_output_stream_get_size (G_MEMORY_OUTPUT_STREAM (ostream));
-        #endif
-        output = g_malloc (size + 1);
-        memcpy (output, p, size);
-        output[size] = 0;
+      if (! ctpltest_render (tree, env, NULL, NULL, NULL, &output, error)) {
+        g_free (output);
+        output = NULL;
       }
-      g_object_unref (stream);
-      g_object_unref (ostream);
       ctpl_token_free (tree);
     }
   }
@@ -54,3 +188,43 @@ ctpltest_parse_string (const gchar  *string,
   
   return output;
 }
+
+/* parses a string with CTPL one top-level token at a time, like
+ * ctpltest_parse_string() */
+gchar *
+ctpltest_parse_string_streamed (const gchar  *string,
+                                const gchar  *env_string,
+                                GError      **error)
+{
+  CtplEnviron *env;
+  gchar       *output = NULL;
+  
+  env = ctpl_environ_new ();
+  if (ctpl_environ_add_from_string (env, env_string, error)) {
+    CtplInputStream  *input;
+    GOutputStream    *ostream;
+    CtplOutputStream *stream;
+    CtplToken        *token;
+    GError           *err = NULL;
+    
+    input = ctpl_input_stream_new_for_memory (string, -1, NULL, NULL);
+    ostream = g_memory_output_stream_new (NULL, 0, g_realloc, g_free);
+    stream = ctpl_output_stream_new (ostream);
+    while ((token = ctpl_lexer_lex_next (input, &err)) != NULL &&
+           ctpl_parser_parse (token, env, stream, &err)) {
+      ctpl_token_free (token);
+    }
+    ctpl_token_free (token);
+    if (err) {
+      g_propagate_error (error, err);
+    } else {
+      output = get_output (ostream);
+    }
+    g_object_unref (stream);
+    g_object_unref (ostream);
+    ctpl_input_stream_unref (input);
+  }
+  ctpl_environ_unref (env);
+  
+  return output;
+}
@@ -8,9 +8,41 @@
 G_BEGIN_DECLS
 
 
+gboolean        ctpltest_render               (const CtplToken          *tree,
+                                               CtplEnviron              *env,
+                                               CtplCache                *cache,
+                                               CtplArena                *arena,
+                                               const CtplParserOptions  *options,
+                                               gchar                   **output,
+                                               GError                  **error);
+gchar          *ctpltest_render_checked       (const CtplToken  *tree,
+                                               CtplEnviron      *env);
+gchar          *ctpltest_render_string        (const gchar              *template,
+                                               CtplEnviron              *env,
+                                               CtplArena                *arena,
+                                               const CtplParserOptions  *options,
+                                               GError                  **error);
+gchar          *ctpltest_render_string_checked
+                                              (const gchar  *template,
+                                               CtplEnviron  *env);
+gboolean        ctpltest_count_function       (CtplEnviron      *env,
+                                               const gchar      *name,
+                                               const CtplValue **args,
+                                               guint             n_args,
+                                               CtplValue        *result,
+                                               gpointer          user_data,
+                                               GError          **error);
+gboolean        ctpltest_count_resolver       (CtplEnviron  *env,
+                                               const gchar  *symbol,
+                                               CtplValue    *value,
+                                               gpointer      user_data);
 gchar          *ctpltest_parse_string         (const gchar  *string,
                                                const gchar  *env_string,
                                                GError      **error);
+gchar          *ctpltest_parse_string_streamed
+                                              (const gchar  *string,
+                                               const gchar  *env_string,
+                                               GError      **error);
 
 
 G_END_DECLS
@@ -0,0 +1,527 @@
+/* Checks for CtplEnviron's parallel loading, snapshots, resolvers,
+ * functions and fingerprints */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "../src/ctpl.h"
+#include "ctpl-test-lib.h"
+
+
+
+/* dumps all values of the @n_symbols symbols named @symbols<N> of @env,
+ * popping them */
+static gchar *
+dump_environ (CtplEnviron  *env,
+              const gchar  *symbols,
+              guint         n_symbols)
+{
+  GString  *dump = g_string_new (NULL);
+  guint     i;
+  
+  for (i = 0; i < n_symbols; i++) {
+    gchar      *symbol = g_strdup_printf ("%s%u", symbols, i);
+    CtplValue  *value;
+    
+    g_string_append_printf (dump, "%s:", symbol);
+    while (ctpl_environ_pop (env, symbol, &value)) {
+      gchar *str = ctpl_value_to_string (value);
+      
+      g_string_append_printf (dump, " %s", str);
+      g_free (str);
+      ctpl_value_free (value);
+    }
+    g_string_append_c (dump, '\n');
+    g_free (symbol);
+  }
+  
+  return g_string_free (dump, FALSE);
+}
+
+/* loads @str both sequentially and in parallel and checks the results are the
+ * same */
+static void
+check_parallel (const gchar *str,
+                guint        n_symbols,
+                gboolean     success)
+{
+  GError       *err = NULL;
+  gchar        *path;
+  gint          fd;
+  guint         n_threads;
+  gchar        *expected_dump;
+  gchar        *expected_error = NULL;
+  guint64       expected_fingerprint;
+  CtplEnviron  *env;
+  
+  fd = g_file_open_tmp ("ctpl-environ-test-XXXXXX", &path, &err);
+  g_assert_no_error (err);
+  close (fd);
+  g_file_set_contents (path, str, -1, &err);
+  g_assert_no_error (err);
+  
+  env = ctpl_environ_new ();
+  g_assert (ctpl_environ_add_from_path (env, path, &err) == success);
+  if (! success) {
+    g_assert (err != NULL);
+    expected_error = g_strdup (err->message);
+    g_clear_error (&err);
+  }
+  expected_fingerprint = ctpl_environ_get_fingerprint (env);
+  expected_dump = dump_environ (env, "sym", n_symbols);
+  g_assert_cmpuint (ctpl_environ_get_fingerprint (env), ==, 0);
+  ctpl_environ_unref (env);
+  
+  for (n_threads = 0; n_threads < 8; n_threads++) {
+    gchar *dump;
+    
+    env = ctpl_environ_new ();
+    /* check merging into an existing environ too */
+    if (n_threads % 2) {
+      ctpl_environ_push_int (env, "unrelated", 42);
+    }
+    g_assert (ctpl_environ_add_from_path_parallel (env, path, n_threads,
+                                                   &err) == success);
+    if (! success) {
+      g_assert (err != NULL);
+      g_assert_cmpstr (err->message, ==, expected_error);
+      g_clear_error (&err);
+    }
+    ctpl_environ_pop (env, "unrelated", NULL);
+    g_assert_cmpuint (ctpl_environ_get_fingerprint (env), ==,
+                      expected_fingerprint);
+    dump = dump_environ (env, "sym", n_symbols);
+    g_assert_cmpstr (dump, ==, expected_dump);
+    g_free (dump);
+    ctpl_environ_unref (env);
+  }
+  
+  g_free (expected_error);
+  g_free (expected_dump);
+  g_unlink (path);
+  g_free (path);
+}
+
+/* checks that a snapshot of the environment described by @str loads back to
+ * the same environment, both lazily and not */
+static void
+check_snapshot (const gchar *str,
+                guint        n_symbols)
+{
+  GError       *err = NULL;
+  gchar        *path;
+  gint          fd;
+  gchar        *expected_dump;
+  guint64       expected_fingerprint;
+  gchar        *dump;
+  CtplEnviron  *env;
+  GPtrArray    *values;
+  guint         i;
+  
+  fd = g_file_open_tmp ("ctpl-environ-test-XXXXXX", &path, &err);
+  g_assert_no_error (err);
+  close (fd);
+  
+  env = ctpl_environ_new ();
+  g_assert (ctpl_environ_add_from_string (env, str, &err));
+  g_assert_no_error (err);
+  g_assert (ctpl_environ_write_snapshot (env, path, &err));
+  g_assert_no_error (err);
+  expected_fingerprint = ctpl_environ_get_fingerprint (env);
+  expected_dump = dump_environ (env, "sym", n_symbols);
+  ctpl_environ_unref (env);
+  
+  /* lazy loading */
+  env = ctpl_environ_new ();
+  g_assert (ctpl_environ_add_from_snapshot (env, path, &err));
+  g_assert_no_error (err);
+  g_assert (ctpl_environ_lookup (env, "not-a-symbol") == NULL);
+  ctpl_environ_push_int (env, "sym0", 1);
+  ctpl_environ_pop (env, "sym0", NULL);
+  g_assert_cmpuint (ctpl_environ_get_fingerprint (env), ==,
+                    expected_fingerprint);
+  dump = dump_environ (env, "sym", n_symbols);
+  g_assert_cmpstr (dump, ==, expected_dump);
+  g_free (dump);
+  ctpl_environ_unref (env);
+  
+  /* loading into a non-empty environ */
+  env = ctpl_environ_new ();
+  ctpl_environ_push_int (env, "unrelated", 42);
+  g_assert (ctpl_environ_add_from_snapshot (env, path, &err));
+  g_assert_no_error (err);
+  ctpl_environ_pop (env, "unrelated", NULL);
+  g_assert_cmpuint (ctpl_environ_get_fingerprint (env), ==,
+                    expected_fingerprint);
+  dump = dump_environ (env, "sym", n_symbols);
+  g_assert_cmpstr (dump, ==, expected_dump);
+  g_free (dump);
+  ctpl_environ_unref (env);
+  
+  /* values outlive the environ they were loaded in */
+  env = ctpl_environ_new ();
+  g_assert (ctpl_environ_add_from_snapshot (env, path, &err));
+  g_assert_no_error (err);
+  values = g_ptr_array_new ();
+  for (i = 0; i < n_symbols; i++) {
+    gchar            *symbol = g_strdup_printf ("sym%u", i);
+    const CtplValue  *value = ctpl_environ_lookup (env, symbol);
+    
+    if (value) {
+      g_ptr_array_add (values, ctpl_value_dup (value));
+    }
+    g_free (symbol);
+  }
+  ctpl_environ_unref (env);
+  for (i = 0; i < values->len; i++) {
+    gchar *str = ctpl_value_to_string (values->pdata[i]);
+    
+    g_assert (strstr (expected_dump, str) != NULL);
+    g_free (str);
+    ctpl_value_free (values->pdata[i]);
+  }
+  g_ptr_array_free (values, TRUE);
+  
+  /* something that is not a snapshot */
+  g_file_set_contents (path, str, -1, &err);
+  g_assert_no_error (err);
+  env = ctpl_environ_new ();
+  g_assert (! ctpl_environ_add_from_snapshot (env, path, &err));
+  g_assert_error (err, CTPL_ENVIRON_ERROR, CTPL_ENVIRON_ERROR_FAILED);
+  g_clear_error (&err);
+  ctpl_environ_unref (env);
+  
+  g_free (expected_dump);
+  g_unlink (path);
+  g_free (path);
+}
+
+/* resolves symbols named "r<N>" to N, counting calls in @user_data */
+static gboolean
+resolve_func (CtplEnviron  *env,
+              const gchar  *symbol,
+              CtplValue    *value,
+              gpointer      user_data)
+{
+  guint *n_calls = user_data;
+  
+  (*n_calls) ++;
+  if (symbol[0] != 'r') {
+    return FALSE;
+  }
+  ctpl_value_set_int (value, atol (&symbol[1]));
+  
+  return TRUE;
+}
+
+/* checks symbol resolution with and without memoization */
+static void
+check_resolver (gboolean memoize)
+{
+  CtplEnviron      *env;
+  const CtplValue  *value;
+  guint             n_calls = 0;
+  
+  env = ctpl_environ_new ();
+  ctpl_environ_push_int (env, "r1", 100);
+  ctpl_environ_set_resolver (env, resolve_func, memoize, &n_calls, NULL);
+  
+  /* existing symbols don't need resolution */
+  value = ctpl_environ_lookup (env, "r1");
+  g_assert_cmpint (ctpl_value_get_int (value), ==, 100);
+  g_assert_cmpuint (n_calls, ==, 0);
+  
+  value = ctpl_environ_lookup (env, "r2");
+  g_assert_cmpint (ctpl_value_get_int (value), ==, 2);
+  g_assert_cmpuint (n_calls, ==, 1);
+  value = ctpl_environ_lookup (env, "r2");
+  g_assert_cmpint (ctpl_value_get_int (value), ==, 2);
+  g_assert_cmpuint (n_calls, ==, memoize ? 1 : 2);
+  
+  g_assert (ctpl_environ_lookup (env, "unknown") == NULL);
+  
+  /* pushed values hide resolved ones */
+  ctpl_environ_push_int (env, "r2", 42);
+  g_assert_cmpint (ctpl_value_get_int (ctpl_environ_lookup (env, "r2")), ==, 42);
+  ctpl_environ_pop (env, "r2", NULL);
+  g_assert_cmpint (ctpl_value_get_int (ctpl_environ_lookup (env, "r2")), ==, 2);
+  
+  /* forgetting resolved values asks the resolver again */
+  n_calls = 0;
+  ctpl_environ_forget_resolved (env);
+  ctpl_environ_lookup (env, "r2");
+  g_assert_cmpuint (n_calls, ==, 1);
+  
+  /* and without a resolver, nothing is resolved anymore */
+  ctpl_environ_set_resolver (env, NULL, FALSE, NULL, NULL);
+  g_assert (ctpl_environ_lookup (env, "r2") == NULL);
+  g_assert_cmpint (ctpl_value_get_int (ctpl_environ_lookup (env, "r1")), ==, 100);
+  
+  ctpl_environ_unref (env);
+}
+
+/* checks that memoized values only live as long as the render using them */
+static void
+check_resolver_renders (void)
+{
+  CtplEnviron  *env;
+  guint         n_calls = 0;
+  gchar        *output;
+  
+  env = ctpl_environ_new ();
+  ctpl_environ_set_resolver (env, ctpltest_count_resolver, TRUE, &n_calls,
+                             NULL);
+  
+  output = ctpltest_render_string_checked ("{c},{c},{c + c}", env);
+  g_assert_cmpstr (output, ==, "1,1,2");
+  g_free (output);
+  /* the next render sees fresh values */
+  output = ctpltest_render_string_checked ("{c},{c}", env);
+  g_assert_cmpstr (output, ==, "2,2");
+  g_free (output);
+  g_assert_cmpuint (n_calls, ==, 2);
+  
+  /* a lookup outside of any render stays memoized until the next one ends */
+  g_assert_cmpint (ctpl_value_get_int (ctpl_environ_lookup (env, "d")), ==, 3);
+  g_assert_cmpint (ctpl_value_get_int (ctpl_environ_lookup (env, "d")), ==, 3);
+  output = ctpltest_render_string_checked ("{d}", env);
+  g_assert_cmpstr (output, ==, "3");
+  g_free (output);
+  output = ctpltest_render_string_checked ("{d}", env);
+  g_assert_cmpstr (output, ==, "4");
+  g_free (output);
+  
+  ctpl_environ_unref (env);
+}
+
+/* a host function concatenating the string form of its arguments */
+static gboolean
+concat_func (CtplEnviron      *env,
+             const gchar      *name,
+             const CtplValue **args,
+             guint             n_args,
+             CtplValue        *result,
+             gpointer          user_data,
+             GError          **error)
+{
+  GString  *str = g_string_new (user_data);
+  guint     i;
+  
+  for (i = 0; i < n_args; i++) {
+    gchar *arg = ctpl_value_to_string (args[i]);
+    
+    g_string_append (str, arg);
+    g_free (arg);
+  }
+  ctpl_value_set_string (result, str->str);
+  g_string_free (str, TRUE);
+  
+  return TRUE;
+}
+
+/* evaluates @expr in @env as a string */
+static gchar *
+eval_string (CtplEnviron  *env,
+             const gchar  *expr,
+             GError      **error)
+{
+  CtplTokenExpr  *token;
+  CtplValue       value;
+  gchar          *str = NULL;
+  
+  token = ctpl_lexer_expr_lex_string (expr, -1, error);
+  g_assert (token != NULL);
+  ctpl_value_init (&value);
+  if (ctpl_eval_value (token, env, &value, error)) {
+    str = ctpl_value_to_string (&value);
+  }
+  ctpl_value_free_value (&value);
+  ctpl_token_expr_free (token);
+  
+  return str;
+}
+
+/* checks host functions */
+static void
+check_functions (void)
+{
+  CtplEnviron  *env;
+  gchar        *str;
+  GError       *err = NULL;
+  
+  env = ctpl_environ_new ();
+  ctpl_environ_push_int (env, "a", 4);
+  ctpl_environ_add_function (env, "concat", concat_func, g_strdup (">"),
+                             g_free);
+  str = eval_string (env, "concat(a, \"b\", a * 2)", &err);
+  g_assert_no_error (err);
+  g_assert_cmpstr (str, ==, ">4b8");
+  g_free (str);
+  
+  /* host functions hide built-in ones */
+  str = eval_string (env, "len(\"abc\")", &err);
+  g_assert_no_error (err);
+  g_assert_cmpstr (str, ==, "3");
+  g_free (str);
+  ctpl_environ_add_function (env, "len", concat_func, NULL, NULL);
+  str = eval_string (env, "len(\"abc\")", &err);
+  g_assert_no_error (err);
+  g_assert_cmpstr (str, ==, "abc");
+  g_free (str);
+  
+  g_assert (ctpl_environ_remove_function (env, "concat"));
+  g_assert (! ctpl_environ_remove_function (env, "concat"));
+  str = eval_string (env, "concat(a)", &err);
+  g_assert_error (err, CTPL_EVAL_ERROR, CTPL_EVAL_ERROR_SYMBOL_NOT_FOUND);
+  g_assert (str == NULL);
+  g_clear_error (&err);
+  
+  ctpl_environ_unref (env);
+}
+
+/* returns the fingerprint of the environment described by @str */
+static guint64
+fingerprint_string (const gchar *str)
+{
+  CtplEnviron  *env = ctpl_environ_new ();
+  GError       *err = NULL;
+  guint64       fingerprint;
+  
+  g_assert (ctpl_environ_add_from_string (env, str, &err));
+  g_assert_no_error (err);
+  fingerprint = ctpl_environ_get_fingerprint (env);
+  ctpl_environ_unref (env);
+  
+  return fingerprint;
+}
+
+/* checks that fingerprints follow the content of environments */
+static void
+check_fingerprint (void)
+{
+  CtplEnviron  *env = ctpl_environ_new ();
+  CtplEnviron  *other;
+  guint64       empty;
+  guint64       fingerprint;
+  gint          i;
+  
+  empty = ctpl_environ_get_fingerprint (env);
+  ctpl_environ_push_int (env, "a", 1);
+  ctpl_environ_push_string (env, "b", "x");
+  fingerprint = ctpl_environ_get_fingerprint (env);
+  g_assert_cmpuint (fingerprint, !=, empty);
+  
+  /* hidden values don't count, and popping restores the fingerprint */
+  ctpl_environ_push_int (env, "a", 2);
+  g_assert_cmpuint (ctpl_environ_get_fingerprint (env), !=, fingerprint);
+  ctpl_environ_pop (env, "a", NULL);
+  g_assert_cmpuint (ctpl_environ_get_fingerprint (env), ==, fingerprint);
+  ctpl_environ_pop (env, "a", NULL);
+  ctpl_environ_pop (env, "b", NULL);
+  g_assert_cmpuint (ctpl_environ_get_fingerprint (env), ==, empty);
+  
+  /* the order of pushes doesn't matter, but all the content does */
+  g_assert_cmpuint (fingerprint_string ("a = 1; b = \"x\";"), ==, fingerprint);
+  g_assert_cmpuint (fingerprint_string ("b = \"x\"; a = 1;"), ==, fingerprint);
+  g_assert_cmpuint (fingerprint_string ("b = 0; b = \"x\"; a = 1;"), ==,
+                    fingerprint);
+  g_assert_cmpuint (fingerprint_string ("a = 1; b = \"y\";"), !=, fingerprint);
+  g_assert_cmpuint (fingerprint_string ("a = \"1\"; b = \"x\";"), !=,
+                    fingerprint);
+  g_assert_cmpuint (fingerprint_string ("a = 1.0; b = \"x\";"), !=, fingerprint);
+  g_assert_cmpuint (fingerprint_string ("b = 1; a = \"x\";"), !=, fingerprint);
+  g_assert_cmpuint (fingerprint_string ("a = [1, [2, 3]];"), ==,
+                    fingerprint_string ("a = [1, [2, 3]];"));
+  g_assert_cmpuint (fingerprint_string ("a = [1, [2, 3]];"), !=,
+                    fingerprint_string ("a = [1, [2], 3];"));
+  g_assert_cmpuint (fingerprint_string ("a = [\"a\", \"b\"];"), !=,
+                    fingerprint_string ("a = [\"ab\"];"));
+  
+  /* merging */
+  other = ctpl_environ_new ();
+  ctpl_environ_push_string (other, "b", "x");
+  ctpl_environ_push_int (env, "a", 1);
+  ctpl_environ_merge (env, other, TRUE);
+  g_assert_cmpuint (ctpl_environ_get_fingerprint (env), ==, fingerprint);
+  ctpl_environ_unref (other);
+  
+  /* only the content when it is requested matters, not the changes made since
+   * the previous request */
+  for (i = 0; i < 10; i++) {
+    ctpl_environ_push_int (env, "a", i);
+    ctpl_environ_push_string (env, "c", "y");
+  }
+  g_assert_cmpuint (ctpl_environ_get_fingerprint (env), ==,
+                    fingerprint_string ("a = 9; b = \"x\"; c = \"y\";"));
+  for (i = 0; i < 10; i++) {
+    ctpl_environ_pop (env, "a", NULL);
+    ctpl_environ_pop (env, "c", NULL);
+    ctpl_environ_push_int (env, "c", i);
+    ctpl_environ_pop (env, "c", NULL);
+  }
+  g_assert_cmpuint (ctpl_environ_get_fingerprint (env), ==, fingerprint);
+  
+  ctpl_environ_unref (env);
+}
+
+
+int
+main (int     argc,
+      char  **argv)
+{
+  GString  *big;
+  guint     i;
+  
+  g_type_init ();
+  
+  check_parallel ("", 1, TRUE);
+  check_parallel ("sym0 = 1; sym0 = 2;", 1, TRUE);
+  
+  check_resolver (FALSE);
+  check_resolver (TRUE);
+  check_resolver_renders ();
+  
+  check_functions ();
+  
+  check_fingerprint ();
+  
+  check_snapshot ("", 1);
+  check_snapshot ("sym0 = 1; sym1 = \"a \\\" string\"; sym0 = 2.5;"
+                  "sym2 = [1, [\"b\", []], 3.5]; sym3 = \"\";", 4);
+  
+  /* large enough to be split, with tricky split points */
+  big = g_string_new (NULL);
+  for (i = 0; i < 200000; i++) {
+    switch (i % 5) {
+      case 0:
+        g_string_append_printf (big, "sym%u = %u;\n", i % 97, i);
+        break;
+      case 1:
+        g_string_append_printf (big, "sym%u = \"a;b \\\" ; # c\";\n", i % 97);
+        break;
+      case 2:
+        g_string_append_printf (big, "# a ; comment \"\nsym%u = 1.5;\n", i % 97);
+        break;
+      case 3:
+        g_string_append_printf (big, "sym%u = [1, [\";\", 2], \"]\"];\n", i % 97);
+        break;
+      default:
+        g_string_append_printf (big, "sym%u\t=\n-%u ; ", i % 97, i);
+    }
+  }
+  check_parallel (big->str, 97, TRUE);
+  
+  /* an error near the end, the symbols before it must be loaded */
+  g_string_append (big, "sym1 = 1;\nsym2 = ;\nsym3 = 3;\n");
+  for (i = 0; i < 1000; i++) {
+    g_string_append (big, "sym4 = 4;\n");
+  }
+  check_parallel (big->str, 97, FALSE);
+  g_string_free (big, TRUE);
+  
+  return 0;
+}
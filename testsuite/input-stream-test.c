@@ -0,0 +1,172 @@
+/* Checks for CtplInputStream's line and position tracking and word reading */
+
+#include <stdio.h>
+#include <string.h>
+#include <glib.h>
+
+#include "../src/ctpl.h"
+
+
+
+/* computes the expected line and position after reading @len bytes of @str,
+ * the naive way */
+static void
+expected_position (const gchar *str,
+                   gsize        len,
+                   guint       *line,
+                   guint       *pos)
+{
+  gsize i;
+  
+  *line = 1;
+  *pos = 0;
+  for (i = 0; i < len; i++) {
+    switch (str[i]) {
+      case '\n':
+        (*line) ++;
+        /* Fallthrough */
+      case '\r':
+        *pos = 0;
+        break;
+      
+      default:
+        (*pos) ++;
+    }
+  }
+}
+
+/* reads @str by chunks of @chunk bytes, alternating reads, skips and peeks,
+ * and checks the position after each step */
+static void
+check_position (const gchar *str,
+                gsize        chunk)
+{
+  CtplInputStream  *stream;
+  gsize             len = strlen (str);
+  gsize             offset = 0;
+  gchar            *buf;
+  guint             step = 0;
+  
+  stream = ctpl_input_stream_new_for_memory (str, -1, NULL, "str");
+  buf = g_malloc (chunk);
+  while (offset < len) {
+    gssize  n;
+    guint   line;
+    guint   pos;
+    
+    switch (step++ % 3) {
+      case 0:
+        n = ctpl_input_stream_read (stream, buf, chunk, NULL);
+        g_assert (n >= 0);
+        g_assert (memcmp (buf, &str[offset], (gsize)n) == 0);
+        break;
+      
+      case 1:
+        n = ctpl_input_stream_skip (stream, chunk, NULL);
+        break;
+      
+      default:
+        n = ctpl_input_stream_peek (stream, buf, chunk, NULL);
+        g_assert (n >= 0);
+        g_assert (memcmp (buf, &str[offset], (gsize)n) == 0);
+        n = (ctpl_input_stream_get_c (stream, NULL) != CTPL_EOF) ? 1 : 0;
+    }
+    g_assert (n > 0);
+    offset += (gsize)n;
+    expected_position (str, offset, &line, &pos);
+    g_assert_cmpuint (ctpl_input_stream_get_line (stream), ==, line);
+    g_assert_cmpuint (ctpl_input_stream_get_line_position (stream), ==, pos);
+  }
+  g_assert (ctpl_input_stream_eof (stream, NULL));
+  g_free (buf);
+  ctpl_input_stream_unref (stream);
+}
+
+/* checks reading of words, symbols, blanks and strings from @str */
+static void
+check_words (const gchar *str)
+{
+  CtplInputStream  *stream;
+  gchar            *word;
+  gsize             len;
+  GError           *err = NULL;
+  
+  stream = ctpl_input_stream_new_for_memory (str, -1, NULL, "str");
+  while (! ctpl_input_stream_eof (stream, NULL)) {
+    gssize n;
+    
+    n = ctpl_input_stream_skip_blank (stream, NULL);
+    g_assert (n >= 0);
+    if (ctpl_input_stream_eof (stream, NULL)) {
+      break;
+    } else if (ctpl_input_stream_peek_c (stream, NULL) == '"') {
+      word = ctpl_input_stream_read_string_literal (stream, &err);
+      g_assert_no_error (err);
+      g_assert_cmpstr (word, ==, "a \"quoted\" \\ string");
+    } else {
+      gchar *peeked;
+      
+      peeked = ctpl_input_stream_peek_symbol_full (stream, -1, NULL, NULL);
+      word = ctpl_input_stream_read_symbol_full (stream, -1, &len, NULL);
+      g_assert_cmpstr (peeked, ==, word);
+      g_assert_cmpuint (strlen (word), ==, len);
+      g_assert (len > 0);
+      g_assert (strspn (word, "abcdefghijklmnopqrstuvwxyz_0123456789") == len);
+      g_free (peeked);
+    }
+    g_free (word);
+  }
+  ctpl_input_stream_unref (stream);
+}
+
+
+int
+main (int     argc,
+      char  **argv)
+{
+  GString  *big;
+  guint     i;
+  
+  g_type_init ();
+  
+  check_position ("", 1);
+  check_position ("a", 1);
+  check_position ("\n\n\n", 1);
+  check_position ("abc\ndef\r\nghi\rjk\n", 1);
+  check_position ("abc\ndef\r\nghi\rjk\n", 2);
+  check_position ("abc\ndef\r\nghi\rjk\n", 5);
+  check_position ("abc\ndef\r\nghi\rjk\n", 64);
+  
+  /* something larger than the stream's buffer */
+  big = g_string_new (NULL);
+  for (i = 0; i < 2000; i++) {
+    g_string_append_printf (big, "line %u%s", i, (i % 7) ? "\n" : "\r\n");
+  }
+  check_position (big->str, 1);
+  check_position (big->str, 13);
+  check_position (big->str, 1000);
+  check_position (big->str, 5000);
+  g_string_free (big, TRUE);
+  
+  /* words spanning over the buffer's boundaries */
+  big = g_string_new (NULL);
+  for (i = 0; i < 500; i++) {
+    g_string_append_printf (big, "%s_%u \t", (i % 3) ? "word" : "w", i * 37);
+    if (i % 50 == 0) {
+      g_string_append (big, "\n\"a \\\"quoted\\\" \\\\ string\"\n");
+    }
+    if (i == 250) {
+      guint j;
+      
+      /* one very large symbol */
+      for (j = 0; j < 10000; j++) {
+        g_string_append_c (big, 'a' + (gchar)(j % 26));
+      }
+      g_string_append_c (big, ' ');
+    }
+  }
+  check_words (big->str);
+  g_string_free (big, TRUE);
+  
+  return 0;
+}
@@ -0,0 +1,236 @@
+/* Checks for ctpl_parser_parse_with_options() */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include <gio/gio.h>
+
+#include "../src/ctpl.h"
+#include "ctpl-test-lib.h"
+
+
+
+/* checks that options without limits render like ctpl_parser_parse() */
+static void
+check_unlimited (void)
+{
+  const gchar       *template = "<{n}>{for i in range(n)}{i * 2},{end}"
+                                "{if n > 2}big{else}small{end}";
+  CtplEnviron       *env = ctpl_environ_new ();
+  CtplParserOptions  options = { 0 };
+  GError            *err = NULL;
+  gchar             *expected;
+  gchar             *output;
+  
+  ctpl_environ_push_int (env, "n", 3);
+  expected = ctpltest_render_string (template, env, NULL, NULL, &err);
+  g_assert_no_error (err);
+  g_assert_cmpstr (expected, ==, "<3>0,2,4,big");
+  output = ctpltest_render_string (template, env, NULL, &options, &err);
+  g_assert_no_error (err);
+  g_assert_cmpstr (output, ==, expected);
+  g_free (output);
+  
+  /* limits that are reached but not exceeded */
+  options.max_output = strlen (expected);
+  options.max_iterations = 3;
+  options.max_memory = 1024 * 1024;
+  output = ctpltest_render_string (template, env, NULL, &options, &err);
+  g_assert_no_error (err);
+  g_assert_cmpstr (output, ==, expected);
+  g_free (output);
+  g_free (expected);
+  
+  ctpl_environ_unref (env);
+}
+
+/* checks that the output is cut exactly at the output limit */
+static void
+check_output_limit (void)
+{
+  CtplEnviron       *env = ctpl_environ_new ();
+  CtplParserOptions  options = { 0 };
+  GError            *err = NULL;
+  gchar             *output;
+  
+  options.max_output = 10;
+  output = ctpltest_render_string ("{for i in range(100)}{i},{end}", env, NULL,
+                                   &options, &err);
+  g_assert_error (err, CTPL_PARSER_ERROR, CTPL_PARSER_ERROR_OUTPUT_LIMIT);
+  g_clear_error (&err);
+  g_assert_cmpstr (output, ==, "0,1,2,3,4,");
+  g_free (output);
+  
+  /* within a data token */
+  options.max_output = 4;
+  output = ctpltest_render_string ("abcdef", env, NULL, &options, &err);
+  g_assert_error (err, CTPL_PARSER_ERROR, CTPL_PARSER_ERROR_OUTPUT_LIMIT);
+  g_clear_error (&err);
+  g_assert_cmpstr (output, ==, "abcd");
+  g_free (output);
+  
+  /* a huge multiplication is cut without being rendered entirely */
+  options.max_output = 1000;
+  output = ctpltest_render_string ("[{\"x\" * 100000000}]", env, NULL, &options,
+                                   &err);
+  g_assert_error (err, CTPL_PARSER_ERROR, CTPL_PARSER_ERROR_OUTPUT_LIMIT);
+  g_clear_error (&err);
+  g_assert_cmpuint (strlen (output), ==, 1000);
+  g_assert (output[0] == '[');
+  g_assert (strspn (&output[1], "x") == 999);
+  g_free (output);
+  
+  ctpl_environ_unref (env);
+}
+
+/* checks the iteration limit, counting the iterations of nested loops */
+static void
+check_iteration_limit (void)
+{
+  CtplEnviron       *env = ctpl_environ_new ();
+  CtplParserOptions  options = { 0 };
+  GError            *err = NULL;
+  gchar             *output;
+  
+  options.max_iterations = 5;
+  output = ctpltest_render_string ("{for i in range(1000000000)}{i},{end}",
+                                   env, NULL, &options, &err);
+  g_assert_error (err, CTPL_PARSER_ERROR, CTPL_PARSER_ERROR_ITERATION_LIMIT);
+  g_clear_error (&err);
+  g_assert_cmpstr (output, ==, "0,1,2,3,4,");
+  g_free (output);
+  
+  options.max_iterations = 5;
+  output = ctpltest_render_string ("{for i in range(2)}{for j in range(2)}"
+                                   "{i}{j},{end}{end}", env, NULL, &options,
+                                   &err);
+  g_assert_error (err, CTPL_PARSER_ERROR, CTPL_PARSER_ERROR_ITERATION_LIMIT);
+  g_clear_error (&err);
+  g_assert_cmpstr (output, ==, "00,01,10,");
+  g_free (output);
+  
+  ctpl_environ_unref (env);
+}
+
+/* checks that the memory budget is checked before allocating large strings */
+static void
+check_memory_limit (void)
+{
+  CtplEnviron       *env = ctpl_environ_new ();
+  CtplParserOptions  options = { 0 };
+  GError            *err = NULL;
+  gchar             *output;
+  
+  options.max_memory = 1024 * 1024;
+  output = ctpltest_render_string ("a{len(\"x\" * 100000000)}b", env, NULL,
+                                   &options, &err);
+  g_assert_error (err, CTPL_PARSER_ERROR, CTPL_PARSER_ERROR_MEMORY_LIMIT);
+  g_clear_error (&err);
+  g_assert_cmpstr (output, ==, "a");
+  g_free (output);
+  
+  /* a smaller string fits */
+  output = ctpltest_render_string ("a{len(\"x\" * 1000)}b", env, NULL, &options,
+                                   &err);
+  g_assert_no_error (err);
+  g_assert_cmpstr (output, ==, "a1000b");
+  g_free (output);
+  
+  ctpl_environ_unref (env);
+}
+
+/* checks that a render past its deadline fails */
+static void
+check_deadline (void)
+{
+  CtplEnviron       *env = ctpl_environ_new ();
+  CtplParserOptions  options = { 0 };
+  GTimeVal           now;
+  GError            *err = NULL;
+  gchar             *output;
+  
+  /* already passed */
+  options.deadline = 1;
+  output = ctpltest_render_string ("{for i in range(1000000000)}{i},{end}",
+                                   env, NULL, &options, &err);
+  g_assert_error (err, CTPL_PARSER_ERROR, CTPL_PARSER_ERROR_TIMED_OUT);
+  g_clear_error (&err);
+  g_assert_cmpstr (output, ==, "");
+  g_free (output);
+  
+  /* far enough not to be reached */
+  g_get_current_time (&now);
+  options.deadline = (gint64) (now.tv_sec + 3600) * G_USEC_PER_SEC;
+  output = ctpltest_render_string ("{for i in range(3)}{i}{end}", env, NULL,
+                                   &options, &err);
+  g_assert_no_error (err);
+  g_assert_cmpstr (output, ==, "012");
+  g_free (output);
+  
+  ctpl_environ_unref (env);
+}
+/* checks that the limits hold with a cache and an arena, and that nothing
+ * exceeding them is cached */
+static void
+check_cache (void)
+{
+  const gchar       *template = "{for i in range(n)}{i},{end}";
+  CtplEnviron       *env = ctpl_environ_new ();
+  CtplCache         *cache = ctpl_cache_new (1024 * 1024);
+  CtplArena         *arena = ctpl_arena_new ();
+  CtplParserOptions  options = { 0 };
+  GError            *err = NULL;
+  gchar             *output;
+  
+  ctpl_environ_push_int (env, "n", 3);
+  options.cache = cache;
+  options.arena = arena;
+  
+  /* the loop is rendered but exceeds the iteration limit */
+  options.max_iterations = 2;
+  output = ctpltest_render_string (template, env, NULL, &options, &err);
+  g_assert_error (err, CTPL_PARSER_ERROR, CTPL_PARSER_ERROR_ITERATION_LIMIT);
+  g_clear_error (&err);
+  g_assert_cmpstr (output, ==, "0,1,");
+  g_free (output);
+  g_assert_cmpuint (ctpl_cache_get_size (cache), ==, 0);
+  
+  options.max_iterations = 0;
+  output = ctpltest_render_string (template, env, NULL, &options, &err);
+  g_assert_no_error (err);
+  g_assert_cmpstr (output, ==, "0,1,2,");
+  g_free (output);
+  g_assert_cmpuint (ctpl_cache_get_misses (cache), ==, 2);
+  g_assert_cmpuint (ctpl_cache_get_hits (cache), ==, 0);
+  
+  /* replayed output is cut at the output limit */
+  options.max_output = 3;
+  output = ctpltest_render_string (template, env, NULL, &options, &err);
+  g_assert_error (err, CTPL_PARSER_ERROR, CTPL_PARSER_ERROR_OUTPUT_LIMIT);
+  g_clear_error (&err);
+  g_assert_cmpstr (output, ==, "0,1");
+  g_free (output);
+  g_assert_cmpuint (ctpl_cache_get_hits (cache), ==, 1);
+  
+  ctpl_arena_unref (arena);
+  ctpl_cache_unref (cache);
+  ctpl_environ_unref (env);
+}
+
+
+int
+main (int     argc,
+      char  **argv)
+{
+  g_type_init ();
+  
+  check_unlimited ();
+  check_output_limit ();
+  check_iteration_limit ();
+  check_memory_limit ();
+  check_deadline ();
+  check_cache ();
+  
+  return 0;
+}
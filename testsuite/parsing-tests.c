@@ -9,6 +9,8 @@
  * $srcdir/fail by:
  * 1) parsing them against $srcdir/environ
  * 2) checking the result against $templatename"-output", if it exists
+ * 3) checking that parsing them one top-level token at a time gives the same
+ *    result
  * 
  * return value tells whether all tests succeeded or not.
  */
@@ -85,19 +87,34 @@ parse_check (const gchar *string,
              GError     **error)
 {
   gchar    *output;
+  gchar    *streamed_output;
   gboolean  success = FALSE;
   
   output = ctpltest_parse_string (string, env_str, error);
+  streamed_output = ctpltest_parse_string_streamed (string, env_str, NULL);
   if (output) {
     if (expected_output && strcmp (output, expected_output) != 0) {
       g_set_error (error, 0, 0,
                    "Parsing succeeded but output is not the expected one");
       show_diff (output, expected_output, stderr);
+    } else if (! streamed_output || strcmp (output, streamed_output) != 0) {
+      g_set_error (error, 0, 0,
+                   "Parsing succeeded but streamed parsing gave another "
+                   "result");
+      if (streamed_output) {
+        show_diff (output, streamed_output, stderr);
+      }
     } else {
       success = TRUE;
     }
     g_free (output);
+  } else if (streamed_output) {
+    /* the streamed parsing must not accept what the parsing rejects, whether
+     * the caller expects a failure or not */
+    fprintf (stderr, " ** Streamed parsing succeeded but parsing failed\n");
+    exit (1);
   }
+  g_free (streamed_output);
   
   return success;
 }
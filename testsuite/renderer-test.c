@@ -0,0 +1,418 @@
+/* Checks for CtplRenderer */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include <gio/gio.h>
+
+#include "../src/ctpl.h"
+#include "ctpl-test-lib.h"
+
+
+
+/* a memory output and its CtplOutputStream */
+typedef struct _Output Output;
+struct _Output
+{
+  GOutputStream    *ostream;
+  CtplOutputStream *stream;
+};
+
+static void
+output_init (Output *output)
+{
+  output->ostream = g_memory_output_stream_new (NULL, 0, g_realloc, g_free);
+  output->stream = ctpl_output_stream_new (output->ostream);
+}
+
+/* gets what was written to @output, and frees it */
+static gchar *
+output_finish (Output *output)
+{
+  GError *err = NULL;
+  gchar  *data;
+  
+  ctpl_output_stream_put_c (output->stream, 0, &err);
+  g_assert_no_error (err);
+  g_output_stream_close (output->ostream, NULL, NULL);
+  data = g_memory_output_stream_steal_data (G_MEMORY_OUTPUT_STREAM (output->ostream));
+  ctpl_output_stream_unref (output->stream);
+  g_object_unref (output->ostream);
+  
+  return data;
+}
+
+static gsize
+output_get_length (Output *output)
+{
+  return g_memory_output_stream_get_data_size (G_MEMORY_OUTPUT_STREAM (output->ostream));
+}
+
+/* renders @tree in @env one token at a time, and checks the progress */
+static void
+check_token_steps (const gchar *template)
+{
+  CtplEnviron        *env = ctpl_environ_new ();
+  CtplToken          *tree;
+  CtplRenderer       *renderer;
+  CtplRendererStatus  status;
+  Output              output;
+  gchar              *expected;
+  gchar              *data;
+  guint               n_steps = 0;
+  GError             *err = NULL;
+  
+  tree = ctpl_lexer_lex_string (template, &err);
+  g_assert_no_error (err);
+  g_assert (ctpl_environ_add_from_string (env, "items = [1, 2, 3];"
+                                               "name = \"ctpl\";", &err));
+  g_assert_no_error (err);
+  expected = ctpltest_render_checked (tree, env);
+  
+  output_init (&output);
+  renderer = ctpl_renderer_new (tree, env, output.stream, NULL);
+  do {
+    gsize n_tokens = ctpl_renderer_get_n_tokens (renderer);
+    
+    status = ctpl_renderer_step (renderer, 0, 1, &err);
+    g_assert_no_error (err);
+    g_assert_cmpuint (ctpl_renderer_get_n_tokens (renderer), <=, n_tokens + 1);
+    g_assert_cmpuint (ctpl_renderer_get_n_bytes (renderer), ==,
+                      output_get_length (&output));
+    n_steps++;
+  } while (status == CTPL_RENDERER_STATUS_SUSPENDED);
+  g_assert_cmpint (status, ==, CTPL_RENDERER_STATUS_DONE);
+  g_assert_cmpuint (n_steps, ==, ctpl_renderer_get_n_tokens (renderer));
+  /* nothing is left to do */
+  g_assert_cmpint (ctpl_renderer_step (renderer, 0, 1, &err), ==,
+                   CTPL_RENDERER_STATUS_DONE);
+  g_assert_no_error (err);
+  ctpl_renderer_unref (renderer);
+  data = output_finish (&output);
+  g_assert_cmpstr (data, ==, expected);
+  g_free (data);
+  
+  g_free (expected);
+  ctpl_token_free (tree);
+  ctpl_environ_unref (env);
+}
+
+/* checks that the rendering can suspend in the middle of loops, leaving the
+ * environ as it was, and that the bytes limit is respected */
+static void
+check_byte_steps (void)
+{
+  CtplEnviron        *env = ctpl_environ_new ();
+  CtplToken          *tree;
+  CtplRenderer       *renderer;
+  CtplRendererStatus  status;
+  Output              output;
+  gchar              *expected;
+  gchar              *data;
+  guint               n_steps = 0;
+  GError             *err = NULL;
+  
+  tree = ctpl_lexer_lex_string ("{for i in range(50)}<{i}>{end}.", &err);
+  g_assert_no_error (err);
+  expected = ctpltest_render_checked (tree, env);
+  
+  output_init (&output);
+  renderer = ctpl_renderer_new (tree, env, output.stream, NULL);
+  do {
+    gsize n_bytes = ctpl_renderer_get_n_bytes (renderer);
+    
+    status = ctpl_renderer_step (renderer, 7, 0, &err);
+    g_assert_no_error (err);
+    /* the last token may exceed the limit by its own length */
+    g_assert_cmpuint (ctpl_renderer_get_n_bytes (renderer), <=, n_bytes + 7 + 2);
+    g_assert (ctpl_environ_lookup (env, "i") == NULL);
+    n_steps++;
+  } while (status == CTPL_RENDERER_STATUS_SUSPENDED);
+  g_assert_cmpint (status, ==, CTPL_RENDERER_STATUS_DONE);
+  g_assert_cmpuint (n_steps, >=, strlen (expected) / (7 + 2));
+  g_assert_cmpuint (ctpl_renderer_get_n_bytes (renderer), ==, strlen (expected));
+  ctpl_renderer_unref (renderer);
+  data = output_finish (&output);
+  g_assert_cmpstr (data, ==, expected);
+  g_free (data);
+  
+  /* without limits, a single step renders everything */
+  output_init (&output);
+  renderer = ctpl_renderer_new (tree, env, output.stream, NULL);
+  g_assert_cmpint (ctpl_renderer_step (renderer, 0, 0, &err), ==,
+                   CTPL_RENDERER_STATUS_DONE);
+  g_assert_no_error (err);
+  ctpl_renderer_unref (renderer);
+  data = output_finish (&output);
+  g_assert_cmpstr (data, ==, expected);
+  g_free (data);
+  
+  g_free (expected);
+  ctpl_token_free (tree);
+  ctpl_environ_unref (env);
+}
+
+/* checks that several renderings of the same environ can be interleaved, and
+ * that a suspended one can be dropped */
+static void
+check_interleaving (void)
+{
+  CtplEnviron   *env = ctpl_environ_new ();
+  CtplToken     *tree_a;
+  CtplToken     *tree_b;
+  CtplRenderer  *renderer_a;
+  CtplRenderer  *renderer_b;
+  Output         output_a;
+  Output         output_b;
+  gchar         *expected;
+  gchar         *data;
+  GError        *err = NULL;
+  
+  tree_a = ctpl_lexer_lex_string ("{for i in range(3)}{for j in range(3)}"
+                                  "{i}{j} {end}{end}", &err);
+  g_assert_no_error (err);
+  tree_b = ctpl_lexer_lex_string ("{for i in range(10)}[{i * 2}]{end}", &err);
+  g_assert_no_error (err);
+  
+  output_init (&output_a);
+  output_init (&output_b);
+  renderer_a = ctpl_renderer_new (tree_a, env, output_a.stream, NULL);
+  renderer_b = ctpl_renderer_new (tree_b, env, output_b.stream, NULL);
+  while (ctpl_renderer_step (renderer_a, 0, 2, &err) ==
+           CTPL_RENDERER_STATUS_SUSPENDED) {
+    g_assert_no_error (err);
+    g_assert_cmpint (ctpl_renderer_step (renderer_b, 0, 1, &err), ==,
+                     CTPL_RENDERER_STATUS_SUSPENDED);
+    g_assert_no_error (err);
+  }
+  g_assert_no_error (err);
+  ctpl_renderer_unref (renderer_a);
+  data = output_finish (&output_a);
+  g_assert_cmpstr (data, ==, "00 01 02 10 11 12 20 21 22 ");
+  g_free (data);
+  
+  /* renderer_b is suspended in its loop */
+  ctpl_renderer_unref (renderer_b);
+  g_assert (ctpl_environ_lookup (env, "i") == NULL);
+  data = output_finish (&output_b);
+  expected = ctpltest_render_checked (tree_b, env);
+  g_assert (g_str_has_prefix (expected, data));
+  g_assert_cmpstr (data, !=, expected);
+  g_free (expected);
+  g_free (data);
+  
+  ctpl_token_free (tree_a);
+  ctpl_token_free (tree_b);
+  ctpl_environ_unref (env);
+}
+
+/* checks that failures stop the rendering and are reported again */
+static void
+check_errors (void)
+{
+  CtplEnviron        *env = ctpl_environ_new ();
+  CtplToken          *tree;
+  CtplRenderer       *renderer;
+  CtplRendererStatus  status;
+  Output              output;
+  gchar              *data;
+  GError             *err = NULL;
+  
+  tree = ctpl_lexer_lex_string ("a{for i in range(2)}{for j in n}{j}{end}{end}b",
+                                &err);
+  g_assert_no_error (err);
+  ctpl_environ_push_int (env, "n", 42);
+  
+  output_init (&output);
+  renderer = ctpl_renderer_new (tree, env, output.stream, NULL);
+  do {
+    status = ctpl_renderer_step (renderer, 0, 1, &err);
+  } while (status == CTPL_RENDERER_STATUS_SUSPENDED);
+  g_assert_cmpint (status, ==, CTPL_RENDERER_STATUS_FAILED);
+  g_assert_error (err, CTPL_PARSER_ERROR, CTPL_PARSER_ERROR_INCOMPATIBLE_SYMBOL);
+  g_clear_error (&err);
+  /* the loop was left */
+  g_assert (ctpl_environ_lookup (env, "i") == NULL);
+  g_assert_cmpint (ctpl_renderer_step (renderer, 0, 0, &err), ==,
+                   CTPL_RENDERER_STATUS_FAILED);
+  g_assert_error (err, CTPL_PARSER_ERROR, CTPL_PARSER_ERROR_INCOMPATIBLE_SYMBOL);
+  g_clear_error (&err);
+  ctpl_renderer_unref (renderer);
+  data = output_finish (&output);
+  g_assert_cmpstr (data, ==, "a");
+  g_free (data);
+  
+  ctpl_token_free (tree);
+  ctpl_environ_unref (env);
+}
+
+/* renders @tree in @env with @options one token at a time, returns the
+ * output and sets @n_tokens to the number of tokens rendered */
+static gchar *
+render_steps (const CtplToken          *tree,
+              CtplEnviron              *env,
+              const CtplParserOptions  *options,
+              gsize                    *n_tokens,
+              GError                  **error)
+{
+  CtplRenderer  *renderer;
+  Output         output;
+  
+  output_init (&output);
+  renderer = ctpl_renderer_new (tree, env, output.stream, options);
+  while (ctpl_renderer_step (renderer, 0, 1, error) ==
+           CTPL_RENDERER_STATUS_SUSPENDED) {
+    /* render the next token */
+  }
+  *n_tokens = ctpl_renderer_get_n_tokens (renderer);
+  ctpl_renderer_unref (renderer);
+  
+  return output_finish (&output);
+}
+
+/* checks that the limits of the options span all the steps, and that the
+ * statements are replayed from the cache of the options */
+static void
+check_options (void)
+{
+  CtplEnviron       *env = ctpl_environ_new ();
+  CtplToken         *tree;
+  CtplCache         *cache = ctpl_cache_new (1024 * 1024);
+  CtplParserOptions  options = { 0 };
+  gchar             *data;
+  gsize              n_tokens;
+  GError            *err = NULL;
+  
+  tree = ctpl_lexer_lex_string ("a{for i in range(n)}<{i}>{end}b", &err);
+  g_assert_no_error (err);
+  ctpl_environ_push_int (env, "n", 10);
+  
+  options.max_iterations = 3;
+  data = render_steps (tree, env, &options, &n_tokens, &err);
+  g_assert_error (err, CTPL_PARSER_ERROR, CTPL_PARSER_ERROR_ITERATION_LIMIT);
+  g_clear_error (&err);
+  g_assert_cmpstr (data, ==, "a<0><1><2>");
+  g_free (data);
+  
+  options.max_iterations = 0;
+  options.cache = cache;
+  data = render_steps (tree, env, &options, &n_tokens, &err);
+  g_assert_no_error (err);
+  g_assert_cmpstr (data, ==, "a<0><1><2><3><4><5><6><7><8><9>b");
+  g_free (data);
+  g_assert_cmpuint (ctpl_cache_get_misses (cache), ==, 1);
+  /* the replayed loop is rendered by a single step */
+  data = render_steps (tree, env, &options, &n_tokens, &err);
+  g_assert_no_error (err);
+  g_assert_cmpstr (data, ==, "a<0><1><2><3><4><5><6><7><8><9>b");
+  g_free (data);
+  g_assert_cmpuint (ctpl_cache_get_hits (cache), ==, 1);
+  g_assert_cmpuint (n_tokens, ==, 3);
+  
+  ctpl_cache_unref (cache);
+  ctpl_token_free (tree);
+  ctpl_environ_unref (env);
+}
+
+/* checks that statements nested deeper than what the C stack would allow to
+ * recurse through are lexed, rendered in one go, with a cache and step by
+ * step, and freed */
+static void
+check_deep_nesting (guint depth)
+{
+  CtplEnviron        *env = ctpl_environ_new ();
+  GString            *template = g_string_new (NULL);
+  CtplToken          *tree;
+  CtplCache          *cache = ctpl_cache_new (0);
+  CtplRenderer       *renderer;
+  CtplRendererStatus  status;
+  CtplRendering      *rendering;
+  Output              output;
+  gchar              *data;
+  guint               i;
+  GError             *err = NULL;
+  
+  for (i = 0; i < depth; i++) {
+    g_string_append (template, (i % 2) ? "{if i >= 0}" : "{for i in range(1)}");
+  }
+  g_string_append (template, "x");
+  for (i = 0; i < depth; i++) {
+    g_string_append (template, "{end}");
+  }
+  tree = ctpl_lexer_lex_string (template->str, &err);
+  g_assert_no_error (err);
+  
+  data = ctpltest_render_checked (tree, env);
+  g_assert_cmpstr (data, ==, "x");
+  g_free (data);
+  
+  g_assert (ctpltest_render (tree, env, cache, NULL, NULL, &data, &err));
+  g_assert_no_error (err);
+  g_assert_cmpstr (data, ==, "x");
+  g_free (data);
+  
+  output_init (&output);
+  renderer = ctpl_renderer_new (tree, env, output.stream, NULL);
+  do {
+    status = ctpl_renderer_step (renderer, 0, 1000, &err);
+    g_assert_no_error (err);
+  } while (status == CTPL_RENDERER_STATUS_SUSPENDED);
+  g_assert_cmpint (status, ==, CTPL_RENDERER_STATUS_DONE);
+  g_assert_cmpuint (ctpl_renderer_get_n_tokens (renderer), ==, depth + 1);
+  ctpl_renderer_unref (renderer);
+  data = output_finish (&output);
+  g_assert_cmpstr (data, ==, "x");
+  g_free (data);
+  ctpl_token_free (tree);
+  
+  /* an incremental rendering splits each if statement in a fragment */
+  g_string_truncate (template, 0);
+  for (i = 0; i < depth; i++) {
+    g_string_append (template, "{if n}");
+  }
+  g_string_append (template, "x");
+  for (i = 0; i < depth; i++) {
+    g_string_append (template, "{end}");
+  }
+  tree = ctpl_lexer_lex_string (template->str, &err);
+  g_assert_no_error (err);
+  ctpl_environ_push_int (env, "n", 1);
+  rendering = ctpl_rendering_new (tree, env);
+  g_assert (ctpl_rendering_update (rendering, &err));
+  g_assert_no_error (err);
+  g_assert_cmpuint (ctpl_rendering_get_n_rendered (rendering), ==, depth);
+  output_init (&output);
+  g_assert (ctpl_rendering_write (rendering, output.stream, &err));
+  g_assert_no_error (err);
+  data = output_finish (&output);
+  g_assert_cmpstr (data, ==, "x");
+  g_free (data);
+  ctpl_rendering_unref (rendering);
+  ctpl_token_free (tree);
+  
+  ctpl_cache_unref (cache);
+  g_string_free (template, TRUE);
+  ctpl_environ_unref (env);
+}
+
+int
+main (int     argc,
+      char  **argv)
+{
+  g_type_init ();
+  
+  check_token_steps ("");
+  check_token_steps ("plain data");
+  check_token_steps ("<h1>{name}</h1>{for i in items}{if i % 2}<{i}>{else}"
+                     "[{i * 10}]{end}{end}{for i in range(0)}never{end}"
+                     "{if len(items) > 5}many{else}few{end}");
+  check_byte_steps ();
+  check_interleaving ();
+  check_errors ();
+  check_options ();
+  /* deep enough to overflow a recursion */
+  check_deep_nesting (100000);
+  
+  return 0;
+}
@@ -0,0 +1,246 @@
+/* Checks for CtplRendering */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include <gio/gio.h>
+
+#include "../src/ctpl.h"
+#include "ctpl-test-lib.h"
+
+
+
+/* gets the output of @rendering */
+static gchar *
+get_output (CtplRendering *rendering)
+{
+  GOutputStream    *ostream;
+  CtplOutputStream *stream;
+  GError           *err = NULL;
+  gchar            *output;
+  
+  ostream = g_memory_output_stream_new (NULL, 0, g_realloc, g_free);
+  stream = ctpl_output_stream_new (ostream);
+  g_assert (ctpl_rendering_write (rendering, stream, &err));
+  g_assert_no_error (err);
+  g_assert_cmpuint (g_memory_output_stream_get_data_size (G_MEMORY_OUTPUT_STREAM (ostream)),
+                    ==, ctpl_rendering_get_length (rendering));
+  ctpl_output_stream_put_c (stream, 0, &err);
+  g_assert_no_error (err);
+  g_output_stream_close (ostream, NULL, NULL);
+  output = g_memory_output_stream_steal_data (G_MEMORY_OUTPUT_STREAM (ostream));
+  ctpl_output_stream_unref (stream);
+  g_object_unref (ostream);
+  
+  return output;
+}
+
+/* updates @rendering and checks its output is the same as a full rendering,
+ * returns how many fragments were rendered */
+static guint
+check_update (CtplRendering   *rendering,
+              const CtplToken *tree,
+              CtplEnviron     *env)
+{
+  GError *err = NULL;
+  gchar  *expected;
+  gchar  *output;
+  
+  g_assert (ctpl_rendering_update (rendering, &err));
+  g_assert_no_error (err);
+  output = get_output (rendering);
+  expected = ctpltest_render_checked (tree, env);
+  g_assert_cmpstr (output, ==, expected);
+  g_free (expected);
+  g_free (output);
+  
+  return ctpl_rendering_get_n_rendered (rendering);
+}
+
+/* checks that only the fragments reading changed symbols are rendered */
+static void
+check_changes (void)
+{
+  CtplEnviron    *env = ctpl_environ_new ();
+  CtplToken      *tree;
+  CtplRendering  *rendering;
+  GError         *err = NULL;
+  
+  tree = ctpl_lexer_lex_string ("<h1>{title}</h1>\n"
+                                "{for i in items}<li>{i}: {i * n}</li>{end}\n"
+                                "{if n > 2}"
+                                  "big {n}{if title == \"x\"} x{else} {title}{end}"
+                                "{else}"
+                                  "small {len(items)}"
+                                "{end}\n"
+                                "{footer}", &err);
+  g_assert_no_error (err);
+  g_assert (ctpl_environ_add_from_string (env, "title = \"Title\";"
+                                               "items = [1, 2, 3];"
+                                               "n = 3;"
+                                               "footer = \"end\";", &err));
+  g_assert_no_error (err);
+  rendering = ctpl_rendering_new (tree, env);
+  g_assert_cmpuint (ctpl_rendering_get_length (rendering), ==, 0);
+  check_update (rendering, tree, env);
+  
+  /* nothing changed */
+  g_assert_cmpuint (check_update (rendering, tree, env), ==, 0);
+  
+  /* the footer only */
+  ctpl_environ_push_string (env, "footer", "the end");
+  g_assert_cmpuint (check_update (rendering, tree, env), ==, 1);
+  
+  /* the title, and the if statement in the taken branch reading it */
+  ctpl_environ_push_string (env, "title", "x");
+  g_assert_cmpuint (check_update (rendering, tree, env), ==, 2);
+  ctpl_environ_pop (env, "title", NULL);
+  g_assert_cmpuint (check_update (rendering, tree, env), ==, 3);
+  
+  /* the loop and the outer if statement with its whole taken branch */
+  ctpl_environ_push_int (env, "n", 1);
+  g_assert_cmpuint (check_update (rendering, tree, env), ==, 3);
+  /* the loop and the expression in the taken branch */
+  g_assert (ctpl_environ_add_from_string (env, "items = [4, 5];", &err));
+  g_assert_no_error (err);
+  g_assert_cmpuint (check_update (rendering, tree, env), ==, 2);
+  
+  /* several changes at once, each fragment is rendered only once */
+  ctpl_environ_pop (env, "items", NULL);
+  ctpl_environ_pop (env, "n", NULL);
+  ctpl_environ_push_string (env, "title", "y");
+  g_assert_cmpuint (check_update (rendering, tree, env), ==, 6);
+  
+  /* changes made by merging */
+  {
+    CtplEnviron *other = ctpl_environ_new ();
+    
+    ctpl_environ_push_int (other, "n", 5);
+    ctpl_environ_merge (env, other, TRUE);
+    ctpl_environ_unref (other);
+  }
+  g_assert_cmpuint (check_update (rendering, tree, env), ==, 5);
+  
+  /* a failure loses the output, which is rendered again afterwards */
+  ctpl_environ_pop (env, "footer", NULL);
+  ctpl_environ_pop (env, "footer", NULL);
+  g_assert (! ctpl_rendering_update (rendering, &err));
+  g_assert_error (err, CTPL_EVAL_ERROR, CTPL_EVAL_ERROR_SYMBOL_NOT_FOUND);
+  g_clear_error (&err);
+  g_assert_cmpuint (ctpl_rendering_get_length (rendering), ==, 0);
+  ctpl_environ_push_string (env, "footer", "back");
+  g_assert_cmpuint (check_update (rendering, tree, env), ==, 7);
+  
+  ctpl_rendering_unref (rendering);
+  ctpl_token_free (tree);
+  ctpl_environ_unref (env);
+}
+
+/* checks that fragments calling host functions are rendered on each update, in
+ * the same order as in a full rendering */
+static void
+check_volatile (void)
+{
+  CtplEnviron    *env = ctpl_environ_new ();
+  CtplToken      *tree;
+  CtplRendering  *rendering;
+  guint           count = 0;
+  gchar          *output;
+  GError         *err = NULL;
+  
+  tree = ctpl_lexer_lex_string ("{count()} {a} {if a}{count()}{end} {count()}",
+                                &err);
+  g_assert_no_error (err);
+  ctpl_environ_push_int (env, "a", 1);
+  ctpl_environ_add_function (env, "count", ctpltest_count_function, &count,
+                             NULL);
+  rendering = ctpl_rendering_new (tree, env);
+  g_assert (ctpl_rendering_update (rendering, &err));
+  g_assert_no_error (err);
+  output = get_output (rendering);
+  g_assert_cmpstr (output, ==, "0 1 1 2");
+  g_free (output);
+  g_assert (ctpl_rendering_update (rendering, &err));
+  g_assert_no_error (err);
+  output = get_output (rendering);
+  g_assert_cmpstr (output, ==, "3 1 4 5");
+  g_free (output);
+  g_assert_cmpuint (ctpl_rendering_get_n_rendered (rendering), ==, 3);
+  
+  /* changing the functions renders everything again */
+  ctpl_environ_remove_function (env, "count");
+  ctpl_environ_push_int (env, "count", 0);
+  g_assert (! ctpl_rendering_update (rendering, &err));
+  g_assert (err != NULL);
+  g_clear_error (&err);
+  
+  ctpl_rendering_unref (rendering);
+  ctpl_token_free (tree);
+  ctpl_environ_unref (env);
+}
+
+/* a host function incrementing the integer symbol "x", returning nothing */
+static gboolean
+increment_function (CtplEnviron      *env,
+                    const gchar      *name,
+                    const CtplValue **args,
+                    guint             n_args,
+                    CtplValue        *result,
+                    gpointer          user_data,
+                    GError          **error)
+{
+  const CtplValue *x = ctpl_environ_lookup (env, "x");
+  
+  ctpl_environ_push_int (env, "x", ctpl_value_get_int (x) + 1);
+  ctpl_value_set_string (result, "");
+  
+  return TRUE;
+}
+
+/* checks that the changes host functions make while rendering are seen by the
+ * next update */
+static void
+check_host_changes (void)
+{
+  CtplEnviron    *env = ctpl_environ_new ();
+  CtplToken      *tree;
+  CtplRendering  *rendering;
+  gchar          *output;
+  GError         *err = NULL;
+  
+  tree = ctpl_lexer_lex_string ("{if x}{x}{end}{increment()}", &err);
+  g_assert_no_error (err);
+  ctpl_environ_push_int (env, "x", 1);
+  ctpl_environ_add_function (env, "increment", increment_function, NULL,
+                             NULL);
+  rendering = ctpl_rendering_new (tree, env);
+  g_assert (ctpl_rendering_update (rendering, &err));
+  g_assert_no_error (err);
+  output = get_output (rendering);
+  g_assert_cmpstr (output, ==, "1");
+  g_free (output);
+  g_assert (ctpl_rendering_update (rendering, &err));
+  g_assert_no_error (err);
+  output = get_output (rendering);
+  g_assert_cmpstr (output, ==, "2");
+  g_free (output);
+  
+  ctpl_rendering_unref (rendering);
+  ctpl_token_free (tree);
+  ctpl_environ_unref (env);
+}
+
+
+int
+main (int     argc,
+      char  **argv)
+{
+  g_type_init ();
+  
+  check_changes ();
+  check_volatile ();
+  check_host_changes ();
+  
+  return 0;
+}
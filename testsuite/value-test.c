@@ -0,0 +1,299 @@
+/* Checks for CtplValue's iterators, numeric strings and arenas */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include <gio/gio.h>
+
+#include "../src/ctpl.h"
+#include "ctpl-test-lib.h"
+
+
+
+/* a counter generating the integers from 0 to limit - 1 */
+typedef struct _Counter Counter;
+struct _Counter
+{
+  glong limit;
+  glong current;
+  guint n_next;
+  guint n_reset;
+};
+
+static gboolean
+counter_next (CtplValue *item,
+              gpointer   data)
+{
+  Counter *counter = data;
+  
+  counter->n_next++;
+  if (counter->current >= counter->limit) {
+    return FALSE;
+  }
+  ctpl_value_set_int (item, counter->current++);
+  
+  return TRUE;
+}
+
+static void
+counter_reset (gpointer data)
+{
+  Counter *counter = data;
+  
+  counter->n_reset++;
+  counter->current = 0;
+}
+
+/* checks that a for loop over an iterator generates the items one by one */
+static void
+check_for_loop (glong limit)
+{
+  CtplEnviron  *env = ctpl_environ_new ();
+  Counter       counter = { 0, 0, 0, 0 };
+  CtplValue    *value;
+  gchar        *output;
+  
+  counter.limit = limit;
+  value = ctpl_value_new_iterator (counter_next, counter_reset, &counter, NULL);
+  ctpl_environ_push (env, "items", value);
+  ctpl_value_free (value);
+  /* the loop output is small whatever the number of items */
+  output = ctpltest_render_string_checked ("{for i in items}"
+                                           "{if (i % 1000) == 0}.{end}{end}",
+                                           env);
+  g_assert_cmpuint (strlen (output), ==, (gsize)(limit + 999) / 1000);
+  g_assert_cmpuint (counter.n_reset, ==, 1);
+  g_assert_cmpuint (counter.n_next, ==, (guint)limit + 1);
+  g_free (output);
+  
+  /* a second loop restarts the iteration */
+  output = ctpltest_render_string_checked ("{for i in items}{i}{end}", env);
+  g_assert_cmpuint (counter.n_reset, ==, 2);
+  g_free (output);
+  
+  /* indexing materializes */
+  if (limit > 3) {
+    output = ctpltest_render_string_checked ("{items[3]}", env);
+    g_assert_cmpstr (output, ==, "3");
+    g_free (output);
+  }
+  
+  /* so does comparing, and an empty iterator is false */
+  output = ctpltest_render_string_checked ("{if items == items}eq{end}"
+                                           "{if items}t{else}f{end}", env);
+  g_assert_cmpstr (output, ==, limit > 0 ? "eqt" : "eqf");
+  g_free (output);
+  
+  ctpl_environ_unref (env);
+}
+
+/* checks that an iterator without reset function can be iterated once */
+static void
+check_single_pass (void)
+{
+  CtplEnviron  *env = ctpl_environ_new ();
+  Counter       counter = { 3, 0, 0, 0 };
+  CtplValue    *value;
+  gchar        *output;
+  
+  value = ctpl_value_new_iterator (counter_next, NULL, &counter, NULL);
+  ctpl_environ_push (env, "items", value);
+  ctpl_value_free (value);
+  output = ctpltest_render_string_checked ("{for i in items}{i}{end}", env);
+  g_assert_cmpstr (output, ==, "012");
+  g_free (output);
+  output = ctpltest_render_string_checked ("{for i in items}{i}{end}", env);
+  g_assert_cmpstr (output, ==, "");
+  g_free (output);
+  ctpl_environ_unref (env);
+}
+
+/* checks that testing or converting an iterator without reset function
+ * doesn't lose its items */
+static void
+check_single_pass_read_ahead (void)
+{
+  CtplEnviron  *env = ctpl_environ_new ();
+  Counter       counter = { 3, 0, 0, 0 };
+  CtplValue    *value;
+  gchar        *output;
+  
+  value = ctpl_value_new_iterator (counter_next, NULL, &counter, NULL);
+  ctpl_environ_push (env, "items", value);
+  ctpl_value_free (value);
+  output = ctpltest_render_string_checked ("{if items}has items: {end}"
+                                           "{for i in items}{i},{end}", env);
+  g_assert_cmpstr (output, ==, "has items: 0,1,2,");
+  g_free (output);
+  /* now empty */
+  output = ctpltest_render_string_checked ("{if items}t{else}f{end}", env);
+  g_assert_cmpstr (output, ==, "f");
+  g_free (output);
+  ctpl_environ_pop (env, "items", NULL);
+  
+  counter.current = 0;
+  value = ctpl_value_new_iterator (counter_next, NULL, &counter, NULL);
+  ctpl_environ_push (env, "items", value);
+  ctpl_value_free (value);
+  output = ctpltest_render_string_checked ("{items}{items[1]}"
+                                           "{for i in items}{i}{end}", env);
+  g_assert_cmpstr (output, ==, "[0, 1, 2]1012");
+  g_free (output);
+  output = ctpltest_render_string_checked ("{for i in items}{i}{end}", env);
+  g_assert_cmpstr (output, ==, "");
+  g_free (output);
+  
+  ctpl_environ_unref (env);
+}
+
+/* checks converting an iterator to other types */
+static void
+check_convert (void)
+{
+  Counter     counter = { 4, 0, 0, 0 };
+  CtplValue  *value;
+  CtplValue   copy;
+  gchar      *str;
+  
+  value = ctpl_value_new_iterator (counter_next, counter_reset, &counter, NULL);
+  g_assert (CTPL_VALUE_HOLDS_ITERATOR (value));
+  str = ctpl_value_to_string (value);
+  g_assert_cmpstr (str, ==, "[0, 1, 2, 3]");
+  g_free (str);
+  g_assert (CTPL_VALUE_HOLDS_ITERATOR (value));
+  
+  ctpl_value_init (&copy);
+  ctpl_value_copy (value, &copy);
+  g_assert (! ctpl_value_convert (&copy, CTPL_VTYPE_INT));
+  g_assert (ctpl_value_convert (&copy, CTPL_VTYPE_ARRAY));
+  g_assert_cmpuint (ctpl_value_array_length (&copy), ==, 4);
+  ctpl_value_free_value (&copy);
+  ctpl_value_free (value);
+}
+
+/* checks that numeric strings are used as numbers without being modified */
+static void
+check_numeric_strings (void)
+{
+  CtplEnviron  *env = ctpl_environ_new ();
+  CtplValue    *value;
+  CtplValue     copy;
+  gchar        *output;
+  GError       *err = NULL;
+  
+  value = ctpl_value_new_string ("41");
+  ctpl_environ_push (env, "n", value);
+  ctpl_value_free (value);
+  value = ctpl_value_new_string ("2.5");
+  ctpl_environ_push (env, "f", value);
+  ctpl_value_free (value);
+  value = ctpl_value_new_string ("abc");
+  ctpl_environ_push (env, "s", value);
+  
+  output = ctpltest_render_string_checked ("{for i in range(3)}"
+                                           "{n - i},{n % 2},{f - 0.5},{n}{end}",
+                                           env);
+  g_assert_cmpstr (output, ==, "41,1,2,4140,1,2,4139,1,2,41");
+  g_free (output);
+  output = ctpltest_render_string_checked ("{if 40 < n}{n}{end}"
+                                           "{if 3 > f}{f}{end}", env);
+  g_assert_cmpstr (output, ==, "412.5");
+  g_free (output);
+  /* not a number, and it should not change on the next try */
+  output = ctpltest_render_string ("{s - 1}", env, NULL, NULL, &err);
+  g_assert (err != NULL);
+  g_clear_error (&err);
+  g_free (output);
+  output = ctpltest_render_string ("{s % 2}", env, NULL, NULL, &err);
+  g_assert (err != NULL);
+  g_clear_error (&err);
+  g_free (output);
+  
+  /* converting a copy leaves the original alone */
+  ctpl_value_init (&copy);
+  ctpl_value_copy (ctpl_environ_lookup (env, "n"), &copy);
+  g_assert (ctpl_value_convert (&copy, CTPL_VTYPE_INT));
+  g_assert_cmpint (ctpl_value_get_int (&copy), ==, 41);
+  g_assert_cmpstr (ctpl_value_get_string (ctpl_environ_lookup (env, "n")), ==,
+                   "41");
+  g_assert (! ctpl_value_convert (value, CTPL_VTYPE_FLOAT));
+  g_assert_cmpstr (ctpl_value_get_string (value), ==, "abc");
+  ctpl_value_free_value (&copy);
+  ctpl_value_free (value);
+  
+  ctpl_environ_unref (env);
+}
+
+/* a host function keeping a copy of its argument */
+static gboolean
+keep_function (CtplEnviron      *env,
+               const gchar      *name,
+               const CtplValue **args,
+               guint             n_args,
+               CtplValue        *result,
+               gpointer          user_data,
+               GError          **error)
+{
+  ctpl_value_copy (args[0], user_data);
+  ctpl_value_set_int (result, 0);
+  
+  return TRUE;
+}
+
+/* checks that an arena can be reused and that values don't depend on it */
+static void
+check_arena (void)
+{
+  CtplEnviron  *env = ctpl_environ_new ();
+  CtplArena    *arena = ctpl_arena_new ();
+  CtplValue    *value;
+  CtplValue     kept;
+  gchar        *output;
+  GError       *err = NULL;
+  guint         i;
+  
+  ctpl_value_init (&kept);
+  value = ctpl_value_new_string ("ab");
+  ctpl_environ_push (env, "s", value);
+  ctpl_value_free (value);
+  ctpl_environ_add_function (env, "keep", keep_function, &kept, NULL);
+  for (i = 0; i < 3; i++) {
+    output = ctpltest_render_string ("{for i in range(100)}"
+                                       "{if (s + i) == \"ab99\"}"
+                                         "{keep(s * 2 + i)}"
+                                         "{s + i + len(s * i)}"
+                                       "{end}"
+                                     "{end}{\"-\" + s * 3000}",
+                                     env, arena, NULL, &err);
+    g_assert_no_error (err);
+    g_assert_cmpuint (strlen (output), ==, 8 + 1 + 6000);
+    g_assert (strncmp (output, "0ab99198", 8) == 0);
+    g_free (output);
+    g_assert_cmpstr (ctpl_value_get_string (&kept), ==, "abab99");
+    ctpl_value_set_int (&kept, 0);
+  }
+  ctpl_value_free_value (&kept);
+  ctpl_arena_unref (arena);
+  ctpl_environ_unref (env);
+}
+
+
+int
+main (int     argc,
+      char  **argv)
+{
+  g_type_init ();
+  
+  check_for_loop (0);
+  check_for_loop (1);
+  check_for_loop (10);
+  check_for_loop (1000000);
+  check_single_pass ();
+  check_single_pass_read_ahead ();
+  check_convert ();
+  check_numeric_strings ();
+  check_arena ();
+  
+  return 0;
+}